@@ -2,13 +2,18 @@
 #include "net_handler.h"
 #include "../common/utils.h"
 #include "../common/protocol.h"
+#include "../common/compress.h"
 #include "../../lib/cJSON/cJSON.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 
 ClientConnection* client_connect(const char* ip, int port) {
     ClientConnection* conn = malloc(sizeof(ClientConnection));
@@ -26,9 +31,75 @@ ClientConnection* client_connect(const char* ip, int port) {
         return NULL;
     }
 
+    if (client_hello(conn) < 0) {
+        client_disconnect(conn);
+        return NULL;
+    }
+
     return conn;
 }
 
+// Whether the server supports a FEATURE_* flag. Servers older than HELLO
+// report none, so their features are tried as before
+static int server_has(const ClientConnection* conn, uint32_t feature) {
+    return conn->protocol_version < PROTOCOL_VERSION || (conn->features & feature);
+}
+
+int client_hello(ClientConnection* conn) {
+    if (!conn || conn->socket_fd < 0) return -1;
+
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "version", PROTOCOL_VERSION);
+    cJSON_AddNumberToObject(json, "max_frame", MAX_PAYLOAD_SIZE);
+    cJSON_AddNumberToObject(json, "features", protocol_features());
+
+    char* payload = cJSON_PrintUnformatted(json);
+    Packet* pkt = packet_create(CMD_HELLO, payload, strlen(payload));
+
+    int result = packet_send(conn->socket_fd, pkt);
+
+    free(payload);
+    packet_free(pkt);
+    cJSON_Delete(json);
+
+    if (result < 0) return -1;
+
+    Packet* response = net_recv_packet(conn->socket_fd);
+    if (!response) return -1;
+
+    // Servers before HELLO answer with an error and keep going
+    conn->protocol_version = 1;
+    conn->features = 0;
+    conn->max_frame = MAX_PAYLOAD_SIZE;
+    cJSON* resp_json = response->command == CMD_SUCCESS && response->payload
+                       ? cJSON_Parse(response->payload) : NULL;
+    cJSON* version = resp_json ? cJSON_GetObjectItem(resp_json, "version") : NULL;
+    if (cJSON_IsNumber(version) && version->valueint >= PROTOCOL_VERSION) {
+        conn->protocol_version = version->valueint;
+
+        cJSON* features = cJSON_GetObjectItem(resp_json, "features");
+        if (cJSON_IsNumber(features)) {
+            conn->features = (uint32_t)features->valuedouble & protocol_features();
+        }
+        cJSON* max_frame = cJSON_GetObjectItem(resp_json, "max_frame");
+        if (cJSON_IsNumber(max_frame) && max_frame->valuedouble >= PROTOCOL_MIN_FRAME &&
+            max_frame->valuedouble < MAX_PAYLOAD_SIZE) {
+            conn->max_frame = (uint32_t)max_frame->valuedouble;
+        }
+        cJSON* granted = cJSON_GetObjectItem(resp_json, "max_streams");
+        if ((conn->features & FEATURE_STREAMS) && cJSON_IsNumber(granted) &&
+            granted->valueint > 0) {
+            conn->max_streams = granted->valueint;
+        }
+        // The server compresses from its reply on
+        conn->compression = protocol_compression(conn->features);
+    }
+    cJSON_Delete(resp_json);
+    packet_free(response);
+
+    return conn->protocol_version;
+}
+
 void client_disconnect(ClientConnection* conn) {
     if (conn) {
         if (conn->socket_fd >= 0) {
@@ -38,13 +109,302 @@ void client_disconnect(ClientConnection* conn) {
     }
 }
 
-int client_login(ClientConnection* conn, const char* username, const char* password) {
+static long long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Request payloads shared by the single and the pipelined operations
+static char* mkdir_payload(ClientConnection* conn, const char* name) {
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "user_id", conn->user_id);
+    cJSON_AddNumberToObject(json, "parent_id", conn->current_directory);
+    cJSON_AddStringToObject(json, "name", name);
+
+    char* payload = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    return payload;
+}
+
+static char* chmod_payload(ClientConnection* conn, int file_id, int permissions) {
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "user_id", conn->user_id);
+    cJSON_AddNumberToObject(json, "file_id", file_id);
+    cJSON_AddNumberToObject(json, "permissions", permissions);
+
+    char* payload = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    return payload;
+}
+
+static char* delete_payload(ClientConnection* conn, int file_id) {
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "user_id", conn->user_id);
+    cJSON_AddNumberToObject(json, "file_id", file_id);
+
+    char* payload = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    return payload;
+}
+
+int client_ping(ClientConnection* conn) {
+    if (!conn || conn->socket_fd < 0) return -1;
+
+    // The server echoes the payload; a timestamp identifies our reply
+    char token[32];
+    long long start = monotonic_ms();
+    snprintf(token, sizeof(token), "%lld", start);
+
+    Packet* pkt = packet_create(CMD_PING, token, strlen(token));
+    int result = packet_send(conn->socket_fd, pkt);
+    packet_free(pkt);
+
+    if (result < 0) return -1;
+
+    Packet* response = net_recv_packet(conn->socket_fd);
+    if (!response) return -1;
+
+    if (response->command == CMD_PONG && response->payload &&
+        strcmp(response->payload, token) == 0) {
+        result = (int)(monotonic_ms() - start);
+    } else {
+        result = -1;
+    }
+
+    packet_free(response);
+    return result;
+}
+
+int client_enable_streams(ClientConnection* conn, int max_streams) {
+    if (!conn || conn->socket_fd < 0 || max_streams <= 0) return -1;
+
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "max_streams", max_streams);
+
+    char* payload = cJSON_PrintUnformatted(json);
+    Packet* pkt = packet_create(CMD_ENABLE_STREAMS, payload, strlen(payload));
+
+    int result = packet_send(conn->socket_fd, pkt);
+
+    free(payload);
+    packet_free(pkt);
+    cJSON_Delete(json);
+
+    if (result < 0) return -1;
+
+    Packet* response = net_recv_packet(conn->socket_fd);
+    if (!response) return -1;
+
+    // Servers without multiplexing answer with an error and keep going
+    conn->max_streams = 0;
+    if (response->command == CMD_SUCCESS && response->payload) {
+        cJSON* resp_json = cJSON_Parse(response->payload);
+        cJSON* granted = resp_json ? cJSON_GetObjectItem(resp_json, "max_streams") : NULL;
+        if (granted && cJSON_IsNumber(granted) && granted->valueint > 0) {
+            conn->max_streams = granted->valueint;
+        }
+        cJSON_Delete(resp_json);
+    }
+
+    packet_free(response);
+    return conn->max_streams;
+}
+
+uint32_t client_send_tagged(ClientConnection* conn, uint8_t command,
+                            const char* payload, uint32_t length) {
+    if (!conn || conn->socket_fd < 0) return 0;
+
+    // Stream ID 0 marks an untagged frame
+    if (++conn->next_stream_id == 0) {
+        conn->next_stream_id = 1;
+    }
+
+    Packet* pkt = packet_create(command, payload, length);
+    if (!pkt) return 0;
+    pkt->stream_id = conn->next_stream_id;
+
+    int result = packet_send(conn->socket_fd, pkt);
+    packet_free(pkt);
+
+    return (result < 0) ? 0 : conn->next_stream_id;
+}
+
+Packet* client_recv_response(ClientConnection* conn) {
+    if (!conn || conn->socket_fd < 0) return NULL;
+    return net_recv_packet(conn->socket_fd);
+}
+
+// Encode requests[first, last) into one buffer and send it with one write
+static int pipeline_send(ClientConnection* conn, ClientRequest* requests, int first, int last) {
+    size_t total = 0;
+    for (int i = first; i < last; i++) {
+        total += HEADER_SIZE + (requests[i].payload ? strlen(requests[i].payload) : 0);
+    }
+
+    uint8_t* buffer = malloc(total);
+    if (!buffer) return -1;
+
+    size_t offset = 0;
+    for (int i = first; i < last; i++) {
+        Packet pkt = {0};
+        pkt.command = requests[i].command;
+        pkt.payload = requests[i].payload;
+        pkt.data_length = pkt.payload ? (uint32_t)strlen(pkt.payload) : 0;
+
+        int encoded = packet_encode(&pkt, buffer + offset, total - offset);
+        if (encoded < 0) {
+            free(buffer);
+            return -1;
+        }
+        offset += (size_t)encoded;
+    }
+
+    int result = packet_send_all(conn->socket_fd, buffer, offset);
+    free(buffer);
+    return result;
+}
+
+int client_pipeline(ClientConnection* conn, ClientRequest* requests, int count) {
+    if (!conn || conn->socket_fd < 0 || !requests || count < 0) return -1;
+
+    for (int i = 0; i < count; i++) {
+        requests[i].response_command = 0;
+        requests[i].response = NULL;
+    }
+
+    // Bounding the window keeps us reading responses while the server
+    // still has requests to read, so neither side stalls on a full buffer
+    int sent = 0;
+    int answered = 0;
+    while (answered < count) {
+        int window_end = answered + CLIENT_PIPELINE_DEPTH;
+        if (window_end > count) window_end = count;
+
+        // Top the window up once at least half of it has been answered
+        if (sent < window_end &&
+            (window_end - sent >= CLIENT_PIPELINE_DEPTH / 2 || window_end == count)) {
+            if (pipeline_send(conn, requests, sent, window_end) < 0) return -1;
+            sent = window_end;
+        }
+
+        // Responses come back in request order
+        Packet* response = net_recv_packet(conn->socket_fd);
+        if (!response) return -1;
+
+        requests[answered].response_command = response->command;
+        requests[answered].response = response->payload;
+        response->payload = NULL;
+        packet_free(response);
+        answered++;
+    }
+
+    return answered;
+}
+
+// Send requests[first, last) as one BATCH and fill in their responses
+static int batch_send(ClientConnection* conn, ClientRequest* requests, int first, int last) {
+    // The payloads are JSON already, so the envelope is built around them
+    // as text rather than parsed into a tree and printed again
+    size_t total = 32;
+    for (int i = first; i < last; i++) {
+        total += 40 + (requests[i].payload ? strlen(requests[i].payload) : 2);
+    }
+    char* payload = malloc(total);
+    if (!payload) return -1;
+
+    size_t length = (size_t)snprintf(payload, total, "{\"requests\":[");
+    for (int i = first; i < last; i++) {
+        length += (size_t)snprintf(payload + length, total - length,
+                                   "%s{\"command\":%d,\"payload\":%s}", i > first ? "," : "",
+                                   requests[i].command,
+                                   requests[i].payload ? requests[i].payload : "{}");
+    }
+    length += (size_t)snprintf(payload + length, total - length, "]}");
+
+    Packet* pkt = packet_create(CMD_BATCH, payload, (uint32_t)length);
+    int result = pkt ? packet_send(conn->socket_fd, pkt) : -1;
+    packet_free(pkt);
+    free(payload);
+    if (result < 0) return -1;
+
+    Packet* response = net_recv_packet(conn->socket_fd);
+    if (!response) return -1;
+
+    cJSON* json = response->command == CMD_SUCCESS && response->payload
+                      ? cJSON_Parse(response->payload) : NULL;
+    cJSON* results = json ? cJSON_GetObjectItem(json, "results") : NULL;
+    if (cJSON_GetArraySize(results) == last - first) {
+        int i = first;
+        cJSON* result_item = NULL;
+        cJSON_ArrayForEach(result_item, results) {
+            const char* status = cJSON_GetStringValue(cJSON_GetObjectItem(result_item, "status"));
+            requests[i].response_command =
+                (status && strcmp(status, "OK") == 0) ? CMD_SUCCESS : CMD_ERROR;
+            requests[i].response = cJSON_PrintUnformatted(result_item);
+            i++;
+        }
+    } else {
+        // The whole batch was refused and rolled back: that is every
+        // request's answer
+        for (int i = first; i < last; i++) {
+            requests[i].response_command = CMD_ERROR;
+            requests[i].response = response->payload ? str_duplicate(response->payload) : NULL;
+        }
+    }
+
+    cJSON_Delete(json);
+    packet_free(response);
+    return 0;
+}
+
+int client_batch(ClientConnection* conn, ClientRequest* requests, int count) {
+    if (!conn || conn->socket_fd < 0 || !requests || count < 0) return -1;
+
+    for (int i = 0; i < count; i++) {
+        requests[i].response_command = 0;
+        requests[i].response = NULL;
+    }
+
+    int answered = 0;
+    while (answered < count) {
+        int last = answered + BATCH_MAX_REQUESTS;
+        if (last > count) last = count;
+        if (batch_send(conn, requests, answered, last) < 0) return -1;
+        answered = last;
+    }
+
+    return answered;
+}
+
+void client_pipeline_free(ClientRequest* requests, int count) {
+    if (!requests) return;
+
+    for (int i = 0; i < count; i++) {
+        free(requests[i].response);
+        requests[i].response = NULL;
+    }
+}
+
+// Send LOGIN_REQ; extra connections of a striped download log in quietly
+static int login_request(ClientConnection* conn, const char* username, const char* password,
+                         int verbose) {
     if (!conn || !username || !password) return -1;
 
     cJSON* json = cJSON_CreateObject();
     cJSON_AddStringToObject(json, "username", username);
     cJSON_AddStringToObject(json, "password", password);
 
+    // Compression methods we accept, best first; the server picks one.
+    // After HELLO it is settled already
+    if (conn->protocol_version < PROTOCOL_VERSION) {
+        cJSON* methods = cJSON_AddArrayToObject(json, "compression");
+        if (compression_available(COMPRESSION_ZSTD)) {
+            cJSON_AddItemToArray(methods, cJSON_CreateString(compression_name(COMPRESSION_ZSTD)));
+        }
+        cJSON_AddItemToArray(methods, cJSON_CreateString(compression_name(COMPRESSION_ZLIB)));
+    }
+
     char* payload = cJSON_PrintUnformatted(json);
     Packet* pkt = packet_create(CMD_LOGIN_REQ, payload, strlen(payload));
 
@@ -77,11 +437,19 @@ int client_login(ClientConnection* conn, const char* username, const char* passw
         cJSON* is_admin = cJSON_GetObjectItem(resp_json, "is_admin");
         conn->is_admin = (is_admin && is_admin->valueint == 1) ? 1 : 0;
 
+        // Servers without compression do not answer the offer
+        if (conn->protocol_version < PROTOCOL_VERSION) {
+            conn->compression = compression_from_name(
+                cJSON_GetStringValue(cJSON_GetObjectItem(resp_json, "compression")));
+        }
+
         result = 0;
-        printf("Login successful! User ID: %d, Admin: %s\n", conn->user_id, conn->is_admin ? "Yes" : "No");
+        if (verbose) {
+            printf("Login successful! User ID: %d, Admin: %s\n", conn->user_id, conn->is_admin ? "Yes" : "No");
+        }
     } else {
         cJSON* message = cJSON_GetObjectItem(resp_json, "message");
-        if (message) {
+        if (message && verbose) {
             printf("Login failed: %s\n", cJSON_GetStringValue(message));
         }
     }
@@ -92,15 +460,54 @@ int client_login(ClientConnection* conn, const char* username, const char* passw
     return result;
 }
 
-int client_list_dir(ClientConnection* conn, int dir_id) {
-    if (!conn || !conn->authenticated) return -1;
+// Open another connection to conn's server logged in with the caller's
+// credentials (parallel transfers); NULL without them
+static ClientConnection* connect_as(ClientConnection* conn, const char* username,
+                                    const char* password) {
+    if (!username || !password) {
+        return NULL;
+    }
+    ClientConnection* extra = client_connect(conn->server_ip, conn->server_port);
+    if (extra && login_request(extra, username, password, 0) < 0) {
+        client_disconnect(extra);
+        extra = NULL;
+    }
+    return extra;
+}
+
+int client_login(ClientConnection* conn, const char* username, const char* password) {
+    return login_request(conn, username, password, 1);
+}
 
+// Send LIST_DIR or FILE_INFO for id (under key) and return the response.
+// With binary set the reply comes in the listing encoding. A limit asks
+// for one page, following the last entry of previous (may be NULL). An
+// if_version >= 0 lets the server answer NOT_MODIFIED instead
+static Packet* listing_request(ClientConnection* conn, uint8_t command, const char* key,
+                               int id, int binary, int limit, const ClientListing* previous,
+                               int64_t if_version) {
     cJSON* json = cJSON_CreateObject();
     cJSON_AddNumberToObject(json, "user_id", conn->user_id);
-    cJSON_AddNumberToObject(json, "directory_id", dir_id);
+    cJSON_AddNumberToObject(json, key, id);
+    if (binary) {
+        cJSON_AddStringToObject(json, "encoding", "binary");
+    }
+    if (limit > 0) {
+        cJSON_AddNumberToObject(json, "limit", limit);
+        cJSON_AddStringToObject(json, "sort", "directories");
+    }
+    if (limit > 0 && previous && previous->count > 0) {
+        const ListingEntry* last = &previous->entries[previous->count - 1];
+        cJSON_AddStringToObject(json, "after_name", last->name ? last->name : "");
+        cJSON_AddNumberToObject(json, "after_id", last->id);
+        cJSON_AddBoolToObject(json, "after_directory", last->is_directory);
+    }
+    if (if_version >= 0) {
+        cJSON_AddNumberToObject(json, "if_version", (double)if_version);
+    }
 
     char* payload = cJSON_PrintUnformatted(json);
-    Packet* pkt = packet_create(CMD_LIST_DIR, payload, strlen(payload));
+    Packet* pkt = packet_create(command, payload, strlen(payload));
 
     int result = packet_send(conn->socket_fd, pkt);
 
@@ -108,65 +515,150 @@ int client_list_dir(ClientConnection* conn, int dir_id) {
     packet_free(pkt);
     cJSON_Delete(json);
 
-    if (result < 0) return -1;
+    if (result < 0) return NULL;
+    return net_recv_packet(conn->socket_fd);
+}
 
-    Packet* response = net_recv_packet(conn->socket_fd);
-    if (!response) return -1;
+ClientListing* client_list_entries(ClientConnection* conn, int dir_id) {
+    return client_list_page(conn, dir_id, NULL, 0);
+}
 
-    cJSON* resp_json = cJSON_Parse(response->payload);
-    if (!resp_json) {
+// Fetch one page of dir_id (see client_list_page()), or learn that the
+// directory is still at if_version (>= 0)
+static ClientListing* list_page(ClientConnection* conn, int dir_id,
+                                const ClientListing* previous, int limit, int64_t if_version) {
+    if (!conn || !conn->authenticated) return NULL;
+
+    int binary = (conn->features & FEATURE_BINARY_LIST) != 0;
+    Packet* response = listing_request(conn, CMD_LIST_DIR, "directory_id", dir_id, binary,
+                                       limit, previous, if_version);
+    if (!response) return NULL;
+    if (response->command == CMD_NOT_MODIFIED) {
         packet_free(response);
-        return -1;
+        ClientListing* listing = calloc(1, sizeof(ClientListing));
+        if (listing) {
+            listing->not_modified = 1;
+            listing->version = if_version;
+        }
+        return listing;
+    }
+    if (response->command != CMD_LIST_DIR || !response->payload) {
+        packet_free(response);
+        return NULL;
     }
 
-    cJSON* files = cJSON_GetObjectItem(resp_json, "files");
-    if (files) {
-        printf("\n%-6s %-4s %-30s %-10s %-10s\n", "ID", "Type", "Name", "Size", "Perms");
-        printf("-------------------------------------------------------------------\n");
-
-        cJSON* file;
-        cJSON_ArrayForEach(file, files) {
-            int id = cJSON_GetObjectItem(file, "id")->valueint;
-            int is_dir = cJSON_GetObjectItem(file, "is_directory")->valueint;
-            const char* name = cJSON_GetStringValue(cJSON_GetObjectItem(file, "name"));
-            int size = cJSON_GetObjectItem(file, "size")->valueint;
-            int perms = cJSON_GetObjectItem(file, "permissions")->valueint;
-
-            printf("%-6d %-4s %-30s %-10d %03o\n",
-                   id, is_dir ? "DIR" : "FILE", name, is_dir ? 0 : size, perms);
-        }
-        printf("\n");
-        result = 0;
+    ClientListing* listing = calloc(1, sizeof(ClientListing));
+    if (!listing) {
+        packet_free(response);
+        return NULL;
+    }
+    listing->payload = response->payload;
+    response->payload = NULL;
+
+    int result = -1;
+    if (binary) {
+        uint32_t fields = 0;
+        uint64_t version = 0;
+        result = listing_decode((const uint8_t*)listing->payload, response->data_length,
+                                &listing->entries, &listing->count, &fields, &version);
+        listing->more = (fields & LISTING_FLAG_MORE) != 0;
+        listing->version = (int64_t)version;
     } else {
-        printf("Error: Unable to list directory\n");
-        result = -1;
+        // Servers without the binary encoding: point the entries into the JSON
+        cJSON* resp_json = cJSON_Parse(listing->payload);
+        cJSON* files = resp_json ? cJSON_GetObjectItem(resp_json, "files") : NULL;
+        cJSON* version = resp_json ? cJSON_GetObjectItem(resp_json, "version") : NULL;
+        listing->json = resp_json;
+        listing->more = cJSON_IsTrue(cJSON_GetObjectItem(resp_json, "more"));
+        listing->version = cJSON_IsNumber(version) ? (int64_t)version->valuedouble : 0;
+        if (files) {
+            int count = cJSON_GetArraySize(files);
+            listing->entries = calloc(count ? count : 1, sizeof(ListingEntry));
+            if (listing->entries) {
+                cJSON* file;
+                cJSON_ArrayForEach(file, files) {
+                    ListingEntry* entry = &listing->entries[listing->count++];
+                    entry->id = cJSON_GetObjectItem(file, "id")->valueint;
+                    entry->name = cJSON_GetStringValue(cJSON_GetObjectItem(file, "name"));
+                    entry->is_directory = cJSON_IsTrue(cJSON_GetObjectItem(file, "is_directory"));
+                    entry->size = (int64_t)cJSON_GetObjectItem(file, "size")->valuedouble;
+                    entry->permissions = cJSON_GetObjectItem(file, "permissions")->valueint;
+                    entry->owner_id = cJSON_GetObjectItem(file, "owner_id")->valueint;
+                }
+                result = 0;
+            }
+        }
     }
 
-    cJSON_Delete(resp_json);
     packet_free(response);
+    if (result < 0) {
+        client_listing_free(listing);
+        return NULL;
+    }
+    return listing;
+}
 
-    return result;
+ClientListing* client_list_page(ClientConnection* conn, int dir_id,
+                                const ClientListing* previous, int limit) {
+    return list_page(conn, dir_id, previous, limit, -1);
 }
 
-void* client_list_dir_gui(ClientConnection* conn, int dir_id) {
-    if (!conn || !conn->authenticated) return NULL;
+ClientListing* client_list_changed(ClientConnection* conn, int dir_id, int64_t version,
+                                   int limit) {
+    return list_page(conn, dir_id, NULL, limit, version < 0 ? 0 : version);
+}
 
-    cJSON* json = cJSON_CreateObject();
-    cJSON_AddNumberToObject(json, "user_id", conn->user_id);
-    cJSON_AddNumberToObject(json, "directory_id", dir_id);
+void client_listing_free(ClientListing* listing) {
+    if (!listing) return;
+    free(listing->entries);
+    cJSON_Delete((cJSON*)listing->json);
+    free(listing->payload);
+    free(listing);
+}
 
-    char* payload = cJSON_PrintUnformatted(json);
-    Packet* pkt = packet_create(CMD_LIST_DIR, payload, strlen(payload));
+int client_list_dir(ClientConnection* conn, int dir_id) {
+    if (!conn || !conn->authenticated) return -1;
 
-    int result = packet_send(conn->socket_fd, pkt);
+    ClientListing* listing = client_list_page(conn, dir_id, NULL, CLIENT_LIST_PAGE);
+    if (!listing) {
+        printf("Error: Unable to list directory\n");
+        return -1;
+    }
 
-    free(payload);
-    packet_free(pkt);
-    cJSON_Delete(json);
+    printf("\n%-6s %-4s %-30s %-10s %-10s\n", "ID", "Type", "Name", "Size", "Perms");
+    printf("-------------------------------------------------------------------\n");
+
+    // Printed a page at a time, so huge directories need no more memory
+    int result = 0;
+    while (listing) {
+        for (int i = 0; i < listing->count; i++) {
+            const ListingEntry* entry = &listing->entries[i];
+            printf("%-6d %-4s %-30s %-10lld %03o\n",
+                   entry->id, entry->is_directory ? "DIR" : "FILE", entry->name,
+                   entry->is_directory ? 0 : (long long)entry->size, entry->permissions);
+        }
 
-    if (result < 0) return NULL;
+        ClientListing* next = NULL;
+        if (listing->more) {
+            next = client_list_page(conn, dir_id, listing, CLIENT_LIST_PAGE);
+            if (!next) {
+                printf("Error: Listing interrupted\n");
+                result = -1;
+            }
+        }
+        client_listing_free(listing);
+        listing = next;
+    }
+    printf("\n");
 
-    Packet* response = net_recv_packet(conn->socket_fd);
+    return result;
+}
+
+void* client_list_dir_gui(ClientConnection* conn, int dir_id) {
+    if (!conn || !conn->authenticated) return NULL;
+
+    Packet* response = listing_request(conn, CMD_LIST_DIR, "directory_id", dir_id, 0, 0, NULL,
+                                       -1);
     if (!response) return NULL;
 
     cJSON* resp_json = cJSON_Parse(response->payload);
@@ -182,19 +674,13 @@ void* client_list_dir_gui(ClientConnection* conn, int dir_id) {
 int client_mkdir(ClientConnection* conn, const char* name) {
     if (!conn || !conn->authenticated || !name) return -1;
 
-    cJSON* json = cJSON_CreateObject();
-    cJSON_AddNumberToObject(json, "user_id", conn->user_id);
-    cJSON_AddNumberToObject(json, "parent_id", conn->current_directory);
-    cJSON_AddStringToObject(json, "name", name);
-
-    char* payload = cJSON_PrintUnformatted(json);
+    char* payload = mkdir_payload(conn, name);
     Packet* pkt = packet_create(CMD_MAKE_DIR, payload, strlen(payload));
 
     int result = packet_send(conn->socket_fd, pkt);
 
     free(payload);
     packet_free(pkt);
-    cJSON_Delete(json);
 
     if (result < 0) return -1;
 
@@ -279,7 +765,9 @@ int client_upload(ClientConnection* conn, const char* local_path) {
     cJSON_AddNumberToObject(json, "user_id", conn->user_id);
     cJSON_AddNumberToObject(json, "parent_id", conn->current_directory);
     cJSON_AddStringToObject(json, "name", filename);
-    cJSON_AddNumberToObject(json, "size", st.st_size);
+    cJSON_AddNumberToObject(json, "size", (double)st.st_size);
+    // Pick up where an interrupted upload of this file stopped
+    cJSON_AddTrueToObject(json, "resume");
 
     char* payload = cJSON_PrintUnformatted(json);
     Packet* pkt = packet_create(CMD_UPLOAD_REQ, payload, strlen(payload));
@@ -298,11 +786,32 @@ int client_upload(ClientConnection* conn, const char* local_path) {
         printf("Error: Upload request rejected\n");
         return -1;
     }
+
+    // Servers that stream uploads announce their chunk size, and the offset
+    // to continue from when the upload is resumed
+    size_t chunk_size = 0;
+    uint64_t offset = 0;
+    cJSON* ready = cJSON_Parse(response->payload);
+    cJSON* chunk_item = cJSON_GetObjectItem(ready, "chunk_size");
+    cJSON* offset_item = cJSON_GetObjectItem(ready, "offset");
+    if (cJSON_IsNumber(chunk_item) && chunk_item->valuedouble > 0) {
+        chunk_size = (size_t)chunk_item->valuedouble;
+    }
+    if (chunk_size > 0 && cJSON_IsNumber(offset_item) && offset_item->valuedouble > 0 &&
+        offset_item->valuedouble <= (double)st.st_size) {
+        offset = (uint64_t)offset_item->valuedouble;
+    }
+    cJSON_Delete(ready);
     packet_free(response);
 
-    printf("Uploading file '%s' (%lld bytes)...\n", filename, (long long)st.st_size);
+    if (offset > 0) {
+        printf("Resuming upload of '%s' at byte %llu of %lld...\n",
+               filename, (unsigned long long)offset, (long long)st.st_size);
+    } else {
+        printf("Uploading file '%s' (%lld bytes)...\n", filename, (long long)st.st_size);
+    }
 
-    if (net_send_file(conn->socket_fd, local_path) < 0) {
+    if (net_send_file(conn->socket_fd, local_path, chunk_size, offset, conn->compression) < 0) {
         printf("Error: File transfer failed\n");
         return -1;
     }
@@ -319,12 +828,242 @@ int client_upload(ClientConnection* conn, const char* local_path) {
     return 0;
 }
 
-int client_download(ClientConnection* conn, int file_id, const char* local_path) {
+// Shared state of a multipart upload: each connection claims the next part
+// until all are sent or one of them fails
+typedef struct {
+    uint32_t upload_id;
+    int fd;
+    uint64_t size;
+    uint32_t part_size;
+    uint32_t part_count;
+    uint32_t next_part;
+    int failed;
+    pthread_mutex_t lock;
+} PartJob;
+
+typedef struct {
+    PartJob* job;
+    ClientConnection* conn;
+    pthread_t thread;
+} PartWorker;
+
+// Read one part acknowledgement; 0 if the server stored the part
+static int recv_part_ack(ClientConnection* conn) {
+    Packet* response = net_recv_packet(conn->socket_fd);
+    if (!response) {
+        return -2;
+    }
+    int result = response->command == CMD_SUCCESS ? 0 : -1;
+    if (result < 0 && response->payload) {
+        printf("Error: %s\n", response->payload);
+    }
+    packet_free(response);
+    return result;
+}
+
+static void* part_worker(void* arg) {
+    PartWorker* worker = arg;
+    PartJob* job = worker->job;
+    int unacked = 0;
+    int failed = 0;
+
+    // Up to CLIENT_PART_WINDOW parts in flight, so the link does not idle
+    // for a round trip after each part
+    while (!failed) {
+        pthread_mutex_lock(&job->lock);
+        uint32_t part = job->next_part;
+        int done = job->failed || part >= job->part_count;
+        if (!done) {
+            job->next_part++;
+        }
+        pthread_mutex_unlock(&job->lock);
+        if (done) {
+            break;
+        }
+
+        uint64_t offset = (uint64_t)part * job->part_size;
+        size_t length = job->size - offset < job->part_size ? (size_t)(job->size - offset)
+                                                            : job->part_size;
+        if (net_send_part(worker->conn->socket_fd, job->fd, job->upload_id, part,
+                          offset, length) < 0) {
+            failed = 1;
+            unacked = 0;    // The connection is gone
+            break;
+        }
+        if (++unacked == CLIENT_PART_WINDOW) {
+            unacked--;
+            int rc = recv_part_ack(worker->conn);
+            if (rc == -2) {
+                unacked = 0;
+            }
+            failed = rc < 0;
+        }
+    }
+
+    // Collect the rest so the connection is in step for the commit
+    while (unacked > 0) {
+        unacked--;
+        int rc = recv_part_ack(worker->conn);
+        if (rc == -2) {
+            failed = 1;
+            break;
+        }
+        failed |= rc < 0;
+    }
+
+    if (failed) {
+        pthread_mutex_lock(&job->lock);
+        job->failed = 1;
+        pthread_mutex_unlock(&job->lock);
+    }
+    return NULL;
+}
+
+int client_upload_multipart(ClientConnection* conn, const char* username,
+                            const char* password, const char* local_path,
+                            int connections, size_t part_size) {
+    if (!conn || !conn->authenticated || !local_path) return -1;
+
+    // Without UPLOAD_PART the server takes one sequential upload
+    if (!server_has(conn, FEATURE_MULTIPART)) {
+        return client_upload(conn, local_path);
+    }
+
+    if (connections <= 0) connections = CLIENT_STRIPE_CONNECTIONS;
+    if (connections > CLIENT_MAX_STRIPE_CONNECTIONS) connections = CLIENT_MAX_STRIPE_CONNECTIONS;
+    if (part_size > conn->max_frame - PART_HEADER_SIZE) {
+        part_size = conn->max_frame - PART_HEADER_SIZE;
+    }
+
+    int fd = open(local_path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        printf("Error: File not found: %s\n", local_path);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+
+    const char* filename = strrchr(local_path, '/');
+    filename = filename ? filename + 1 : local_path;
+
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "parent_id", conn->current_directory);
+    cJSON_AddStringToObject(json, "name", filename);
+    cJSON_AddNumberToObject(json, "size", (double)st.st_size);
+    cJSON_AddTrueToObject(json, "multipart");
+    if (part_size > 0) {
+        cJSON_AddNumberToObject(json, "part_size", (double)part_size);
+    }
+
+    char* payload = cJSON_PrintUnformatted(json);
+    Packet* pkt = packet_create(CMD_UPLOAD_REQ, payload, strlen(payload));
+    int result = packet_send(conn->socket_fd, pkt);
+    free(payload);
+    packet_free(pkt);
+    cJSON_Delete(json);
+
+    Packet* response = result < 0 ? NULL : net_recv_packet(conn->socket_fd);
+    cJSON* ready = response && response->command == CMD_SUCCESS
+                   ? cJSON_Parse(response->payload) : NULL;
+    cJSON* upload_id_item = cJSON_GetObjectItem(ready, "upload_id");
+    cJSON* part_size_item = cJSON_GetObjectItem(ready, "part_size");
+    if (!cJSON_IsNumber(upload_id_item) || !cJSON_IsNumber(part_size_item) ||
+        part_size_item->valuedouble < 1) {
+        if (response && response->command == CMD_ERROR && response->payload) {
+            printf("Error: %s\n", response->payload);
+        }
+        printf("Error: Upload request rejected\n");
+        cJSON_Delete(ready);
+        packet_free(response);
+        close(fd);
+        return -1;
+    }
+
+    PartJob job = { .upload_id = (uint32_t)upload_id_item->valueint, .fd = fd,
+                    .size = (uint64_t)st.st_size,
+                    .part_size = (uint32_t)part_size_item->valuedouble,
+                    .next_part = 0, .failed = 0 };
+    job.part_count = (uint32_t)((job.size + job.part_size - 1) / job.part_size);
+    pthread_mutex_init(&job.lock, NULL);
+    cJSON_Delete(ready);
+    packet_free(response);
+
+    if ((uint32_t)connections > job.part_count) {
+        connections = job.part_count > 0 ? (int)job.part_count : 1;
+    }
+
+    PartWorker workers[CLIENT_MAX_STRIPE_CONNECTIONS];
+    workers[0].job = &job;
+    workers[0].conn = conn;
+
+    int count = 1;
+    for (int i = 1; i < connections; i++) {
+        ClientConnection* extra = connect_as(conn, username, password);
+        if (!extra) {
+            break;
+        }
+        workers[count].job = &job;
+        workers[count].conn = extra;
+        if (pthread_create(&workers[count].thread, NULL, part_worker, &workers[count]) != 0) {
+            client_disconnect(extra);
+            break;
+        }
+        count++;
+    }
+
+    printf("Uploading file '%s' (%lld bytes) in %u parts over %d connection%s...\n",
+           filename, (long long)st.st_size, job.part_count, count, count == 1 ? "" : "s");
+
+    long long start = monotonic_ms();
+    part_worker(&workers[0]);
+    for (int i = 1; i < count; i++) {
+        pthread_join(workers[i].thread, NULL);
+        client_disconnect(workers[i].conn);
+    }
+    pthread_mutex_destroy(&job.lock);
+    close(fd);
+
+    // Every part is acknowledged; the commit checks none is missing (and
+    // drops the upload if one is)
+    json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "upload_id", job.upload_id);
+    payload = cJSON_PrintUnformatted(json);
+    pkt = packet_create(CMD_UPLOAD_COMMIT, payload, strlen(payload));
+    result = packet_send(conn->socket_fd, pkt);
+    free(payload);
+    packet_free(pkt);
+    cJSON_Delete(json);
+
+    response = result < 0 ? NULL : net_recv_packet(conn->socket_fd);
+    long long elapsed = monotonic_ms() - start;
+    if (job.failed || !response || response->command != CMD_SUCCESS) {
+        if (response && response->command == CMD_ERROR && response->payload) {
+            printf("Error: %s\n", response->payload);
+        }
+        packet_free(response);
+        printf("Error: Upload failed\n");
+        return -1;
+    }
+
+    packet_free(response);
+    printf("Upload successful! (%.1f MB/s)\n",
+           elapsed > 0 ? (double)st.st_size / 1048576.0 / ((double)elapsed / 1000.0) : 0.0);
+    return 0;
+}
+
+// Download file_id into local_path from byte offset on (the local file
+// already holds the bytes before it)
+static int download_from(ClientConnection* conn, int file_id, const char* local_path,
+                         uint64_t offset) {
     if (!conn || !conn->authenticated || !local_path) return -1;
 
     cJSON* json = cJSON_CreateObject();
     cJSON_AddNumberToObject(json, "user_id", conn->user_id);
     cJSON_AddNumberToObject(json, "file_id", file_id);
+    cJSON_AddTrueToObject(json, "chunked");
+    if (offset > 0) {
+        cJSON_AddNumberToObject(json, "offset", (double)offset);
+    }
 
     char* payload = cJSON_PrintUnformatted(json);
     Packet* pkt = packet_create(CMD_DOWNLOAD_REQ, payload, strlen(payload));
@@ -341,6 +1080,9 @@ int client_download(ClientConnection* conn, int file_id, const char* local_path)
     if (!response) return -1;
 
     if (response->command != CMD_DOWNLOAD_RES) {
+        if (response->command == CMD_ERROR && response->payload) {
+            printf("Error: %s\n", response->payload);
+        }
         printf("Error: Download request rejected\n");
         packet_free(response);
         return -1;
@@ -355,21 +1097,27 @@ int client_download(ClientConnection* conn, int file_id, const char* local_path)
     cJSON* size_obj = cJSON_GetObjectItem(resp_json, "size");
     cJSON* name_obj = cJSON_GetObjectItem(resp_json, "name");
 
-    if (!size_obj) {
+    if (!cJSON_IsNumber(size_obj) || size_obj->valuedouble < 0) {
         cJSON_Delete(resp_json);
         packet_free(response);
         return -1;
     }
 
-    size_t file_size = size_obj->valueint;
-    const char* name = name_obj ? cJSON_GetStringValue(name_obj) : "file";
+    // valueint would truncate sizes past 2 GB
+    uint64_t file_size = (uint64_t)size_obj->valuedouble;
+    const char* name = cJSON_IsString(name_obj) ? cJSON_GetStringValue(name_obj) : "file";
+
+    if (offset > 0) {
+        printf("Resuming download of '%s' at byte %llu of %llu...\n", name,
+               (unsigned long long)offset, (unsigned long long)file_size);
+    } else {
+        printf("Downloading '%s' (%llu bytes)...\n", name, (unsigned long long)file_size);
+    }
 
     cJSON_Delete(resp_json);
     packet_free(response);
 
-    printf("Downloading '%s' (%zu bytes)...\n", name, file_size);
-
-    if (net_recv_file(conn->socket_fd, local_path, file_size) < 0) {
+    if (net_recv_file(conn->socket_fd, local_path, file_size, offset) < 0) {
         printf("Error: Download failed\n");
         return -1;
     }
@@ -378,16 +1126,30 @@ int client_download(ClientConnection* conn, int file_id, const char* local_path)
     return 0;
 }
 
-int client_chmod(ClientConnection* conn, int file_id, int permissions) {
-    if (!conn || !conn->authenticated) return -1;
+int client_download(ClientConnection* conn, int file_id, const char* local_path) {
+    return download_from(conn, file_id, local_path, 0);
+}
 
+int client_download_resume(ClientConnection* conn, int file_id, const char* local_path) {
+    struct stat st;
+    uint64_t offset = 0;
+    if (local_path && stat(local_path, &st) == 0 && S_ISREG(st.st_mode)) {
+        offset = (uint64_t)st.st_size;
+    }
+    return download_from(conn, file_id, local_path, offset);
+}
+
+// Send READ_RANGE and read its DOWNLOAD_RES header: *served is the number
+// of bytes the following chunks carry, *size the file's size
+static int request_range(ClientConnection* conn, int file_id, uint64_t offset, uint64_t length,
+                         uint64_t* served, uint64_t* size) {
     cJSON* json = cJSON_CreateObject();
-    cJSON_AddNumberToObject(json, "user_id", conn->user_id);
     cJSON_AddNumberToObject(json, "file_id", file_id);
-    cJSON_AddNumberToObject(json, "permissions", permissions);
+    cJSON_AddNumberToObject(json, "offset", (double)offset);
+    cJSON_AddNumberToObject(json, "length", (double)length);
 
     char* payload = cJSON_PrintUnformatted(json);
-    Packet* pkt = packet_create(CMD_CHMOD, payload, strlen(payload));
+    Packet* pkt = packet_create(CMD_READ_RANGE, payload, strlen(payload));
 
     int result = packet_send(conn->socket_fd, pkt);
 
@@ -400,6 +1162,199 @@ int client_chmod(ClientConnection* conn, int file_id, int permissions) {
     Packet* response = net_recv_packet(conn->socket_fd);
     if (!response) return -1;
 
+    if (response->command != CMD_DOWNLOAD_RES) {
+        if (response->command == CMD_ERROR && response->payload) {
+            printf("Error: %s\n", response->payload);
+        }
+        packet_free(response);
+        return -1;
+    }
+
+    // The range is clipped at the end of the file
+    cJSON* resp_json = cJSON_Parse(response->payload);
+    cJSON* length_item = cJSON_GetObjectItem(resp_json, "length");
+    cJSON* size_item = cJSON_GetObjectItem(resp_json, "size");
+    double served_value = cJSON_IsNumber(length_item) ? length_item->valuedouble : -1;
+    double size_value = cJSON_IsNumber(size_item) ? size_item->valuedouble : -1;
+    cJSON_Delete(resp_json);
+    packet_free(response);
+
+    if (served_value < 0 || served_value > (double)length || size_value < 0) return -1;
+
+    *served = (uint64_t)served_value;
+    *size = (uint64_t)size_value;
+    return 0;
+}
+
+int64_t client_read_range(ClientConnection* conn, int file_id, uint64_t offset,
+                          uint64_t length, uint8_t* buffer) {
+    if (!conn || !conn->authenticated || !buffer) return -1;
+
+    uint64_t served, size;
+    if (request_range(conn, file_id, offset, length, &served, &size) < 0 ||
+        net_recv_range(conn->socket_fd, offset, served, buffer) < 0) {
+        return -1;
+    }
+    return (int64_t)served;
+}
+
+// Shared state of a striped download: each connection claims the next
+// stripe until the file is covered or one of them fails
+typedef struct {
+    int file_id;
+    int fd;
+    uint64_t size;
+    uint64_t stripe_size;
+    uint64_t next_offset;
+    int failed;
+    pthread_mutex_t lock;
+} StripeJob;
+
+typedef struct {
+    StripeJob* job;
+    ClientConnection* conn;
+    pthread_t thread;
+} StripeWorker;
+
+static void* stripe_worker(void* arg) {
+    StripeWorker* worker = arg;
+    StripeJob* job = worker->job;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        uint64_t offset = job->next_offset;
+        int done = job->failed || offset >= job->size;
+        if (!done) {
+            job->next_offset += job->stripe_size;
+        }
+        pthread_mutex_unlock(&job->lock);
+        if (done) {
+            break;
+        }
+
+        uint64_t length = job->size - offset < job->stripe_size ? job->size - offset
+                                                                : job->stripe_size;
+        uint64_t served, size;
+        if (request_range(worker->conn, job->file_id, offset, length, &served, &size) < 0 ||
+            served != length || size != job->size ||
+            net_recv_range_fd(worker->conn->socket_fd, offset, length, job->fd) < 0) {
+            pthread_mutex_lock(&job->lock);
+            job->failed = 1;
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+int client_download_striped(ClientConnection* conn, const char* username,
+                            const char* password, int file_id, const char* local_path,
+                            int connections, size_t stripe_size) {
+    if (!conn || !conn->authenticated || !local_path) return -1;
+
+    // Stripes are READ_RANGE requests
+    if (!server_has(conn, FEATURE_RANGE)) {
+        return client_download(conn, file_id, local_path);
+    }
+
+    if (connections <= 0) connections = CLIENT_STRIPE_CONNECTIONS;
+    if (connections > CLIENT_MAX_STRIPE_CONNECTIONS) connections = CLIENT_MAX_STRIPE_CONNECTIONS;
+    if (stripe_size == 0) stripe_size = CLIENT_STRIPE_SIZE;
+
+    // An empty range tells the file's size
+    uint64_t served, size;
+    if (request_range(conn, file_id, 0, 0, &served, &size) < 0) {
+        printf("Error: Download request rejected\n");
+        return -1;
+    }
+
+    int fd = open(local_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Error: Cannot create '%s': %s\n", local_path, strerror(errno));
+        return -1;
+    }
+
+    // Stripes land out of order; reserve the whole file up front
+    if (size > 0 && posix_fallocate(fd, 0, (off_t)size) != 0 &&
+        ftruncate(fd, (off_t)size) < 0) {
+        printf("Error: Cannot allocate '%s': %s\n", local_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    uint64_t stripes = (size + stripe_size - 1) / stripe_size;
+    if ((uint64_t)connections > stripes) {
+        connections = stripes > 0 ? (int)stripes : 1;
+    }
+
+    StripeJob job = { .file_id = file_id, .fd = fd, .size = size,
+                      .stripe_size = stripe_size, .next_offset = 0, .failed = 0 };
+    pthread_mutex_init(&job.lock, NULL);
+
+    StripeWorker workers[CLIENT_MAX_STRIPE_CONNECTIONS];
+    workers[0].job = &job;
+    workers[0].conn = conn;
+
+    // Extra connections log in as the same user; run with those that do
+    int count = 1;
+    for (int i = 1; i < connections; i++) {
+        ClientConnection* extra = connect_as(conn, username, password);
+        if (!extra) {
+            break;
+        }
+        workers[count].job = &job;
+        workers[count].conn = extra;
+        if (pthread_create(&workers[count].thread, NULL, stripe_worker, &workers[count]) != 0) {
+            client_disconnect(extra);
+            break;
+        }
+        count++;
+    }
+
+    printf("Downloading file %d (%llu bytes) over %d connection%s...\n", file_id,
+           (unsigned long long)size, count, count == 1 ? "" : "s");
+
+    long long start = monotonic_ms();
+    stripe_worker(&workers[0]);
+    for (int i = 1; i < count; i++) {
+        pthread_join(workers[i].thread, NULL);
+        client_disconnect(workers[i].conn);
+    }
+    long long elapsed = monotonic_ms() - start;
+
+    pthread_mutex_destroy(&job.lock);
+    int failed = job.failed;
+    if (close(fd) < 0) {
+        failed = 1;
+    }
+
+    if (failed) {
+        printf("Error: Download failed\n");
+        return -1;
+    }
+
+    printf("Download successful! (%.1f MB/s)\n",
+           elapsed > 0 ? (double)size / 1048576.0 / ((double)elapsed / 1000.0) : 0.0);
+    return 0;
+}
+
+int client_chmod(ClientConnection* conn, int file_id, int permissions) {
+    if (!conn || !conn->authenticated) return -1;
+
+    char* payload = chmod_payload(conn, file_id, permissions);
+    Packet* pkt = packet_create(CMD_CHMOD, payload, strlen(payload));
+
+    int result = packet_send(conn->socket_fd, pkt);
+
+    free(payload);
+    packet_free(pkt);
+
+    if (result < 0) return -1;
+
+    Packet* response = net_recv_packet(conn->socket_fd);
+    if (!response) return -1;
+
     if (response->command == CMD_SUCCESS) {
         printf("Permissions changed successfully\n");
         result = 0;
@@ -415,18 +1370,13 @@ int client_chmod(ClientConnection* conn, int file_id, int permissions) {
 int client_delete(ClientConnection* conn, int file_id) {
     if (!conn || !conn->authenticated) return -1;
 
-    cJSON* json = cJSON_CreateObject();
-    cJSON_AddNumberToObject(json, "user_id", conn->user_id);
-    cJSON_AddNumberToObject(json, "file_id", file_id);
-
-    char* payload = cJSON_PrintUnformatted(json);
+    char* payload = delete_payload(conn, file_id);
     Packet* pkt = packet_create(CMD_DELETE, payload, strlen(payload));
 
     int result = packet_send(conn->socket_fd, pkt);
 
     free(payload);
     packet_free(pkt);
-    cJSON_Delete(json);
 
     if (result < 0) return -1;
 
@@ -454,28 +1404,53 @@ int client_delete(ClientConnection* conn, int file_id) {
     return result;
 }
 
-int client_file_info(ClientConnection* conn, int file_id) {
-    if (!conn || !conn->authenticated) return -1;
-
-    cJSON* json = cJSON_CreateObject();
-    cJSON_AddNumberToObject(json, "user_id", conn->user_id);
-    cJSON_AddNumberToObject(json, "file_id", file_id);
-
-    char* payload = cJSON_PrintUnformatted(json);
-    Packet* pkt = packet_create(CMD_FILE_INFO, payload, strlen(payload));
-
-    int result = packet_send(conn->socket_fd, pkt);
+// Print FILE_INFO from its binary encoding (one record)
+static int print_file_info(const Packet* response) {
+    ListingEntry* entry = NULL;
+    int count = 0;
+    if (listing_decode((const uint8_t*)response->payload, response->data_length,
+                       &entry, &count, NULL, NULL) < 0 || count != 1) {
+        free(entry);
+        return -1;
+    }
 
-    free(payload);
-    packet_free(pkt);
-    cJSON_Delete(json);
+    static const char rwx[] = "rwx";
+    char perm_str[10];
+    for (int i = 0; i < 9; i++) {
+        perm_str[i] = (entry->permissions & (0400 >> i)) ? rwx[i % 3] : '-';
+    }
+    perm_str[9] = '\0';
+
+    printf("\n=== File Information ===\n");
+    printf("ID:          %d\n", entry->id);
+    printf("Name:        %s\n", entry->name);
+    printf("Type:        %s\n", entry->is_directory ? "directory" : "file");
+    printf("Size:        %lld bytes\n", (long long)entry->size);
+    printf("Owner ID:    %d\n", entry->owner_id);
+    printf("Parent ID:   %d\n", entry->parent_id);
+    printf("Permissions: %03o (%s)\n", entry->permissions, perm_str);
+    printf("Created:     %s\n", entry->created_at);
+    printf("\n");
+
+    free(entry);
+    return 0;
+}
 
-    if (result < 0) return -1;
+int client_file_info(ClientConnection* conn, int file_id) {
+    if (!conn || !conn->authenticated) return -1;
 
-    Packet* response = net_recv_packet(conn->socket_fd);
+    int binary = (conn->features & FEATURE_BINARY_LIST) != 0;
+    Packet* response = listing_request(conn, CMD_FILE_INFO, "file_id", file_id, binary,
+                                       0, NULL, -1);
     if (!response) return -1;
 
-    if (response->command == CMD_SUCCESS) {
+    int result;
+    if (response->command == CMD_SUCCESS && binary) {
+        result = print_file_info(response);
+        if (result < 0) {
+            printf("Error: Invalid file info response\n");
+        }
+    } else if (response->command == CMD_SUCCESS) {
         cJSON* resp_json = cJSON_Parse(response->payload);
         if (resp_json) {
             printf("\n=== File Information ===\n");
@@ -508,6 +1483,113 @@ int client_file_info(ClientConnection* conn, int file_id) {
     return result;
 }
 
+// Print the server's message for a failed pipelined request
+static void print_pipeline_error(const ClientRequest* request, const char* what) {
+    cJSON* resp_json = request->response ? cJSON_Parse(request->response) : NULL;
+    cJSON* message = resp_json ? cJSON_GetObjectItem(resp_json, "message") : NULL;
+    if (message) {
+        printf("Error: %s: %s\n", what, cJSON_GetStringValue(message));
+    } else {
+        printf("Error: %s failed\n", what);
+    }
+    cJSON_Delete(resp_json);
+}
+
+// Run a batch built by one of the *_many() helpers and count its successes.
+// A server that agreed on BATCH takes it in one round trip, others pipelined
+static int run_batch(ClientConnection* conn, ClientRequest* requests, int count,
+                     char** labels, const char* action) {
+    int answered = (conn->features & FEATURE_BATCH) ? client_batch(conn, requests, count)
+                                                    : client_pipeline(conn, requests, count);
+    int succeeded = 0;
+
+    for (int i = 0; i < answered; i++) {
+        if (requests[i].response_command == CMD_SUCCESS) {
+            succeeded++;
+        } else {
+            print_pipeline_error(&requests[i], labels[i]);
+        }
+    }
+
+    if (answered >= 0) {
+        printf("%s: %d of %d succeeded\n", action, succeeded, count);
+    }
+
+    client_pipeline_free(requests, count);
+    for (int i = 0; i < count; i++) {
+        free(requests[i].payload);
+        free(labels[i]);
+    }
+    free(requests);
+    free(labels);
+
+    return (answered < 0) ? -1 : succeeded;
+}
+
+// Allocate a batch of count requests and their labels
+static int batch_alloc(int count, ClientRequest** requests, char*** labels) {
+    *requests = calloc(count, sizeof(ClientRequest));
+    *labels = calloc(count, sizeof(char*));
+    if (!*requests || !*labels) {
+        free(*requests);
+        free(*labels);
+        return -1;
+    }
+    return 0;
+}
+
+int client_mkdir_many(ClientConnection* conn, const char** names, int count) {
+    if (!conn || !conn->authenticated || !names || count <= 0) return -1;
+
+    ClientRequest* requests;
+    char** labels;
+    if (batch_alloc(count, &requests, &labels) < 0) return -1;
+
+    for (int i = 0; i < count; i++) {
+        requests[i].command = CMD_MAKE_DIR;
+        requests[i].payload = mkdir_payload(conn, names[i]);
+        labels[i] = str_duplicate(names[i]);
+    }
+
+    return run_batch(conn, requests, count, labels, "mkdir");
+}
+
+int client_chmod_many(ClientConnection* conn, const int* file_ids, int count, int permissions) {
+    if (!conn || !conn->authenticated || !file_ids || count <= 0) return -1;
+
+    ClientRequest* requests;
+    char** labels;
+    if (batch_alloc(count, &requests, &labels) < 0) return -1;
+
+    for (int i = 0; i < count; i++) {
+        char label[32];
+        snprintf(label, sizeof(label), "file %d", file_ids[i]);
+        requests[i].command = CMD_CHMOD;
+        requests[i].payload = chmod_payload(conn, file_ids[i], permissions);
+        labels[i] = str_duplicate(label);
+    }
+
+    return run_batch(conn, requests, count, labels, "chmod");
+}
+
+int client_delete_many(ClientConnection* conn, const int* file_ids, int count) {
+    if (!conn || !conn->authenticated || !file_ids || count <= 0) return -1;
+
+    ClientRequest* requests;
+    char** labels;
+    if (batch_alloc(count, &requests, &labels) < 0) return -1;
+
+    for (int i = 0; i < count; i++) {
+        char label[32];
+        snprintf(label, sizeof(label), "file %d", file_ids[i]);
+        requests[i].command = CMD_DELETE;
+        requests[i].payload = delete_payload(conn, file_ids[i]);
+        labels[i] = str_duplicate(label);
+    }
+
+    return run_batch(conn, requests, count, labels, "delete");
+}
+
 int client_upload_folder(ClientConnection* conn, const char* local_path) {
     if (!conn || !conn->authenticated || !local_path) return -1;
 
@@ -607,8 +1689,9 @@ int client_download_folder(ClientConnection* conn, int folder_id, const char* lo
     }
 
     // Get file listing for this directory (use current_directory after cd)
-    cJSON* resp_json = (cJSON*)client_list_dir_gui(conn, conn->current_directory);
-    if (!resp_json) {
+    ClientListing* listing = client_list_page(conn, conn->current_directory, NULL,
+                                              CLIENT_LIST_PAGE);
+    if (!listing) {
         client_cd(conn, saved_dir);  // Restore directory
         printf("Error: Cannot list directory\n");
         return -1;
@@ -618,13 +1701,11 @@ int client_download_folder(ClientConnection* conn, int folder_id, const char* lo
     int dirs_downloaded = 0;
     int errors = 0;
 
-    cJSON* files = cJSON_GetObjectItem(resp_json, "files");
-    if (files) {
-        cJSON* file;
-        cJSON_ArrayForEach(file, files) {
-            int id = cJSON_GetObjectItem(file, "id")->valueint;
-            int is_dir = cJSON_GetObjectItem(file, "is_directory")->valueint;
-            const char* name = cJSON_GetStringValue(cJSON_GetObjectItem(file, "name"));
+    while (listing) {
+        for (int i = 0; i < listing->count; i++) {
+            int id = listing->entries[i].id;
+            int is_dir = listing->entries[i].is_directory;
+            const char* name = listing->entries[i].name;
 
             char local_file_path[1024];
             snprintf(local_file_path, sizeof(local_file_path), "%s/%s", local_path, name);
@@ -640,8 +1721,8 @@ int client_download_folder(ClientConnection* conn, int folder_id, const char* lo
                 }
             } else {
                 // Download file
-                int size = cJSON_GetObjectItem(file, "size")->valueint;
-                printf("Downloading file: %s (%d bytes)\n", name, size);
+                printf("Downloading file: %s (%lld bytes)\n", name,
+                       (long long)listing->entries[i].size);
                 if (client_download(conn, id, local_file_path) < 0) {
                     printf("Warning: Failed to download file %s\n", name);
                     errors++;
@@ -650,9 +1731,18 @@ int client_download_folder(ClientConnection* conn, int folder_id, const char* lo
                 }
             }
         }
-    }
 
-    cJSON_Delete(resp_json);
+        ClientListing* next = NULL;
+        if (listing->more) {
+            next = client_list_page(conn, folder_id, listing, CLIENT_LIST_PAGE);
+            if (!next) {
+                printf("Warning: Listing of folder %d interrupted\n", folder_id);
+                errors++;
+            }
+        }
+        client_listing_free(listing);
+        listing = next;
+    }
 
     // Restore original directory
     client_cd(conn, saved_dir);
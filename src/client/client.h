@@ -3,6 +3,21 @@
 
 #include <stdint.h>
 #include "../common/protocol.h"
+#include "../common/listing.h"
+
+// Requests a pipelined batch keeps unanswered at once
+#define CLIENT_PIPELINE_DEPTH 64
+
+// Striped downloads (see client_download_striped())
+#define CLIENT_STRIPE_SIZE (8 * 1024 * 1024)
+#define CLIENT_STRIPE_CONNECTIONS 4
+#define CLIENT_MAX_STRIPE_CONNECTIONS 32
+
+// Entries per page when listing a directory
+#define CLIENT_LIST_PAGE LIST_PAGE_MAX
+
+// Unacknowledged parts a connection of a multipart upload keeps in flight
+#define CLIENT_PART_WINDOW 4
 
 // Connection state
 typedef struct {
@@ -14,24 +29,136 @@ typedef struct {
     int is_admin;
     int current_directory;
     char current_path[512];
+    int protocol_version;       // Agreed by client_hello(), 1 for older servers
+    uint32_t features;          // FEATURE_* flags both sides support
+    uint32_t max_frame;         // Largest frame payload the server takes
+    int max_streams;            // Granted by HELLO or client_enable_streams(), 0 if off
+    uint32_t next_stream_id;
+    int compression;            // Agreed by HELLO or at login (compress.h), 0 if none
 } ClientConnection;
 
-// Connection management
+// One request of a pipelined batch (see client_pipeline())
+typedef struct {
+    uint8_t command;
+    char* payload;              // Request payload, owned by the caller
+    uint8_t response_command;   // Filled in by client_pipeline()
+    char* response;             // Response payload or NULL; release with client_pipeline_free()
+} ClientRequest;
+
+// A directory listing (see client_list_entries())
+typedef struct {
+    ListingEntry* entries;
+    int count;
+    int more;                   // Paged listing: entries follow the last one
+    int64_t version;            // Directory version the listing shows, 0 if unknown
+    int not_modified;           // client_list_changed(): still at that version, no entries
+    char* payload;              // Response payload the entries point into
+    void* json;                 // Its parsed cJSON tree, NULL for a binary listing
+} ClientListing;
+
+// Connection management. client_connect() runs client_hello() before
+// returning the connection.
 ClientConnection* client_connect(const char* ip, int port);
 void client_disconnect(ClientConnection* conn);
 
+// Capability negotiation: send HELLO with our protocol version, frame size
+// and features, and keep what the server agrees to (multiplexing, zlib).
+// Returns the agreed protocol version, 1 if the server predates HELLO
+// (every feature is then tried as before), or -1 on error
+int client_hello(ClientConnection* conn);
+
+// Keepalive: PING the server (allowed before login)
+// Returns the round-trip time in milliseconds, or -1 on error
+int client_ping(ClientConnection* conn);
+
+// Multiplexing: ask the server to run up to max_streams tagged requests at
+// once. Returns the number granted, 0 if the server does not support it
+// (requests then stay untagged and are answered in order), -1 on error
+int client_enable_streams(ClientConnection* conn, int max_streams);
+
+// Send a tagged request without waiting for its response
+// Returns the request's stream ID, or 0 on error
+uint32_t client_send_tagged(ClientConnection* conn, uint8_t command,
+                            const char* payload, uint32_t length);
+
+// Receive the next response. Responses to tagged requests may arrive in
+// any order and carry their request's stream ID. Free with packet_free().
+Packet* client_recv_response(ClientConnection* conn);
+
+// Pipelining: send the requests back-to-back, up to CLIENT_PIPELINE_DEPTH
+// unanswered at a time, and collect the responses, which the server
+// returns in request order. A batch of N small requests costs about
+// N / CLIENT_PIPELINE_DEPTH round trips instead of N.
+// Returns the number of requests answered, or -1 on a connection error
+int client_pipeline(ClientConnection* conn, ClientRequest* requests, int count);
+
+// Batching: send the requests (MAKE_DIR, CHMOD, DELETE or FILE_INFO) in
+// BATCH envelopes of up to BATCH_MAX_REQUESTS, which the server runs under
+// one transaction, and collect each one's response as client_pipeline()
+// does. Needs FEATURE_BATCH. A batch the server refuses as a whole is
+// every request's error response.
+// Returns the number of requests answered, or -1 on a connection error
+int client_batch(ClientConnection* conn, ClientRequest* requests, int count);
+
+// Free the responses collected by client_pipeline() or client_batch()
+void client_pipeline_free(ClientRequest* requests, int count);
+
 // Authentication
 int client_login(ClientConnection* conn, const char* username, const char* password);
 
 // File operations
 int client_list_dir(ClientConnection* conn, int dir_id);
 void* client_list_dir_gui(ClientConnection* conn, int dir_id);  // Returns cJSON* with file list for GUI
+// Fetch dir_id's entries, in the binary encoding when HELLO agreed on it
+// (no JSON on either end). Returns NULL on error; release with
+// client_listing_free()
+ClientListing* client_list_entries(ClientConnection* conn, int dir_id);
+// One page of up to limit entries, directories first and each by name (as
+// unpaged listings), following the last entry of previous (NULL: the
+// first page). Servers without paging return the
+// whole directory as one page
+ClientListing* client_list_page(ClientConnection* conn, int dir_id,
+                                const ClientListing* previous, int limit);
+// The first page, unless dir_id is still at version (that of a listing the
+// caller holds): then a listing with not_modified set and no entries. The
+// server then skips reading the directory and replies with a bare header
+ClientListing* client_list_changed(ClientConnection* conn, int dir_id, int64_t version,
+                                   int limit);
+void client_listing_free(ClientListing* listing);
 int client_mkdir(ClientConnection* conn, const char* name);
 int client_cd(ClientConnection* conn, int dir_id);
 int client_upload(ClientConnection* conn, const char* local_path);
+// Upload over several connections at once: the file is split into parts of
+// part_size bytes (0: the server's choice) that conn and connections - 1
+// new logins with username/password send in parallel, then conn commits.
+// connections 0 picks CLIENT_STRIPE_CONNECTIONS. The credentials are only
+// used for those logins and never kept; without them conn sends every part
+int client_upload_multipart(ClientConnection* conn, const char* username,
+                            const char* password, const char* local_path,
+                            int connections, size_t part_size);
 int client_download(ClientConnection* conn, int file_id, const char* local_path);
+// Continue a download into local_path from the bytes it already holds
+int client_download_resume(ClientConnection* conn, int file_id, const char* local_path);
+// Download over several connections at once: conn plus connections - 1
+// new logins with username/password each fetch stripe_size byte ranges
+// with READ_RANGE and write them into the preallocated local file. A value
+// of 0 picks CLIENT_STRIPE_CONNECTIONS / CLIENT_STRIPE_SIZE. As for
+// uploads, the credentials are not kept and NULL leaves conn on its own
+int client_download_striped(ClientConnection* conn, const char* username,
+                            const char* password, int file_id, const char* local_path,
+                            int connections, size_t stripe_size);
+// Read up to length bytes of a file from offset into buffer
+// Returns the number of bytes read (less at the end of the file), -1 on error
+int64_t client_read_range(ClientConnection* conn, int file_id, uint64_t offset,
+                          uint64_t length, uint8_t* buffer);
 int client_chmod(ClientConnection* conn, int file_id, int permissions);
 
+// Bulk operations in the current directory, batched (client_batch()) or
+// else pipelined. Return the number of items that succeeded, or -1 on a connection error
+int client_mkdir_many(ClientConnection* conn, const char** names, int count);
+int client_chmod_many(ClientConnection* conn, const int* file_ids, int count, int permissions);
+int client_delete_many(ClientConnection* conn, const int* file_ids, int count);
+
 // Recursive operations
 int client_upload_folder(ClientConnection* conn, const char* local_path);
 int client_download_folder(ClientConnection* conn, int folder_id, const char* local_path);
@@ -1,41 +1,56 @@
 #include "gui.h"
 #include <string.h>
-#include "cJSON.h"
 
 void refresh_file_list(AppState *state) {
-    gtk_list_store_clear(state->file_store);
-
-    // Get file list from server
-    cJSON* resp_json = (cJSON*)client_list_dir_gui(state->conn, state->current_directory);
-    if (!resp_json) {
+    // Get file list from server; the directory shown already only needs
+    // fetching again if it changed since
+    ClientListing* listing;
+    if (state->listed_directory == state->current_directory) {
+        listing = client_list_changed(state->conn, state->current_directory,
+                                      state->listed_version, CLIENT_LIST_PAGE);
+    } else {
+        listing = client_list_page(state->conn, state->current_directory, NULL,
+                                   CLIENT_LIST_PAGE);
+    }
+    if (!listing) {
         show_error_dialog(state->window, "Failed to list directory");
         return;
     }
+    if (listing->not_modified) {
+        client_listing_free(listing);
+        return;
+    }
 
-    cJSON* files = cJSON_GetObjectItem(resp_json, "files");
-    if (files) {
-        cJSON* file;
-        cJSON_ArrayForEach(file, files) {
-            int id = cJSON_GetObjectItem(file, "id")->valueint;
-            int is_dir = cJSON_GetObjectItem(file, "is_directory")->valueint;
-            const char* name = cJSON_GetStringValue(cJSON_GetObjectItem(file, "name"));
-            int size = cJSON_GetObjectItem(file, "size")->valueint;
-            int perms = cJSON_GetObjectItem(file, "permissions")->valueint;
+    gtk_list_store_clear(state->file_store);
+    state->listed_directory = state->current_directory;
+    state->listed_version = listing->version;
+
+    while (listing) {
+        for (int i = 0; i < listing->count; i++) {
+            const ListingEntry* entry = &listing->entries[i];
 
             GtkTreeIter iter;
             gtk_list_store_append(state->file_store, &iter);
             gtk_list_store_set(state->file_store, &iter,
-                0, id,
-                1, is_dir ? "folder" : "text-x-generic",  // Icon name
-                2, name,
-                3, is_dir ? "Directory" : "File",
-                4, is_dir ? 0 : size,
-                5, g_strdup_printf("%03o", perms),
+                0, entry->id,
+                1, entry->is_directory ? "folder" : "text-x-generic",  // Icon name
+                2, entry->name,
+                3, entry->is_directory ? "Directory" : "File",
+                4, entry->is_directory ? 0 : (int)entry->size,
+                5, g_strdup_printf("%03o", entry->permissions),
                 -1);
         }
-    }
 
-    cJSON_Delete(resp_json);
+        ClientListing* next = listing->more
+            ? client_list_page(state->conn, state->current_directory, listing, CLIENT_LIST_PAGE)
+            : NULL;
+        if (listing->more && !next) {
+            show_error_dialog(state->window, "Failed to list directory");
+            state->listed_directory = -1;   // Incomplete: fetch it all next time
+        }
+        client_listing_free(listing);
+        listing = next;
+    }
 }
 
 void on_row_activated(GtkTreeView *tree_view, GtkTreePath *path,
@@ -98,13 +113,43 @@ void on_upload_clicked(GtkWidget *widget, AppState *state) {
     gtk_widget_destroy(dialog);
 }
 
-void on_download_clicked(GtkWidget *widget, AppState *state) {
+// First selected row (the list allows several); FALSE if none
+static gboolean get_first_selected(AppState *state, GtkTreeModel **model, GtkTreeIter *iter) {
+    GtkTreeSelection *selection = gtk_tree_view_get_selection(
+        GTK_TREE_VIEW(state->tree_view));
+    GList *rows = gtk_tree_selection_get_selected_rows(selection, model);
+    gboolean found = rows && gtk_tree_model_get_iter(*model, iter, rows->data);
+    g_list_free_full(rows, (GDestroyNotify)gtk_tree_path_free);
+    return found;
+}
+
+// IDs of all selected rows into a new array (g_free() it); returns how many
+static int get_selected_ids(AppState *state, int **ids) {
     GtkTreeSelection *selection = gtk_tree_view_get_selection(
         GTK_TREE_VIEW(state->tree_view));
     GtkTreeModel *model;
+    GList *rows = gtk_tree_selection_get_selected_rows(selection, &model);
+
+    *ids = g_new(int, g_list_length(rows) + 1);
+    int count = 0;
+    for (GList *row = rows; row; row = row->next) {
+        GtkTreeIter iter;
+        if (gtk_tree_model_get_iter(model, &iter, row->data)) {
+            gint file_id;
+            gtk_tree_model_get(model, &iter, 0, &file_id, -1);
+            (*ids)[count++] = file_id;
+        }
+    }
+
+    g_list_free_full(rows, (GDestroyNotify)gtk_tree_path_free);
+    return count;
+}
+
+void on_download_clicked(GtkWidget *widget, AppState *state) {
+    GtkTreeModel *model;
     GtkTreeIter iter;
 
-    if (!gtk_tree_selection_get_selected(selection, &model, &iter)) {
+    if (!get_first_selected(state, &model, &iter)) {
         show_error_dialog(state->window, "Please select a file to download");
         return;
     }
@@ -175,28 +220,39 @@ void on_mkdir_clicked(GtkWidget *widget, AppState *state) {
 void on_delete_clicked(GtkWidget *widget, AppState *state) {
     (void)widget;  // Suppress unused warning
 
-    GtkTreeSelection *selection = gtk_tree_view_get_selection(
-        GTK_TREE_VIEW(state->tree_view));
     GtkTreeModel *model;
     GtkTreeIter iter;
 
-    if (!gtk_tree_selection_get_selected(selection, &model, &iter)) {
+    if (!get_first_selected(state, &model, &iter)) {
         show_error_dialog(state->window, "Please select a file to delete");
         return;
     }
 
-    gint file_id;
+    int *file_ids;
+    int count = get_selected_ids(state, &file_ids);
+
     gchar *name;
-    gtk_tree_model_get(model, &iter, 0, &file_id, 2, &name, -1);
+    gtk_tree_model_get(model, &iter, 2, &name, -1);
 
     // Confirmation dialog
-    GtkWidget *dialog = gtk_message_dialog_new(
-        GTK_WINDOW(state->window),
-        GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
-        GTK_MESSAGE_QUESTION,
-        GTK_BUTTONS_YES_NO,
-        "Delete '%s'?", name
-    );
+    GtkWidget *dialog;
+    if (count == 1) {
+        dialog = gtk_message_dialog_new(
+            GTK_WINDOW(state->window),
+            GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+            GTK_MESSAGE_QUESTION,
+            GTK_BUTTONS_YES_NO,
+            "Delete '%s'?", name
+        );
+    } else {
+        dialog = gtk_message_dialog_new(
+            GTK_WINDOW(state->window),
+            GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT,
+            GTK_MESSAGE_QUESTION,
+            GTK_BUTTONS_YES_NO,
+            "Delete %d items?", count
+        );
+    }
     gtk_message_dialog_format_secondary_text(
         GTK_MESSAGE_DIALOG(dialog),
         "This action cannot be undone.");
@@ -205,33 +261,38 @@ void on_delete_clicked(GtkWidget *widget, AppState *state) {
     gtk_widget_destroy(dialog);
 
     if (response == GTK_RESPONSE_YES) {
-        if (client_delete(state->conn, file_id) == 0) {
-            show_info_dialog(state->window, "File deleted successfully!");
-            refresh_file_list(state);
+        // All selected items go to the server in one batch
+        int deleted = client_delete_many(state->conn, file_ids, count);
+        if (deleted == count) {
+            show_info_dialog(state->window, count == 1 ? "File deleted successfully!"
+                                                       : "Files deleted successfully!");
         } else {
-            show_error_dialog(state->window, "Failed to delete file");
+            show_error_dialog(state->window, count == 1 ? "Failed to delete file"
+                                                        : "Failed to delete some files");
+        }
+        if (deleted > 0) {
+            refresh_file_list(state);
         }
     }
 
     g_free(name);
+    g_free(file_ids);
 }
 
 void on_chmod_clicked(GtkWidget *widget, AppState *state) {
-    GtkTreeSelection *selection = gtk_tree_view_get_selection(
-        GTK_TREE_VIEW(state->tree_view));
     GtkTreeModel *model;
     GtkTreeIter iter;
 
-    if (!gtk_tree_selection_get_selected(selection, &model, &iter)) {
+    if (!get_first_selected(state, &model, &iter)) {
         show_error_dialog(state->window, "Please select a file");
         return;
     }
 
-    gint file_id;
     gchar *perms_str;
-    gtk_tree_model_get(model, &iter, 0, &file_id, 5, &perms_str, -1);
+    gtk_tree_model_get(model, &iter, 5, &perms_str, -1);
 
-    // Parse current permissions (e.g., "755")
+    // Parse current permissions (e.g., "755") of the first selected item;
+    // the new ones apply to all of them
     int current_perms = strtol(perms_str, NULL, 8);
     g_free(perms_str);
 
@@ -242,12 +303,18 @@ void on_chmod_clicked(GtkWidget *widget, AppState *state) {
         const char *new_perms_str = gtk_entry_get_text(GTK_ENTRY(entry));
         int new_perms = strtol(new_perms_str, NULL, 8);
 
-        if (client_chmod(state->conn, file_id, new_perms) == 0) {
+        int *file_ids;
+        int count = get_selected_ids(state, &file_ids);
+        int changed = client_chmod_many(state->conn, file_ids, count, new_perms);
+        if (changed == count) {
             show_info_dialog(state->window, "Permissions changed successfully!");
-            refresh_file_list(state);
         } else {
             show_error_dialog(state->window, "Failed to change permissions");
         }
+        if (changed > 0) {
+            refresh_file_list(state);
+        }
+        g_free(file_ids);
     }
 
     gtk_widget_destroy(chmod_dialog);
@@ -13,6 +13,8 @@ typedef struct {
     ClientConnection *conn;
     int current_directory;
     char current_path[512];
+    int listed_directory;       // Directory the file list shows, -1 before the first
+    int64_t listed_version;     // and its version then
 } AppState;
 
 // Login result structure
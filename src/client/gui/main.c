@@ -36,6 +36,7 @@ int main(int argc, char *argv[]) {
             AppState *state = g_new0(AppState, 1);
             state->conn = conn;
             state->current_directory = 0;
+            state->listed_directory = -1;
             strcpy(state->current_path, "/");
 
             state->window = create_main_window(state);
@@ -124,6 +124,9 @@ GtkWidget* create_main_window(AppState *state) {
     );
 
     state->tree_view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(state->file_store));
+    gtk_tree_selection_set_mode(
+        gtk_tree_view_get_selection(GTK_TREE_VIEW(state->tree_view)),
+        GTK_SELECTION_MULTIPLE);
     g_signal_connect(state->tree_view, "row-activated",
                     G_CALLBACK(on_row_activated), state);
 
@@ -5,18 +5,38 @@
 #include "net_handler.h"
 #include "../common/protocol.h"
 
+// Arguments a bulk command (mkdir, chmod, delete) takes on one line
+#define MAX_BATCH_ARGS 128
+
+// Largest range the read command prints
+#define MAX_READ_LENGTH (16 * 1024 * 1024)
+
+// Collect the remaining tokens of the command line
+static int read_args(char** args, int max) {
+    int count = 0;
+    char* token;
+    while (count < max && (token = strtok(NULL, " \t\n")) != NULL) {
+        args[count++] = token;
+    }
+    return count;
+}
+
 void print_help(void) {
     printf("\nCommands:\n");
     printf("  ls                    - List current directory\n");
     printf("  cd <id>               - Change to directory by ID\n");
-    printf("  mkdir <name>          - Create new directory\n");
-    printf("  upload <file>         - Upload local file\n");
+    printf("  mkdir <name>...       - Create new directories\n");
+    printf("  upload <file>         - Upload local file (resumes if interrupted)\n");
+    printf("  upload -p <n> <file>  - Upload over n parallel connections\n");
     printf("  uploadfolder <folder> - Upload folder recursively\n");
     printf("  download <id> <file>  - Download file to local path\n");
+    printf("  download -c <id> <file> - Continue an interrupted download\n");
+    printf("  download -p <n> <id> <file> - Download over n parallel connections\n");
     printf("  downloadfolder <id> <path> - Download folder recursively\n");
-    printf("  chmod <id> <perm>     - Change permissions (e.g., 755)\n");
-    printf("  delete <id>           - Delete file or directory\n");
+    printf("  chmod <id>... <perm>  - Change permissions (e.g., 755)\n");
+    printf("  delete <id>...        - Delete files or directories\n");
     printf("  info <id>             - Show detailed file information\n");
+    printf("  read <id> <off> <len> - Print part of a file\n");
     printf("  pwd                   - Print current directory\n");
     printf("  help                  - Show this help\n");
     printf("  quit                  - Exit\n");
@@ -71,7 +91,9 @@ int main(int argc, char** argv) {
     client_list_dir(conn, 0);
 
     // Command loop
-    char command[512];
+    char command[4096];
+    char* args[MAX_BATCH_ARGS];
+    int ids[MAX_BATCH_ARGS];
     char arg1[256], arg2[256];
 
     while (1) {
@@ -102,18 +124,29 @@ int main(int argc, char** argv) {
                 printf("Usage: cd <directory_id>\n");
             }
         } else if (strcmp(cmd, "mkdir") == 0) {
-            char* name = strtok(NULL, " \t\n");
-            if (name) {
-                client_mkdir(conn, name);
+            int count = read_args(args, MAX_BATCH_ARGS);
+            if (count == 1) {
+                client_mkdir(conn, args[0]);
+            } else if (count > 1) {
+                // Pipelined: one round trip instead of one per directory
+                client_mkdir_many(conn, (const char**)args, count);
             } else {
-                printf("Usage: mkdir <name>\n");
+                printf("Usage: mkdir <name>...\n");
             }
         } else if (strcmp(cmd, "upload") == 0) {
             char* path = strtok(NULL, " \t\n");
-            if (path) {
+            int connections = 0;
+            if (path && strcmp(path, "-p") == 0) {
+                char* count_str = strtok(NULL, " \t\n");
+                connections = count_str && atoi(count_str) > 0 ? atoi(count_str) : -1;
+                path = strtok(NULL, " \t\n");
+            }
+            if (path && connections > 0) {
+                client_upload_multipart(conn, username, password, path, connections, 0);
+            } else if (path && connections == 0) {
                 client_upload(conn, path);
             } else {
-                printf("Usage: upload <local_file_path>\n");
+                printf("Usage: upload [-p <connections>] <local_file_path>\n");
             }
         } else if (strcmp(cmd, "uploadfolder") == 0) {
             char* path = strtok(NULL, " \t\n");
@@ -124,11 +157,28 @@ int main(int argc, char** argv) {
             }
         } else if (strcmp(cmd, "download") == 0) {
             char* id_str = strtok(NULL, " \t\n");
+            int resume = id_str && strcmp(id_str, "-c") == 0;
+            int striped = id_str && strcmp(id_str, "-p") == 0;
+            int connections = 0;
+            if (resume) {
+                id_str = strtok(NULL, " \t\n");
+            } else if (striped) {
+                char* count_str = strtok(NULL, " \t\n");
+                connections = count_str ? atoi(count_str) : 0;
+                id_str = strtok(NULL, " \t\n");
+            }
             char* path = strtok(NULL, " \t\n");
-            if (id_str && path) {
-                client_download(conn, atoi(id_str), path);
+            if (id_str && path && (!striped || connections > 0)) {
+                if (resume) {
+                    client_download_resume(conn, atoi(id_str), path);
+                } else if (striped) {
+                    client_download_striped(conn, username, password, atoi(id_str), path,
+                                            connections, 0);
+                } else {
+                    client_download(conn, atoi(id_str), path);
+                }
             } else {
-                printf("Usage: download <file_id> <local_path>\n");
+                printf("Usage: download [-c | -p <connections>] <file_id> <local_path>\n");
             }
         } else if (strcmp(cmd, "downloadfolder") == 0) {
             char* id_str = strtok(NULL, " \t\n");
@@ -139,22 +189,53 @@ int main(int argc, char** argv) {
                 printf("Usage: downloadfolder <folder_id> <local_path>\n");
             }
         } else if (strcmp(cmd, "chmod") == 0) {
-            char* id_str = strtok(NULL, " \t\n");
-            char* perm_str = strtok(NULL, " \t\n");
-            if (id_str && perm_str) {
+            int count = read_args(args, MAX_BATCH_ARGS);
+            if (count >= 2) {
                 // Convert octal string to integer
-                int perm = (int)strtol(perm_str, NULL, 8);
-                client_chmod(conn, atoi(id_str), perm);
+                int perm = (int)strtol(args[count - 1], NULL, 8);
+                for (int i = 0; i < count - 1; i++) {
+                    ids[i] = atoi(args[i]);
+                }
+                if (count == 2) {
+                    client_chmod(conn, ids[0], perm);
+                } else {
+                    client_chmod_many(conn, ids, count - 1, perm);
+                }
             } else {
-                printf("Usage: chmod <file_id> <permissions>\n");
+                printf("Usage: chmod <file_id>... <permissions>\n");
                 printf("Example: chmod 5 755\n");
             }
         } else if (strcmp(cmd, "delete") == 0 || strcmp(cmd, "rm") == 0) {
+            int count = read_args(args, MAX_BATCH_ARGS);
+            for (int i = 0; i < count; i++) {
+                ids[i] = atoi(args[i]);
+            }
+            if (count == 1) {
+                client_delete(conn, ids[0]);
+            } else if (count > 1) {
+                client_delete_many(conn, ids, count);
+            } else {
+                printf("Usage: delete <file_id>...\n");
+            }
+        } else if (strcmp(cmd, "read") == 0) {
             char* id_str = strtok(NULL, " \t\n");
-            if (id_str) {
-                client_delete(conn, atoi(id_str));
+            char* offset_str = strtok(NULL, " \t\n");
+            char* length_str = strtok(NULL, " \t\n");
+            long long length = length_str ? atoll(length_str) : 0;
+            if (id_str && offset_str && length > 0 && length <= MAX_READ_LENGTH) {
+                uint8_t* buffer = malloc((size_t)length);
+                int64_t got = buffer ? client_read_range(conn, atoi(id_str),
+                                                         (uint64_t)atoll(offset_str),
+                                                         (uint64_t)length, buffer) : -1;
+                if (got >= 0) {
+                    fwrite(buffer, 1, (size_t)got, stdout);
+                    printf("\n(%lld bytes)\n", (long long)got);
+                } else {
+                    printf("Error: Unable to read file\n");
+                }
+                free(buffer);
             } else {
-                printf("Usage: delete <file_id>\n");
+                printf("Usage: read <file_id> <offset> <length>\n");
             }
         } else if (strcmp(cmd, "info") == 0) {
             char* id_str = strtok(NULL, " \t\n");
@@ -172,6 +253,7 @@ int main(int argc, char** argv) {
     }
 
     printf("\nDisconnecting...\n");
+    memset(password, 0, sizeof(password));
     client_disconnect(conn);
     printf("Goodbye!\n");
 
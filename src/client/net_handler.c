@@ -1,5 +1,6 @@
 #include "net_handler.h"
 #include "../common/utils.h"
+#include "../common/compress.h"
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -8,6 +9,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
 
 int net_connect(const char* host, uint16_t port) {
     struct addrinfo hints, *result, *rp;
@@ -66,41 +68,116 @@ Packet* net_recv_packet(int sockfd) {
     return pkt;
 }
 
-int net_send_file(int sockfd, const char* file_path) {
+int net_send_file(int sockfd, const char* file_path, size_t chunk_size, uint64_t offset,
+                  int compression) {
     FILE* fp = fopen(file_path, "rb");
     if (!fp) return -1;
 
-    char buffer[8192];
+    // Only chunks carry offsets; a single UPLOAD_DATA is the whole file
+    if (chunk_size == 0) {
+        offset = 0;
+    }
+    if (offset > 0 && fseeko(fp, (off_t)offset, SEEK_SET) != 0) {
+        fclose(fp);
+        return -1;
+    }
+
+    // Server without chunked uploads: the whole file in one UPLOAD_DATA
+    int chunked = chunk_size > 0;
+    if (!chunked) {
+        chunk_size = MAX_PAYLOAD_SIZE;
+    } else if (chunk_size > CHUNK_MAX_SIZE) {
+        chunk_size = CHUNK_MAX_SIZE;
+    }
+
+    // Each chunk is its 8-byte offset followed by the data
+    size_t prefix = chunked ? CHUNK_OFFSET_SIZE : 0;
+    char* buffer = malloc(prefix + chunk_size);
+    if (!buffer) {
+        fclose(fp);
+        return -1;
+    }
+
     size_t bytes_read;
     int result = 0;
 
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
-        Packet* pkt = packet_create(CMD_UPLOAD_DATA, buffer, bytes_read);
-        if (!pkt) {
+    while ((bytes_read = fread(buffer + prefix, 1, chunk_size, fp)) > 0) {
+        Packet pkt = {0};
+        pkt.command = chunked ? CMD_UPLOAD_CHUNK : CMD_UPLOAD_DATA;
+        pkt.data_length = (uint32_t)(prefix + bytes_read);
+        pkt.payload = buffer;
+        if (chunked) {
+            packet_put_u64((uint8_t*)buffer, offset);
+        }
+
+        // Already compressed content (a sample tells) is not worth the CPU
+        int rc = (chunked && compression != COMPRESSION_NONE &&
+                  compress_worthwhile((const uint8_t*)buffer + prefix, bytes_read))
+                 ? packet_send_compressed(sockfd, &pkt, compression, COMPRESS_LEVEL_DATA)
+                 : packet_send(sockfd, &pkt);
+        if (rc < 0) {
             result = -1;
             break;
         }
+        offset += bytes_read;
 
-        if (packet_send(sockfd, pkt) < 0) {
-            packet_free(pkt);
-            result = -1;
+        if (!chunked) {
+            // Larger files need the chunked protocol
+            if (fgetc(fp) != EOF) {
+                result = -1;
+            }
             break;
         }
+    }
+
+    if (result == 0 && ferror(fp)) {
+        result = -1;
+    }
 
-        packet_free(pkt);
+    // An empty file still needs its single (empty) UPLOAD_DATA
+    if (result == 0 && !chunked && offset == 0) {
+        Packet pkt = {0};
+        pkt.command = CMD_UPLOAD_DATA;
+        result = packet_send(sockfd, &pkt) < 0 ? -1 : 0;
+    }
+
+    if (result == 0 && chunked) {
+        Packet pkt = {0};
+        pkt.command = CMD_UPLOAD_COMMIT;
+        result = packet_send(sockfd, &pkt) < 0 ? -1 : 0;
     }
 
+    free(buffer);
     fclose(fp);
     return result;
 }
 
-int net_recv_file(int sockfd, const char* file_path, size_t file_size) {
-    FILE* fp = fopen(file_path, "wb");
+int net_send_part(int sockfd, int file_fd, uint32_t upload_id, uint32_t part,
+                  uint64_t offset, size_t length) {
+    uint8_t header[PART_HEADER_SIZE];
+    packet_put_u32(header, upload_id);
+    packet_put_u32(header + 4, part);
+
+    Packet frame = {0};
+    frame.command = CMD_UPLOAD_PART;
+    frame.data_length = PART_HEADER_SIZE;
+    frame.payload = (char*)header;
+    return packet_send_file(sockfd, &frame, file_fd, offset, length, NULL, NULL) == 0 ? 0 : -1;
+}
+
+int net_recv_file(int sockfd, const char* file_path, uint64_t file_size, uint64_t offset) {
+    // Resuming keeps the bytes before offset
+    FILE* fp = fopen(file_path, offset > 0 ? "r+b" : "wb");
     if (!fp) return -1;
+    if (offset > 0 && fseeko(fp, (off_t)offset, SEEK_SET) != 0) {
+        fclose(fp);
+        return -1;
+    }
 
-    size_t total_received = 0;
+    uint64_t total_received = offset;
     int result = 0;
 
+    // DOWNLOAD_CHUNK frames arrive in order; each is written as it comes
     while (total_received < file_size) {
         Packet pkt = {0};
         if (packet_recv(sockfd, &pkt) < 0) {
@@ -108,18 +185,87 @@ int net_recv_file(int sockfd, const char* file_path, size_t file_size) {
             break;
         }
 
-        if (pkt.command != CMD_DOWNLOAD_RES && pkt.data_length > 0) {
-            fwrite(pkt.payload, 1, pkt.data_length, fp);
-            total_received += pkt.data_length;
+        if (pkt.command != CMD_DOWNLOAD_CHUNK || pkt.data_length <= CHUNK_OFFSET_SIZE ||
+            packet_get_u64((const uint8_t*)pkt.payload) != total_received) {
+            if (pkt.command == CMD_ERROR && pkt.payload) {
+                printf("Error: %s\n", pkt.payload);
+            }
+            free(pkt.payload);
+            result = -1;
+            break;
         }
 
-        if (pkt.payload) free(pkt.payload);
-
-        if (pkt.command == CMD_SUCCESS || pkt.command == CMD_ERROR) {
+        size_t length = pkt.data_length - CHUNK_OFFSET_SIZE;
+        if (total_received + length > file_size ||
+            fwrite(pkt.payload + CHUNK_OFFSET_SIZE, 1, length, fp) != length) {
+            free(pkt.payload);
+            result = -1;
             break;
         }
+        total_received += length;
+        free(pkt.payload);
     }
 
-    fclose(fp);
+    if (fclose(fp) != 0) {
+        result = -1;
+    }
     return result;
 }
+
+// Write all of data at offset; pwrite() may return short
+static int pwrite_all(int fd, const char* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t n = pwrite(fd, data, size, (off_t)offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        size -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return 0;
+}
+
+// Receive a range into buffer, or into file_fd when buffer is NULL
+static int recv_range(int sockfd, uint64_t offset, uint64_t length, uint8_t* buffer, int file_fd) {
+    uint64_t received = 0;
+
+    while (received < length) {
+        Packet pkt = {0};
+        if (packet_recv(sockfd, &pkt) < 0) {
+            return -1;
+        }
+
+        // Chunks arrive in order and cover the range exactly
+        size_t chunk = pkt.data_length > CHUNK_OFFSET_SIZE ? pkt.data_length - CHUNK_OFFSET_SIZE : 0;
+        if (pkt.command != CMD_DOWNLOAD_CHUNK || chunk == 0 ||
+            packet_get_u64((const uint8_t*)pkt.payload) != offset + received ||
+            received + chunk > length) {
+            free(pkt.payload);
+            return -1;
+        }
+
+        const char* data = pkt.payload + CHUNK_OFFSET_SIZE;
+        if (buffer) {
+            memcpy(buffer + received, data, chunk);
+        } else if (pwrite_all(file_fd, data, chunk, offset + received) < 0) {
+            free(pkt.payload);
+            return -1;
+        }
+        received += chunk;
+        free(pkt.payload);
+    }
+
+    return 0;
+}
+
+int net_recv_range(int sockfd, uint64_t offset, uint64_t length, uint8_t* buffer) {
+    return buffer ? recv_range(sockfd, offset, length, buffer, -1) : -1;
+}
+
+int net_recv_range_fd(int sockfd, uint64_t offset, uint64_t length, int file_fd) {
+    return file_fd >= 0 ? recv_range(sockfd, offset, length, NULL, file_fd) : -1;
+}
@@ -13,7 +13,24 @@ int net_send_packet(int sockfd, Packet* pkt);
 Packet* net_recv_packet(int sockfd);
 
 // File transfer helpers
-int net_send_file(int sockfd, const char* file_path);
-int net_recv_file(int sockfd, const char* file_path, size_t file_size);
+// Sends UPLOAD_CHUNK frames of up to chunk_size bytes from offset on and
+// UPLOAD_COMMIT, or a single UPLOAD_DATA when chunk_size is 0 (servers
+// without chunking). With compression (compress.h) negotiated, chunks
+// that look compressible are sent compressed
+int net_send_file(int sockfd, const char* file_path, size_t chunk_size, uint64_t offset,
+                  int compression);
+// Sends bytes [offset, offset + length) of file_fd as part number part of
+// multipart upload upload_id (UPLOAD_PART, data sent with sendfile)
+int net_send_part(int sockfd, int file_fd, uint32_t upload_id, uint32_t part,
+                  uint64_t offset, size_t length);
+// Receives the DOWNLOAD_CHUNK frames of a chunked download (starting at
+// offset) into file_path
+int net_recv_file(int sockfd, const char* file_path, uint64_t file_size, uint64_t offset);
+
+// Receives the DOWNLOAD_CHUNK frames of a range read of length bytes at
+// offset into buffer
+int net_recv_range(int sockfd, uint64_t offset, uint64_t length, uint8_t* buffer);
+// Same, written with pwrite() at their offsets into file_fd
+int net_recv_range_fd(int sockfd, uint64_t offset, uint64_t length, int file_fd);
 
 #endif // NET_HANDLER_H
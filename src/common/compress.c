@@ -0,0 +1,199 @@
+#include "compress.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// Bits of entropy per byte above which a sample counts as incompressible
+#define COMPRESS_ENTROPY_LIMIT 7.5
+
+// First bytes of every zstd frame (0xFD2FB528, little-endian). A zlib
+// stream starts with a CMF byte whose low nibble is 8, so never 0x28
+static const uint8_t zstd_magic[4] = { 0x28, 0xB5, 0x2F, 0xFD };
+
+const char* compression_name(Compression method) {
+    switch (method) {
+        case COMPRESSION_ZLIB:
+            return "zlib";
+        case COMPRESSION_ZSTD:
+            return "zstd";
+        default:
+            return NULL;
+    }
+}
+
+Compression compression_from_name(const char* name) {
+    if (!name) {
+        return COMPRESSION_NONE;
+    }
+    if (strcmp(name, "zlib") == 0) {
+        return COMPRESSION_ZLIB;
+    }
+    if (strcmp(name, "zstd") == 0 && compression_available(COMPRESSION_ZSTD)) {
+        return COMPRESSION_ZSTD;
+    }
+    return COMPRESSION_NONE;
+}
+
+int compression_available(Compression method) {
+    switch (method) {
+        case COMPRESSION_ZLIB:
+            return 1;
+        case COMPRESSION_ZSTD:
+#ifdef HAVE_ZSTD
+            return 1;
+#else
+            return 0;
+#endif
+        default:
+            return 0;
+    }
+}
+
+int compress_worthwhile(const uint8_t* data, size_t len) {
+    if (!data || len < COMPRESS_MIN_SIZE) {
+        return 0;
+    }
+    if (len > COMPRESS_SAMPLE_SIZE) {
+        len = COMPRESS_SAMPLE_SIZE;
+    }
+
+    unsigned counts[256] = {0};
+    for (size_t i = 0; i < len; i++) {
+        counts[data[i]]++;
+    }
+
+    // Shannon entropy of the byte histogram
+    double entropy = 0.0;
+    for (int i = 0; i < 256; i++) {
+        if (counts[i]) {
+            double p = (double)counts[i] / (double)len;
+            entropy -= p * log2(p);
+        }
+    }
+    return entropy < COMPRESS_ENTROPY_LIMIT;
+}
+
+static void put_u32(uint8_t* buf, uint32_t value) {
+    buf[0] = (uint8_t)(value >> 24);
+    buf[1] = (uint8_t)(value >> 16);
+    buf[2] = (uint8_t)(value >> 8);
+    buf[3] = (uint8_t)value;
+}
+
+static uint32_t get_u32(const uint8_t* buf) {
+    return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) |
+           ((uint32_t)buf[2] << 8) | (uint32_t)buf[3];
+}
+
+// Compress into dst (capacity *dst_len, updated). Returns 0, or -1 when
+// the result does not fit
+static int zlib_pack(uint8_t* dst, size_t* dst_len, const uint8_t* src, size_t len,
+                     int level) {
+    uLongf packed = (uLongf)*dst_len;
+    if (compress2(dst, &packed, src, (uLong)len, level) != Z_OK) {
+        return -1;
+    }
+    *dst_len = packed;
+    return 0;
+}
+
+static int zlib_unpack(uint8_t* dst, size_t dst_len, const uint8_t* src, size_t len) {
+    uLongf unpacked = (uLongf)dst_len;
+    return uncompress(dst, &unpacked, src, (uLong)len) == Z_OK && unpacked == dst_len ? 0 : -1;
+}
+
+#ifdef HAVE_ZSTD
+static int zstd_pack(uint8_t* dst, size_t* dst_len, const uint8_t* src, size_t len,
+                     int level) {
+    size_t packed = ZSTD_compress(dst, *dst_len, src, len, level);
+    if (ZSTD_isError(packed)) {
+        return -1;
+    }
+    *dst_len = packed;
+    return 0;
+}
+
+static int zstd_unpack(uint8_t* dst, size_t dst_len, const uint8_t* src, size_t len) {
+    size_t unpacked = ZSTD_decompress(dst, dst_len, src, len);
+    return !ZSTD_isError(unpacked) && unpacked == dst_len ? 0 : -1;
+}
+#endif
+
+int compress_payload(Compression method, const uint8_t* data, size_t len, int level,
+                     uint8_t** out, size_t* out_len) {
+    if (!compression_available(method) || !data || !out || !out_len || len == 0 ||
+        len > UINT32_MAX) {
+        return -1;
+    }
+
+    // Anything that does not end up smaller is sent as it is, so the
+    // output never needs more room than the input
+    uint8_t* buffer = malloc(COMPRESS_HEADER_SIZE + len);
+    if (!buffer) {
+        return -1;
+    }
+
+    size_t packed = len;
+    int rc;
+#ifdef HAVE_ZSTD
+    if (method == COMPRESSION_ZSTD) {
+        rc = zstd_pack(buffer + COMPRESS_HEADER_SIZE, &packed, data, len, level);
+    } else
+#endif
+    {
+        rc = zlib_pack(buffer + COMPRESS_HEADER_SIZE, &packed, data, len, level);
+    }
+    if (rc < 0 || COMPRESS_HEADER_SIZE + packed >= len) {
+        free(buffer);
+        return -1;
+    }
+
+    put_u32(buffer, (uint32_t)len);
+    *out = buffer;
+    *out_len = COMPRESS_HEADER_SIZE + packed;
+    return 0;
+}
+
+int decompress_payload(const uint8_t* data, size_t len, size_t max_len,
+                       uint8_t** out, size_t* out_len) {
+    if (!data || !out || !out_len || len <= COMPRESS_HEADER_SIZE) {
+        return -1;
+    }
+
+    uint32_t original = get_u32(data);
+    if (original == 0 || original > max_len) {
+        return -1;
+    }
+
+    uint8_t* buffer = malloc((size_t)original + 1);
+    if (!buffer) {
+        return -1;
+    }
+
+    const uint8_t* stream = data + COMPRESS_HEADER_SIZE;
+    size_t stream_len = len - COMPRESS_HEADER_SIZE;
+    int rc;
+    if (stream_len >= sizeof(zstd_magic) &&
+        memcmp(stream, zstd_magic, sizeof(zstd_magic)) == 0) {
+#ifdef HAVE_ZSTD
+        rc = zstd_unpack(buffer, original, stream, stream_len);
+#else
+        rc = -1;
+#endif
+    } else {
+        rc = zlib_unpack(buffer, original, stream, stream_len);
+    }
+    if (rc < 0) {
+        free(buffer);
+        return -1;
+    }
+
+    buffer[original] = '\0';
+    *out = buffer;
+    *out_len = original;
+    return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// On-the-wire compression of frame payloads (see MAGIC_BYTE_2_COMPRESSED).
+// A compressed payload is the original length (4 bytes, big-endian)
+// followed by a zlib or zstd stream; the stream's own header tells which.
+// Peers agree on the method at login; a frame is only sent compressed
+// when that makes it smaller.
+//
+// zstd is optional: the Makefiles build it in (HAVE_ZSTD) when zstd.h is
+// found, otherwise it is never offered or accepted.
+
+typedef enum {
+    COMPRESSION_NONE = 0,
+    COMPRESSION_ZLIB = 1,
+    COMPRESSION_ZSTD = 2
+} Compression;
+
+#define COMPRESS_HEADER_SIZE 4
+
+// Payloads smaller than this are not worth compressing
+#define COMPRESS_MIN_SIZE 512
+
+// Bytes examined by compress_worthwhile()
+#define COMPRESS_SAMPLE_SIZE 4096
+
+// Levels for either method: file data favours speed, JSON responses are
+// small
+#define COMPRESS_LEVEL_DATA 1
+#define COMPRESS_LEVEL_JSON 6
+
+// Name used in negotiation ("zlib", "zstd"), or NULL for COMPRESSION_NONE
+const char* compression_name(Compression method);
+
+// Method named name, or COMPRESSION_NONE if unsupported or not built in
+Compression compression_from_name(const char* name);
+
+// Nonzero if method is built in (COMPRESSION_NONE never is)
+int compression_available(Compression method);
+
+// Estimate from up to COMPRESS_SAMPLE_SIZE bytes of data whether it is
+// worth compressing: already compressed content (.zip, .jpg, ...) has
+// close to 8 bits of entropy per byte and is skipped
+int compress_worthwhile(const uint8_t* data, size_t len);
+
+// Compress len bytes with method into a new buffer (*out, *out_len;
+// free() it). Returns 0, or -1 on error, for a method that is not built
+// in, or when the result would not be smaller
+int compress_payload(Compression method, const uint8_t* data, size_t len, int level,
+                     uint8_t** out, size_t* out_len);
+
+// Undo compress_payload(), whichever method made it. The original may be
+// at most max_len bytes; *out gets one extra NUL byte past *out_len.
+// Returns 0 or -1
+int decompress_payload(const uint8_t* data, size_t len, size_t max_len,
+                       uint8_t** out, size_t* out_len);
+
+#endif // COMPRESS_H
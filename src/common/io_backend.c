@@ -0,0 +1,865 @@
+#define _GNU_SOURCE
+
+#include "io_backend.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/sendfile.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#ifndef MSG_MORE
+#define MSG_MORE 0
+#endif
+
+// Bounce buffer of the copy fallbacks of io_sendfile_all()/io_splice_to_file()
+#define SENDFILE_BOUNCE_SIZE (64 * 1024)
+
+// Capacity requested for each thread's splice pipe (the kernel may refuse
+// and keep its default of 64 KB)
+#define SPLICE_PIPE_SIZE (1024 * 1024)
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+// Longest iovec list accepted by io_send_iov()
+#define IO_MAX_IOV 8
+
+// How long blocking helpers wait on a non-blocking socket (matches SO_*TIMEO)
+#define IO_POLL_TIMEOUT_MS (300 * 1000)
+
+static IoBackend current_backend = IO_BACKEND_POSIX;
+
+const char* io_backend_name(IoBackend backend) {
+    return backend == IO_BACKEND_URING ? "io_uring" : "posix";
+}
+
+IoBackend io_backend_current(void) {
+    return current_backend;
+}
+
+// Drop n sent bytes from the front of an iovec list
+static void iov_advance(struct iovec** iov, int* iovcnt, size_t n) {
+    while (*iovcnt > 0 && n >= (*iov)->iov_len) {
+        n -= (*iov)->iov_len;
+        (*iov)++;
+        (*iovcnt)--;
+    }
+    if (*iovcnt > 0 && n > 0) {
+        (*iov)->iov_base = (uint8_t*)(*iov)->iov_base + n;
+        (*iov)->iov_len -= n;
+    }
+}
+
+static int wait_socket(int fd, short events) {
+    struct pollfd pfd = { .fd = fd, .events = events, .revents = 0 };
+    return poll(&pfd, 1, IO_POLL_TIMEOUT_MS) > 0 ? 0 : -1;
+}
+
+// ---------------------------------------------------------------------------
+// POSIX backend
+// ---------------------------------------------------------------------------
+
+static int posix_send_iov_flags(int fd, struct iovec* iov, int iovcnt, int flags) {
+    while (iovcnt > 0) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL | flags);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && wait_socket(fd, POLLOUT) == 0) {
+                continue;
+            }
+            return -1;
+        }
+        iov_advance(&iov, &iovcnt, (size_t)n);
+    }
+    return 0;
+}
+
+static int posix_send_iov(int fd, struct iovec* iov, int iovcnt) {
+    return posix_send_iov_flags(fd, iov, iovcnt, 0);
+}
+
+static ssize_t posix_recv_all(int fd, void* buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = recv(fd, (uint8_t*)buf + got, len - got, MSG_WAITALL);
+        if (n == 0) {
+            return got == 0 ? 0 : -1;
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && wait_socket(fd, POLLIN) == 0) {
+                continue;
+            }
+            return -1;
+        }
+        got += (size_t)n;
+    }
+    return (ssize_t)len;
+}
+
+static int posix_pwrite_all(int fd, const uint8_t* buf, size_t len, off_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pwrite(fd, buf + done, len - done, offset + (off_t)done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+static int posix_pread_all(int fd, uint8_t* buf, size_t len, off_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, buf + done, len - done, offset + (off_t)done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            return -1;  // File shorter than expected
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// io_uring backend (raw syscalls, one ring per thread)
+// ---------------------------------------------------------------------------
+
+#ifdef HAVE_IO_URING
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+typedef struct {
+    int fd;
+    unsigned sq_entries;
+    unsigned sq_tail_local;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ptr;
+    size_t sq_size;
+    void* cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+} Ring;
+
+static __thread Ring* thread_ring = NULL;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static void ring_destroy(Ring* r) {
+    if (!r) {
+        return;
+    }
+    if (r->sqes) {
+        munmap(r->sqes, r->sqes_size);
+    }
+    if (r->cq_ptr && r->cq_ptr != r->sq_ptr) {
+        munmap(r->cq_ptr, r->cq_size);
+    }
+    if (r->sq_ptr) {
+        munmap(r->sq_ptr, r->sq_size);
+    }
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+    free(r);
+}
+
+static void ring_key_destructor(void* arg) {
+    ring_destroy((Ring*)arg);
+}
+
+static void ring_key_create(void) {
+    pthread_key_create(&ring_key, ring_key_destructor);
+}
+
+static Ring* ring_create(void) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = (int)syscall(__NR_io_uring_setup, IO_URING_ENTRIES, &params);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    Ring* r = calloc(1, sizeof(Ring));
+    if (!r) {
+        close(fd);
+        return NULL;
+    }
+    r->fd = fd;
+    r->sq_entries = params.sq_entries;
+
+    r->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_size > r->sq_size) {
+            r->sq_size = r->cq_size;
+        }
+        r->cq_size = r->sq_size;
+    }
+
+    r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) {
+        r->sq_ptr = NULL;
+        ring_destroy(r);
+        return NULL;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED) {
+            r->cq_ptr = NULL;
+            ring_destroy(r);
+            return NULL;
+        }
+    }
+
+    r->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        ring_destroy(r);
+        return NULL;
+    }
+
+    uint8_t* sq = r->sq_ptr;
+    uint8_t* cq = r->cq_ptr;
+    r->sq_head = (unsigned*)(sq + params.sq_off.head);
+    r->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    r->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(sq + params.sq_off.array);
+    r->cq_head = (unsigned*)(cq + params.cq_off.head);
+    r->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    r->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    r->sq_tail_local = *r->sq_tail;
+
+    return r;
+}
+
+// Lazily create the calling thread's ring (NULL if io_uring is unusable)
+static Ring* ring_get(void) {
+    if (thread_ring) {
+        return thread_ring;
+    }
+
+    pthread_once(&ring_key_once, ring_key_create);
+
+    thread_ring = ring_create();
+    if (thread_ring) {
+        pthread_setspecific(ring_key, thread_ring);
+    }
+    return thread_ring;
+}
+
+// Drop the calling thread's ring after an unrecoverable error
+static void ring_discard(void) {
+    if (thread_ring) {
+        pthread_setspecific(ring_key, NULL);
+        ring_destroy(thread_ring);
+        thread_ring = NULL;
+    }
+}
+
+// Reserve a zeroed SQE; it becomes visible to the kernel in ring_complete()
+static struct io_uring_sqe* ring_sqe(Ring* r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sq_tail_local - head >= r->sq_entries) {
+        return NULL;
+    }
+
+    unsigned idx = r->sq_tail_local & *r->sq_mask;
+    struct io_uring_sqe* sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    r->sq_tail_local++;
+    return sqe;
+}
+
+// Submit every reserved SQE with a single io_uring_enter() and wait for
+// count completions; res[user_data] receives each result
+static int ring_complete(Ring* r, unsigned count, int* res) {
+    __atomic_store_n(r->sq_tail, r->sq_tail_local, __ATOMIC_RELEASE);
+
+    unsigned done = 0;
+    while (done < count) {
+        unsigned pending = r->sq_tail_local - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        int ret = (int)syscall(__NR_io_uring_enter, r->fd, pending, count - done,
+                               IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0 && errno != EINTR) {
+            return -1;
+        }
+
+        unsigned head = *r->cq_head;
+        unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe* cqe = &r->cqes[head & *r->cq_mask];
+            if (cqe->user_data < count) {
+                res[cqe->user_data] = cqe->res;
+            }
+            head++;
+            done++;
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return 0;
+}
+
+// Wait for a non-blocking socket to become ready through the ring: a
+// POLL_ADD bounded by a linked timeout, both submitted with one enter, as
+// wait_socket() does with poll() for the posix backend
+static int uring_wait_socket(Ring* r, int fd, short events) {
+    struct io_uring_sqe* poll_sqe = ring_sqe(r);
+    struct io_uring_sqe* timeout_sqe = poll_sqe ? ring_sqe(r) : NULL;
+    if (!timeout_sqe) {
+        ring_discard();     // A half-reserved pair cannot be taken back
+        return -1;
+    }
+
+    poll_sqe->opcode = IORING_OP_POLL_ADD;
+    poll_sqe->fd = fd;
+    poll_sqe->poll32_events = (uint32_t)events;
+    poll_sqe->flags = IOSQE_IO_LINK;
+    poll_sqe->user_data = 0;
+
+    struct __kernel_timespec ts = { .tv_sec = IO_POLL_TIMEOUT_MS / 1000,
+                                    .tv_nsec = (IO_POLL_TIMEOUT_MS % 1000) * 1000000LL };
+    timeout_sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    timeout_sqe->fd = -1;
+    timeout_sqe->addr = (uintptr_t)&ts;
+    timeout_sqe->len = 1;
+    timeout_sqe->user_data = 1;
+
+    // res[0] is the ready mask, or -ECANCELED once the timeout fired
+    int res[2] = { 0, 0 };
+    if (ring_complete(r, 2, res) < 0) {
+        ring_discard();
+        return -1;
+    }
+    if (res[0] == -EINVAL) {
+        return wait_socket(fd, events);     // Kernel without ring polling
+    }
+    return res[0] > 0 ? 0 : -1;
+}
+
+static int uring_send_iov(Ring* r, int fd, struct iovec* iov, int iovcnt) {
+    while (iovcnt > 0) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovcnt;
+
+        struct io_uring_sqe* sqe = ring_sqe(r);
+        if (!sqe) {
+            return -1;
+        }
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = fd;
+        sqe->addr = (uintptr_t)&msg;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        sqe->user_data = 0;
+
+        int res = 0;
+        if (ring_complete(r, 1, &res) < 0) {
+            ring_discard();
+            return -1;
+        }
+        if (res < 0) {
+            if (res == -EINTR) {
+                continue;
+            }
+            // Non-blocking socket with a full send buffer: wait, never spin
+            if (res == -EAGAIN && uring_wait_socket(r, fd, POLLOUT) == 0) {
+                continue;
+            }
+            errno = -res;
+            return -1;
+        }
+        iov_advance(&iov, &iovcnt, (size_t)res);
+    }
+    return 0;
+}
+
+static ssize_t uring_recv_all(Ring* r, int fd, uint8_t* buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        struct io_uring_sqe* sqe = ring_sqe(r);
+        if (!sqe) {
+            return -1;
+        }
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = fd;
+        sqe->addr = (uintptr_t)(buf + got);
+        sqe->len = (unsigned)(len - got);
+        sqe->msg_flags = MSG_WAITALL;
+        sqe->user_data = 0;
+
+        int res = 0;
+        if (ring_complete(r, 1, &res) < 0) {
+            ring_discard();
+            return -1;
+        }
+        if (res == 0) {
+            return got == 0 ? 0 : -1;
+        }
+        if (res < 0) {
+            if (res == -EINTR) {
+                continue;
+            }
+            if (res == -EAGAIN && uring_wait_socket(r, fd, POLLIN) == 0) {
+                continue;
+            }
+            errno = -res;
+            return -1;
+        }
+        got += (size_t)res;
+    }
+    return (ssize_t)len;
+}
+
+// Split [buf, buf+len) into chunks and submit up to a ring's worth at once
+static int uring_rw_all(Ring* r, int opcode, int fd, uint8_t* buf, size_t len, off_t offset) {
+    size_t pos = 0;
+
+    while (pos < len) {
+        int res[IO_URING_ENTRIES];
+        size_t sizes[IO_URING_ENTRIES];
+        size_t batch_start = pos;
+        unsigned n = 0;
+
+        while (n < IO_URING_ENTRIES && pos < len) {
+            struct io_uring_sqe* sqe = ring_sqe(r);
+            if (!sqe) {
+                break;
+            }
+            size_t chunk = len - pos;
+            if (chunk > IO_URING_CHUNK_SIZE) {
+                chunk = IO_URING_CHUNK_SIZE;
+            }
+            sqe->opcode = opcode;
+            sqe->fd = fd;
+            sqe->addr = (uintptr_t)(buf + pos);
+            sqe->len = (unsigned)chunk;
+            sqe->off = (uint64_t)(offset + (off_t)pos);
+            sqe->user_data = n;
+            sizes[n] = chunk;
+            pos += chunk;
+            n++;
+        }
+
+        if (n == 0 || ring_complete(r, n, res) < 0) {
+            ring_discard();
+            return -1;
+        }
+
+        // Finish any short chunk synchronously
+        size_t chunk_pos = batch_start;
+        for (unsigned i = 0; i < n; i++) {
+            if (res[i] < 0) {
+                errno = -res[i];
+                return -1;
+            }
+            size_t got = (size_t)res[i];
+            if (got < sizes[i]) {
+                int rc = (opcode == IORING_OP_WRITE)
+                    ? posix_pwrite_all(fd, buf + chunk_pos + got, sizes[i] - got,
+                                       offset + (off_t)(chunk_pos + got))
+                    : posix_pread_all(fd, buf + chunk_pos + got, sizes[i] - got,
+                                      offset + (off_t)(chunk_pos + got));
+                if (rc < 0) {
+                    return -1;
+                }
+            }
+            chunk_pos += sizes[i];
+        }
+    }
+
+    return 0;
+}
+
+#endif // HAVE_IO_URING
+
+// ---------------------------------------------------------------------------
+// Public API
+// ---------------------------------------------------------------------------
+
+IoBackend io_backend_select(IoBackend requested) {
+    current_backend = IO_BACKEND_POSIX;
+
+    if (requested == IO_BACKEND_URING) {
+#ifdef HAVE_IO_URING
+        if (ring_get()) {
+            current_backend = IO_BACKEND_URING;
+        } else {
+            log_error("io_uring unavailable (%s), falling back to posix I/O", strerror(errno));
+        }
+#else
+        log_error("io_uring not supported on this platform, falling back to posix I/O");
+#endif
+    }
+
+    log_info("I/O backend: %s", io_backend_name(current_backend));
+    return current_backend;
+}
+
+int io_send_iov(int fd, const struct iovec* iov, int iovcnt) {
+    if (!iov || iovcnt <= 0 || iovcnt > IO_MAX_IOV) {
+        return -1;
+    }
+
+    // Work on a copy: partial sends trim the list in place
+    struct iovec local[IO_MAX_IOV];
+    memcpy(local, iov, sizeof(struct iovec) * iovcnt);
+
+#ifdef HAVE_IO_URING
+    if (current_backend == IO_BACKEND_URING) {
+        Ring* r = ring_get();
+        if (r) {
+            return uring_send_iov(r, fd, local, iovcnt);
+        }
+    }
+#endif
+
+    return posix_send_iov(fd, local, iovcnt);
+}
+
+ssize_t io_recv_all(int fd, void* buf, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+
+#ifdef HAVE_IO_URING
+    if (current_backend == IO_BACKEND_URING) {
+        Ring* r = ring_get();
+        if (r) {
+            return uring_recv_all(r, fd, buf, len);
+        }
+    }
+#endif
+
+    return posix_recv_all(fd, buf, len);
+}
+
+int io_pwrite_all(int fd, const void* buf, size_t len, off_t offset) {
+#ifdef HAVE_IO_URING
+    if (current_backend == IO_BACKEND_URING) {
+        Ring* r = ring_get();
+        if (r) {
+            return uring_rw_all(r, IORING_OP_WRITE, fd, (uint8_t*)buf, len, offset);
+        }
+    }
+#endif
+
+    return posix_pwrite_all(fd, buf, len, offset);
+}
+
+int io_pread_all(int fd, void* buf, size_t len, off_t offset) {
+#ifdef HAVE_IO_URING
+    if (current_backend == IO_BACKEND_URING) {
+        Ring* r = ring_get();
+        if (r) {
+            return uring_rw_all(r, IORING_OP_READ, fd, buf, len, offset);
+        }
+    }
+#endif
+
+    return posix_pread_all(fd, buf, len, offset);
+}
+
+int io_sendfile_all(int sock_fd, const struct iovec* head, int headcnt,
+                    int file_fd, off_t offset, size_t len,
+                    io_progress_fn progress, void* arg) {
+    if (headcnt < 0 || headcnt > IO_MAX_IOV || (headcnt > 0 && !head)) {
+        return -1;
+    }
+
+    // MSG_MORE keeps the small head queued so it leaves in the same
+    // segment as the first file bytes
+    if (headcnt > 0) {
+        struct iovec local[IO_MAX_IOV];
+        memcpy(local, head, sizeof(struct iovec) * headcnt);
+        if (posix_send_iov_flags(sock_fd, local, headcnt, len > 0 ? MSG_MORE : 0) < 0) {
+            return -1;
+        }
+    }
+
+#ifdef __linux__
+    // The kernel copies page cache pages to the socket; no user buffer.
+    // With a progress callback a blocking socket returns every step
+    while (len > 0) {
+        size_t want = (progress && len > IO_PROGRESS_STEP) ? IO_PROGRESS_STEP : len;
+        ssize_t n = sendfile(sock_fd, file_fd, &offset, want);
+        if (n > 0) {
+            len -= (size_t)n;
+            if (progress) {
+                progress(arg);
+            }
+            continue;
+        }
+        if (n == 0) {
+            return -1;  // File shorter than expected
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if ((errno == EAGAIN || errno == EWOULDBLOCK) && wait_socket(sock_fd, POLLOUT) == 0) {
+            continue;
+        }
+        if ((errno == EINVAL || errno == ENOSYS) && len > 0) {
+            break;  // File system without sendfile support: copy below
+        }
+        return -1;
+    }
+    if (len == 0) {
+        return 0;
+    }
+#endif
+
+    uint8_t* buffer = malloc(len < SENDFILE_BOUNCE_SIZE ? len : SENDFILE_BOUNCE_SIZE);
+    if (!buffer) {
+        return -1;
+    }
+    int result = 0;
+    while (len > 0) {
+        size_t want = len < SENDFILE_BOUNCE_SIZE ? len : SENDFILE_BOUNCE_SIZE;
+        struct iovec iov = { .iov_base = buffer, .iov_len = want };
+        if (posix_pread_all(file_fd, buffer, want, offset) < 0 ||
+            posix_send_iov(sock_fd, &iov, 1) < 0) {
+            result = -1;
+            break;
+        }
+        offset += (off_t)want;
+        len -= want;
+        if (progress) {
+            progress(arg);
+        }
+    }
+    free(buffer);
+    return result;
+}
+
+// ---------------------------------------------------------------------------
+// Socket to file ingest (splice through a per-thread pipe)
+// ---------------------------------------------------------------------------
+
+#ifdef __linux__
+
+typedef struct {
+    int fds[2];
+} SplicePipe;
+
+static __thread SplicePipe* thread_pipe = NULL;
+static pthread_key_t pipe_key;
+static pthread_once_t pipe_key_once = PTHREAD_ONCE_INIT;
+
+static void pipe_destroy(SplicePipe* p) {
+    if (p) {
+        close(p->fds[0]);
+        close(p->fds[1]);
+        free(p);
+    }
+}
+
+static void pipe_key_destructor(void* arg) {
+    pipe_destroy((SplicePipe*)arg);
+}
+
+static void pipe_key_create(void) {
+    pthread_key_create(&pipe_key, pipe_key_destructor);
+}
+
+// Lazily create the calling thread's pipe (NULL if pipes are unavailable)
+static SplicePipe* pipe_get(void) {
+    if (thread_pipe) {
+        return thread_pipe;
+    }
+
+    pthread_once(&pipe_key_once, pipe_key_create);
+
+    SplicePipe* p = malloc(sizeof(SplicePipe));
+    if (!p) {
+        return NULL;
+    }
+    if (pipe2(p->fds, O_CLOEXEC) < 0) {
+        free(p);
+        return NULL;
+    }
+    fcntl(p->fds[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+
+    thread_pipe = p;
+    pthread_setspecific(pipe_key, thread_pipe);
+    return thread_pipe;
+}
+
+// Drop the calling thread's pipe when bytes were left stranded in it
+static void pipe_discard(void) {
+    if (thread_pipe) {
+        pthread_setspecific(pipe_key, NULL);
+        pipe_destroy(thread_pipe);
+        thread_pipe = NULL;
+    }
+}
+
+// Returns 0 on success, -1 on socket errors, -2 on file errors,
+// 1 when the socket cannot be spliced (nothing consumed)
+static int splice_to_file(int sock_fd, int file_fd, off_t offset, size_t len, size_t* consumed,
+                          io_progress_fn progress, void* arg) {
+    SplicePipe* p = pipe_get();
+    if (!p) {
+        return 1;
+    }
+
+    size_t in_pipe = 0;
+    while (*consumed < len || in_pipe > 0) {
+        if (*consumed < len) {
+            // Socket -> pipe; only the pipe end is non-blocking, so a
+            // blocking socket waits here for data
+            ssize_t n = splice(sock_fd, NULL, p->fds[1], NULL, len - *consumed,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0) {
+                *consumed += (size_t)n;
+                in_pipe += (size_t)n;
+                if (progress) {
+                    progress(arg);
+                }
+            } else if (n == 0) {
+                pipe_discard();
+                return -1;  // Peer closed mid-frame
+            } else if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // With an empty pipe the socket is what has nothing to give
+                if (in_pipe == 0 && wait_socket(sock_fd, POLLIN) < 0) {
+                    return -1;
+                }
+            } else if (errno == EINVAL && *consumed == 0) {
+                return 1;
+            } else {
+                pipe_discard();
+                return -1;
+            }
+        }
+
+        // Pipe -> file
+        while (in_pipe > 0) {
+            ssize_t n = splice(p->fds[0], NULL, file_fd, &offset, in_pipe, SPLICE_F_MOVE);
+            if (n > 0) {
+                in_pipe -= (size_t)n;
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else {
+                pipe_discard();
+                return -2;
+            }
+        }
+    }
+    return 0;
+}
+
+#endif // __linux__
+
+int io_recv_discard(int sock_fd, size_t len) {
+    uint8_t buffer[4096];
+    while (len > 0) {
+        size_t want = len < sizeof(buffer) ? len : sizeof(buffer);
+        if (posix_recv_all(sock_fd, buffer, want) != (ssize_t)want) {
+            return -1;
+        }
+        len -= want;
+    }
+    return 0;
+}
+
+int io_splice_to_file(int sock_fd, int file_fd, off_t offset, size_t len, size_t* consumed,
+                      io_progress_fn progress, void* arg) {
+    *consumed = 0;
+
+#ifdef __linux__
+    int rc = splice_to_file(sock_fd, file_fd, offset, len, consumed, progress, arg);
+    if (rc <= 0) {
+        return rc;
+    }
+#endif
+
+    // Copy fallback through a bounce buffer
+    uint8_t* buffer = malloc(len < SENDFILE_BOUNCE_SIZE ? len : SENDFILE_BOUNCE_SIZE);
+    if (!buffer) {
+        return -1;
+    }
+    int result = 0;
+    while (*consumed < len) {
+        size_t want = len - *consumed;
+        if (want > SENDFILE_BOUNCE_SIZE) {
+            want = SENDFILE_BOUNCE_SIZE;
+        }
+        if (posix_recv_all(sock_fd, buffer, want) != (ssize_t)want) {
+            result = -1;
+            break;
+        }
+        *consumed += want;
+        if (progress) {
+            progress(arg);
+        }
+        if (posix_pwrite_all(file_fd, buffer, want, offset + (off_t)(*consumed - want)) < 0) {
+            result = -2;
+            break;
+        }
+    }
+    free(buffer);
+    return result;
+}
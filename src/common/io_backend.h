@@ -0,0 +1,78 @@
+#ifndef IO_BACKEND_H
+#define IO_BACKEND_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Maximum bytes per file read/write SQE; larger buffers are split into
+// several SQEs submitted together
+#define IO_URING_CHUNK_SIZE (256 * 1024)
+
+// Submission queue depth of each per-thread ring
+#define IO_URING_ENTRIES 64
+
+// Called as a long transfer moves along (see io_sendfile_all)
+typedef void (*io_progress_fn)(void* arg);
+
+// Largest piece a transfer with a progress callback moves between calls
+#define IO_PROGRESS_STEP (256 * 1024)
+
+// The io_uring backend is a synchronous shim: each call submits its SQEs
+// with one io_uring_enter() and waits for them before returning, so it
+// costs about one syscall per operation, the same as the posix backend.
+// Only file reads/writes larger than IO_URING_CHUNK_SIZE batch several
+// SQEs. Nothing is queued across calls.
+typedef enum {
+    IO_BACKEND_POSIX = 0,   // Plain blocking syscalls (default)
+    IO_BACKEND_URING = 1    // io_uring via raw syscalls (Linux only)
+} IoBackend;
+
+// Select the backend used by packet_send/packet_recv and storage file I/O.
+// Requesting io_uring falls back to POSIX when the kernel refuses it.
+// Returns the backend actually in effect.
+IoBackend io_backend_select(IoBackend requested);
+
+// Backend currently in effect
+IoBackend io_backend_current(void);
+
+// Human-readable backend name ("posix" / "io_uring")
+const char* io_backend_name(IoBackend backend);
+
+// Send every byte described by iov (one SENDMSG SQE on io_uring)
+// Returns 0 on success, -1 on error
+int io_send_iov(int fd, const struct iovec* iov, int iovcnt);
+
+// Receive exactly len bytes
+// Returns len on success, 0 if the peer closed first, -1 on error
+ssize_t io_recv_all(int fd, void* buf, size_t len);
+
+// Write/read a whole buffer at offset; on io_uring the buffer is split into
+// IO_URING_CHUNK_SIZE pieces submitted as one batch
+// Returns 0 on success, -1 on error (including short reads)
+int io_pwrite_all(int fd, const void* buf, size_t len, off_t offset);
+int io_pread_all(int fd, void* buf, size_t len, off_t offset);
+
+// Send head (may be empty) followed by len bytes of file_fd from offset.
+// On Linux the file part goes through sendfile() without entering user
+// space; elsewhere it is copied through a small bounce buffer. progress
+// (if non-NULL) runs after every IO_PROGRESS_STEP bytes or less sent
+// Returns 0 on success, -1 on error (including a file shorter than len)
+int io_sendfile_all(int sock_fd, const struct iovec* head, int headcnt,
+                    int file_fd, off_t offset, size_t len,
+                    io_progress_fn progress, void* arg);
+
+// Move len bytes from a socket into file_fd at offset. On Linux they are
+// spliced through a per-thread pipe and never copied into user space;
+// otherwise a bounce buffer is used. *consumed counts the bytes taken off
+// the socket, also on failure. progress (if non-NULL) runs each time bytes
+// come off the socket, so a slow sender is seen to make progress
+// Returns 0 on success, -1 on socket errors, -2 if writing the file failed
+int io_splice_to_file(int sock_fd, int file_fd, off_t offset, size_t len, size_t* consumed,
+                      io_progress_fn progress, void* arg);
+
+// Receive and drop len bytes (waits on non-blocking sockets)
+// Returns 0 on success, -1 on error
+int io_recv_discard(int sock_fd, size_t len);
+
+#endif // IO_BACKEND_H
@@ -0,0 +1,210 @@
+#include "listing.h"
+#include "protocol.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Columns in record order with their widths
+static const struct {
+    uint32_t field;
+    size_t width;
+} columns[] = {
+    { LISTING_FIELD_ID, 4 },
+    { LISTING_FIELD_NAME, 4 },
+    { LISTING_FIELD_DIRECTORY, 1 },
+    { LISTING_FIELD_SIZE, 8 },
+    { LISTING_FIELD_PERMISSIONS, 2 },
+    { LISTING_FIELD_OWNER, 4 },
+    { LISTING_FIELD_PARENT, 4 },
+    { LISTING_FIELD_CREATED, 4 },
+};
+
+#define COLUMN_COUNT (sizeof(columns) / sizeof(columns[0]))
+
+size_t listing_record_size(uint32_t fields) {
+    size_t size = 0;
+    for (size_t i = 0; i < COLUMN_COUNT; i++) {
+        if (fields & columns[i].field) {
+            size += columns[i].width;
+        }
+    }
+    return size;
+}
+
+// Copy str (NULL as "") into the string table; returns its offset
+static uint32_t put_string(uint8_t* table, size_t* used, const char* str) {
+    size_t len = str ? strlen(str) : 0;
+    uint32_t offset = (uint32_t)*used;
+    if (len) {
+        memcpy(table + *used, str, len);
+    }
+    table[*used + len] = '\0';
+    *used += len + 1;
+    return offset;
+}
+
+uint8_t* listing_encode(const ListingEntry* entries, int count, uint32_t fields,
+                        uint64_t version, size_t* length) {
+    if (count < 0 || (count > 0 && !entries) || !length) {
+        return NULL;
+    }
+    uint32_t flags = fields & LISTING_FLAGS;
+    fields &= LISTING_FIELDS_ALL;
+    size_t header = LISTING_HEADER_SIZE + ((flags & LISTING_FLAG_VERSION) ? LISTING_VERSION_SIZE : 0);
+
+    size_t record_size = listing_record_size(fields);
+    size_t strings = 0;
+    for (int i = 0; i < count; i++) {
+        if (fields & LISTING_FIELD_NAME) {
+            strings += (entries[i].name ? strlen(entries[i].name) : 0) + 1;
+        }
+        if (fields & LISTING_FIELD_CREATED) {
+            strings += (entries[i].created_at ? strlen(entries[i].created_at) : 0) + 1;
+        }
+    }
+
+    size_t total = header + (size_t)count * record_size + strings;
+    if (total > MAX_PAYLOAD_SIZE) {
+        return NULL;
+    }
+    uint8_t* buffer = malloc(total ? total : 1);
+    if (!buffer) {
+        return NULL;
+    }
+
+    packet_put_u32(buffer, (uint32_t)count);
+    packet_put_u32(buffer + 4, fields | flags);
+    packet_put_u32(buffer + 8, (uint32_t)strings);
+    if (flags & LISTING_FLAG_VERSION) {
+        packet_put_u64(buffer + LISTING_HEADER_SIZE, version);
+    }
+
+    uint8_t* record = buffer + header;
+    uint8_t* table = record + (size_t)count * record_size;
+    size_t used = 0;
+    for (int i = 0; i < count; i++) {
+        const ListingEntry* entry = &entries[i];
+        uint8_t* p = record;
+        if (fields & LISTING_FIELD_ID) {
+            packet_put_u32(p, (uint32_t)entry->id);
+            p += 4;
+        }
+        if (fields & LISTING_FIELD_NAME) {
+            packet_put_u32(p, put_string(table, &used, entry->name));
+            p += 4;
+        }
+        if (fields & LISTING_FIELD_DIRECTORY) {
+            *p++ = entry->is_directory ? 1 : 0;
+        }
+        if (fields & LISTING_FIELD_SIZE) {
+            packet_put_u64(p, (uint64_t)entry->size);
+            p += 8;
+        }
+        if (fields & LISTING_FIELD_PERMISSIONS) {
+            p[0] = (uint8_t)(entry->permissions >> 8);
+            p[1] = (uint8_t)entry->permissions;
+            p += 2;
+        }
+        if (fields & LISTING_FIELD_OWNER) {
+            packet_put_u32(p, (uint32_t)entry->owner_id);
+            p += 4;
+        }
+        if (fields & LISTING_FIELD_PARENT) {
+            packet_put_u32(p, (uint32_t)entry->parent_id);
+            p += 4;
+        }
+        if (fields & LISTING_FIELD_CREATED) {
+            packet_put_u32(p, put_string(table, &used, entry->created_at));
+        }
+        record += record_size;
+    }
+
+    *length = total;
+    return buffer;
+}
+
+// String at offset of a table of size bytes, or NULL if it runs off the end
+static const char* get_string(const uint8_t* table, size_t size, uint32_t offset) {
+    if (offset >= size || !memchr(table + offset, '\0', size - offset)) {
+        return NULL;
+    }
+    return (const char*)table + offset;
+}
+
+int listing_decode(const uint8_t* data, size_t length, ListingEntry** entries,
+                   int* count, uint32_t* fields, uint64_t* version) {
+    if (!data || !entries || !count || length < LISTING_HEADER_SIZE) {
+        return -1;
+    }
+
+    uint32_t n = packet_get_u32(data);
+    uint32_t word = packet_get_u32(data + 4);
+    uint32_t present = word & LISTING_FIELDS_ALL;
+    uint32_t strings = packet_get_u32(data + 8);
+    size_t record_size = listing_record_size(present);
+    size_t header = LISTING_HEADER_SIZE + ((word & LISTING_FLAG_VERSION) ? LISTING_VERSION_SIZE : 0);
+    if ((word & ~(LISTING_FIELDS_ALL | LISTING_FLAGS)) || n > MAX_PAYLOAD_SIZE ||
+        length != header + (size_t)n * record_size + strings) {
+        return -1;
+    }
+
+    ListingEntry* out = calloc(n ? n : 1, sizeof(ListingEntry));
+    if (!out) {
+        return -1;
+    }
+
+    const uint8_t* record = data + header;
+    const uint8_t* table = record + (size_t)n * record_size;
+    for (uint32_t i = 0; i < n; i++) {
+        ListingEntry* entry = &out[i];
+        const uint8_t* p = record;
+        if (present & LISTING_FIELD_ID) {
+            entry->id = (int)packet_get_u32(p);
+            p += 4;
+        }
+        if (present & LISTING_FIELD_NAME) {
+            entry->name = get_string(table, strings, packet_get_u32(p));
+            if (!entry->name) {
+                free(out);
+                return -1;
+            }
+            p += 4;
+        }
+        if (present & LISTING_FIELD_DIRECTORY) {
+            entry->is_directory = *p++ ? 1 : 0;
+        }
+        if (present & LISTING_FIELD_SIZE) {
+            entry->size = (int64_t)packet_get_u64(p);
+            p += 8;
+        }
+        if (present & LISTING_FIELD_PERMISSIONS) {
+            entry->permissions = (p[0] << 8) | p[1];
+            p += 2;
+        }
+        if (present & LISTING_FIELD_OWNER) {
+            entry->owner_id = (int)packet_get_u32(p);
+            p += 4;
+        }
+        if (present & LISTING_FIELD_PARENT) {
+            entry->parent_id = (int)packet_get_u32(p);
+            p += 4;
+        }
+        if (present & LISTING_FIELD_CREATED) {
+            entry->created_at = get_string(table, strings, packet_get_u32(p));
+            if (!entry->created_at) {
+                free(out);
+                return -1;
+            }
+        }
+        record += record_size;
+    }
+
+    *entries = out;
+    *count = (int)n;
+    if (fields) {
+        *fields = word;
+    }
+    if (version) {
+        *version = (word & LISTING_FLAG_VERSION) ? packet_get_u64(data + LISTING_HEADER_SIZE) : 0;
+    }
+    return 0;
+}
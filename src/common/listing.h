@@ -0,0 +1,76 @@
+#ifndef LISTING_H
+#define LISTING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary encoding of LIST_DIR and FILE_INFO responses (FEATURE_BINARY_LIST).
+// All integers are big-endian:
+//
+//   header   count (4 bytes), fields and flags (4 bytes), string table
+//            size (4 bytes)
+//   version  the directory's version (8 bytes), with LISTING_FLAG_VERSION
+//   records  count fixed-width records holding the columns named in fields,
+//            in the order of their LISTING_FIELD_* bits
+//   strings  NUL-terminated strings; a string column is its offset here
+//
+// A reader takes the fields of each record by offset, without parsing.
+
+#define LISTING_HEADER_SIZE 12
+#define LISTING_VERSION_SIZE 8
+
+// Columns and their width in a record
+#define LISTING_FIELD_ID          0x01  // 4 bytes
+#define LISTING_FIELD_NAME        0x02  // 4 bytes, string offset
+#define LISTING_FIELD_DIRECTORY   0x04  // 1 byte, 1 for a directory
+#define LISTING_FIELD_SIZE        0x08  // 8 bytes
+#define LISTING_FIELD_PERMISSIONS 0x10  // 2 bytes
+#define LISTING_FIELD_OWNER       0x20  // 4 bytes
+#define LISTING_FIELD_PARENT      0x40  // 4 bytes
+#define LISTING_FIELD_CREATED     0x80  // 4 bytes, string offset
+#define LISTING_FIELDS_ALL        0xFF
+
+// Flag in the fields word: a paged listing has more entries after the
+// last record (see LIST_DIR "limit")
+#define LISTING_FLAG_MORE 0x80000000u
+
+// Flag in the fields word: the directory's version follows the header
+// (see LIST_DIR "if_version")
+#define LISTING_FLAG_VERSION 0x40000000u
+#define LISTING_FLAGS (LISTING_FLAG_MORE | LISTING_FLAG_VERSION)
+
+// Columns of a LIST_DIR entry in JSON, sent unless the client projects
+#define LISTING_FIELDS_DEFAULT (LISTING_FIELD_ID | LISTING_FIELD_NAME | \
+                                LISTING_FIELD_DIRECTORY | LISTING_FIELD_SIZE | \
+                                LISTING_FIELD_PERMISSIONS | LISTING_FIELD_OWNER)
+
+// One entry. Decoded strings point into the encoded buffer; columns the
+// listing leaves out are 0 or NULL.
+typedef struct {
+    int id;
+    int parent_id;
+    int owner_id;
+    int permissions;
+    int is_directory;
+    int64_t size;
+    const char* name;
+    const char* created_at;
+} ListingEntry;
+
+// Bytes of one record holding fields
+size_t listing_record_size(uint32_t fields);
+
+// Encode count entries with the columns in fields (plus any flags) into a
+// new buffer (*length bytes; free() it). version is written only with
+// LISTING_FLAG_VERSION. Returns NULL on error
+uint8_t* listing_encode(const ListingEntry* entries, int count, uint32_t fields,
+                        uint64_t version, size_t* length);
+
+// Decode a listing into a new array (*entries, *count; free() it) whose
+// strings point into data, so data must outlive it. *fields (may be NULL)
+// gets the columns present and the flags, *version (may be NULL) the
+// version or 0 without one. Returns 0, or -1 if data is malformed
+int listing_decode(const uint8_t* data, size_t length, ListingEntry** entries,
+                   int* count, uint32_t* fields, uint64_t* version);
+
+#endif // LISTING_H
@@ -1,9 +1,20 @@
 #include "protocol.h"
+#include "io_backend.h"
+#include "compress.h"
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <poll.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// How long a sender waits for a non-blocking socket to drain (matches SO_SNDTIMEO)
+#define SEND_POLL_TIMEOUT_MS (300 * 1000)
+
 Packet* packet_create(uint8_t command, const char* payload, uint32_t length) {
     Packet* pkt = malloc(sizeof(Packet));
     if (!pkt) return NULL;
@@ -12,6 +23,9 @@ Packet* packet_create(uint8_t command, const char* payload, uint32_t length) {
     pkt->magic[1] = MAGIC_BYTE_2;
     pkt->command = command;
     pkt->data_length = length;
+    pkt->stream_id = 0;
+    pkt->payload_unread = 0;
+    pkt->compressed = 0;
 
     if (payload && length > 0) {
         pkt->payload = malloc(length + 1);
@@ -28,15 +42,19 @@ Packet* packet_create(uint8_t command, const char* payload, uint32_t length) {
     return pkt;
 }
 
-int packet_encode(Packet* pkt, uint8_t* buffer, size_t buf_size) {
-    if (!pkt || !buffer) return -1;
-
-    size_t required_size = HEADER_SIZE + pkt->data_length;
-    if (buf_size < required_size) return -1;
+int packet_header_size(const Packet* pkt) {
+    return pkt->stream_id ? TAGGED_HEADER_SIZE : HEADER_SIZE;
+}
 
+// Write pkt's header into buffer; returns its size
+static int packet_write_header(const Packet* pkt, uint8_t* buffer) {
     // Magic bytes
     buffer[0] = MAGIC_BYTE_1;
-    buffer[1] = MAGIC_BYTE_2;
+    if (pkt->compressed) {
+        buffer[1] = pkt->stream_id ? MAGIC_BYTE_2_COMPRESSED_TAGGED : MAGIC_BYTE_2_COMPRESSED;
+    } else {
+        buffer[1] = pkt->stream_id ? MAGIC_BYTE_2_TAGGED : MAGIC_BYTE_2;
+    }
 
     // Command
     buffer[2] = pkt->command;
@@ -45,9 +63,28 @@ int packet_encode(Packet* pkt, uint8_t* buffer, size_t buf_size) {
     uint32_t net_length = htonl(pkt->data_length);
     memcpy(buffer + 3, &net_length, sizeof(uint32_t));
 
+    if (!pkt->stream_id) {
+        return HEADER_SIZE;
+    }
+
+    // Stream ID (network byte order)
+    uint32_t net_stream = htonl(pkt->stream_id);
+    memcpy(buffer + HEADER_SIZE, &net_stream, sizeof(uint32_t));
+    return TAGGED_HEADER_SIZE;
+}
+
+int packet_encode(Packet* pkt, uint8_t* buffer, size_t buf_size) {
+    if (!pkt || !buffer) return -1;
+
+    size_t header_size = (size_t)packet_header_size(pkt);
+    size_t required_size = header_size + pkt->data_length;
+    if (buf_size < required_size) return -1;
+
+    packet_write_header(pkt, buffer);
+
     // Payload
     if (pkt->payload && pkt->data_length > 0) {
-        memcpy(buffer + HEADER_SIZE, pkt->payload, pkt->data_length);
+        memcpy(buffer + header_size, pkt->payload, pkt->data_length);
     }
 
     return (int)required_size;
@@ -57,25 +94,20 @@ int packet_decode(uint8_t* buffer, size_t buf_size, Packet* pkt) {
     if (!buffer || !pkt || buf_size < HEADER_SIZE) return -1;
 
     // Verify magic bytes
-    if (buffer[0] != MAGIC_BYTE_1 || buffer[1] != MAGIC_BYTE_2) {
+    int header_size = packet_header_length(buffer);
+    if (header_size < 0) {
         return -2;  // Invalid magic
     }
-
-    pkt->magic[0] = buffer[0];
-    pkt->magic[1] = buffer[1];
-    pkt->command = buffer[2];
-
-    // Get data length (convert from network byte order)
-    uint32_t net_length;
-    memcpy(&net_length, buffer + 3, sizeof(uint32_t));
-    pkt->data_length = ntohl(net_length);
+    if (buf_size < (size_t)header_size) {
+        return -1;
+    }
 
     // Validate payload size
-    if (pkt->data_length > MAX_PAYLOAD_SIZE) {
+    if (packet_parse_header(buffer, pkt) < 0) {
         return -3;  // Payload too large
     }
 
-    if (buf_size < HEADER_SIZE + pkt->data_length) {
+    if (buf_size < header_size + pkt->data_length) {
         return -4;  // Buffer too small for payload
     }
 
@@ -83,12 +115,17 @@ int packet_decode(uint8_t* buffer, size_t buf_size, Packet* pkt) {
     if (pkt->data_length > 0) {
         pkt->payload = malloc(pkt->data_length + 1);
         if (!pkt->payload) return -5;
-        memcpy(pkt->payload, buffer + HEADER_SIZE, pkt->data_length);
+        memcpy(pkt->payload, buffer + header_size, pkt->data_length);
         pkt->payload[pkt->data_length] = '\0';
     } else {
         pkt->payload = NULL;
     }
 
+    if (packet_inflate(pkt) < 0) {
+        free(pkt->payload);
+        pkt->payload = NULL;
+        return -7;
+    }
     return 0;
 }
 
@@ -101,17 +138,51 @@ void packet_free(Packet* pkt) {
     }
 }
 
-// Helper: Read full packet from socket
-int packet_recv(int socket_fd, Packet* pkt) {
-    uint8_t header[HEADER_SIZE];
+void packet_put_u64(uint8_t* buf, uint64_t value) {
+    for (int i = 7; i >= 0; i--) {
+        buf[i] = (uint8_t)(value & 0xFF);
+        value >>= 8;
+    }
+}
 
-    // Read header first
-    ssize_t n = recv(socket_fd, header, HEADER_SIZE, MSG_WAITALL);
-    if (n <= 0) return -1;
-    if (n < HEADER_SIZE) return -2;
+uint64_t packet_get_u64(const uint8_t* buf) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value = (value << 8) | buf[i];
+    }
+    return value;
+}
+
+void packet_put_u32(uint8_t* buf, uint32_t value) {
+    uint32_t net_value = htonl(value);
+    memcpy(buf, &net_value, sizeof(net_value));
+}
+
+uint32_t packet_get_u32(const uint8_t* buf) {
+    uint32_t net_value;
+    memcpy(&net_value, buf, sizeof(net_value));
+    return ntohl(net_value);
+}
+
+int packet_header_length(const uint8_t* header) {
+    if (header[0] != MAGIC_BYTE_1) {
+        return -3;
+    }
+    if (header[1] == MAGIC_BYTE_2 || header[1] == MAGIC_BYTE_2_COMPRESSED) {
+        return HEADER_SIZE;
+    }
+    if (header[1] == MAGIC_BYTE_2_TAGGED || header[1] == MAGIC_BYTE_2_COMPRESSED_TAGGED) {
+        return TAGGED_HEADER_SIZE;
+    }
+    return -3;
+}
+
+int packet_parse_header(const uint8_t* header, Packet* pkt) {
+    if (!header || !pkt) return -1;
 
     // Verify magic
-    if (header[0] != MAGIC_BYTE_1 || header[1] != MAGIC_BYTE_2) {
+    int header_size = packet_header_length(header);
+    if (header_size < 0) {
         return -3;
     }
 
@@ -123,43 +194,227 @@ int packet_recv(int socket_fd, Packet* pkt) {
     memcpy(&net_length, header + 3, sizeof(uint32_t));
     pkt->data_length = ntohl(net_length);
 
+    pkt->stream_id = 0;
+    pkt->payload_unread = 0;
+    pkt->compressed = (header[1] == MAGIC_BYTE_2_COMPRESSED ||
+                       header[1] == MAGIC_BYTE_2_COMPRESSED_TAGGED);
+    if (header_size == TAGGED_HEADER_SIZE) {
+        uint32_t net_stream;
+        memcpy(&net_stream, header + HEADER_SIZE, sizeof(uint32_t));
+        pkt->stream_id = ntohl(net_stream);
+    }
+
     if (pkt->data_length > MAX_PAYLOAD_SIZE) {
         return -4;
     }
 
+    return 0;
+}
+
+// Helper: Read full packet from socket
+int packet_recv(int socket_fd, Packet* pkt) {
+    return packet_recv_progress(socket_fd, pkt, NULL, NULL);
+}
+
+int packet_recv_progress(int socket_fd, Packet* pkt, packet_progress_fn progress, void* arg) {
+    int rc = packet_recv_header(socket_fd, pkt);
+    if (rc < 0) {
+        return rc;
+    }
+    if (progress) {
+        progress(arg);
+    }
+    return packet_recv_payload(socket_fd, pkt, progress, arg);
+}
+
+int packet_defers_payload(const Packet* pkt) {
+    // A compressed chunk has to be inflated in memory first
+    return (pkt->command == CMD_UPLOAD_CHUNK || pkt->command == CMD_UPLOAD_PART) &&
+           pkt->data_length > 0 && !pkt->compressed;
+}
+
+int packet_inflate(Packet* pkt) {
+    if (!pkt->compressed) {
+        return 0;
+    }
+
+    uint8_t* original = NULL;
+    size_t original_len = 0;
+    if (!pkt->payload ||
+        decompress_payload((const uint8_t*)pkt->payload, pkt->data_length, MAX_PAYLOAD_SIZE,
+                           &original, &original_len) < 0) {
+        return -7;
+    }
+
+    free(pkt->payload);
+    pkt->payload = (char*)original;
+    pkt->data_length = (uint32_t)original_len;
+    pkt->compressed = 0;
+    return 0;
+}
+
+int packet_recv_header(int socket_fd, Packet* pkt) {
+    uint8_t header[TAGGED_HEADER_SIZE];
+
+    int use_uring = (io_backend_current() == IO_BACKEND_URING);
+
+    // Read header first
+    ssize_t n = use_uring ? io_recv_all(socket_fd, header, HEADER_SIZE)
+                          : recv(socket_fd, header, HEADER_SIZE, MSG_WAITALL);
+    if (n <= 0) return -1;
+    if (n < HEADER_SIZE) return -2;
+
+    // A tagged frame continues with its stream ID
+    int header_size = packet_header_length(header);
+    if (header_size < 0) {
+        return -3;
+    }
+    if (header_size > HEADER_SIZE) {
+        size_t rest = (size_t)(header_size - HEADER_SIZE);
+        n = use_uring ? io_recv_all(socket_fd, header + HEADER_SIZE, rest)
+                      : recv(socket_fd, header + HEADER_SIZE, rest, MSG_WAITALL);
+        if (n <= 0) return -1;
+        if ((size_t)n < rest) return -2;
+    }
+
+    pkt->payload = NULL;
+    return packet_parse_header(header, pkt);
+}
+
+int packet_recv_payload(int socket_fd, Packet* pkt, packet_progress_fn progress, void* arg) {
+    int use_uring = (io_backend_current() == IO_BACKEND_URING);
+    ssize_t n;
+
     // Read payload if present
     if (pkt->data_length > 0) {
         pkt->payload = malloc(pkt->data_length + 1);
         if (!pkt->payload) return -5;
 
-        n = recv(socket_fd, pkt->payload, pkt->data_length, MSG_WAITALL);
-        if (n < (ssize_t)pkt->data_length) {
-            free(pkt->payload);
-            pkt->payload = NULL;
-            return -6;
+        uint32_t received = 0;
+        while (received < pkt->data_length) {
+            uint32_t want = pkt->data_length - received;
+            if (progress && want > PACKET_RECV_CHUNK) {
+                want = PACKET_RECV_CHUNK;
+            }
+
+            n = use_uring ? io_recv_all(socket_fd, pkt->payload + received, want)
+                          : recv(socket_fd, pkt->payload + received, want, MSG_WAITALL);
+            if (n <= 0) {
+                free(pkt->payload);
+                pkt->payload = NULL;
+                return -6;
+            }
+            received += (uint32_t)n;
+            if (progress) {
+                progress(arg);
+            }
         }
         pkt->payload[pkt->data_length] = '\0';
     } else {
         pkt->payload = NULL;
     }
 
+    if (packet_inflate(pkt) < 0) {
+        free(pkt->payload);
+        pkt->payload = NULL;
+        return -7;
+    }
+    return 0;
+}
+
+int packet_send_all(int socket_fd, const void* data, size_t len) {
+    const uint8_t* buf = data;
+    size_t sent = 0;
+
+    while (sent < len) {
+        ssize_t n = send(socket_fd, buf + sent, len - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // Non-blocking socket: wait until the peer drains its window
+            struct pollfd pfd = { .fd = socket_fd, .events = POLLOUT, .revents = 0 };
+            if (poll(&pfd, 1, SEND_POLL_TIMEOUT_MS) <= 0) {
+                return -1;
+            }
+            continue;
+        }
+        return -1;
+    }
+
     return 0;
 }
 
 // Helper: Send packet to socket
 int packet_send(int socket_fd, Packet* pkt) {
-    size_t total_size = HEADER_SIZE + pkt->data_length;
-    uint8_t* buffer = malloc(total_size);
-    if (!buffer) return -1;
+    // Header and payload go out in one gather write, without copying the
+    // payload into an encode buffer (io_send_iov falls back to sendmsg)
+    uint8_t header[TAGGED_HEADER_SIZE];
+    int header_size = packet_write_header(pkt, header);
+
+    struct iovec iov[2] = {
+        { .iov_base = header, .iov_len = (size_t)header_size },
+        { .iov_base = pkt->payload, .iov_len = pkt->payload ? pkt->data_length : 0 }
+    };
+    int iovcnt = (pkt->payload && pkt->data_length > 0) ? 2 : 1;
+    return (io_send_iov(socket_fd, iov, iovcnt) == 0) ? 0 : -3;
+}
 
-    int encoded_size = packet_encode(pkt, buffer, total_size);
-    if (encoded_size < 0) {
-        free(buffer);
-        return -2;
+int packet_send_compressed(int socket_fd, Packet* pkt, int method, int level) {
+    uint8_t* packed = NULL;
+    size_t packed_len = 0;
+    if (pkt->compressed || !pkt->payload || pkt->data_length < COMPRESS_MIN_SIZE ||
+        compress_payload((Compression)method, (const uint8_t*)pkt->payload,
+                         pkt->data_length, level, &packed, &packed_len) < 0) {
+        return packet_send(socket_fd, pkt);
     }
 
-    ssize_t sent = send(socket_fd, buffer, encoded_size, 0);
-    free(buffer);
+    Packet frame = *pkt;
+    frame.payload = (char*)packed;
+    frame.data_length = (uint32_t)packed_len;
+    frame.compressed = 1;
+    int rc = packet_send(socket_fd, &frame);
+    free(packed);
+    return rc;
+}
+
+int packet_send_file(int socket_fd, Packet* pkt, int file_fd, uint64_t offset, size_t length,
+                     packet_progress_fn progress, void* arg) {
+    if (!pkt || (uint64_t)pkt->data_length + length > MAX_PAYLOAD_SIZE) {
+        return -1;
+    }
+
+    // The header announces the inline payload plus the file bytes
+    Packet frame = *pkt;
+    frame.data_length += (uint32_t)length;
+
+    uint8_t header[TAGGED_HEADER_SIZE];
+    int header_size = packet_write_header(&frame, header);
 
-    return (sent == encoded_size) ? 0 : -3;
+    struct iovec head[2] = {
+        { .iov_base = header, .iov_len = (size_t)header_size },
+        { .iov_base = pkt->payload, .iov_len = pkt->payload ? pkt->data_length : 0 }
+    };
+    int headcnt = (pkt->payload && pkt->data_length > 0) ? 2 : 1;
+    return io_sendfile_all(socket_fd, head, headcnt, file_fd, (off_t)offset, length,
+                           progress, arg) == 0 ? 0 : -3;
+}
+
+uint32_t protocol_features(void) {
+    uint32_t features = FEATURES_ALL;
+    if (!compression_available(COMPRESSION_ZSTD)) {
+        features &= ~FEATURE_ZSTD;
+    }
+    return features;
+}
+
+int protocol_compression(uint32_t features) {
+    if (features & FEATURE_ZSTD) {
+        return COMPRESSION_ZSTD;
+    }
+    return (features & FEATURE_ZLIB) ? COMPRESSION_ZLIB : COMPRESSION_NONE;
 }
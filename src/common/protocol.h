@@ -7,29 +7,92 @@
 #define MAGIC_BYTE_1 0xFA
 #define MAGIC_BYTE_2 0xCE
 
+// Tagged frames (after CMD_ENABLE_STREAMS) use this second magic byte and
+// carry a 4-byte stream ID after the length, so several requests can be
+// outstanding on one connection and their responses can come back in any
+// order. A response echoes the stream ID of its request.
+#define MAGIC_BYTE_2_TAGGED 0xCF
+
+// Frames whose payload is compressed (see compress.h), sent only to peers
+// that negotiated compression at login. Receivers inflate them before
+// handing the packet on, so handlers never see the difference.
+#define MAGIC_BYTE_2_COMPRESSED 0xCC
+#define MAGIC_BYTE_2_COMPRESSED_TAGGED 0xCD
+
+// Capabilities exchanged by CMD_HELLO. Version 1 is the protocol before
+// HELLO: a peer that never sends it gets version 1 behaviour.
+#define PROTOCOL_VERSION 2
+
+// Smallest max_frame a peer may announce in HELLO
+#define PROTOCOL_MIN_FRAME (64 * 1024)
+
+// Feature flags
+#define FEATURE_STREAMS   0x01      // Tagged frames (as with ENABLE_STREAMS)
+#define FEATURE_CHUNKED   0x02      // UPLOAD_CHUNK / DOWNLOAD_CHUNK streaming
+#define FEATURE_RESUME    0x04      // UPLOAD_REQ "resume", DOWNLOAD_REQ "offset"
+#define FEATURE_RANGE     0x08      // READ_RANGE
+#define FEATURE_MULTIPART 0x10      // UPLOAD_PART
+#define FEATURE_ZLIB      0x20      // zlib-compressed frames
+#define FEATURE_BINARY_LIST 0x40    // Binary LIST_DIR / FILE_INFO (listing.h)
+#define FEATURE_BATCH     0x80      // BATCH
+#define FEATURE_DIR_VERSION 0x100   // Directory versions in binary listings
+#define FEATURE_ZSTD      0x200     // zstd-compressed frames (preferred to zlib)
+#define FEATURES_ALL (FEATURE_STREAMS | FEATURE_CHUNKED | FEATURE_RESUME | \
+                      FEATURE_RANGE | FEATURE_MULTIPART | FEATURE_ZLIB | \
+                      FEATURE_BINARY_LIST | FEATURE_BATCH | FEATURE_DIR_VERSION | \
+                      FEATURE_ZSTD)
+
 #define DEFAULT_PORT 8080
 #define MAX_PAYLOAD_SIZE (16 * 1024 * 1024)  // 16MB max
 #define HEADER_SIZE 7
+#define TAGGED_HEADER_SIZE 11
+
+// Streaming transfers: a chunk frame starts with the 64-bit file offset of
+// its data (big-endian), followed by at most CHUNK_MAX_SIZE data bytes
+#define CHUNK_OFFSET_SIZE 8
+#define CHUNK_MAX_SIZE (1024 * 1024)
+
+// Multipart uploads: an UPLOAD_PART frame starts with the 32-bit upload ID
+// and part number (big-endian), followed by the part's data
+#define PART_HEADER_SIZE 8
+
+// Most entries one page of a paged LIST_DIR holds (its "limit")
+#define LIST_PAGE_MAX 1000
+
+// Most sub-requests one BATCH carries
+#define BATCH_MAX_REQUESTS 256
 
 // Command IDs
 #define CMD_LOGIN_REQ    0x01
 #define CMD_LOGIN_RES    0x02
+#define CMD_PING         0x03
+#define CMD_PONG         0x04
+#define CMD_ENABLE_STREAMS 0x05
+#define CMD_HELLO        0x06
 #define CMD_LIST_DIR     0x10
 #define CMD_CHANGE_DIR   0x11
 #define CMD_MAKE_DIR     0x12
 #define CMD_UPLOAD_REQ   0x20
 #define CMD_UPLOAD_DATA  0x21
+#define CMD_UPLOAD_CHUNK 0x22
+#define CMD_UPLOAD_COMMIT 0x23
+#define CMD_UPLOAD_PART  0x24
 #define CMD_DOWNLOAD_REQ 0x30
 #define CMD_DOWNLOAD_RES 0x31
+#define CMD_DOWNLOAD_CHUNK 0x32
+#define CMD_READ_RANGE   0x33
 #define CMD_DELETE       0x40
 #define CMD_CHMOD        0x41
 #define CMD_FILE_INFO    0x42
+#define CMD_BATCH        0x43
 #define CMD_ADMIN_LIST_USERS   0x50
 #define CMD_ADMIN_CREATE_USER  0x51
 #define CMD_ADMIN_DELETE_USER  0x52
 #define CMD_ADMIN_UPDATE_USER  0x53
+#define CMD_ADMIN_SERVER_STATS 0x54
 #define CMD_ERROR        0xFF
 #define CMD_SUCCESS      0xFE
+#define CMD_NOT_MODIFIED 0xFD       // LIST_DIR "if_version" still current; no payload
 
 // Response Status Codes
 #define STATUS_OK           0
@@ -44,6 +107,9 @@ typedef struct {
     uint8_t command;
     uint32_t data_length;
     char* payload;
+    uint32_t stream_id;     // Tagged frames only; 0 means an untagged frame
+    int payload_unread;     // Payload left on the socket for the handler
+    int compressed;         // Payload is compressed (compress.h format)
 } Packet;
 
 // Function prototypes
@@ -52,8 +118,71 @@ int packet_decode(uint8_t* buffer, size_t buf_size, Packet* pkt);
 void packet_free(Packet* pkt);
 Packet* packet_create(uint8_t command, const char* payload, uint32_t length);
 
+// Full header size announced by the first HEADER_SIZE bytes of a frame
+// Returns HEADER_SIZE, TAGGED_HEADER_SIZE, or -3 on bad magic (compressed
+// frames have the same sizes)
+int packet_header_length(const uint8_t* header);
+
+// Header size pkt is sent with (tagged when pkt->stream_id is set)
+int packet_header_size(const Packet* pkt);
+
+// Parse and validate a complete header (packet_header_length() bytes)
+// into pkt (payload untouched)
+// Returns 0 on success, -3 on bad magic, -4 if payload too large
+int packet_parse_header(const uint8_t* header, Packet* pkt);
+
+// Big-endian 64-bit fields (chunk offsets)
+void packet_put_u64(uint8_t* buf, uint64_t value);
+uint64_t packet_get_u64(const uint8_t* buf);
+
+// Big-endian 32-bit fields (part headers)
+void packet_put_u32(uint8_t* buf, uint32_t value);
+uint32_t packet_get_u32(const uint8_t* buf);
+
+// Frames whose payload the receiver leaves on the socket (payload_unread)
+// so the handler can move it to disk without copying (UPLOAD_CHUNK,
+// UPLOAD_PART)
+int packet_defers_payload(const Packet* pkt);
+
+// Replace a compressed packet's payload with the original
+// Returns 0 (also for uncompressed packets), or -7 on corrupt data
+int packet_inflate(Packet* pkt);
+
 // Helper functions for socket I/O
 int packet_recv(int socket_fd, Packet* pkt);
 int packet_send(int socket_fd, Packet* pkt);
 
+// packet_send() with the payload compressed by method at level
+// (compress.h) when it is at least COMPRESS_MIN_SIZE bytes and shrinks;
+// else sent as it is
+int packet_send_compressed(int socket_fd, Packet* pkt, int method, int level);
+
+// FEATURES_ALL less what this build lacks (FEATURE_ZSTD without libzstd):
+// what a peer offers and accepts in HELLO
+uint32_t protocol_features(void);
+
+// Compression (compress.h) both peers use after HELLO settled on features
+int protocol_compression(uint32_t features);
+
+// Called as a packet arrives or leaves piece by piece
+typedef void (*packet_progress_fn)(void* arg);
+
+// Send pkt (payload = inline prefix, may be empty) followed by length bytes
+// of file_fd at offset as one frame, without copying the file through user
+// space (see io_sendfile_all, which calls progress as the bytes leave)
+int packet_send_file(int socket_fd, Packet* pkt, int file_fd, uint64_t offset, size_t length,
+                     packet_progress_fn progress, void* arg);
+
+// packet_recv(), reading the payload PACKET_RECV_CHUNK bytes at a time and
+// calling progress (if non-NULL) after the header and after each chunk
+#define PACKET_RECV_CHUNK (64 * 1024)
+int packet_recv_progress(int socket_fd, Packet* pkt, packet_progress_fn progress, void* arg);
+
+// The two halves of packet_recv_progress(): the header, then the payload
+int packet_recv_header(int socket_fd, Packet* pkt);
+int packet_recv_payload(int socket_fd, Packet* pkt, packet_progress_fn progress, void* arg);
+
+// Write a whole buffer, waiting on POLLOUT when the socket is non-blocking
+int packet_send_all(int socket_fd, const void* data, size_t len);
+
 #endif // PROTOCOL_H
@@ -5,6 +5,7 @@
 #include <stdarg.h>
 #include <time.h>
 #include <unistd.h>
+#include <stdint.h>
 
 static FILE* log_file_handle = NULL;
 static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -100,12 +101,25 @@ char* generate_uuid(void) {
     char* uuid_str = malloc(37);
     if (!uuid_str) return NULL;
 
-    // Simple UUID generation using random
-    srand(time(NULL) ^ getpid());
-    snprintf(uuid_str, 37, "%08x-%04x-%04x-%04x-%012llx",
-             rand(), rand() & 0xffff, (rand() & 0x0fff) | 0x4000,
-             (rand() & 0x3fff) | 0x8000,
-             ((long long)rand() << 32) | rand());
+    // Random version-4 UUID; reseeding rand() per call repeated UUIDs
+    // for uploads made within the same second
+    uint8_t b[16];
+    FILE* urandom = fopen("/dev/urandom", "rb");
+    if (!urandom || fread(b, 1, sizeof(b), urandom) != sizeof(b)) {
+        static __thread unsigned int seed;
+        if (!seed) seed = (unsigned int)(time(NULL) ^ getpid() ^ (uintptr_t)&seed);
+        for (size_t i = 0; i < sizeof(b); i++) {
+            b[i] = (uint8_t)rand_r(&seed);
+        }
+    }
+    if (urandom) fclose(urandom);
+
+    b[6] = (b[6] & 0x0f) | 0x40;
+    b[8] = (b[8] & 0x3f) | 0x80;
+    snprintf(uuid_str, 37,
+             "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+             b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7],
+             b[8], b[9], b[10], b[11], b[12], b[13], b[14], b[15]);
     return uuid_str;
 }
 
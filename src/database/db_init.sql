@@ -19,10 +19,41 @@ CREATE TABLE IF NOT EXISTS files (
     is_directory INTEGER DEFAULT 0,
     permissions INTEGER DEFAULT 755,
     created_at TEXT DEFAULT CURRENT_TIMESTAMP,
+    version INTEGER NOT NULL DEFAULT 0,     -- Of a directory's listing, see below
     FOREIGN KEY (owner_id) REFERENCES users(id),
     FOREIGN KEY (parent_id) REFERENCES files(id)
 );
 
+-- A directory's version goes up whenever a child is created, deleted,
+-- renamed, moved or changed in what a listing shows, so LIST_DIR
+-- "if_version" can tell a client its listing is still current
+CREATE TRIGGER IF NOT EXISTS files_version_insert AFTER INSERT ON files
+BEGIN
+    UPDATE files SET version = version + 1 WHERE id = NEW.parent_id;
+END;
+CREATE TRIGGER IF NOT EXISTS files_version_delete AFTER DELETE ON files
+BEGIN
+    UPDATE files SET version = version + 1 WHERE id = OLD.parent_id;
+END;
+CREATE TRIGGER IF NOT EXISTS files_version_update
+AFTER UPDATE OF parent_id, name, permissions, size, is_directory, owner_id ON files
+BEGIN
+    UPDATE files SET version = version + 1 WHERE id IN (OLD.parent_id, NEW.parent_id);
+END;
+
+-- Chunked uploads cut off mid-stream. The files row and the blob named by
+-- uuid stay; the blob holds the bytes received so far (chunks are written
+-- in order), and a later UPLOAD_REQ with "resume" continues from there.
+CREATE TABLE IF NOT EXISTS partial_uploads (
+    file_id INTEGER PRIMARY KEY,
+    uuid TEXT NOT NULL,
+    size INTEGER NOT NULL,
+    owner_id INTEGER NOT NULL,
+    updated_at TEXT DEFAULT CURRENT_TIMESTAMP,
+    FOREIGN KEY (file_id) REFERENCES files(id),
+    FOREIGN KEY (owner_id) REFERENCES users(id)
+);
+
 -- Activity logs
 CREATE TABLE IF NOT EXISTS activity_logs (
     id INTEGER PRIMARY KEY AUTOINCREMENT,
@@ -35,6 +66,12 @@ CREATE TABLE IF NOT EXISTS activity_logs (
 
 -- Indexes
 CREATE INDEX IF NOT EXISTS idx_files_parent ON files(parent_id);
+-- Paged listings in name order (LIST_DIR "limit"); rows of equal name
+-- follow in id order, as the index also holds the rowid
+CREATE INDEX IF NOT EXISTS idx_files_parent_name ON files(parent_id, name);
+-- Paged listings with directories first (LIST_DIR "sort": "directories"),
+-- read from either end
+CREATE INDEX IF NOT EXISTS idx_files_parent_kind_name ON files(parent_id, is_directory DESC, name);
 CREATE INDEX IF NOT EXISTS idx_files_owner ON files(owner_id);
 CREATE INDEX IF NOT EXISTS idx_logs_user ON activity_logs(user_id);
 CREATE INDEX IF NOT EXISTS idx_users_admin ON users(is_admin);
@@ -11,7 +11,12 @@ Database* db_init(const char* db_path) {
         return NULL;
     }
 
-    pthread_mutex_init(&db->mutex, NULL);
+    // Recursive, so db_begin() can hold it across the calls of a transaction
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&db->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
 
     int rc = sqlite3_open(db_path, &db->conn);
     if (rc != SQLITE_OK) {
@@ -20,6 +25,9 @@ Database* db_init(const char* db_path) {
         return NULL;
     }
 
+    // Wait out short write locks held by another server process
+    sqlite3_busy_timeout(db->conn, DB_BUSY_TIMEOUT_MS);
+
     // Enable WAL mode for better concurrency
     sqlite3_exec(db->conn, "PRAGMA journal_mode=WAL;", NULL, NULL, NULL);
 
@@ -40,6 +48,20 @@ void db_close(Database* db) {
     }
 }
 
+// Databases created before files.version get the column before the
+// schema, whose triggers use it, runs. On a new database both statements
+// fail harmlessly and the schema creates the table with it.
+static void db_migrate(Database* db) {
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db->conn, "SELECT version FROM files LIMIT 0", -1, &stmt,
+                           NULL) == SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        return;
+    }
+    sqlite3_exec(db->conn, "ALTER TABLE files ADD COLUMN version INTEGER NOT NULL DEFAULT 0",
+                 NULL, NULL, NULL);
+}
+
 int db_init_schema(Database* db, const char* schema_path) {
     FILE* f = fopen(schema_path, "r");
     if (!f) {
@@ -59,6 +81,8 @@ int db_init_schema(Database* db, const char* schema_path) {
 
     pthread_mutex_lock(&db->mutex);
 
+    db_migrate(db);
+
     char* err_msg = NULL;
     int rc = sqlite3_exec(db->conn, sql, NULL, NULL, &err_msg);
 
@@ -76,6 +100,36 @@ int db_init_schema(Database* db, const char* schema_path) {
     return 0;
 }
 
+int db_begin(Database* db) {
+    pthread_mutex_lock(&db->mutex);
+    char* err = NULL;
+    if (sqlite3_exec(db->conn, "BEGIN IMMEDIATE", NULL, NULL, &err) != SQLITE_OK) {
+        log_error("BEGIN failed: %s", err ? err : "unknown error");
+        sqlite3_free(err);
+        pthread_mutex_unlock(&db->mutex);
+        return -1;
+    }
+    return 0;
+}
+
+int db_commit(Database* db) {
+    char* err = NULL;
+    int result = 0;
+    if (sqlite3_exec(db->conn, "COMMIT", NULL, NULL, &err) != SQLITE_OK) {
+        log_error("COMMIT failed: %s", err ? err : "unknown error");
+        sqlite3_free(err);
+        sqlite3_exec(db->conn, "ROLLBACK", NULL, NULL, NULL);
+        result = -1;
+    }
+    pthread_mutex_unlock(&db->mutex);
+    return result;
+}
+
+void db_rollback(Database* db) {
+    sqlite3_exec(db->conn, "ROLLBACK", NULL, NULL, NULL);
+    pthread_mutex_unlock(&db->mutex);
+}
+
 int db_create_user(Database* db, const char* username, const char* password_hash) {
     pthread_mutex_lock(&db->mutex);
 
@@ -213,7 +267,7 @@ int db_log_activity(Database* db, int user_id, const char* action_type, const ch
 
 // File operations - stub implementations for Phase 4
 int db_create_file(Database* db, int parent_id, const char* name, const char* physical_path,
-                   int owner_id, long size, int is_directory, int permissions) {
+                   int owner_id, int64_t size, int is_directory, int permissions) {
     pthread_mutex_lock(&db->mutex);
 
     sqlite3_stmt* stmt;
@@ -357,6 +411,142 @@ int db_list_directory(Database* db, int parent_id, FileEntry** entries, int* cou
     return 0;
 }
 
+// Append the rows of parent_id that follow the cursor (if use_cursor) in
+// page's order to rows[*count], up to page->limit + 1 in all. kind >= 0
+// keeps only directories (1) or files (0). Caller holds the lock
+static int fetch_page_rows(Database* db, int parent_id, const DbPage* page, int kind,
+                           int use_cursor, FileEntry* rows, int* count) {
+    // Row-value comparison keeps (name, id) ties in order and lets SQLite
+    // seek into the (parent_id, name) or (parent_id, is_directory, name) index
+    const char* cursor = "";
+    const char* order;
+    if (page->sort == DB_SORT_ID) {
+        if (use_cursor) {
+            cursor = page->descending ? "AND id < ? " : "AND id > ? ";
+        }
+        order = page->descending ? "ORDER BY id DESC" : "ORDER BY id ASC";
+    } else {
+        if (use_cursor) {
+            cursor = page->descending ? "AND (name, id) < (?, ?) " : "AND (name, id) > (?, ?) ";
+        }
+        order = page->descending ? "ORDER BY name DESC, id DESC" : "ORDER BY name ASC, id ASC";
+    }
+
+    char sql[320];
+    snprintf(sql, sizeof(sql),
+             "SELECT id, parent_id, name, physical_path, owner_id, size, is_directory, permissions, created_at "
+             "FROM files WHERE parent_id = ? %s%s%s LIMIT ?",
+             kind >= 0 ? "AND is_directory = ? " : "", cursor, order);
+
+    sqlite3_stmt* stmt;
+    if (sqlite3_prepare_v2(db->conn, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        return -1;
+    }
+
+    int param = 1;
+    sqlite3_bind_int(stmt, param++, parent_id);
+    if (kind >= 0) {
+        sqlite3_bind_int(stmt, param++, kind);
+    }
+    if (cursor[0] && page->sort != DB_SORT_ID) {
+        sqlite3_bind_text(stmt, param++, page->after_name, -1, SQLITE_STATIC);
+        sqlite3_bind_int(stmt, param++, page->after_id);
+    } else if (cursor[0]) {
+        sqlite3_bind_int(stmt, param++, page->after_id);
+    }
+    sqlite3_bind_int(stmt, param, page->limit + 1 - *count);
+
+    int i = *count;
+    while (i <= page->limit && sqlite3_step(stmt) == SQLITE_ROW) {
+        rows[i].id = sqlite3_column_int(stmt, 0);
+        rows[i].parent_id = sqlite3_column_int(stmt, 1);
+        strncpy(rows[i].name, (const char*)sqlite3_column_text(stmt, 2), sizeof(rows[i].name) - 1);
+        const char* path = (const char*)sqlite3_column_text(stmt, 3);
+        if (path) strncpy(rows[i].physical_path, path, sizeof(rows[i].physical_path) - 1);
+        rows[i].owner_id = sqlite3_column_int(stmt, 4);
+        rows[i].size = sqlite3_column_int64(stmt, 5);
+        rows[i].is_directory = sqlite3_column_int(stmt, 6);
+        rows[i].permissions = sqlite3_column_int(stmt, 7);
+        const char* created = (const char*)sqlite3_column_text(stmt, 8);
+        if (created) strncpy(rows[i].created_at, created, sizeof(rows[i].created_at) - 1);
+        i++;
+    }
+
+    sqlite3_finalize(stmt);
+    *count = i;
+    return 0;
+}
+
+int db_list_directory_page(Database* db, int parent_id, const DbPage* page,
+                           FileEntry** entries, int* count, int* more) {
+    if (!page || page->limit <= 0) {
+        return -1;
+    }
+
+    // One extra row tells whether another page follows
+    FileEntry* rows = calloc((size_t)page->limit + 1, sizeof(FileEntry));
+    if (!rows) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&db->mutex);
+
+    int i = 0;
+    int rc;
+    if (page->sort == DB_SORT_DIRECTORIES) {
+        // Two index seeks: the rest of the cursor's kind, then the other
+        // kind from its start (directories first, or last when descending)
+        int first = page->descending ? 0 : 1;
+        int resume = page->after_name ? (page->after_directory ? 1 : 0) : first;
+        rc = fetch_page_rows(db, parent_id, page, resume, page->after_name != NULL, rows, &i);
+        if (rc == 0 && resume == first && i <= page->limit) {
+            rc = fetch_page_rows(db, parent_id, page, !first, 0, rows, &i);
+        }
+    } else {
+        int use_cursor = page->sort == DB_SORT_NAME ? page->after_name != NULL
+                                                    : page->after_id > 0;
+        rc = fetch_page_rows(db, parent_id, page, -1, use_cursor, rows, &i);
+    }
+
+    pthread_mutex_unlock(&db->mutex);
+
+    if (rc < 0) {
+        free(rows);
+        return -1;
+    }
+
+    *more = i > page->limit;
+    *count = *more ? page->limit : i;
+    *entries = rows;
+    return 0;
+}
+
+int db_get_directory_version(Database* db, int dir_id, int64_t* version) {
+    pthread_mutex_lock(&db->mutex);
+
+    sqlite3_stmt* stmt;
+    const char* sql = "SELECT version FROM files WHERE id = ? AND is_directory = 1";
+
+    int rc = sqlite3_prepare_v2(db->conn, sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        pthread_mutex_unlock(&db->mutex);
+        return -1;
+    }
+
+    sqlite3_bind_int(stmt, 1, dir_id);
+
+    int result = -1;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        *version = sqlite3_column_int64(stmt, 0);
+        result = 0;
+    }
+
+    sqlite3_finalize(stmt);
+    pthread_mutex_unlock(&db->mutex);
+
+    return result;
+}
+
 int db_delete_file(Database* db, int file_id) {
     pthread_mutex_lock(&db->mutex);
 
@@ -375,6 +565,17 @@ int db_delete_file(Database* db, int file_id) {
     int result = (rc == SQLITE_DONE) ? 0 : -1;
 
     sqlite3_finalize(stmt);
+
+    // A deleted file cannot be resumed either
+    if (result == 0) {
+        sql = "DELETE FROM partial_uploads WHERE file_id = ?";
+        if (sqlite3_prepare_v2(db->conn, sql, -1, &stmt, NULL) == SQLITE_OK) {
+            sqlite3_bind_int(stmt, 1, file_id);
+            sqlite3_step(stmt);
+            sqlite3_finalize(stmt);
+        }
+    }
+
     pthread_mutex_unlock(&db->mutex);
 
     return result;
@@ -577,3 +778,102 @@ int db_create_user_admin(Database* db, const char* username, const char* passwor
 
     return user_id;
 }
+
+int db_save_partial_upload(Database* db, int file_id, const char* uuid, int64_t size, int owner_id) {
+    pthread_mutex_lock(&db->mutex);
+
+    sqlite3_stmt* stmt;
+    const char* sql = "INSERT OR REPLACE INTO partial_uploads (file_id, uuid, size, owner_id) "
+                      "VALUES (?, ?, ?, ?)";
+
+    int rc = sqlite3_prepare_v2(db->conn, sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        pthread_mutex_unlock(&db->mutex);
+        return -1;
+    }
+
+    sqlite3_bind_int(stmt, 1, file_id);
+    sqlite3_bind_text(stmt, 2, uuid, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, size);
+    sqlite3_bind_int(stmt, 4, owner_id);
+
+    rc = sqlite3_step(stmt);
+    int result = (rc == SQLITE_DONE) ? 0 : -1;
+
+    sqlite3_finalize(stmt);
+    pthread_mutex_unlock(&db->mutex);
+
+    return result;
+}
+
+int db_claim_partial_upload(Database* db, int owner_id, int parent_id, const char* name,
+                            int64_t size, PartialUpload* upload) {
+    pthread_mutex_lock(&db->mutex);
+
+    sqlite3_stmt* stmt;
+    const char* sql = "SELECT p.file_id, p.uuid, p.size FROM partial_uploads p "
+                      "JOIN files f ON f.id = p.file_id "
+                      "WHERE p.owner_id = ? AND f.parent_id = ? AND f.name = ? AND p.size = ? "
+                      "ORDER BY p.updated_at DESC LIMIT 1";
+
+    int rc = sqlite3_prepare_v2(db->conn, sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        pthread_mutex_unlock(&db->mutex);
+        return -1;
+    }
+
+    sqlite3_bind_int(stmt, 1, owner_id);
+    sqlite3_bind_int(stmt, 2, parent_id);
+    sqlite3_bind_text(stmt, 3, name, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 4, size);
+
+    int result = -1;
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        memset(upload, 0, sizeof(*upload));
+        upload->file_id = sqlite3_column_int(stmt, 0);
+        strncpy(upload->uuid, (const char*)sqlite3_column_text(stmt, 1), sizeof(upload->uuid) - 1);
+        upload->size = sqlite3_column_int64(stmt, 2);
+        result = 0;
+    }
+    sqlite3_finalize(stmt);
+
+    // Claimed under the lock: a second session cannot find it any more
+    if (result == 0) {
+        sql = "DELETE FROM partial_uploads WHERE file_id = ?";
+        result = -1;
+        if (sqlite3_prepare_v2(db->conn, sql, -1, &stmt, NULL) == SQLITE_OK) {
+            sqlite3_bind_int(stmt, 1, upload->file_id);
+            if (sqlite3_step(stmt) == SQLITE_DONE) {
+                result = 0;
+            }
+            sqlite3_finalize(stmt);
+        }
+    }
+
+    pthread_mutex_unlock(&db->mutex);
+
+    return result;
+}
+
+int db_is_partial_upload(Database* db, int file_id) {
+    pthread_mutex_lock(&db->mutex);
+
+    sqlite3_stmt* stmt;
+    const char* sql = "SELECT 1 FROM partial_uploads WHERE file_id = ?";
+
+    int rc = sqlite3_prepare_v2(db->conn, sql, -1, &stmt, NULL);
+    if (rc != SQLITE_OK) {
+        pthread_mutex_unlock(&db->mutex);
+        return -1;
+    }
+
+    sqlite3_bind_int(stmt, 1, file_id);
+
+    rc = sqlite3_step(stmt);
+    int result = (rc == SQLITE_ROW) ? 1 : (rc == SQLITE_DONE ? 0 : -1);
+
+    sqlite3_finalize(stmt);
+    pthread_mutex_unlock(&db->mutex);
+
+    return result;
+}
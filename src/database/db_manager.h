@@ -1,9 +1,14 @@
 #ifndef DB_MANAGER_H
 #define DB_MANAGER_H
 
+#include <stdint.h>
 #include <sqlite3.h>
 #include <pthread.h>
 
+// How long a statement waits for another process's lock (e.g. the old
+// server during a hot restart) before failing with SQLITE_BUSY
+#define DB_BUSY_TIMEOUT_MS 5000
+
 // Database handle
 typedef struct {
     sqlite3* conn;
@@ -17,12 +22,39 @@ typedef struct {
     char name[256];
     char physical_path[64];
     int owner_id;
-    long size;
+    int64_t size;
     int is_directory;
     int permissions;
     char created_at[32];
 } FileEntry;
 
+// One page of a directory listing (see db_list_directory_page())
+typedef enum {
+    DB_SORT_NAME,               // By (name, id); served by idx_files_parent_name
+    DB_SORT_ID,
+    DB_SORT_DIRECTORIES         // Directories, then files, each by (name, id), as
+                                // db_list_directory(); served by idx_files_parent_kind_name
+} DbSort;
+
+typedef struct {
+    DbSort sort;
+    int descending;
+    // Cursor: the last entry of the previous page. A first page has no
+    // after_name (DB_SORT_NAME, DB_SORT_DIRECTORIES) or after_id 0
+    // (DB_SORT_ID); DB_SORT_DIRECTORIES also needs whether it was one
+    const char* after_name;
+    int after_id;
+    int after_directory;
+    int limit;                  // Entries per page, > 0
+} DbPage;
+
+// Interrupted chunked upload (see partial_uploads in db_init.sql)
+typedef struct {
+    int file_id;
+    char uuid[64];
+    int64_t size;
+} PartialUpload;
+
 // Initialize database connection
 Database* db_init(const char* db_path);
 
@@ -32,6 +64,14 @@ void db_close(Database* db);
 // Execute schema initialization
 int db_init_schema(Database* db, const char* schema_path);
 
+// Transactions: db_begin() holds the database lock until db_commit() or
+// db_rollback(), so the calls in between (on the same thread) are the
+// only statements in the transaction. db_commit() rolls back on failure.
+// Returns 0 or -1
+int db_begin(Database* db);
+int db_commit(Database* db);
+void db_rollback(Database* db);
+
 // User operations
 int db_create_user(Database* db, const char* username, const char* password_hash);
 int db_verify_user(Database* db, const char* username, const char* password_hash, int* user_id);
@@ -50,10 +90,29 @@ int db_log_activity(Database* db, int user_id, const char* action_type, const ch
 
 // File operations (stubs for Phase 4, but implement signature)
 int db_create_file(Database* db, int parent_id, const char* name, const char* physical_path,
-                   int owner_id, long size, int is_directory, int permissions);
+                   int owner_id, int64_t size, int is_directory, int permissions);
 int db_get_file_by_id(Database* db, int file_id, FileEntry* entry);
 int db_list_directory(Database* db, int parent_id, FileEntry** entries, int* count);
+// Keyset pagination: up to page->limit entries of parent_id past the
+// cursor, found through the index instead of skipping rows, so a page
+// costs the same anywhere in a directory. *more is 1 if entries follow
+int db_list_directory_page(Database* db, int parent_id, const DbPage* page,
+                           FileEntry** entries, int* count, int* more);
+// Version of a directory's listing, raised by every change to its children
+// (see the files_version_* triggers in db_init.sql). Returns 0, or -1 if
+// dir_id is not a directory
+int db_get_directory_version(Database* db, int dir_id, int64_t* version);
 int db_delete_file(Database* db, int file_id);
 int db_update_permissions(Database* db, int file_id, int permissions);
 
+// Partial uploads
+int db_save_partial_upload(Database* db, int file_id, const char* uuid, int64_t size, int owner_id);
+// Take owner_id's partial upload of name (announced with size) in parent_id:
+// its record is removed, so only one session resumes it.
+// Returns 0 and fills *upload when one was claimed, -1 otherwise
+int db_claim_partial_upload(Database* db, int owner_id, int parent_id, const char* name,
+                            int64_t size, PartialUpload* upload);
+// Returns 1 if file_id is an unfinished upload, 0 if not, -1 on error
+int db_is_partial_upload(Database* db, int file_id);
+
 #endif
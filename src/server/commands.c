@@ -1,8 +1,16 @@
 #include "commands.h"
 #include "storage.h"
 #include "permissions.h"
+#include "session_registry.h"
+#include "session_timers.h"
+#include "server.h"
+#include "socket_mgr.h"
+#include "multipart.h"
 #include "../common/utils.h"
 #include "../common/crypto.h"
+#include "../common/io_backend.h"
+#include "../common/compress.h"
+#include "../common/listing.h"
 #include "../database/db_manager.h"
 #include "../../lib/cJSON/cJSON.h"
 #include <stdio.h>
@@ -11,18 +19,100 @@
 #include <unistd.h>
 #include <sys/socket.h>
 
-// Global database handle (defined in main.c)
-extern Database* global_db;
+// Stream ID of the request the current thread is handling; its responses
+// are tagged with it (0 sends untagged frames)
+static __thread uint32_t reply_stream = 0;
+
+// BATCH the current thread is running (see handle_batch): the responses of
+// its sub-requests are collected into a JSON array instead of being sent,
+// and what cannot be undone waits for the commit
+typedef struct {
+    char* results;              // "[...]" text, without the closing bracket
+    size_t length;
+    size_t capacity;
+    int count;
+
+    // Permission checks done so far, one per (file, access)
+    struct {
+        int file_id;
+        AccessType access;
+        int allowed;
+    } checks[BATCH_MAX_REQUESTS];
+    int check_count;
+
+    // Blobs (storage UUIDs) of deleted files, removed once the transaction
+    // commits
+    char* blobs[BATCH_MAX_REQUESTS];
+    int blob_count;
+} Batch;
+
+static __thread Batch* current_batch = NULL;
 
 void commands_init(void) {
     log_info("Command handlers initialized");
 }
 
+int command_is_concurrent(uint8_t command) {
+    // Everything that changes session state (login, current directory,
+    // pending upload) must run alone and in order
+    switch (command) {
+        case CMD_PING:
+        case CMD_LIST_DIR:
+        case CMD_MAKE_DIR:
+        case CMD_DOWNLOAD_REQ:
+        case CMD_READ_RANGE:
+        case CMD_DELETE:
+        case CMD_CHMOD:
+        case CMD_FILE_INFO:
+        case CMD_ADMIN_LIST_USERS:
+        case CMD_ADMIN_CREATE_USER:
+        case CMD_ADMIN_DELETE_USER:
+        case CMD_ADMIN_UPDATE_USER:
+        case CMD_ADMIN_SERVER_STATS:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+int command_is_transfer(uint8_t command) {
+    return command == CMD_DOWNLOAD_REQ || command == CMD_READ_RANGE;
+}
+
+int command_defers_payload(ClientSession* session, const Packet* pkt) {
+    // The handler then waits on the socket for the data; a peer that is
+    // not uploading must not tie up a worker with a frame it never sends
+    if (!packet_defers_payload(pkt) || !session->authenticated) {
+        return 0;
+    }
+    if (pkt->command == CMD_UPLOAD_CHUNK) {
+        return session->pending_upload_uuid != NULL;
+    }
+    return multipart_has_user(&session->server->uploads, session->user_id);
+}
+
+// Take a payload the receiver left on the socket (see packet_defers_payload)
+// off it unused, so the next frame can be read
+static void skip_unread_payload(ClientSession* session, Packet* pkt) {
+    if (!pkt->payload_unread) {
+        return;
+    }
+    pkt->payload_unread = 0;
+    if (io_recv_discard(session->client_socket, pkt->data_length) < 0) {
+        shutdown(session->client_socket, SHUT_RDWR);
+    }
+}
+
 int dispatch_command(ClientSession* session, Packet* pkt) {
-    log_debug("Dispatching command 0x%02X", pkt->command);
+    log_debug("Dispatching command 0x%02X (stream=%u)", pkt->command, pkt->stream_id);
+
+    reply_stream = pkt->stream_id;
 
     // Commands requiring authentication
-    if (pkt->command != CMD_LOGIN_REQ && !session->authenticated) {
+    if (pkt->command != CMD_LOGIN_REQ && pkt->command != CMD_PING &&
+        pkt->command != CMD_ENABLE_STREAMS && pkt->command != CMD_HELLO &&
+        !session->authenticated) {
+        skip_unread_payload(session, pkt);
         send_error(session, "Not authenticated");
         return -1;
     }
@@ -31,6 +121,15 @@ int dispatch_command(ClientSession* session, Packet* pkt) {
         case CMD_LOGIN_REQ:
             handle_login(session, pkt);
             break;
+        case CMD_PING:
+            handle_ping(session, pkt);
+            break;
+        case CMD_ENABLE_STREAMS:
+            handle_enable_streams(session, pkt);
+            break;
+        case CMD_HELLO:
+            handle_hello(session, pkt);
+            break;
         case CMD_LIST_DIR:
             handle_list_dir(session, pkt);
             break;
@@ -46,9 +145,21 @@ int dispatch_command(ClientSession* session, Packet* pkt) {
         case CMD_UPLOAD_DATA:
             handle_upload_data(session, pkt);
             break;
+        case CMD_UPLOAD_CHUNK:
+            handle_upload_chunk(session, pkt);
+            break;
+        case CMD_UPLOAD_COMMIT:
+            handle_upload_commit(session, pkt);
+            break;
+        case CMD_UPLOAD_PART:
+            handle_upload_part(session, pkt);
+            break;
         case CMD_DOWNLOAD_REQ:
             handle_download(session, pkt);
             break;
+        case CMD_READ_RANGE:
+            handle_read_range(session, pkt);
+            break;
         case CMD_CHMOD:
             handle_chmod(session, pkt);
             break;
@@ -58,6 +169,9 @@ int dispatch_command(ClientSession* session, Packet* pkt) {
         case CMD_FILE_INFO:
             handle_file_info(session, pkt);
             break;
+        case CMD_BATCH:
+            handle_batch(session, pkt);
+            break;
         case CMD_ADMIN_LIST_USERS:
             handle_admin_list_users(session, pkt);
             break;
@@ -70,14 +184,94 @@ int dispatch_command(ClientSession* session, Packet* pkt) {
         case CMD_ADMIN_UPDATE_USER:
             handle_admin_update_user(session, pkt);
             break;
+        case CMD_ADMIN_SERVER_STATS:
+            handle_admin_server_stats(session, pkt);
+            break;
         default:
             send_error(session, "Unknown command");
             return -1;
     }
 
+    skip_unread_payload(session, pkt);
     return 0;
 }
 
+// Append the response of a batched sub-request to the batch's results
+static int batch_collect(Batch* batch, const Packet* pkt) {
+    size_t needed = batch->length + pkt->data_length + 2;
+    if (needed > batch->capacity) {
+        size_t capacity = batch->capacity ? batch->capacity : 1024;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        char* grown = realloc(batch->results, capacity);
+        if (!grown) {
+            return -1;
+        }
+        batch->results = grown;
+        batch->capacity = capacity;
+    }
+
+    batch->results[batch->length++] = batch->count++ ? ',' : '[';
+    memcpy(batch->results + batch->length, pkt->payload, pkt->data_length);
+    batch->length += pkt->data_length;
+    return 0;
+}
+
+int send_packet(ClientSession* session, Packet* pkt) {
+    if (current_batch) {
+        return batch_collect(current_batch, pkt);
+    }
+
+    pkt->stream_id = reply_stream;
+
+    // Large responses (mostly JSON) are compressed for clients that agreed
+    // to it; the deflate runs before the lock is taken
+    uint8_t* packed = NULL;
+    size_t packed_len = 0;
+    Packet frame = *pkt;
+    if (session->compression != COMPRESSION_NONE && !pkt->compressed && pkt->payload &&
+        pkt->data_length >= COMPRESS_MIN_SIZE &&
+        compress_payload(session->compression, (const uint8_t*)pkt->payload,
+                         pkt->data_length, COMPRESS_LEVEL_JSON, &packed, &packed_len) == 0) {
+        frame.payload = (char*)packed;
+        frame.data_length = (uint32_t)packed_len;
+        frame.compressed = 1;
+    }
+
+    // Concurrent requests of one session must not interleave their frames
+    pthread_mutex_lock(&session->send_mutex);
+    int result = packet_send(session->client_socket, &frame);
+    pthread_mutex_unlock(&session->send_mutex);
+
+    free(packed);
+
+    return result;
+}
+
+// Bytes moving either way count as activity, so a download the client
+// reads slowly or an upload it sends slowly is not taken for a stalled session
+static void session_progress(void* arg) {
+    session_timers_touch((ClientSession*)arg);
+}
+
+int send_packet_file(ClientSession* session, Packet* pkt, int file_fd,
+                     uint64_t offset, size_t length) {
+    pkt->stream_id = reply_stream;
+
+    pthread_mutex_lock(&session->send_mutex);
+    int result = packet_send_file(session->client_socket, pkt, file_fd, offset, length,
+                                  session_progress, session);
+    if (result < 0) {
+        // The header is out but the frame is cut short: nothing more can be
+        // framed on this connection, so let the reader see it close
+        shutdown(session->client_socket, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&session->send_mutex);
+
+    return result;
+}
+
 void send_error(ClientSession* session, const char* message) {
     cJSON* json = cJSON_CreateObject();
     cJSON_AddStringToObject(json, "status", "ERROR");
@@ -86,7 +280,7 @@ void send_error(ClientSession* session, const char* message) {
     char* payload = cJSON_PrintUnformatted(json);
     Packet* response = packet_create(CMD_ERROR, payload, strlen(payload));
 
-    packet_send(session->client_socket, response);
+    send_packet(session, response);
 
     free(payload);
     packet_free(response);
@@ -95,10 +289,202 @@ void send_error(ClientSession* session, const char* message) {
 
 void send_success(ClientSession* session, uint8_t cmd, const char* json_payload) {
     Packet* response = packet_create(cmd, json_payload, strlen(json_payload));
-    packet_send(session->client_socket, response);
+    send_packet(session, response);
     packet_free(response);
 }
 
+// Forget the session's upload once it is stored or dropped
+static void clear_pending_upload(ClientSession* session) {
+    free(session->pending_upload_uuid);
+    session->pending_upload_uuid = NULL;
+    session->pending_upload_size = 0;
+    session->pending_upload_file_id = 0;
+    session->pending_upload_fd = -1;
+    session->pending_upload_received = 0;
+    session->pending_upload_error = NULL;
+    if (session->state == STATE_TRANSFERRING) {
+        session->state = STATE_AUTHENTICATED;
+    }
+    session_timers_transfer_done(session);
+}
+
+void suspend_pending_upload(ClientSession* session) {
+    // Only chunked uploads keep their bytes in order on disk
+    if (session->pending_upload_uuid && session->pending_upload_fd >= 0 &&
+        session->pending_upload_received > 0 && !session->pending_upload_error &&
+        db_save_partial_upload(session->server->db, session->pending_upload_file_id,
+                               session->pending_upload_uuid, session->pending_upload_size,
+                               session->user_id) == 0) {
+        close(session->pending_upload_fd);
+        session->pending_upload_fd = -1;
+
+        log_info("Upload suspended: file_id=%d, %lld of %lld bytes stored",
+                 session->pending_upload_file_id,
+                 (long long)session->pending_upload_received,
+                 (long long)session->pending_upload_size);
+        clear_pending_upload(session);
+        return;
+    }
+
+    abort_pending_upload(session);
+}
+
+void abort_pending_upload(ClientSession* session) {
+    if (!session->pending_upload_uuid) {
+        return;
+    }
+
+    if (session->pending_upload_fd >= 0) {
+        close(session->pending_upload_fd);
+        session->pending_upload_fd = -1;
+    }
+
+    // The file row was created by UPLOAD_REQ; without data it is an orphan
+    if (session->pending_upload_file_id > 0) {
+        db_delete_file(session->server->db, session->pending_upload_file_id);
+    }
+    if (storage_file_exists(session->server->storage_root, session->pending_upload_uuid)) {
+        storage_delete_file(session->server->storage_root, session->pending_upload_uuid);
+    }
+
+    log_info("Upload abandoned: file_id=%d, uuid=%s",
+             session->pending_upload_file_id, session->pending_upload_uuid);
+
+    clear_pending_upload(session);
+}
+
+// Delete an uncommitted multipart upload's file row and blob
+static void discard_multipart_upload(ClientSession* session, MultipartUpload* upload) {
+    db_delete_file(session->server->db, upload->file_id);
+    storage_delete_file(session->server->storage_root, upload->uuid);
+    log_info("Multipart upload abandoned: file_id=%d, uuid=%s, %u of %u parts stored",
+             upload->file_id, upload->uuid, upload->parts_received, upload->part_count);
+    multipart_release(&session->server->uploads, upload);
+}
+
+void abandon_multipart_uploads(ClientSession* session) {
+    MultipartUpload* upload = multipart_take_owned(&session->server->uploads,
+                                                   session->session_id);
+    while (upload) {
+        MultipartUpload* next = upload->next;
+        discard_multipart_upload(session, upload);
+        upload = next;
+    }
+}
+
+void handle_ping(ClientSession* session, Packet* pkt) {
+    // Echo the payload so the client can match replies or measure RTT
+    Packet* response = packet_create(CMD_PONG, pkt->payload, pkt->data_length);
+    if (!response) {
+        send_error(session, "Internal error");
+        return;
+    }
+    send_packet(session, response);
+    packet_free(response);
+}
+
+// Turn on multiplexing with the server's stream limit, lowered to the
+// client's "max_streams" if json has a smaller one
+static void grant_streams(ClientSession* session, cJSON* json) {
+    int limit = session->server->config.max_streams;
+
+    // The client may ask for fewer concurrent streams than we allow
+    int wanted = limit;
+    cJSON* max_item = json ? cJSON_GetObjectItem(json, "max_streams") : NULL;
+    if (max_item && cJSON_IsNumber(max_item) && max_item->valueint > 0) {
+        wanted = max_item->valueint;
+    }
+
+    session->max_streams = wanted < limit ? wanted : limit;
+    log_info("Multiplexing enabled (max_streams=%d, fd=%d)",
+             session->max_streams, session->client_socket);
+}
+
+void handle_enable_streams(ClientSession* session, Packet* pkt) {
+    if (session->server->config.max_streams <= 0) {
+        send_error(session, "Multiplexing disabled");
+        return;
+    }
+
+    cJSON* json = pkt->payload ? cJSON_Parse(pkt->payload) : NULL;
+    grant_streams(session, json);
+    cJSON_Delete(json);
+
+    cJSON* response = cJSON_CreateObject();
+    cJSON_AddStringToObject(response, "status", "OK");
+    cJSON_AddNumberToObject(response, "max_streams", session->max_streams);
+
+    char* payload = cJSON_PrintUnformatted(response);
+    send_success(session, CMD_SUCCESS, payload);
+    free(payload);
+    cJSON_Delete(response);
+}
+
+void handle_hello(ClientSession* session, Packet* pkt) {
+    cJSON* json = pkt->payload ? cJSON_Parse(pkt->payload) : NULL;
+    if (!json) {
+        send_error(session, "Invalid JSON");
+        return;
+    }
+
+    cJSON* version_item = cJSON_GetObjectItem(json, "version");
+    cJSON* max_frame_item = cJSON_GetObjectItem(json, "max_frame");
+    cJSON* features_item = cJSON_GetObjectItem(json, "features");
+    if (!cJSON_IsNumber(version_item) || version_item->valuedouble < 1) {
+        send_error(session, "Missing or invalid 'version' parameter");
+        cJSON_Delete(json);
+        return;
+    }
+    if (max_frame_item && (!cJSON_IsNumber(max_frame_item) ||
+                           max_frame_item->valuedouble < PROTOCOL_MIN_FRAME)) {
+        send_error(session, "Invalid 'max_frame' parameter");
+        cJSON_Delete(json);
+        return;
+    }
+
+    // Both sides keep to the lower version and frame size of the two and
+    // use the features both of them have
+    int version = version_item->valuedouble < PROTOCOL_VERSION ? version_item->valueint
+                                                               : PROTOCOL_VERSION;
+    uint32_t max_frame = MAX_PAYLOAD_SIZE;
+    if (max_frame_item && max_frame_item->valuedouble < MAX_PAYLOAD_SIZE) {
+        max_frame = (uint32_t)max_frame_item->valuedouble;
+    }
+    uint32_t features = protocol_features();
+    if (session->server->config.max_streams <= 0) {
+        features &= ~FEATURE_STREAMS;
+    }
+    features &= cJSON_IsNumber(features_item) ? (uint32_t)features_item->valuedouble : 0;
+
+    session->protocol_version = version;
+    session->max_frame = max_frame;
+    session->features = features;
+    if (features & FEATURE_STREAMS) {
+        grant_streams(session, json);
+    }
+    cJSON_Delete(json);
+
+    cJSON* response = cJSON_CreateObject();
+    cJSON_AddStringToObject(response, "status", "OK");
+    cJSON_AddNumberToObject(response, "version", version);
+    cJSON_AddNumberToObject(response, "max_frame", max_frame);
+    cJSON_AddNumberToObject(response, "features", features);
+    if (features & FEATURE_STREAMS) {
+        cJSON_AddNumberToObject(response, "max_streams", session->max_streams);
+    }
+
+    char* payload = cJSON_PrintUnformatted(response);
+    send_success(session, CMD_SUCCESS, payload);
+    free(payload);
+    cJSON_Delete(response);
+
+    // Frames after the reply may be compressed
+    session->compression = (Compression)protocol_compression(features);
+
+    log_debug("HELLO: version=%d, max_frame=%u, features=0x%02X (fd=%d)",
+              version, max_frame, features, session->client_socket);
+}
+
 void handle_login(ClientSession* session, Packet* pkt) {
     if (!pkt->payload) {
         send_error(session, "Empty payload");
@@ -134,27 +520,43 @@ void handle_login(ClientSession* session, Packet* pkt) {
     }
 
     int user_id = 0;
-    if (db_verify_user(global_db, username, password_hash, &user_id) == 0) {
+    if (db_verify_user(session->server->db, username, password_hash, &user_id) == 0) {
         // Login successful
         session->authenticated = 1;
         session->user_id = user_id;
         session->current_directory = 0;  // Root
         session->state = STATE_AUTHENTICATED;
+        session_timers_authenticated(session);
 
         // Check if user is admin
-        int is_admin = db_is_admin(global_db, user_id);
+        int is_admin = db_is_admin(session->server->db, user_id);
 
         // Log successful login
-        db_log_activity(global_db, user_id, "LOGIN", "User logged in successfully");
+        db_log_activity(session->server->db, user_id, "LOGIN", "User logged in successfully");
 
         cJSON* response_json = cJSON_CreateObject();
         cJSON_AddStringToObject(response_json, "status", "OK");
         cJSON_AddNumberToObject(response_json, "user_id", session->user_id);
         cJSON_AddNumberToObject(response_json, "is_admin", is_admin);
 
+        // Take the first compression method of the client's offer we know
+        Compression compression = COMPRESSION_NONE;
+        cJSON* method;
+        cJSON_ArrayForEach(method, cJSON_GetObjectItem(json, "compression")) {
+            compression = compression_from_name(cJSON_GetStringValue(method));
+            if (compression != COMPRESSION_NONE) {
+                cJSON_AddStringToObject(response_json, "compression",
+                                        compression_name(compression));
+                break;
+            }
+        }
+
         char* response_payload = cJSON_PrintUnformatted(response_json);
         send_success(session, CMD_LOGIN_RES, response_payload);
 
+        // Frames after LOGIN_RES may be compressed
+        session->compression = compression;
+
         log_info("User '%s' logged in successfully (user_id=%d, is_admin=%d)", username, user_id, is_admin);
 
         free(response_payload);
@@ -169,6 +571,172 @@ void handle_login(ClientSession* session, Packet* pkt) {
     cJSON_Delete(json);
 }
 
+// Whether a LIST_DIR or FILE_INFO request asks for the binary encoding
+// (only once HELLO agreed on it, and never inside a BATCH, whose results
+// are JSON). *fields gets its "fields" projection, or defaults
+static int wants_binary_listing(ClientSession* session, cJSON* json, uint32_t defaults,
+                                uint32_t* fields) {
+    const char* encoding = cJSON_GetStringValue(cJSON_GetObjectItem(json, "encoding"));
+    if (!(session->features & FEATURE_BINARY_LIST) || current_batch || !encoding ||
+        strcmp(encoding, "binary") != 0) {
+        return 0;
+    }
+
+    cJSON* fields_item = cJSON_GetObjectItem(json, "fields");
+    *fields = defaults;
+    if (cJSON_IsNumber(fields_item)) {
+        *fields = (uint32_t)fields_item->valuedouble & LISTING_FIELDS_ALL;
+    }
+    return 1;
+}
+
+static ListingEntry listing_entry(const FileEntry* entry) {
+    ListingEntry out = {
+        .id = entry->id,
+        .parent_id = entry->parent_id,
+        .owner_id = entry->owner_id,
+        .permissions = entry->permissions,
+        .is_directory = entry->is_directory,
+        .size = entry->size,
+        .name = entry->name,
+        .created_at = entry->created_at,
+    };
+    return out;
+}
+
+// Binary encoding of count entries with the given columns, or NULL
+static uint8_t* encode_listing(const FileEntry* entries, int count, uint32_t fields,
+                               int64_t version, size_t* length) {
+    ListingEntry* rows = malloc((count ? count : 1) * sizeof(ListingEntry));
+    if (!rows) {
+        return NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        rows[i] = listing_entry(&entries[i]);
+    }
+
+    uint8_t* data = listing_encode(rows, count, fields, (uint64_t)version, length);
+    free(rows);
+    return data;
+}
+
+// Send count entries with the given columns in the binary encoding
+static void send_listing(ClientSession* session, uint8_t command, const FileEntry* entries,
+                         int count, uint32_t fields, int64_t version) {
+    size_t length = 0;
+    uint8_t* data = encode_listing(entries, count, fields, version, &length);
+    if (!data) {
+        send_error(session, "Listing too large");
+        return;
+    }
+
+    Packet response = {0};
+    response.command = command;
+    response.data_length = (uint32_t)length;
+    response.payload = (char*)data;
+    send_packet(session, &response);
+    free(data);
+}
+
+// Read a paged LIST_DIR's "limit", "sort", "order" and cursor into page.
+// Returns 0, or -1 after sending the error
+static int parse_list_page(ClientSession* session, cJSON* json, DbPage* page) {
+    cJSON* limit_item = cJSON_GetObjectItem(json, "limit");
+    cJSON* after_name_item = cJSON_GetObjectItem(json, "after_name");
+    cJSON* after_id_item = cJSON_GetObjectItem(json, "after_id");
+    cJSON* after_directory_item = cJSON_GetObjectItem(json, "after_directory");
+    const char* sort = cJSON_GetStringValue(cJSON_GetObjectItem(json, "sort"));
+    const char* order = cJSON_GetStringValue(cJSON_GetObjectItem(json, "order"));
+
+    memset(page, 0, sizeof(*page));
+    if (!cJSON_IsNumber(limit_item) || limit_item->valuedouble < 1) {
+        send_error(session, "Invalid 'limit' parameter");
+        return -1;
+    }
+    page->limit = limit_item->valuedouble < LIST_PAGE_MAX ? limit_item->valueint : LIST_PAGE_MAX;
+
+    if (!sort || strcmp(sort, "name") == 0) {
+        page->sort = DB_SORT_NAME;
+    } else if (strcmp(sort, "id") == 0) {
+        page->sort = DB_SORT_ID;
+    } else if (strcmp(sort, "directories") == 0) {
+        page->sort = DB_SORT_DIRECTORIES;
+    } else {
+        send_error(session, "Invalid 'sort' parameter");
+        return -1;
+    }
+    if (order && strcmp(order, "desc") == 0) {
+        page->descending = 1;
+    } else if (order && strcmp(order, "asc") != 0) {
+        send_error(session, "Invalid 'order' parameter");
+        return -1;
+    }
+
+    if ((after_name_item && !cJSON_IsString(after_name_item)) ||
+        (after_id_item && !cJSON_IsNumber(after_id_item))) {
+        send_error(session, "Invalid cursor");
+        return -1;
+    }
+    page->after_name = cJSON_GetStringValue(after_name_item);
+    page->after_id = after_id_item ? after_id_item->valueint : 0;
+    page->after_directory = cJSON_IsTrue(after_directory_item) ||
+                            (cJSON_IsNumber(after_directory_item) && after_directory_item->valueint);
+    return 0;
+}
+
+// Send a LIST_DIR payload straight from the listing cache and give the
+// entry back
+static void send_cached_listing(ClientSession* session, ListingCacheEntry* entry) {
+    Packet response = {0};
+    response.command = CMD_LIST_DIR;
+    response.payload = (char*)entry->data;
+    response.data_length = entry->length;
+    response.compressed = entry->compressed;
+    send_packet(session, &response);
+    listing_cache_release(&session->server->listings, entry);
+}
+
+// Send an encoded LIST_DIR payload, taking over data. With a key it is
+// first compressed the way send_packet() would and kept in the listing
+// cache, so the next request for it costs no query, encoding or deflate
+static void send_list_payload(ClientSession* session, const ListingCacheKey* key,
+                              uint8_t* data, size_t length) {
+    int compressed = 0;
+    if (key) {
+        uint8_t* packed = NULL;
+        size_t packed_len = 0;
+        if (session->compression != COMPRESSION_NONE && length >= COMPRESS_MIN_SIZE &&
+            compress_payload(session->compression, data, length, COMPRESS_LEVEL_JSON,
+                             &packed, &packed_len) == 0) {
+            free(data);
+            data = packed;
+            length = packed_len;
+            compressed = 1;
+        }
+
+        ListingCacheEntry* entry = listing_cache_put(&session->server->listings, key, data,
+                                                     (uint32_t)length, compressed);
+        if (entry) {
+            send_cached_listing(session, entry);
+            return;
+        }
+    }
+
+    Packet response = {0};
+    response.command = CMD_LIST_DIR;
+    response.payload = (char*)data;
+    response.data_length = (uint32_t)length;
+    response.compressed = compressed;
+    send_packet(session, &response);
+    free(data);
+}
+
+// The listing of dir_id changed: its cached payloads are unreachable under
+// the new version, so free them now
+static void directory_changed(ClientSession* session, int dir_id) {
+    listing_cache_invalidate(&session->server->listings, dir_id);
+}
+
 void handle_list_dir(ClientSession* session, Packet* pkt) {
     cJSON* json = cJSON_Parse(pkt->payload);
     int dir_id = session->current_directory;
@@ -179,23 +747,98 @@ void handle_list_dir(ClientSession* session, Packet* pkt) {
     }
 
     // Check READ permission on directory
-    if (!check_permission(global_db, session->user_id, dir_id, ACCESS_READ)) {
+    if (!check_permission(session->server->db, session->user_id, dir_id, ACCESS_READ)) {
         send_error(session, "Permission denied");
-        db_log_activity(global_db, session->user_id, "ACCESS_DENIED", "LIST_DIR");
+        db_log_activity(session->server->db, session->user_id, "ACCESS_DENIED", "LIST_DIR");
         if (json) cJSON_Delete(json);
         return;
     }
 
+    // The version is read before the entries: a change in between makes
+    // the client's next "if_version" miss, never match a stale listing
+    int64_t version = 0;
+    int versioned = db_get_directory_version(session->server->db, dir_id, &version) == 0;
+    cJSON* if_version_item = json ? cJSON_GetObjectItem(json, "if_version") : NULL;
+    if (versioned && cJSON_IsNumber(if_version_item) &&
+        (int64_t)if_version_item->valuedouble == version) {
+        Packet response = {0};
+        response.command = CMD_NOT_MODIFIED;
+        send_packet(session, &response);
+        cJSON_Delete(json);
+        db_log_activity(session->server->db, session->user_id, "LIST_DIR", NULL);
+        return;
+    }
+
+    // With "limit" one page past the cursor, else the whole directory
     FileEntry* entries = NULL;
     int count = 0;
-    if (db_list_directory(global_db, dir_id, &entries, &count) < 0) {
+    int paged = json && cJSON_GetObjectItem(json, "limit");
+    int more = 0;
+    DbPage page;
+    if (paged && parse_list_page(session, json, &page) < 0) {
+        cJSON_Delete(json);
+        return;
+    }
+
+    // Records and a string table instead of a JSON tree
+    uint32_t fields = 0;
+    int binary = json && wants_binary_listing(session, json, LISTING_FIELDS_DEFAULT, &fields);
+    if (binary && versioned && (session->features & FEATURE_DIR_VERSION)) {
+        fields |= LISTING_FLAG_VERSION;
+    }
+
+    // A whole directory or its first page is the same for every reader of
+    // one version, so hot directories are sent from the listing cache
+    ListingCacheKey key = {
+        .dir_id = dir_id,
+        .version = version,
+        .encoding = binary ? fields : LISTING_CACHE_JSON,
+        .limit = paged ? page.limit : 0,
+        .sort = paged ? (int)page.sort : 0,
+        .descending = paged ? page.descending : 0,
+        .compression = (int)session->compression,
+    };
+    int cacheable = versioned && !current_batch && session->server->listings.capacity > 0 &&
+                    !(paged && (page.after_name || page.after_id));
+    if (cacheable) {
+        ListingCacheEntry* hit = listing_cache_get(&session->server->listings, &key);
+        if (hit) {
+            send_cached_listing(session, hit);
+            cJSON_Delete(json);
+            db_log_activity(session->server->db, session->user_id, "LIST_DIR", NULL);
+            return;
+        }
+    }
+
+    int rc = paged ? db_list_directory_page(session->server->db, dir_id, &page,
+                                            &entries, &count, &more)
+                   : db_list_directory(session->server->db, dir_id, &entries, &count);
+    if (rc < 0) {
         send_error(session, "Failed to list directory");
         if (json) cJSON_Delete(json);
         return;
     }
 
+    if (binary) {
+        size_t length = 0;
+        uint8_t* data = encode_listing(entries, count, more ? fields | LISTING_FLAG_MORE : fields,
+                                       version, &length);
+        if (data) {
+            send_list_payload(session, cacheable ? &key : NULL, data, length);
+        } else {
+            send_error(session, "Listing too large");
+        }
+        free(entries);
+        cJSON_Delete(json);
+        db_log_activity(session->server->db, session->user_id, "LIST_DIR", NULL);
+        return;
+    }
+
     cJSON* response = cJSON_CreateObject();
     cJSON_AddStringToObject(response, "status", "OK");
+    if (versioned) {
+        cJSON_AddNumberToObject(response, "version", (double)version);
+    }
     cJSON* files_array = cJSON_AddArrayToObject(response, "files");
 
     for (int i = 0; i < count; i++) {
@@ -209,15 +852,46 @@ void handle_list_dir(ClientSession* session, Packet* pkt) {
         cJSON_AddItemToArray(files_array, item);
     }
 
+    // The next page starts after the last entry of this one
+    if (paged) {
+        cJSON_AddBoolToObject(response, "more", more);
+    }
+    if (more) {
+        cJSON* next = cJSON_AddObjectToObject(response, "next");
+        cJSON_AddStringToObject(next, "after_name", entries[count - 1].name);
+        cJSON_AddNumberToObject(next, "after_id", entries[count - 1].id);
+        cJSON_AddBoolToObject(next, "after_directory", entries[count - 1].is_directory);
+    }
+
     char* payload = cJSON_PrintUnformatted(response);
-    send_success(session, CMD_LIST_DIR, payload);
+    send_list_payload(session, cacheable ? &key : NULL, (uint8_t*)payload, strlen(payload));
 
     free(entries);
-    free(payload);
     if (json) cJSON_Delete(json);
     cJSON_Delete(response);
 
-    db_log_activity(global_db, session->user_id, "LIST_DIR", NULL);
+    db_log_activity(session->server->db, session->user_id, "LIST_DIR", NULL);
+}
+
+// check_permission(), asked once per (file, access) within a BATCH
+static int check_permission_cached(ClientSession* session, int file_id, AccessType access) {
+    Batch* batch = current_batch;
+    if (batch) {
+        for (int i = 0; i < batch->check_count; i++) {
+            if (batch->checks[i].file_id == file_id && batch->checks[i].access == access) {
+                return batch->checks[i].allowed;
+            }
+        }
+    }
+
+    int allowed = check_permission(session->server->db, session->user_id, file_id, access);
+    if (batch && batch->check_count < BATCH_MAX_REQUESTS) {
+        batch->checks[batch->check_count].file_id = file_id;
+        batch->checks[batch->check_count].access = access;
+        batch->checks[batch->check_count].allowed = allowed;
+        batch->check_count++;
+    }
+    return allowed;
 }
 
 void handle_mkdir(ClientSession* session, Packet* pkt) {
@@ -250,244 +924,844 @@ void handle_mkdir(ClientSession* session, Packet* pkt) {
         log_info("handle_mkdir: parent_id overridden to %d", parent_id);
     }
 
-    // Check WRITE permission on parent directory
-    if (!check_permission(global_db, session->user_id, parent_id, ACCESS_WRITE)) {
-        log_error("handle_mkdir: Permission denied for user %d on parent %d", session->user_id, parent_id);
-        send_error(session, "Permission denied");
-        db_log_activity(global_db, session->user_id, "ACCESS_DENIED", "MKDIR");
-        cJSON_Delete(json);
+    // Check WRITE permission on parent directory
+    if (!check_permission_cached(session, parent_id, ACCESS_WRITE)) {
+        log_error("handle_mkdir: Permission denied for user %d on parent %d", session->user_id, parent_id);
+        send_error(session, "Permission denied");
+        db_log_activity(session->server->db, session->user_id, "ACCESS_DENIED", "MKDIR");
+        cJSON_Delete(json);
+        return;
+    }
+
+    log_info("handle_mkdir: Permission check passed, creating directory");
+
+    // Create directory entry in database (no physical path for directories)
+    int new_dir_id = db_create_file(session->server->db, parent_id, name, "",
+                                     session->user_id, 0, 1, 0755);
+
+    if (new_dir_id < 0) {
+        log_error("handle_mkdir: db_create_file failed, returned %d", new_dir_id);
+        send_error(session, "Failed to create directory");
+        cJSON_Delete(json);
+        return;
+    }
+
+    log_info("handle_mkdir: Successfully created directory with id=%d", new_dir_id);
+    directory_changed(session, parent_id);
+
+    cJSON* response = cJSON_CreateObject();
+    cJSON_AddStringToObject(response, "status", "OK");
+    cJSON_AddNumberToObject(response, "directory_id", new_dir_id);
+    cJSON_AddStringToObject(response, "name", name);
+
+    char* payload = cJSON_PrintUnformatted(response);
+    send_success(session, CMD_SUCCESS, payload);
+
+    free(payload);
+    cJSON_Delete(json);
+    cJSON_Delete(response);
+
+    db_log_activity(session->server->db, session->user_id, "MAKE_DIR", name);
+}
+
+// UPLOAD_REQ "multipart": create the file, allocate its blob at full size
+// and register the upload; parts then come as UPLOAD_PART on any of the
+// user's connections
+static void begin_multipart_upload(ClientSession* session, cJSON* json, const char* name,
+                                   int64_t size, int parent_id) {
+    uint32_t part_size = CHUNK_MAX_SIZE;
+    cJSON* part_size_item = cJSON_GetObjectItem(json, "part_size");
+    if (part_size_item) {
+        if (!cJSON_IsNumber(part_size_item) || part_size_item->valuedouble < 1 ||
+            part_size_item->valuedouble > MULTIPART_MAX_PART_SIZE) {
+            send_error(session, "Invalid 'part_size' parameter");
+            return;
+        }
+        part_size = (uint32_t)part_size_item->valuedouble;
+    }
+
+    char* uuid = generate_uuid();
+    if (!uuid) {
+        send_error(session, "Failed to generate UUID");
+        return;
+    }
+
+    int file_id = db_create_file(session->server->db, parent_id, name, uuid,
+                                 session->user_id, size, 0, 0644);
+    if (file_id < 0) {
+        send_error(session, "Failed to create file entry");
+        free(uuid);
+        return;
+    }
+    directory_changed(session, parent_id);
+
+    int fd = storage_open_write(session->server->storage_root, uuid);
+    if (fd < 0 || storage_preallocate(fd, size) < 0 ||
+        multipart_begin(&session->server->uploads, file_id, session->user_id,
+                        session->session_id, uuid, size, part_size, fd) < 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        db_delete_file(session->server->db, file_id);
+        storage_delete_file(session->server->storage_root, uuid);
+        send_error(session, "Failed to allocate file in storage");
+        free(uuid);
+        return;
+    }
+
+    cJSON* response = cJSON_CreateObject();
+    cJSON_AddStringToObject(response, "status", "READY");
+    cJSON_AddNumberToObject(response, "file_id", file_id);
+    cJSON_AddStringToObject(response, "uuid", uuid);
+    cJSON_AddNumberToObject(response, "upload_id", file_id);
+    cJSON_AddNumberToObject(response, "part_size", part_size);
+
+    char* payload = cJSON_PrintUnformatted(response);
+    send_success(session, CMD_SUCCESS, payload);
+
+    free(payload);
+    cJSON_Delete(response);
+
+    log_info("Multipart upload opened: file_id=%d, uuid=%s, size=%lld, part_size=%u",
+             file_id, uuid, (long long)size, part_size);
+    free(uuid);
+}
+
+void handle_upload_req(ClientSession* session, Packet* pkt) {
+    cJSON* json = cJSON_Parse(pkt->payload);
+    if (!json) {
+        send_error(session, "Invalid JSON");
+        return;
+    }
+
+    cJSON* name_item = cJSON_GetObjectItem(json, "name");
+    cJSON* size_item = cJSON_GetObjectItem(json, "size");
+
+    if (!name_item || !size_item) {
+        send_error(session, "Missing 'name' or 'size' parameter");
+        cJSON_Delete(json);
+        return;
+    }
+
+    // valueint is an int; sizes are 64-bit (exact in a double up to 2^53)
+    const char* name = cJSON_GetStringValue(name_item);
+    if (!cJSON_IsNumber(size_item) || size_item->valuedouble < 0 ||
+        size_item->valuedouble > 9007199254740992.0) {
+        send_error(session, "Invalid 'size' parameter");
+        cJSON_Delete(json);
+        return;
+    }
+    int64_t size = (int64_t)size_item->valuedouble;
+    int parent_id = session->current_directory;
+
+    // Allow override of parent directory
+    cJSON* parent_item = cJSON_GetObjectItem(json, "parent_id");
+    if (parent_item) {
+        parent_id = parent_item->valueint;
+    }
+
+    // Check WRITE permission on parent directory
+    if (!check_permission(session->server->db, session->user_id, parent_id, ACCESS_WRITE)) {
+        send_error(session, "Permission denied");
+        db_log_activity(session->server->db, session->user_id, "ACCESS_DENIED", "UPLOAD");
+        cJSON_Delete(json);
+        return;
+    }
+
+    if (cJSON_IsTrue(cJSON_GetObjectItem(json, "multipart"))) {
+        begin_multipart_upload(session, json, name, size, parent_id);
+        cJSON_Delete(json);
+        return;
+    }
+
+    // "resume": continue this user's interrupted upload of the same file
+    // (same directory, name and size) from the bytes already stored
+    char* uuid = NULL;
+    int file_id = -1;
+    int fd = -1;
+    int64_t offset = 0;
+    PartialUpload partial;
+    if (cJSON_IsTrue(cJSON_GetObjectItem(json, "resume")) && name &&
+        db_claim_partial_upload(session->server->db, session->user_id, parent_id,
+                                name, size, &partial) == 0) {
+        fd = storage_open_resume(session->server->storage_root, partial.uuid, &offset);
+        if (fd >= 0 && offset <= size) {
+            uuid = str_duplicate(partial.uuid);
+            file_id = partial.file_id;
+        } else {
+            // Nothing usable left of it: replace it with a fresh upload
+            if (fd >= 0) {
+                close(fd);
+                fd = -1;
+            }
+            offset = 0;
+            db_delete_file(session->server->db, partial.file_id);
+            storage_delete_file(session->server->storage_root, partial.uuid);
+        }
+    }
+
+    if (!uuid) {
+        // Generate UUID for file storage
+        uuid = generate_uuid();
+        if (!uuid) {
+            send_error(session, "Failed to generate UUID");
+            cJSON_Delete(json);
+            return;
+        }
+
+        // Create file entry in database
+        file_id = db_create_file(session->server->db, parent_id, name, uuid,
+                                 session->user_id, size, 0, 0644);
+
+        if (file_id < 0) {
+            send_error(session, "Failed to create file entry");
+            free(uuid);
+            cJSON_Delete(json);
+            return;
+        }
+        directory_changed(session, parent_id);
+    }
+
+    // Store UUID and size in session for upcoming upload
+    abort_pending_upload(session);
+    session->pending_upload_uuid = uuid;
+    session->pending_upload_size = size;
+    session->pending_upload_file_id = file_id;
+    session->pending_upload_fd = fd;
+    session->pending_upload_received = offset;
+    session->state = STATE_TRANSFERRING;
+    session_timers_transfer_start(session);
+
+    // Send READY response with file_id and where the chunks start
+    cJSON* response = cJSON_CreateObject();
+    cJSON_AddStringToObject(response, "status", "READY");
+    cJSON_AddNumberToObject(response, "file_id", file_id);
+    cJSON_AddStringToObject(response, "uuid", uuid);
+    cJSON_AddNumberToObject(response, "chunk_size", CHUNK_MAX_SIZE);
+    cJSON_AddNumberToObject(response, "offset", (double)offset);
+
+    char* payload = cJSON_PrintUnformatted(response);
+    send_success(session, CMD_SUCCESS, payload);
+
+    free(payload);
+    cJSON_Delete(json);
+    cJSON_Delete(response);
+
+    log_info("Upload request accepted: file_id=%d, uuid=%s, size=%lld, offset=%lld",
+             file_id, uuid, (long long)size, (long long)offset);
+}
+
+void handle_upload_data(ClientSession* session, Packet* pkt) {
+    // Check that upload request was made
+    if (!session->pending_upload_uuid) {
+        send_error(session, "No pending upload. Send UPLOAD_REQ first");
+        return;
+    }
+
+    // Verify payload exists and size matches
+    if (!pkt->payload || pkt->data_length == 0) {
+        send_error(session, "Empty upload data");
+        abort_pending_upload(session);
+        return;
+    }
+
+    if (session->pending_upload_fd >= 0) {
+        send_error(session, "Chunked upload in progress. Send UPLOAD_COMMIT");
+        abort_pending_upload(session);
+        return;
+    }
+
+    if ((int64_t)pkt->data_length != session->pending_upload_size) {
+        char error_msg[128];
+        snprintf(error_msg, sizeof(error_msg),
+                "Size mismatch. Expected %lld bytes, got %u bytes",
+                (long long)session->pending_upload_size, pkt->data_length);
+        send_error(session, error_msg);
+        abort_pending_upload(session);
+        return;
+    }
+
+    // Write file to storage
+    if (storage_write_file(session->server->storage_root, session->pending_upload_uuid,
+                          (uint8_t*)pkt->payload,
+                          pkt->data_length) < 0) {
+        send_error(session, "Failed to write file to storage");
+        abort_pending_upload(session);
+        return;
+    }
+
+    // Log activity
+    db_log_activity(session->server->db, session->user_id, "UPLOAD",
+                   session->pending_upload_uuid);
+
+    // Send success response
+    cJSON* response = cJSON_CreateObject();
+    cJSON_AddStringToObject(response, "status", "OK");
+    cJSON_AddStringToObject(response, "message", "File uploaded successfully");
+
+    char* payload = cJSON_PrintUnformatted(response);
+    send_success(session, CMD_SUCCESS, payload);
+
+    free(payload);
+    cJSON_Delete(response);
+
+    log_info("Upload completed: uuid=%s, size=%lld",
+             session->pending_upload_uuid, (long long)session->pending_upload_size);
+
+    // Clear pending upload
+    clear_pending_upload(session);
+}
+
+// Keep the first failure of a chunked upload for UPLOAD_COMMIT to report
+static void fail_upload_chunk(ClientSession* session, const char* error) {
+    log_error("Upload chunk rejected (uuid=%s): %s", session->pending_upload_uuid, error);
+    session->pending_upload_error = error;
+    if (session->pending_upload_fd >= 0) {
+        close(session->pending_upload_fd);
+        session->pending_upload_fd = -1;
+    }
+}
+
+// Check the next chunk of the session's upload and open its file on the
+// first one. Returns 0 to write the chunk, -1 to drop it.
+static int accept_upload_chunk(ClientSession* session, uint32_t data_length, uint64_t offset) {
+    if (!session->pending_upload_uuid || session->pending_upload_error) {
+        return -1;
+    }
+
+    if (data_length <= CHUNK_OFFSET_SIZE || data_length - CHUNK_OFFSET_SIZE > CHUNK_MAX_SIZE) {
+        fail_upload_chunk(session, "Invalid chunk size");
+        return -1;
+    }
+    size_t length = data_length - CHUNK_OFFSET_SIZE;
+
+    // Chunks arrive in order; a gap or overlap means one was lost
+    if (offset != (uint64_t)session->pending_upload_received) {
+        fail_upload_chunk(session, "Unexpected chunk offset");
+        return -1;
+    }
+    if (offset + length > (uint64_t)session->pending_upload_size) {
+        fail_upload_chunk(session, "Chunk exceeds the announced size");
+        return -1;
+    }
+
+    if (session->pending_upload_fd < 0) {
+        session->pending_upload_fd = storage_open_write(session->server->storage_root,
+                                                        session->pending_upload_uuid);
+        if (session->pending_upload_fd < 0) {
+            fail_upload_chunk(session, "Failed to open file in storage");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// UPLOAD_CHUNK still on the socket: the data is spliced into the file
+// without entering user space. The whole frame is consumed either way.
+static void ingest_upload_chunk(ClientSession* session, Packet* pkt) {
+    int sock = session->client_socket;
+    size_t remaining = pkt->data_length;
+    pkt->payload_unread = 0;
+
+    uint64_t offset = 0;
+    if (remaining >= CHUNK_OFFSET_SIZE) {
+        uint8_t prefix[CHUNK_OFFSET_SIZE];
+        if (io_recv_all(sock, prefix, sizeof(prefix)) != (ssize_t)sizeof(prefix)) {
+            shutdown(sock, SHUT_RDWR);
+            return;
+        }
+        remaining -= CHUNK_OFFSET_SIZE;
+        offset = packet_get_u64(prefix);
+    }
+
+    if (accept_upload_chunk(session, pkt->data_length, offset) == 0) {
+        size_t consumed = 0;
+        int rc = io_splice_to_file(sock, session->pending_upload_fd, (off_t)offset,
+                                   remaining, &consumed, session_progress, session);
+        remaining -= consumed;
+        if (rc == 0) {
+            session->pending_upload_received += (int64_t)consumed;
+            return;
+        }
+        if (rc == -1) {
+            // Cut off mid-frame: the connection cannot be read any further
+            log_error("Upload chunk receive failed (uuid=%s)", session->pending_upload_uuid);
+            shutdown(sock, SHUT_RDWR);
+            return;
+        }
+        fail_upload_chunk(session, "Failed to write file to storage");
+    }
+
+    // Dropped: skip its data to reach the next frame
+    if (remaining > 0 && io_recv_discard(sock, remaining) < 0) {
+        shutdown(sock, SHUT_RDWR);
+    }
+}
+
+void handle_upload_chunk(ClientSession* session, Packet* pkt) {
+    // Chunks are not answered, so a client can stream without waiting;
+    // UPLOAD_COMMIT reports the outcome
+    if (pkt->payload_unread) {
+        ingest_upload_chunk(session, pkt);
+        return;
+    }
+
+    uint64_t offset = 0;
+    if (pkt->data_length >= CHUNK_OFFSET_SIZE) {
+        offset = packet_get_u64((const uint8_t*)pkt->payload);
+    }
+    if (accept_upload_chunk(session, pkt->data_length, offset) < 0) {
+        return;
+    }
+
+    // Written straight away: the session holds one chunk at a time
+    size_t length = pkt->data_length - CHUNK_OFFSET_SIZE;
+    if (storage_write_at(session->pending_upload_fd,
+                         (const uint8_t*)pkt->payload + CHUNK_OFFSET_SIZE,
+                         length, offset) < 0) {
+        fail_upload_chunk(session, "Failed to write file to storage");
         return;
     }
 
-    log_info("handle_mkdir: Permission check passed, creating directory");
+    session->pending_upload_received += (int64_t)length;
+}
 
-    // Create directory entry in database (no physical path for directories)
-    int new_dir_id = db_create_file(global_db, parent_id, name, "",
-                                     session->user_id, 0, 1, 0755);
+// UPLOAD_COMMIT {"upload_id"}: every part must have been written
+static void commit_multipart_upload(ClientSession* session, int upload_id) {
+    const char* error = NULL;
+    MultipartUpload* upload = multipart_take(&session->server->uploads, upload_id,
+                                             session->session_id, &error);
+    if (!upload) {
+        send_error(session, error);
+        return;
+    }
 
-    if (new_dir_id < 0) {
-        log_error("handle_mkdir: db_create_file failed, returned %d", new_dir_id);
-        send_error(session, "Failed to create directory");
-        cJSON_Delete(json);
+    if (upload->parts_received != upload->part_count) {
+        char error_msg[128];
+        snprintf(error_msg, sizeof(error_msg), "Missing parts. Expected %u, got %u",
+                 upload->part_count, upload->parts_received);
+        send_error(session, error_msg);
+        discard_multipart_upload(session, upload);
         return;
     }
 
-    log_info("handle_mkdir: Successfully created directory with id=%d", new_dir_id);
+    int fd = upload->fd;
+    upload->fd = -1;
+    if (close(fd) < 0) {
+        send_error(session, "Failed to write file to storage");
+        discard_multipart_upload(session, upload);
+        return;
+    }
+
+    db_log_activity(session->server->db, session->user_id, "UPLOAD", upload->uuid);
 
     cJSON* response = cJSON_CreateObject();
     cJSON_AddStringToObject(response, "status", "OK");
-    cJSON_AddNumberToObject(response, "directory_id", new_dir_id);
-    cJSON_AddStringToObject(response, "name", name);
+    cJSON_AddStringToObject(response, "message", "File uploaded successfully");
+    cJSON_AddNumberToObject(response, "file_id", upload->file_id);
+    cJSON_AddNumberToObject(response, "size", (double)upload->size);
 
     char* payload = cJSON_PrintUnformatted(response);
     send_success(session, CMD_SUCCESS, payload);
 
     free(payload);
-    cJSON_Delete(json);
     cJSON_Delete(response);
 
-    db_log_activity(global_db, session->user_id, "MAKE_DIR", name);
+    log_info("Multipart upload completed: uuid=%s, size=%lld, parts=%u",
+             upload->uuid, (long long)upload->size, upload->part_count);
+    multipart_release(&session->server->uploads, upload);
 }
 
-void handle_upload_req(ClientSession* session, Packet* pkt) {
-    cJSON* json = cJSON_Parse(pkt->payload);
-    if (!json) {
-        send_error(session, "Invalid JSON");
-        return;
-    }
-
-    cJSON* name_item = cJSON_GetObjectItem(json, "name");
-    cJSON* size_item = cJSON_GetObjectItem(json, "size");
-
-    if (!name_item || !size_item) {
-        send_error(session, "Missing 'name' or 'size' parameter");
+void handle_upload_commit(ClientSession* session, Packet* pkt) {
+    // With "upload_id" the commit ends a multipart upload
+    cJSON* json = pkt->payload ? cJSON_Parse(pkt->payload) : NULL;
+    cJSON* upload_id_item = cJSON_GetObjectItem(json, "upload_id");
+    if (cJSON_IsNumber(upload_id_item)) {
+        commit_multipart_upload(session, upload_id_item->valueint);
         cJSON_Delete(json);
         return;
     }
+    cJSON_Delete(json);
 
-    const char* name = cJSON_GetStringValue(name_item);
-    long size = size_item->valueint;
-    int parent_id = session->current_directory;
-
-    // Allow override of parent directory
-    cJSON* parent_item = cJSON_GetObjectItem(json, "parent_id");
-    if (parent_item) {
-        parent_id = parent_item->valueint;
+    if (!session->pending_upload_uuid) {
+        send_error(session, "No pending upload. Send UPLOAD_REQ first");
+        return;
     }
 
-    // Check WRITE permission on parent directory
-    if (!check_permission(global_db, session->user_id, parent_id, ACCESS_WRITE)) {
-        send_error(session, "Permission denied");
-        db_log_activity(global_db, session->user_id, "ACCESS_DENIED", "UPLOAD");
-        cJSON_Delete(json);
+    if (session->pending_upload_error) {
+        send_error(session, session->pending_upload_error);
+        abort_pending_upload(session);
         return;
     }
 
-    // Generate UUID for file storage
-    char* uuid = generate_uuid();
-    if (!uuid) {
-        send_error(session, "Failed to generate UUID");
-        cJSON_Delete(json);
+    if (session->pending_upload_received != session->pending_upload_size) {
+        char error_msg[128];
+        snprintf(error_msg, sizeof(error_msg),
+                "Size mismatch. Expected %lld bytes, got %lld bytes",
+                (long long)session->pending_upload_size,
+                (long long)session->pending_upload_received);
+        send_error(session, error_msg);
+        abort_pending_upload(session);
         return;
     }
 
-    // Create file entry in database
-    int file_id = db_create_file(global_db, parent_id, name, uuid,
-                                  session->user_id, size, 0, 0644);
-
-    if (file_id < 0) {
-        send_error(session, "Failed to create file entry");
-        free(uuid);
-        cJSON_Delete(json);
+    // An empty file gets no chunks
+    if (session->pending_upload_fd < 0) {
+        session->pending_upload_fd = storage_open_write(session->server->storage_root,
+                                                        session->pending_upload_uuid);
+    }
+    if (session->pending_upload_fd < 0 || close(session->pending_upload_fd) < 0) {
+        session->pending_upload_fd = -1;
+        send_error(session, "Failed to write file to storage");
+        abort_pending_upload(session);
         return;
     }
+    session->pending_upload_fd = -1;
 
-    // Store UUID and size in session for upcoming upload
-    if (session->pending_upload_uuid) {
-        free(session->pending_upload_uuid);
-    }
-    session->pending_upload_uuid = uuid;
-    session->pending_upload_size = size;
-    session->state = STATE_TRANSFERRING;
+    db_log_activity(session->server->db, session->user_id, "UPLOAD",
+                   session->pending_upload_uuid);
 
-    // Send READY response with file_id
     cJSON* response = cJSON_CreateObject();
-    cJSON_AddStringToObject(response, "status", "READY");
-    cJSON_AddNumberToObject(response, "file_id", file_id);
-    cJSON_AddStringToObject(response, "uuid", uuid);
+    cJSON_AddStringToObject(response, "status", "OK");
+    cJSON_AddStringToObject(response, "message", "File uploaded successfully");
+    cJSON_AddNumberToObject(response, "file_id", session->pending_upload_file_id);
+    cJSON_AddNumberToObject(response, "size", (double)session->pending_upload_size);
 
     char* payload = cJSON_PrintUnformatted(response);
     send_success(session, CMD_SUCCESS, payload);
 
     free(payload);
-    cJSON_Delete(json);
     cJSON_Delete(response);
 
-    log_info("Upload request accepted: file_id=%d, uuid=%s, size=%ld", file_id, uuid, size);
+    log_info("Chunked upload completed: uuid=%s, size=%lld",
+             session->pending_upload_uuid, (long long)session->pending_upload_size);
+
+    clear_pending_upload(session);
 }
 
-void handle_upload_data(ClientSession* session, Packet* pkt) {
-    // Check that upload request was made
-    if (!session->pending_upload_uuid) {
-        send_error(session, "No pending upload. Send UPLOAD_REQ first");
+void handle_upload_part(ClientSession* session, Packet* pkt) {
+    int sock = session->client_socket;
+    int unread = pkt->payload_unread;
+    pkt->payload_unread = 0;
+
+    if (pkt->data_length < PART_HEADER_SIZE) {
+        if (unread && io_recv_discard(sock, pkt->data_length) < 0) {
+            shutdown(sock, SHUT_RDWR);
+        }
+        send_error(session, "Invalid part header");
         return;
     }
 
-    // Verify payload exists and size matches
-    if (!pkt->payload || pkt->data_length == 0) {
-        send_error(session, "Empty upload data");
-        free(session->pending_upload_uuid);
-        session->pending_upload_uuid = NULL;
-        session->state = STATE_AUTHENTICATED;
+    uint8_t header[PART_HEADER_SIZE];
+    if (!unread) {
+        memcpy(header, pkt->payload, PART_HEADER_SIZE);
+    } else if (io_recv_all(sock, header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        shutdown(sock, SHUT_RDWR);
         return;
     }
+    int upload_id = (int)packet_get_u32(header);
+    uint32_t part = packet_get_u32(header + 4);
+    size_t length = pkt->data_length - PART_HEADER_SIZE;
 
-    if (pkt->data_length != (uint32_t)session->pending_upload_size) {
-        char error_msg[128];
-        snprintf(error_msg, sizeof(error_msg),
-                "Size mismatch. Expected %ld bytes, got %u bytes",
-                session->pending_upload_size, pkt->data_length);
-        send_error(session, error_msg);
-        free(session->pending_upload_uuid);
-        session->pending_upload_uuid = NULL;
-        session->state = STATE_AUTHENTICATED;
-        return;
+    const char* error = NULL;
+    uint64_t offset = 0;
+    MultipartUpload* upload = multipart_claim_part(&session->server->uploads, upload_id,
+                                                   session->user_id, part, length,
+                                                   &offset, &error);
+    int ok = 0;
+    if (upload && unread) {
+        // Spliced from the socket into place, like UPLOAD_CHUNK
+        size_t consumed = 0;
+        int rc = io_splice_to_file(sock, upload->fd, (off_t)offset, length, &consumed,
+                                   session_progress, session);
+        length -= consumed;
+        if (rc == -1) {
+            multipart_finish_part(&session->server->uploads, upload, part, 0);
+            log_error("Upload part receive failed (file_id=%d, part=%u)", upload_id, part);
+            shutdown(sock, SHUT_RDWR);
+            return;
+        }
+        ok = (rc == 0);
+    } else if (upload) {
+        ok = storage_write_at(upload->fd, (const uint8_t*)pkt->payload + PART_HEADER_SIZE,
+                              length, offset) == 0;
+        length = 0;
+    }
+    if (upload) {
+        multipart_finish_part(&session->server->uploads, upload, part, ok);
+        if (!ok) {
+            error = "Failed to write file to storage";
+        }
     }
 
-    // Write file to storage
-    if (storage_write_file(session->pending_upload_uuid,
-                          (uint8_t*)pkt->payload,
-                          pkt->data_length) < 0) {
-        send_error(session, "Failed to write file to storage");
-        free(session->pending_upload_uuid);
-        session->pending_upload_uuid = NULL;
-        session->state = STATE_AUTHENTICATED;
+    // Rejected: skip its data to reach the next frame
+    if (unread && length > 0 && io_recv_discard(sock, length) < 0) {
+        shutdown(sock, SHUT_RDWR);
         return;
     }
 
-    // Log activity
-    db_log_activity(global_db, session->user_id, "UPLOAD",
-                   session->pending_upload_uuid);
+    if (!ok) {
+        send_error(session, error);
+        return;
+    }
 
-    // Send success response
+    // Acknowledged so the client knows every part is in before it commits
     cJSON* response = cJSON_CreateObject();
     cJSON_AddStringToObject(response, "status", "OK");
-    cJSON_AddStringToObject(response, "message", "File uploaded successfully");
+    cJSON_AddNumberToObject(response, "upload_id", upload_id);
+    cJSON_AddNumberToObject(response, "part", part);
 
     char* payload = cJSON_PrintUnformatted(response);
     send_success(session, CMD_SUCCESS, payload);
 
     free(payload);
     cJSON_Delete(response);
+}
 
-    log_info("Upload completed: uuid=%s, size=%ld",
-             session->pending_upload_uuid, session->pending_upload_size);
-
-    // Clear pending upload
-    free(session->pending_upload_uuid);
-    session->pending_upload_uuid = NULL;
-    session->pending_upload_size = 0;
-    session->state = STATE_AUTHENTICATED;
+// Largest frame payload the client takes (HELLO "max_frame")
+static size_t session_max_frame(const ClientSession* session) {
+    return session->max_frame ? session->max_frame : MAX_PAYLOAD_SIZE;
 }
 
-void handle_download(ClientSession* session, Packet* pkt) {
-    cJSON* json = cJSON_Parse(pkt->payload);
-    if (!json) {
-        send_error(session, "Invalid JSON");
-        return;
+// Legacy download: the whole file as the payload of one DOWNLOAD_RES
+static int send_download_frame(ClientSession* session, int fd, int64_t offset, int64_t size) {
+    if ((uint64_t)(size - offset) > session_max_frame(session)) {
+        send_error(session, "File too large for one frame. Request a chunked download");
+        return -1;
     }
 
+    // Sent straight from the page cache (sendfile)
+    Packet response = {0};
+    response.command = CMD_DOWNLOAD_RES;
+    return send_packet_file(session, &response, fd, (uint64_t)offset, (size_t)(size - offset));
+}
+
+// Send one DOWNLOAD_CHUNK compressed, reading it through buffer
+// (CHUNK_OFFSET_SIZE + CHUNK_MAX_SIZE bytes). Returns 0 when sent, 1 when
+// the data does not compress (a sample looks random, or deflate does not
+// shrink it) and should go out with sendfile, -1 on a send error
+static int send_chunk_compressed(ClientSession* session, int fd, uint8_t* buffer,
+                                 int64_t offset, size_t length) {
+    uint8_t* data = buffer + CHUNK_OFFSET_SIZE;
+    size_t sample = length < COMPRESS_SAMPLE_SIZE ? length : COMPRESS_SAMPLE_SIZE;
+    if (storage_read_at(fd, data, sample, (uint64_t)offset) < 0 ||
+        !compress_worthwhile(data, sample)) {
+        return 1;
+    }
+    if (length > sample &&
+        storage_read_at(fd, data + sample, length - sample, (uint64_t)(offset + sample)) < 0) {
+        return 1;
+    }
+
+    packet_put_u64(buffer, (uint64_t)offset);
+    uint8_t* packed = NULL;
+    size_t packed_len = 0;
+    if (compress_payload(session->compression, buffer, CHUNK_OFFSET_SIZE + length,
+                         COMPRESS_LEVEL_DATA, &packed, &packed_len) < 0) {
+        return 1;
+    }
+
+    Packet frame = {0};
+    frame.command = CMD_DOWNLOAD_CHUNK;
+    frame.data_length = (uint32_t)packed_len;
+    frame.payload = (char*)packed;
+    frame.compressed = 1;
+    int rc = send_packet(session, &frame);
+    free(packed);
+    return rc < 0 ? -1 : 0;
+}
+
+// Chunked download of bytes [offset, end) of a file of size bytes: a
+// DOWNLOAD_RES with the file's metadata, then DOWNLOAD_CHUNK frames whose
+// data is sent from the page cache with sendfile, so a transfer holds no
+// file data in user space. With compression agreed, chunks that compress
+// are read and sent deflated instead.
+static int send_download_stream(ClientSession* session, const FileEntry* entry,
+                                int fd, int64_t offset, int64_t end, int64_t size) {
+    size_t chunk_size = CHUNK_MAX_SIZE;
+    if (session_max_frame(session) - CHUNK_OFFSET_SIZE < chunk_size) {
+        chunk_size = session_max_frame(session) - CHUNK_OFFSET_SIZE;
+    }
+
+    cJSON* header = cJSON_CreateObject();
+    cJSON_AddStringToObject(header, "status", "OK");
+    cJSON_AddNumberToObject(header, "file_id", entry->id);
+    cJSON_AddStringToObject(header, "name", entry->name);
+    cJSON_AddNumberToObject(header, "size", (double)size);
+    cJSON_AddNumberToObject(header, "chunk_size", (double)chunk_size);
+    cJSON_AddNumberToObject(header, "offset", (double)offset);
+    cJSON_AddNumberToObject(header, "length", (double)(end - offset));
+
+    char* payload = cJSON_PrintUnformatted(header);
+    cJSON_Delete(header);
+    Packet* response = packet_create(CMD_DOWNLOAD_RES, payload, strlen(payload));
+    int rc = send_packet(session, response);
+    packet_free(response);
+    free(payload);
+
+    uint8_t* buffer = NULL;
+    if (session->compression != COMPRESSION_NONE && offset < end) {
+        buffer = malloc(CHUNK_OFFSET_SIZE + CHUNK_MAX_SIZE);
+    }
+
+    while (rc == 0 && offset < end) {
+        size_t length = (end - offset) < (int64_t)chunk_size ? (size_t)(end - offset)
+                                                             : chunk_size;
+        if (buffer) {
+            int sent = send_chunk_compressed(session, fd, buffer, offset, length);
+            if (sent <= 0) {
+                session_progress(session);
+                rc = sent;
+                offset += (int64_t)length;
+                continue;
+            }
+        }
+
+        uint8_t prefix[CHUNK_OFFSET_SIZE];
+        packet_put_u64(prefix, (uint64_t)offset);
+
+        Packet frame = {0};
+        frame.command = CMD_DOWNLOAD_CHUNK;
+        frame.data_length = CHUNK_OFFSET_SIZE;
+        frame.payload = (char*)prefix;
+        rc = send_packet_file(session, &frame, fd, (uint64_t)offset, length);
+        offset += (int64_t)length;
+    }
+
+    free(buffer);
+    return rc;
+}
+
+// Shared checks of DOWNLOAD_REQ and READ_RANGE: look up json's "file_id",
+// check READ permission and open its blob. Returns the descriptor (size in
+// *size), or -1 after sending the error
+static int open_download(ClientSession* session, cJSON* json, FileEntry* entry, int64_t* size) {
     cJSON* file_id_item = cJSON_GetObjectItem(json, "file_id");
     if (!file_id_item) {
         send_error(session, "Missing 'file_id' parameter");
-        cJSON_Delete(json);
-        return;
+        return -1;
     }
 
     int file_id = file_id_item->valueint;
 
     // Check READ permission on file
-    if (!check_permission(global_db, session->user_id, file_id, ACCESS_READ)) {
+    if (!check_permission(session->server->db, session->user_id, file_id, ACCESS_READ)) {
         send_error(session, "Permission denied");
-        db_log_activity(global_db, session->user_id, "ACCESS_DENIED", "DOWNLOAD");
-        cJSON_Delete(json);
-        return;
+        db_log_activity(session->server->db, session->user_id, "ACCESS_DENIED", "DOWNLOAD");
+        return -1;
     }
 
     // Get file entry from database
-    FileEntry entry;
-    if (db_get_file_by_id(global_db, file_id, &entry) < 0) {
+    if (db_get_file_by_id(session->server->db, file_id, entry) < 0) {
         send_error(session, "File not found");
-        cJSON_Delete(json);
-        return;
+        return -1;
     }
 
     // Check it's not a directory
-    if (entry.is_directory) {
+    if (entry->is_directory) {
         send_error(session, "Cannot download a directory");
-        cJSON_Delete(json);
-        return;
+        return -1;
+    }
+
+    if (db_is_partial_upload(session->server->db, file_id) == 1 ||
+        multipart_is_open(&session->server->uploads, file_id)) {
+        send_error(session, "File upload is not complete");
+        return -1;
     }
 
-    // Read file from storage
-    uint8_t* data = NULL;
-    size_t size = 0;
-    if (storage_read_file(entry.physical_path, &data, &size) < 0) {
+    int fd = storage_open_read(session->server->storage_root, entry->physical_path, size);
+    if (fd < 0) {
         send_error(session, "Failed to read file from storage");
+    }
+    return fd;
+}
+
+void handle_download(ClientSession* session, Packet* pkt) {
+    cJSON* json = cJSON_Parse(pkt->payload);
+    if (!json) {
+        send_error(session, "Invalid JSON");
+        return;
+    }
+
+    FileEntry entry;
+    int64_t size = 0;
+    int fd = open_download(session, json, &entry, &size);
+    if (fd < 0) {
         cJSON_Delete(json);
         return;
     }
 
-    // Send binary data with CMD_DOWNLOAD_RES
-    Packet* response = packet_create(CMD_DOWNLOAD_RES, (char*)data, size);
-    packet_send(session->client_socket, response);
-    packet_free(response);
+    // "offset": continue an interrupted download from that byte
+    int chunked = cJSON_IsTrue(cJSON_GetObjectItem(json, "chunked"));
+    cJSON* offset_item = cJSON_GetObjectItem(json, "offset");
+    double offset_value = cJSON_IsNumber(offset_item) ? offset_item->valuedouble : 0;
+    cJSON_Delete(json);
 
-    free(data);
+    if (offset_value < 0 || offset_value > (double)size) {
+        close(fd);
+        send_error(session, "Invalid 'offset' parameter");
+        return;
+    }
+    int64_t offset = (int64_t)offset_value;
+
+    int rc = chunked ? send_download_stream(session, &entry, fd, offset, size, size)
+                     : send_download_frame(session, fd, offset, size);
+    close(fd);
+    if (rc < 0) {
+        return;
+    }
+
+    db_log_activity(session->server->db, session->user_id, "DOWNLOAD", entry.name);
+    log_info("Download completed: file_id=%d, name=%s, size=%lld",
+             entry.id, entry.name, (long long)size);
+}
+
+void handle_read_range(ClientSession* session, Packet* pkt) {
+    cJSON* json = cJSON_Parse(pkt->payload);
+    if (!json) {
+        send_error(session, "Invalid JSON");
+        return;
+    }
+
+    cJSON* offset_item = cJSON_GetObjectItem(json, "offset");
+    cJSON* length_item = cJSON_GetObjectItem(json, "length");
+    if (!cJSON_IsNumber(offset_item) || !cJSON_IsNumber(length_item) ||
+        offset_item->valuedouble < 0 || length_item->valuedouble < 0) {
+        send_error(session, "Missing or invalid 'offset' or 'length' parameter");
+        cJSON_Delete(json);
+        return;
+    }
+    double offset_value = offset_item->valuedouble;
+    double length_value = length_item->valuedouble;
+
+    FileEntry entry;
+    int64_t size = 0;
+    int fd = open_download(session, json, &entry, &size);
     cJSON_Delete(json);
+    if (fd < 0) {
+        return;
+    }
 
-    db_log_activity(global_db, session->user_id, "DOWNLOAD", entry.name);
-    log_info("Download completed: file_id=%d, name=%s, size=%zu", file_id, entry.name, size);
+    if (offset_value > (double)size) {
+        close(fd);
+        send_error(session, "Invalid 'offset' parameter");
+        return;
+    }
+
+    // Clipped at the end of the file
+    int64_t offset = (int64_t)offset_value;
+    int64_t end = size;
+    if (length_value < (double)(size - offset)) {
+        end = offset + (int64_t)length_value;
+    }
+
+    // Striped downloads read far-apart ranges of one file at once
+    storage_prefetch(fd, (uint64_t)offset, (uint64_t)(end - offset));
+    send_download_stream(session, &entry, fd, offset, end, size);
+    close(fd);
+
+    log_debug("Range read: file_id=%d, offset=%lld, length=%lld",
+              entry.id, (long long)offset, (long long)(end - offset));
 }
 
 void handle_change_dir(ClientSession* session, Packet* pkt) {
@@ -507,16 +1781,16 @@ void handle_change_dir(ClientSession* session, Packet* pkt) {
     int dir_id = dir_id_item->valueint;
 
     // Check EXECUTE permission on directory
-    if (!check_permission(global_db, session->user_id, dir_id, ACCESS_EXECUTE)) {
+    if (!check_permission(session->server->db, session->user_id, dir_id, ACCESS_EXECUTE)) {
         send_error(session, "Permission denied");
-        db_log_activity(global_db, session->user_id, "ACCESS_DENIED", "CD");
+        db_log_activity(session->server->db, session->user_id, "ACCESS_DENIED", "CD");
         cJSON_Delete(json);
         return;
     }
 
     // Verify the directory exists and is actually a directory
     FileEntry entry;
-    if (db_get_file_by_id(global_db, dir_id, &entry) < 0) {
+    if (db_get_file_by_id(session->server->db, dir_id, &entry) < 0) {
         send_error(session, "Directory not found");
         cJSON_Delete(json);
         return;
@@ -543,7 +1817,7 @@ void handle_change_dir(ClientSession* session, Packet* pkt) {
     cJSON_Delete(json);
     cJSON_Delete(response);
 
-    db_log_activity(global_db, session->user_id, "CHANGE_DIR", entry.name);
+    db_log_activity(session->server->db, session->user_id, "CHANGE_DIR", entry.name);
     log_info("Changed directory: user_id=%d, dir_id=%d, name=%s",
              session->user_id, dir_id, entry.name);
 }
@@ -587,7 +1861,7 @@ void handle_chmod(ClientSession* session, Packet* pkt) {
 
     // Get file entry
     FileEntry entry;
-    if (db_get_file_by_id(global_db, file_id, &entry) < 0) {
+    if (db_get_file_by_id(session->server->db, file_id, &entry) < 0) {
         send_error(session, "File not found");
         cJSON_Delete(json);
         return;
@@ -596,17 +1870,18 @@ void handle_chmod(ClientSession* session, Packet* pkt) {
     // Only owner can change permissions
     if (entry.owner_id != session->user_id) {
         send_error(session, "Not owner");
-        db_log_activity(global_db, session->user_id, "ACCESS_DENIED", "CHMOD - not owner");
+        db_log_activity(session->server->db, session->user_id, "ACCESS_DENIED", "CHMOD - not owner");
         cJSON_Delete(json);
         return;
     }
 
     // Update permissions
-    if (db_update_permissions(global_db, file_id, new_perms) < 0) {
+    if (db_update_permissions(session->server->db, file_id, new_perms) < 0) {
         send_error(session, "Failed to update permissions");
         cJSON_Delete(json);
         return;
     }
+    directory_changed(session, entry.parent_id);
 
     char* perm_str = format_permissions(new_perms);
     log_info("User %d changed permissions on file %d to %03o (%s)",
@@ -620,7 +1895,7 @@ void handle_chmod(ClientSession* session, Packet* pkt) {
     char* payload = cJSON_PrintUnformatted(response);
     send_success(session, CMD_SUCCESS, payload);
 
-    db_log_activity(global_db, session->user_id, "CHMOD", entry.name);
+    db_log_activity(session->server->db, session->user_id, "CHMOD", entry.name);
 
     free(perm_str);
     free(payload);
@@ -651,7 +1926,7 @@ void handle_delete(ClientSession* session, Packet* pkt) {
 
     // Get file info to check ownership and get name for logging
     FileEntry entry;
-    if (db_get_file_by_id(global_db, file_id, &entry) < 0) {
+    if (db_get_file_by_id(session->server->db, file_id, &entry) < 0) {
         send_error(session, "File not found");
         cJSON_Delete(json);
         return;
@@ -665,15 +1940,23 @@ void handle_delete(ClientSession* session, Packet* pkt) {
     }
 
     // Delete the file from database
-    if (db_delete_file(global_db, file_id) < 0) {
+    if (db_delete_file(session->server->db, file_id) < 0) {
         send_error(session, "Failed to delete file");
         cJSON_Delete(json);
         return;
     }
+    directory_changed(session, entry.parent_id);
 
-    // If it's a regular file (not directory), delete physical file
+    // If it's a regular file (not directory), delete physical file; in a
+    // BATCH only once the row's deletion has committed
     if (!entry.is_directory && entry.physical_path[0] != '\0') {
-        unlink(entry.physical_path);  // Delete physical file, ignore errors
+        Batch* batch = current_batch;
+        if (batch && batch->blob_count < BATCH_MAX_REQUESTS) {
+            batch->blobs[batch->blob_count++] = str_duplicate(entry.physical_path);
+        } else {
+            // Delete physical file, ignore errors
+            storage_delete_file(session->server->storage_root, entry.physical_path);
+        }
     }
 
     log_info("User %d deleted %s (ID: %d)",
@@ -686,7 +1969,7 @@ void handle_delete(ClientSession* session, Packet* pkt) {
     char* payload = cJSON_PrintUnformatted(response);
     send_success(session, CMD_SUCCESS, payload);
 
-    db_log_activity(global_db, session->user_id, "DELETE", entry.name);
+    db_log_activity(session->server->db, session->user_id, "DELETE", entry.name);
 
     free(payload);
     cJSON_Delete(json);
@@ -716,12 +1999,20 @@ void handle_file_info(ClientSession* session, Packet* pkt) {
 
     // Get file information
     FileEntry entry;
-    if (db_get_file_by_id(global_db, file_id, &entry) < 0) {
+    if (db_get_file_by_id(session->server->db, file_id, &entry) < 0) {
         send_error(session, "File not found");
         cJSON_Delete(json);
         return;
     }
 
+    // A one-record listing; the client formats type and permissions itself
+    uint32_t fields;
+    if (wants_binary_listing(session, json, LISTING_FIELDS_ALL, &fields)) {
+        send_listing(session, CMD_SUCCESS, &entry, 1, fields, 0);
+        cJSON_Delete(json);
+        return;
+    }
+
     // Build detailed response
     cJSON* response = cJSON_CreateObject();
     cJSON_AddStringToObject(response, "status", "OK");
@@ -752,17 +2043,132 @@ void handle_file_info(ClientSession* session, Packet* pkt) {
     cJSON_Delete(response);
 }
 
+// Run one BATCH sub-request {"command", "payload"} as if it came alone;
+// its response lands in the batch's results
+static void run_batched(ClientSession* session, cJSON* request) {
+    cJSON* command_item = cJSON_GetObjectItem(request, "command");
+    cJSON* payload_item = cJSON_GetObjectItem(request, "payload");
+    if (!cJSON_IsNumber(command_item) || !cJSON_IsObject(payload_item)) {
+        send_error(session, "Missing command or payload");
+        return;
+    }
+
+    Packet sub = {0};
+    sub.command = (uint8_t)command_item->valueint;
+    sub.payload = cJSON_PrintUnformatted(payload_item);
+    if (!sub.payload) {
+        send_error(session, "Out of memory");
+        return;
+    }
+    sub.data_length = (uint32_t)strlen(sub.payload);
+
+    // Only commands that touch nothing but the database (and the blobs of
+    // deleted files, see handle_delete) can share its transaction
+    switch (sub.command) {
+        case CMD_MAKE_DIR:
+            handle_mkdir(session, &sub);
+            break;
+        case CMD_CHMOD:
+            handle_chmod(session, &sub);
+            break;
+        case CMD_DELETE:
+            handle_delete(session, &sub);
+            break;
+        case CMD_FILE_INFO:
+            handle_file_info(session, &sub);
+            break;
+        default:
+            send_error(session, "Command not allowed in a batch");
+            break;
+    }
+
+    free(sub.payload);
+}
+
+// BATCH {"requests": [{"command", "payload"}, ...]}: run the sub-requests
+// in order under one transaction and answer {"status", "results"}, one
+// result per request as it would have been answered alone. A sub-request
+// that fails leaves the others be; its result is its error.
+void handle_batch(ClientSession* session, Packet* pkt) {
+    cJSON* json = cJSON_Parse(pkt->payload);
+    if (!json) {
+        send_error(session, "Invalid JSON");
+        return;
+    }
+
+    cJSON* requests = cJSON_GetObjectItem(json, "requests");
+    int count = cJSON_GetArraySize(requests);
+    if (!cJSON_IsArray(requests) || count < 1 || count > BATCH_MAX_REQUESTS) {
+        send_error(session, "Batch needs 1 to 256 requests");
+        cJSON_Delete(json);
+        return;
+    }
+
+    Batch* batch = calloc(1, sizeof(Batch));
+    if (!batch || db_begin(session->server->db) < 0) {
+        free(batch);
+        send_error(session, "Failed to start batch");
+        cJSON_Delete(json);
+        return;
+    }
+
+    current_batch = batch;
+    cJSON* request = NULL;
+    cJSON_ArrayForEach(request, requests) {
+        run_batched(session, request);
+    }
+    current_batch = NULL;
+
+    // A result that could not be recorded must not be committed unreported
+    int failed = batch->count != count;
+    if (failed) {
+        db_rollback(session->server->db);
+    } else {
+        failed = db_commit(session->server->db) < 0;
+    }
+    if (failed) {
+        send_error(session, "Batch failed");
+    } else {
+        for (int i = 0; i < batch->blob_count; i++) {
+            storage_delete_file(session->server->storage_root, batch->blobs[i]);
+        }
+
+        static const char prefix[] = "{\"status\":\"OK\",\"results\":";
+        size_t length = sizeof(prefix) - 1 + batch->length + 2;
+        char* payload = malloc(length + 1);
+        if (payload) {
+            memcpy(payload, prefix, sizeof(prefix) - 1);
+            memcpy(payload + sizeof(prefix) - 1, batch->results, batch->length);
+            memcpy(payload + length - 2, "]}", 3);
+            send_success(session, CMD_SUCCESS, payload);
+            free(payload);
+        } else {
+            send_error(session, "Out of memory");
+        }
+    }
+
+    log_info("User %d ran a batch of %d requests%s", session->user_id, count,
+             failed ? " (rolled back)" : "");
+
+    for (int i = 0; i < batch->blob_count; i++) {
+        free(batch->blobs[i]);
+    }
+    free(batch->results);
+    free(batch);
+    cJSON_Delete(json);
+}
+
 // Admin command handlers
 void handle_admin_list_users(ClientSession* session, Packet* pkt) {
     // Check admin authorization
-    if (!db_is_admin(global_db, session->user_id)) {
+    if (!db_is_admin(session->server->db, session->user_id)) {
         send_error(session, "Admin access required");
         log_info("Non-admin user %d attempted to list users", session->user_id);
         return;
     }
 
     char* json_result = NULL;
-    if (db_list_users(global_db, &json_result) < 0) {
+    if (db_list_users(session->server->db, &json_result) < 0) {
         send_error(session, "Failed to retrieve user list");
         return;
     }
@@ -777,7 +2183,7 @@ void handle_admin_list_users(ClientSession* session, Packet* pkt) {
     send_success(session, CMD_SUCCESS, payload);
 
     log_info("Admin user %d listed all users", session->user_id);
-    db_log_activity(global_db, session->user_id, "ADMIN_LIST_USERS", "Listed all users");
+    db_log_activity(session->server->db, session->user_id, "ADMIN_LIST_USERS", "Listed all users");
 
     free(json_result);
     free(payload);
@@ -786,7 +2192,7 @@ void handle_admin_list_users(ClientSession* session, Packet* pkt) {
 
 void handle_admin_create_user(ClientSession* session, Packet* pkt) {
     // Check admin authorization
-    if (!db_is_admin(global_db, session->user_id)) {
+    if (!db_is_admin(session->server->db, session->user_id)) {
         send_error(session, "Admin access required");
         log_info("Non-admin user %d attempted to create user", session->user_id);
         return;
@@ -831,7 +2237,7 @@ void handle_admin_create_user(ClientSession* session, Packet* pkt) {
     }
 
     // Check if user already exists
-    if (db_user_exists(global_db, username)) {
+    if (db_user_exists(session->server->db, username)) {
         send_error(session, "Username already exists");
         cJSON_Delete(json);
         return;
@@ -845,7 +2251,7 @@ void handle_admin_create_user(ClientSession* session, Packet* pkt) {
         return;
     }
 
-    int new_user_id = db_create_user_admin(global_db, username, password_hash, is_admin);
+    int new_user_id = db_create_user_admin(session->server->db, username, password_hash, is_admin);
     free(password_hash);
 
     if (new_user_id < 0) {
@@ -869,7 +2275,7 @@ void handle_admin_create_user(ClientSession* session, Packet* pkt) {
     char log_desc[256];
     snprintf(log_desc, sizeof(log_desc), "Created user '%s' (id=%d, is_admin=%d)",
              username, new_user_id, is_admin);
-    db_log_activity(global_db, session->user_id, "ADMIN_CREATE_USER", log_desc);
+    db_log_activity(session->server->db, session->user_id, "ADMIN_CREATE_USER", log_desc);
 
     free(payload);
     cJSON_Delete(json);
@@ -878,7 +2284,7 @@ void handle_admin_create_user(ClientSession* session, Packet* pkt) {
 
 void handle_admin_delete_user(ClientSession* session, Packet* pkt) {
     // Check admin authorization
-    if (!db_is_admin(global_db, session->user_id)) {
+    if (!db_is_admin(session->server->db, session->user_id)) {
         send_error(session, "Admin access required");
         log_info("Non-admin user %d attempted to delete user", session->user_id);
         return;
@@ -913,10 +2319,10 @@ void handle_admin_delete_user(ClientSession* session, Packet* pkt) {
 
     // Get username for logging before deletion
     char username[256] = {0};
-    db_get_user_by_id(global_db, target_user_id, username, sizeof(username));
+    db_get_user_by_id(session->server->db, target_user_id, username, sizeof(username));
 
     // Delete user (db_delete_user has built-in protection for user ID 1)
-    if (db_delete_user(global_db, target_user_id) < 0) {
+    if (db_delete_user(session->server->db, target_user_id) < 0) {
         send_error(session, "Failed to delete user");
         cJSON_Delete(json);
         return;
@@ -934,7 +2340,7 @@ void handle_admin_delete_user(ClientSession* session, Packet* pkt) {
 
     char log_desc[256];
     snprintf(log_desc, sizeof(log_desc), "Deleted user '%s' (id=%d)", username, target_user_id);
-    db_log_activity(global_db, session->user_id, "ADMIN_DELETE_USER", log_desc);
+    db_log_activity(session->server->db, session->user_id, "ADMIN_DELETE_USER", log_desc);
 
     free(payload);
     cJSON_Delete(json);
@@ -943,7 +2349,7 @@ void handle_admin_delete_user(ClientSession* session, Packet* pkt) {
 
 void handle_admin_update_user(ClientSession* session, Packet* pkt) {
     // Check admin authorization
-    if (!db_is_admin(global_db, session->user_id)) {
+    if (!db_is_admin(session->server->db, session->user_id)) {
         send_error(session, "Admin access required");
         log_info("Non-admin user %d attempted to update user", session->user_id);
         return;
@@ -976,10 +2382,10 @@ void handle_admin_update_user(ClientSession* session, Packet* pkt) {
 
     // Get username for logging
     char username[256] = {0};
-    db_get_user_by_id(global_db, target_user_id, username, sizeof(username));
+    db_get_user_by_id(session->server->db, target_user_id, username, sizeof(username));
 
     // Update user (db_update_user has built-in protection for user ID 1)
-    if (db_update_user(global_db, target_user_id, is_admin, is_active) < 0) {
+    if (db_update_user(session->server->db, target_user_id, is_admin, is_active) < 0) {
         send_error(session, "Failed to update user");
         cJSON_Delete(json);
         return;
@@ -999,9 +2405,91 @@ void handle_admin_update_user(ClientSession* session, Packet* pkt) {
     char log_desc[256];
     snprintf(log_desc, sizeof(log_desc), "Updated user '%s' (id=%d, is_admin=%d, is_active=%d)",
              username, target_user_id, is_admin, is_active);
-    db_log_activity(global_db, session->user_id, "ADMIN_UPDATE_USER", log_desc);
+    db_log_activity(session->server->db, session->user_id, "ADMIN_UPDATE_USER", log_desc);
 
     free(payload);
     cJSON_Delete(json);
     cJSON_Delete(response);
 }
+
+// Tallies live sessions for handle_admin_server_stats()
+typedef struct {
+    int authenticated;
+    int transferring;
+    cJSON* list;
+} SessionStats;
+
+static const char* session_state_name(ClientState state) {
+    switch (state) {
+        case STATE_CONNECTED:     return "connected";
+        case STATE_AUTHENTICATED: return "authenticated";
+        case STATE_TRANSFERRING:  return "transferring";
+        case STATE_DISCONNECTED:  return "disconnected";
+    }
+    return "unknown";
+}
+
+static int collect_session_stats(ClientSession* s, void* arg) {
+    SessionStats* stats = (SessionStats*)arg;
+
+    if (s->authenticated) {
+        stats->authenticated++;
+    }
+    if (s->pending_upload_uuid) {
+        stats->transferring++;
+    }
+
+    cJSON* entry = cJSON_CreateObject();
+    char* client_ip = socket_get_client_ip(&s->client_addr);
+    cJSON_AddNumberToObject(entry, "user_id", s->user_id);
+    cJSON_AddStringToObject(entry, "address", client_ip);
+    cJSON_AddStringToObject(entry, "state", session_state_name(s->state));
+    cJSON_AddItemToArray(stats->list, entry);
+    free(client_ip);
+    return 0;
+}
+
+void handle_admin_server_stats(ClientSession* session, Packet* pkt) {
+    (void)pkt;
+
+    // Check admin authorization
+    if (!db_is_admin(session->server->db, session->user_id)) {
+        send_error(session, "Admin access required");
+        log_info("Non-admin user %d attempted to read server stats", session->user_id);
+        return;
+    }
+
+    SessionRegistry* sessions = &session->server->sessions;
+    SessionStats stats = {0, 0, cJSON_CreateArray()};
+    int live = session_registry_foreach(sessions, collect_session_stats, &stats);
+
+    // Build response
+    cJSON* response = cJSON_CreateObject();
+    cJSON_AddStringToObject(response, "status", "OK");
+    cJSON_AddNumberToObject(response, "active_sessions", live);
+    cJSON_AddNumberToObject(response, "authenticated_sessions", stats.authenticated);
+    cJSON_AddNumberToObject(response, "pending_uploads", stats.transferring);
+    cJSON_AddNumberToObject(response, "max_sessions", session_registry_capacity(sessions));
+    cJSON_AddNumberToObject(response, "registry_slots", session_registry_slots(sessions));
+    cJSON_AddNumberToObject(response, "workers", thread_pool_worker_count());
+    cJSON_AddNumberToObject(response, "max_transfers", thread_pool_transfer_limit());
+    cJSON_AddItemToObject(response, "sessions", stats.list);
+
+    ListingCache* listings = &session->server->listings;
+    cJSON* cache = cJSON_AddObjectToObject(response, "listing_cache");
+    pthread_mutex_lock(&listings->lock);
+    cJSON_AddNumberToObject(cache, "entries", listings->count);
+    cJSON_AddNumberToObject(cache, "bytes", (double)listings->size);
+    cJSON_AddNumberToObject(cache, "capacity", (double)listings->capacity);
+    cJSON_AddNumberToObject(cache, "hits", (double)listings->hits);
+    cJSON_AddNumberToObject(cache, "misses", (double)listings->misses);
+    pthread_mutex_unlock(&listings->lock);
+
+    char* payload = cJSON_PrintUnformatted(response);
+    send_success(session, CMD_SUCCESS, payload);
+
+    log_info("Admin user %d read server stats (%d sessions)", session->user_id, live);
+
+    free(payload);
+    cJSON_Delete(response);
+}
@@ -8,25 +8,70 @@
 void commands_init(void);
 
 // Main command dispatcher
+// Responses are tagged with pkt->stream_id, so tagged requests of one
+// session may be dispatched on several threads and complete in any order
 int dispatch_command(ClientSession* session, Packet* pkt);
 
+// Whether a tagged request may run while other requests of its session are
+// still running (it neither reads nor changes per-session state that other
+// commands change)
+int command_is_concurrent(uint8_t command);
+
+// Whether the command streams a file to the client, holding its worker
+// until the client has read it all (see thread_pool_start())
+int command_is_transfer(uint8_t command);
+
+// Whether the receiver leaves pkt's payload on the socket for its handler
+// (see packet_defers_payload()): only for a transfer the session has open
+int command_defers_payload(ClientSession* session, const Packet* pkt);
+
 // Individual command handlers
 void handle_login(ClientSession* session, Packet* pkt);
+void handle_ping(ClientSession* session, Packet* pkt);
+void handle_enable_streams(ClientSession* session, Packet* pkt);
+void handle_hello(ClientSession* session, Packet* pkt);
 void handle_list_dir(ClientSession* session, Packet* pkt);
 void handle_change_dir(ClientSession* session, Packet* pkt);
 void handle_mkdir(ClientSession* session, Packet* pkt);
 void handle_upload_req(ClientSession* session, Packet* pkt);
 void handle_upload_data(ClientSession* session, Packet* pkt);
+void handle_upload_chunk(ClientSession* session, Packet* pkt);
+void handle_upload_commit(ClientSession* session, Packet* pkt);
+void handle_upload_part(ClientSession* session, Packet* pkt);
 void handle_download(ClientSession* session, Packet* pkt);
+void handle_read_range(ClientSession* session, Packet* pkt);
 void handle_chmod(ClientSession* session, Packet* pkt);
 void handle_delete(ClientSession* session, Packet* pkt);
 void handle_file_info(ClientSession* session, Packet* pkt);
+void handle_batch(ClientSession* session, Packet* pkt);
 
 // Admin command handlers
 void handle_admin_list_users(ClientSession* session, Packet* pkt);
 void handle_admin_create_user(ClientSession* session, Packet* pkt);
 void handle_admin_delete_user(ClientSession* session, Packet* pkt);
 void handle_admin_update_user(ClientSession* session, Packet* pkt);
+void handle_admin_server_stats(ClientSession* session, Packet* pkt);
+
+// The connection is closing: keep a chunked upload that has stored data
+// as a partial upload (resumable with UPLOAD_REQ "resume"), else abort it
+void suspend_pending_upload(ClientSession* session);
+
+// Drop the session's unfinished upload: delete its file row and any
+// partial data, free the UUID and cancel the transfer deadline
+void abort_pending_upload(ClientSession* session);
+
+// The connection is closing: delete the multipart uploads it opened and
+// did not commit
+void abandon_multipart_uploads(ClientSession* session);
+
+// Helper: Send a response to the request being dispatched on this thread
+// (tagged with its stream ID), serialized with the session's other sends
+int send_packet(ClientSession* session, Packet* pkt);
+
+// Helper: send_packet() with length bytes of file_fd (from offset) appended
+// to pkt's payload, sent with sendfile
+int send_packet_file(ClientSession* session, Packet* pkt, int file_fd,
+                     uint64_t offset, size_t length);
 
 // Helper: Send error response
 void send_error(ClientSession* session, const char* message);
@@ -0,0 +1,715 @@
+#define _GNU_SOURCE
+
+#include "event_loop.h"
+#include "server.h"
+#include "thread_pool.h"
+#include "socket_mgr.h"
+#include "commands.h"
+#include "session_timers.h"
+#include "../common/utils.h"
+#include "../common/protocol.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifdef __linux__
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+// Client sockets are armed one-shot: after an event the socket stays
+// disabled until the reactor (drained, nothing to wait for) or a worker
+// re-arms it. Untagged requests, and tagged ones that touch session state
+// (see command_is_concurrent()), wait for the session's running requests
+// and run alone, so they execute in order. Once multiplexing is negotiated
+// the reactor keeps decoding tagged requests while up to max_streams of
+// them run on workers at once.
+#define CLIENT_EVENTS (EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT)
+
+// Per-connection receive state, owned by exactly one reactor
+typedef struct Connection {
+    struct Reactor* reactor;
+    ClientSession* session;
+    uint8_t header[TAGGED_HEADER_SIZE];
+    size_t header_len;
+    Packet pkt;
+    size_t payload_len;
+
+    // Requests handed to workers and not finished yet. While the reactor
+    // waits for them (stalled) the socket stays disarmed, and the worker
+    // that brings in_flight below resume_below re-arms it.
+    pthread_mutex_t lock;
+    int in_flight;
+    int stalled;
+    int resume_below;
+    int parked;         // pkt is decoded but waits until in_flight is 0
+    int closing;        // Peer gone; close once in_flight is 0
+
+    struct Connection* prev;
+    struct Connection* next;
+} Connection;
+
+typedef struct Reactor {
+    struct EventLoop* loop;
+    pthread_t thread;
+    int epoll_fd;
+    int index;
+    int listen_fd;          // Shared listener, or this reactor's SO_REUSEPORT shard
+    int owns_listener;      // Sole acceptor of listen_fd (sharded mode)
+    Connection* connections;    // Session shard: connections this reactor accepted
+    int connection_count;
+} Reactor;
+
+struct EventLoop {
+    Server* server;
+    Reactor* reactors;
+    int reactors_started;
+    int stop_fd;
+    int pause_fd;
+
+    // Reactors that have dropped their listener after event_loop_stop_accepting()
+    int paused_count;
+    pthread_mutex_t pause_mutex;
+    pthread_cond_t pause_cond;
+};
+
+// epoll data.ptr tags for the descriptors that are not client connections
+static char listener_tag;
+static char stop_tag;
+static char pause_tag;
+
+int event_loop_supported(void) {
+    return 1;
+}
+
+static void event_loop_cleanup(EventLoop* loop) {
+    free(loop->reactors);
+    if (loop->stop_fd >= 0) {
+        close(loop->stop_fd);
+    }
+    if (loop->pause_fd >= 0) {
+        close(loop->pause_fd);
+    }
+    pthread_mutex_destroy(&loop->pause_mutex);
+    pthread_cond_destroy(&loop->pause_cond);
+    free(loop);
+}
+
+// Idle sessions cost one descriptor each, so lift the soft limit to the hard one
+static void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) == 0) {
+            log_info("Raised open file limit to %llu", (unsigned long long)rl.rlim_cur);
+        }
+    }
+}
+
+static void reactor_link(Reactor* r, Connection* conn) {
+    conn->prev = NULL;
+    conn->next = r->connections;
+    if (r->connections) {
+        r->connections->prev = conn;
+    }
+    r->connections = conn;
+    r->connection_count++;
+}
+
+static void reactor_unlink(Reactor* r, Connection* conn) {
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        r->connections = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    }
+    r->connection_count--;
+}
+
+static void connection_close(Reactor* r, Connection* conn) {
+    reactor_unlink(r, conn);
+    free(conn->pkt.payload);
+
+    // Closing the socket also removes it from the epoll set
+    cleanup_session(conn->session);
+    pthread_mutex_destroy(&conn->lock);
+    free(conn);
+}
+
+static void reactor_accept(Reactor* r) {
+    for (;;) {
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        memset(&addr, 0, sizeof(addr));
+
+        int fd = accept4(r->listen_fd, (struct sockaddr*)&addr, &addr_len,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_error("Reactor %d: accept() failed: %s", r->index, strerror(errno));
+            }
+            return;
+        }
+
+        // Keepalive still helps detect dead peers; the timeouts are unused here
+        socket_set_options(fd);
+
+        ClientSession* session = session_create(r->loop->server, fd, &addr);
+        if (!session) {
+            socket_close(fd);
+            continue;
+        }
+
+        Connection* conn = calloc(1, sizeof(Connection));
+        if (!conn) {
+            log_error("Failed to allocate connection state");
+            cleanup_session(session);
+            continue;
+        }
+        conn->reactor = r;
+        conn->session = session;
+        pthread_mutex_init(&conn->lock, NULL);
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = CLIENT_EVENTS;
+        ev.data.ptr = conn;
+        if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            log_error("Reactor %d: epoll_ctl(ADD) failed: %s", r->index, strerror(errno));
+            cleanup_session(session);
+            pthread_mutex_destroy(&conn->lock);
+            free(conn);
+            continue;
+        }
+
+        reactor_link(r, conn);
+
+        char* client_ip = socket_get_client_ip(&addr);
+        log_info("Client connected from %s (reactor=%d, fd=%d, owned=%d)",
+                 client_ip, r->index, fd, r->connection_count);
+        free(client_ip);
+    }
+}
+
+static int connection_arm_events(Connection* conn, uint32_t events) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = conn;
+    return epoll_ctl(conn->reactor->epoll_fd, EPOLL_CTL_MOD,
+                     conn->session->client_socket, &ev);
+}
+
+static int connection_arm(Connection* conn) {
+    return connection_arm_events(conn, CLIENT_EVENTS);
+}
+
+// Worker thread: a request finished; wake the reactor if it waits for it
+static void connection_done(ClientSession* session, void* arg) {
+    Connection* conn = (Connection*)arg;
+    uint32_t events = CLIENT_EVENTS;
+
+    pthread_mutex_lock(&conn->lock);
+    conn->in_flight--;
+    int wake = conn->stalled && conn->in_flight < conn->resume_below;
+    if (wake) {
+        conn->stalled = 0;
+        // A parked request or a pending close has no socket data to
+        // trigger on; EPOLLOUT fires right away instead
+        if (conn->parked || conn->closing) {
+            events |= EPOLLOUT;
+        }
+    }
+    pthread_mutex_unlock(&conn->lock);
+
+    // The reactor leaves a stalled connection alone until this re-arm
+    if (wake && connection_arm_events(conn, events) < 0) {
+        log_error("Failed to re-arm fd=%d: %s", session->client_socket, strerror(errno));
+    }
+}
+
+// The connection is finished. Returns -1 to close it now or, while workers
+// still run its requests, 1: the last of them wakes the reactor to close it.
+static int connection_fail(Connection* conn) {
+    pthread_mutex_lock(&conn->lock);
+    if (conn->in_flight == 0) {
+        pthread_mutex_unlock(&conn->lock);
+        return -1;
+    }
+    conn->closing = 1;
+    conn->stalled = 1;
+    conn->resume_below = 1;
+    pthread_mutex_unlock(&conn->lock);
+    return 1;
+}
+
+// Hand the decoded packet to the worker pool; the payload moves with it.
+// Returns 0 to keep reading, 1 when the reactor must wait for the workers
+// (one of them re-arms the socket), -1 to close.
+static int connection_submit(Connection* conn) {
+    ClientSession* session = conn->session;
+    log_debug("Received command 0x%02X (fd=%d, stream=%u)",
+              conn->pkt.command, session->client_socket, conn->pkt.stream_id);
+
+    conn->header_len = 0;
+    conn->payload_len = 0;
+
+    // A worker reading the payload off the socket itself must be alone on it
+    int concurrent = conn->pkt.stream_id != 0 && session->max_streams > 0 &&
+                     command_is_concurrent(conn->pkt.command) &&
+                     !conn->pkt.payload_unread;
+    int limit = concurrent ? session->max_streams : 1;
+
+    pthread_mutex_lock(&conn->lock);
+    if (!concurrent && conn->in_flight > 0) {
+        // Runs alone: hold it until the running requests are done
+        conn->parked = 1;
+        conn->stalled = 1;
+        conn->resume_below = 1;
+        pthread_mutex_unlock(&conn->lock);
+        return 1;
+    }
+    conn->in_flight++;
+    int wait = (conn->in_flight >= limit);
+    if (wait) {
+        conn->stalled = 1;
+        conn->resume_below = limit;
+    }
+    pthread_mutex_unlock(&conn->lock);
+
+    if (thread_pool_submit(session, &conn->pkt, connection_done, conn) < 0) {
+        log_error("Worker pool rejected command 0x%02X", conn->pkt.command);
+        free(conn->pkt.payload);
+        conn->pkt.payload = NULL;
+
+        pthread_mutex_lock(&conn->lock);
+        conn->in_flight--;
+        conn->stalled = 0;
+        pthread_mutex_unlock(&conn->lock);
+        return connection_fail(conn);
+    }
+
+    return wait;
+}
+
+// Read and submit packets until the socket is drained or the reactor has
+// to wait for workers. Returns 0 when drained (re-arm), 1 when waiting
+// (a worker re-arms), -1 to close.
+static int connection_read(Connection* conn) {
+    int fd = conn->session->client_socket;
+
+    for (;;) {
+        // The first bytes of the header tell whether a stream ID follows
+        size_t header_size = HEADER_SIZE;
+        if (conn->header_len >= HEADER_SIZE) {
+            header_size = (size_t)packet_header_length(conn->header);
+        }
+
+        ssize_t n;
+        if (conn->header_len < header_size) {
+            n = recv(fd, conn->header + conn->header_len,
+                     header_size - conn->header_len, 0);
+        } else {
+            n = recv(fd, conn->pkt.payload + conn->payload_len,
+                     conn->pkt.data_length - conn->payload_len, 0);
+        }
+
+        if (n == 0) {
+            return connection_fail(conn);   // Peer closed the connection
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;  // Drained; wait for the next edge
+            }
+            return connection_fail(conn);
+        }
+
+        session_timers_touch(conn->session);
+
+        if (conn->header_len < header_size) {
+            conn->header_len += (size_t)n;
+            if (conn->header_len == HEADER_SIZE &&
+                packet_header_length(conn->header) < 0) {
+                log_error("Invalid packet magic on fd=%d", fd);
+                return connection_fail(conn);
+            }
+            if (conn->header_len < HEADER_SIZE ||
+                conn->header_len < (size_t)packet_header_length(conn->header)) {
+                continue;
+            }
+
+            int rc = packet_parse_header(conn->header, &conn->pkt);
+            if (rc < 0) {
+                log_error("Invalid packet header (error %d) on fd=%d", rc, fd);
+                return connection_fail(conn);
+            }
+
+            conn->pkt.payload = NULL;
+            conn->payload_len = 0;
+            if (command_defers_payload(conn->session, &conn->pkt)) {
+                // The handler splices the payload to disk; the socket stays
+                // disarmed until it is done (see connection_submit()).
+                // Anything else is read here, without blocking a worker
+                conn->pkt.payload_unread = 1;
+            } else if (conn->pkt.data_length > 0) {
+                conn->pkt.payload = malloc(conn->pkt.data_length + 1);
+                if (!conn->pkt.payload) {
+                    log_error("Failed to allocate %u byte payload", conn->pkt.data_length);
+                    return connection_fail(conn);
+                }
+                continue;
+            }
+        } else {
+            conn->payload_len += (size_t)n;
+            if (conn->payload_len < conn->pkt.data_length) {
+                continue;
+            }
+            conn->pkt.payload[conn->pkt.data_length] = '\0';
+        }
+
+        if (packet_inflate(&conn->pkt) < 0) {
+            log_error("Invalid compressed payload on fd=%d", fd);
+            return connection_fail(conn);
+        }
+
+        int rc = connection_submit(conn);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+}
+
+// The socket fired, or a worker woke the reactor after a stall
+static int connection_process(Connection* conn) {
+    if (conn->closing) {
+        return -1;  // The last running request has finished
+    }
+    if (conn->parked) {
+        conn->parked = 0;
+        int rc = connection_submit(conn);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+    return connection_read(conn);
+}
+
+// Stop accepting on this reactor; pause_fd stays readable for the others
+static void reactor_pause_accept(Reactor* r) {
+    epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, r->listen_fd, NULL);
+    epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, r->loop->pause_fd, NULL);
+    log_info("Reactor %d stopped accepting (%d connections left)",
+             r->index, r->connection_count);
+
+    pthread_mutex_lock(&r->loop->pause_mutex);
+    r->loop->paused_count++;
+    pthread_cond_broadcast(&r->loop->pause_cond);
+    pthread_mutex_unlock(&r->loop->pause_mutex);
+}
+
+// Keep a shard's accept queue, sessions and caches on one core. Shards
+// wrap around the CPUs this process may run on (a cpuset or taskset can
+// hide some online ones), so extra reactors share cores instead of
+// asking for CPUs that do not exist
+static void reactor_pin(Reactor* r) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return;
+    }
+    int count = CPU_COUNT(&allowed);
+    if (count <= 0) {
+        return;
+    }
+
+    int skip = r->index % count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed) || skip-- > 0) {
+            continue;
+        }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            log_error("Reactor %d: failed to pin to CPU %d", r->index, cpu);
+        }
+        return;
+    }
+}
+
+static void* reactor_main(void* arg) {
+    Reactor* r = (Reactor*)arg;
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+    int stopping = 0;
+
+    if (r->owns_listener) {
+        reactor_pin(r);
+    }
+
+    log_info("Reactor %d started (listener fd=%d%s)", r->index, r->listen_fd,
+             r->owns_listener ? ", sharded" : "");
+
+    while (!stopping) {
+        int n = epoll_wait(r->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("Reactor %d: epoll_wait() failed: %s", r->index, strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            void* tag = events[i].data.ptr;
+
+            if (tag == &stop_tag) {
+                stopping = 1;
+            } else if (tag == &pause_tag) {
+                reactor_pause_accept(r);
+            } else if (tag == &listener_tag) {
+                reactor_accept(r);
+            } else {
+                Connection* conn = (Connection*)tag;
+                int rc = connection_process(conn);
+                if (rc == 0 && connection_arm(conn) < 0) {
+                    rc = connection_fail(conn);
+                }
+                if (rc < 0) {
+                    connection_close(r, conn);
+                }
+            }
+        }
+    }
+
+    log_info("Reactor %d stopped", r->index);
+    return NULL;
+}
+
+static int reactor_setup(EventLoop* loop, Reactor* r, int index, int fd, int owns_listener) {
+    memset(r, 0, sizeof(*r));
+    r->loop = loop;
+    r->index = index;
+    r->listen_fd = fd;
+    r->owns_listener = owns_listener;
+
+    r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epoll_fd < 0) {
+        log_error("epoll_create1() failed: %s", strerror(errno));
+        return -1;
+    }
+
+    // Level-triggered; a shared listener also needs EPOLLEXCLUSIVE so only
+    // one reactor wakes per new connection
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = owns_listener ? EPOLLIN : (EPOLLIN | EPOLLEXCLUSIVE);
+    ev.data.ptr = &listener_tag;
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        log_error("epoll_ctl(listener) failed: %s", strerror(errno));
+        close(r->epoll_fd);
+        return -1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &stop_tag;
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, loop->stop_fd, &ev) < 0) {
+        log_error("epoll_ctl(stop) failed: %s", strerror(errno));
+        close(r->epoll_fd);
+        return -1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &pause_tag;
+    if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, loop->pause_fd, &ev) < 0) {
+        log_error("epoll_ctl(pause) failed: %s", strerror(errno));
+        close(r->epoll_fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+EventLoop* event_loop_start(Server* server, const int* listen_fds,
+                            int num_listeners, int num_reactors) {
+    if (!server) {
+        return NULL;
+    }
+    if (num_reactors <= 0) {
+        num_reactors = 1;
+    }
+    if (!listen_fds || (num_listeners != 1 && num_listeners != num_reactors)) {
+        log_error("Event loop needs one shared listener or one per reactor (got %d for %d)",
+                  num_listeners, num_reactors);
+        return NULL;
+    }
+
+    raise_fd_limit();
+
+    // Reactors drain accept() until EAGAIN, so listeners must not block
+    for (int i = 0; i < num_listeners; i++) {
+        int flags = fcntl(listen_fds[i], F_GETFL, 0);
+        if (flags < 0 || fcntl(listen_fds[i], F_SETFL, flags | O_NONBLOCK) < 0) {
+            log_error("Failed to make listener fd=%d non-blocking: %s",
+                      listen_fds[i], strerror(errno));
+            return NULL;
+        }
+    }
+    int sharded = (num_listeners > 1);
+
+    EventLoop* loop = calloc(1, sizeof(EventLoop));
+    if (!loop) {
+        log_error("Failed to allocate event loop");
+        return NULL;
+    }
+    loop->server = server;
+    pthread_mutex_init(&loop->pause_mutex, NULL);
+    pthread_cond_init(&loop->pause_cond, NULL);
+
+    loop->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    loop->pause_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    loop->reactors = calloc(num_reactors, sizeof(Reactor));
+    if (loop->stop_fd < 0 || loop->pause_fd < 0 || !loop->reactors) {
+        log_error("Failed to set up event loop: %s", strerror(errno));
+        event_loop_cleanup(loop);
+        return NULL;
+    }
+
+    int started = 0;
+    int result = 0;
+    for (int i = 0; i < num_reactors; i++) {
+        Reactor* r = &loop->reactors[i];
+        int fd = sharded ? listen_fds[i] : listen_fds[0];
+        if (reactor_setup(loop, r, i, fd, sharded) < 0) {
+            result = -1;
+            break;
+        }
+        if (pthread_create(&r->thread, NULL, reactor_main, r) != 0) {
+            log_error("Failed to create reactor thread %d", i);
+            close(r->epoll_fd);
+            result = -1;
+            break;
+        }
+        started++;
+    }
+
+    loop->reactors_started = started;
+
+    if (result < 0) {
+        event_loop_stop(loop);
+        event_loop_wait(loop);
+        return NULL;
+    }
+
+    log_info("Event loop running with %d reactor threads (%s listener)",
+             started, sharded ? "SO_REUSEPORT per-reactor" : "shared");
+    return loop;
+}
+
+int event_loop_wait(EventLoop* loop) {
+    if (!loop) {
+        return -1;
+    }
+
+    for (int i = 0; i < loop->reactors_started; i++) {
+        pthread_join(loop->reactors[i].thread, NULL);
+    }
+
+    // In-flight commands still use their sessions; let them finish first
+    thread_pool_drain();
+
+    for (int i = 0; i < loop->reactors_started; i++) {
+        Reactor* r = &loop->reactors[i];
+        while (r->connections) {
+            connection_close(r, r->connections);
+        }
+        close(r->epoll_fd);
+    }
+
+    event_loop_cleanup(loop);
+    return 0;
+}
+
+int event_loop_run(Server* server, const int* listen_fds, int num_listeners, int num_reactors) {
+    EventLoop* loop = event_loop_start(server, listen_fds, num_listeners, num_reactors);
+    if (!loop) {
+        return -1;
+    }
+    return event_loop_wait(loop);
+}
+
+void event_loop_stop_accepting(EventLoop* loop) {
+    if (!loop || loop->pause_fd < 0) {
+        return;
+    }
+
+    uint64_t one = 1;
+    ssize_t written = write(loop->pause_fd, &one, sizeof(one));
+    (void)written;
+
+    pthread_mutex_lock(&loop->pause_mutex);
+    while (loop->paused_count < loop->reactors_started) {
+        pthread_cond_wait(&loop->pause_cond, &loop->pause_mutex);
+    }
+    pthread_mutex_unlock(&loop->pause_mutex);
+}
+
+void event_loop_stop(EventLoop* loop) {
+    if (loop && loop->stop_fd >= 0) {
+        uint64_t one = 1;
+        ssize_t written = write(loop->stop_fd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+#else // !__linux__
+
+int event_loop_supported(void) {
+    return 0;
+}
+
+EventLoop* event_loop_start(struct Server* server, const int* listen_fds,
+                            int num_listeners, int num_reactors) {
+    (void)server;
+    (void)listen_fds;
+    (void)num_listeners;
+    (void)num_reactors;
+    log_error("epoll reactor mode is only available on Linux");
+    return NULL;
+}
+
+int event_loop_wait(EventLoop* loop) {
+    (void)loop;
+    return -1;
+}
+
+int event_loop_run(struct Server* server, const int* listen_fds,
+                   int num_listeners, int num_reactors) {
+    (void)event_loop_start(server, listen_fds, num_listeners, num_reactors);
+    return -1;
+}
+
+void event_loop_stop_accepting(EventLoop* loop) {
+    (void)loop;
+}
+
+void event_loop_stop(EventLoop* loop) {
+    (void)loop;
+}
+
+#endif // __linux__
@@ -0,0 +1,51 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+// Session capacity used when the server runs in epoll reactor mode
+#define EVENT_LOOP_MAX_CLIENTS 16384
+
+// Upper bound on reactor threads (and SO_REUSEPORT listeners); must stay
+// below the kernel's per-message SCM_RIGHTS limit for hot restart
+#define EVENT_LOOP_MAX_REACTORS 128
+
+// Events fetched per epoll_wait() call
+#define EVENT_LOOP_MAX_EVENTS 256
+
+struct Server;
+
+// One set of reactor threads serving one server's listeners
+typedef struct EventLoop EventLoop;
+
+// Check whether the epoll reactor is available on this platform
+int event_loop_supported(void);
+
+// Start num_reactors edge-triggered reactor threads and return.
+// With a single listener every reactor waits on it (EPOLLEXCLUSIVE).
+// With num_listeners == num_reactors (SO_REUSEPORT listeners, see
+// socket_create_listener()) reactor i owns listen_fds[i]: it is the only
+// thread accepting from that queue, it is pinned to CPU i, and the
+// sessions it accepts stay in its own shard.
+// Reactors only accept and decode; complete packets are handed to the
+// worker pool (thread_pool_start() must have been called). Accepted
+// sessions belong to server.
+// Returns the running loop, or NULL on error.
+EventLoop* event_loop_start(struct Server* server, const int* listen_fds,
+                            int num_listeners, int num_reactors);
+
+// Block until event_loop_stop(), let in-flight commands finish, then
+// close every connection and free the loop. Returns 0, or -1 if loop is NULL.
+int event_loop_wait(EventLoop* loop);
+
+// event_loop_start() followed by event_loop_wait()
+int event_loop_run(struct Server* server, const int* listen_fds,
+                   int num_listeners, int num_reactors);
+
+// Remove the listeners from every reactor and block until all reactors
+// have done so; open connections keep being served. Afterwards the
+// caller may close the listening sockets (used by hot restart).
+void event_loop_stop_accepting(EventLoop* loop);
+
+// Wake all reactors and make event_loop_wait() return (async-signal-safe)
+void event_loop_stop(EventLoop* loop);
+
+#endif // EVENT_LOOP_H
@@ -0,0 +1,319 @@
+#include "hot_restart.h"
+#include "../common/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define HANDOFF_MAGIC "FSHR"
+#define HANDOFF_VERSION 2
+#define HANDOFF_READY 'R'
+#define HANDOFF_CONFIRM 'C'
+
+// Version 1 (older servers) sends no HANDOFF_CONFIRM
+#define HANDOFF_VERSION_UNCONFIRMED 1
+
+// Version of the handoff this process received (new process side)
+static uint32_t received_version = 0;
+
+// Fixed-size header sent along with the descriptors
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+} HandoffHeader;
+
+// Copy argv minus any previous --takeover-fd, then append ours
+static char** build_child_argv(char* const argv[]) {
+    int argc = 0;
+    while (argv[argc]) {
+        argc++;
+    }
+
+    char** child = calloc(argc + 3, sizeof(char*));
+    if (!child) {
+        return NULL;
+    }
+
+    int n = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--takeover-fd") == 0) {
+            i++;    // Skip its value too
+            continue;
+        }
+        if (strncmp(argv[i], "--takeover-fd=", 14) == 0) {
+            continue;
+        }
+        child[n++] = argv[i];
+    }
+
+    static char fd_arg[16];
+    snprintf(fd_arg, sizeof(fd_arg), "%d", HOT_RESTART_CHANNEL_FD);
+    child[n++] = "--takeover-fd";
+    child[n++] = fd_arg;
+    child[n] = NULL;
+    return child;
+}
+
+// Runs between fork() and exec(): async-signal-safe calls only
+static void exec_child(char** child_argv, int channel_fd, long max_fd) {
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+
+    if (channel_fd == HOT_RESTART_CHANNEL_FD) {
+        fcntl(channel_fd, F_SETFD, 0);
+    } else if (dup2(channel_fd, HOT_RESTART_CHANNEL_FD) < 0) {
+        _exit(127);
+    }
+
+    // Sessions, listeners and the database stay with the old process
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, HOT_RESTART_CHANNEL_FD + 1, ~0U, 0) != 0)
+#endif
+    {
+        for (long fd = HOT_RESTART_CHANNEL_FD + 1; fd < max_fd; fd++) {
+            close((int)fd);
+        }
+    }
+
+    if (strchr(child_argv[0], '/')) {
+        execv(child_argv[0], child_argv);
+    } else {
+        execvp(child_argv[0], child_argv);
+    }
+    _exit(127);
+}
+
+int hot_restart_send(int channel_fd, const int* listen_fds, int count) {
+    HandoffHeader header;
+    memcpy(header.magic, HANDOFF_MAGIC, sizeof(header.magic));
+    header.version = HANDOFF_VERSION;
+    header.count = (uint32_t)count;
+
+    struct iovec iov = { .iov_base = &header, .iov_len = sizeof(header) };
+
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HOT_RESTART_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cmsg), listen_fds, sizeof(int) * count);
+
+    ssize_t n;
+    do {
+        n = sendmsg(channel_fd, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+
+    return n == (ssize_t)sizeof(header) ? 0 : -1;
+}
+
+int hot_restart_await_ready(int channel_fd) {
+    struct pollfd pfd = { .fd = channel_fd, .events = POLLIN, .revents = 0 };
+    int rc;
+    do {
+        rc = poll(&pfd, 1, HOT_RESTART_READY_TIMEOUT_MS);
+    } while (rc < 0 && errno == EINTR);
+    if (rc <= 0) {
+        return -1;
+    }
+
+    char ready = 0;
+    if (read(channel_fd, &ready, 1) != 1 || ready != HANDOFF_READY) {
+        return -1;
+    }
+
+    // From here on the listeners are the new process's
+    char confirm = HANDOFF_CONFIRM;
+    ssize_t n;
+    do {
+        n = write(channel_fd, &confirm, 1);
+    } while (n < 0 && errno == EINTR);
+    return n == 1 ? 0 : -1;
+}
+
+// Collect a new process that did not take over: it exits by itself once
+// the channel closes, SIGTERM hurries it, SIGKILL ends a hung one. A pidfd
+// becomes readable when the child exits, so the wait blocks in poll()
+// with a timeout instead of polling waitpid(); kernels without
+// pidfd_open() skip the grace period
+static void reap_child(pid_t pid) {
+    kill(pid, SIGTERM);
+
+    int exited = 0;
+#ifdef SYS_pidfd_open
+    int pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    if (pidfd >= 0) {
+        struct pollfd pfd = { .fd = pidfd, .events = POLLIN, .revents = 0 };
+        int rc;
+        do {
+            rc = poll(&pfd, 1, HOT_RESTART_REAP_TIMEOUT_MS);
+        } while (rc < 0 && errno == EINTR);
+        exited = rc > 0;
+        close(pidfd);
+    }
+#endif
+
+    if (!exited) {
+        log_error("Hot restart: new server (pid=%d) did not exit; killing it", (int)pid);
+        kill(pid, SIGKILL);
+    }
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) {
+    }
+}
+
+int hot_restart_spawn(char* const argv[], const int* listen_fds, int count) {
+    if (!argv || !argv[0] || !listen_fds || count <= 0 || count > HOT_RESTART_MAX_FDS) {
+        log_error("Invalid hot restart request");
+        return -1;
+    }
+
+    char** child_argv = build_child_argv(argv);
+    if (!child_argv) {
+        log_error("Failed to build hot restart command line");
+        return -1;
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        log_error("socketpair() failed: %s", strerror(errno));
+        free(child_argv);
+        return -1;
+    }
+
+    long max_fd = sysconf(_SC_OPEN_MAX);
+    if (max_fd <= 0) {
+        max_fd = 1024;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        log_error("fork() failed: %s", strerror(errno));
+        close(sv[0]);
+        close(sv[1]);
+        free(child_argv);
+        return -1;
+    }
+    if (pid == 0) {
+        exec_child(child_argv, sv[1], max_fd);
+    }
+
+    close(sv[1]);
+    free(child_argv);
+    log_info("Hot restart: started new server (pid=%d), handing over %d listener(s)",
+             (int)pid, count);
+
+    if (hot_restart_send(sv[0], listen_fds, count) < 0 || hot_restart_await_ready(sv[0]) < 0) {
+        log_error("Hot restart: new server (pid=%d) did not take over; keeping current process",
+                  (int)pid);
+        close(sv[0]);
+        reap_child(pid);
+        return -1;
+    }
+
+    close(sv[0]);
+    log_info("Hot restart: new server (pid=%d) is accepting connections", (int)pid);
+    return 0;
+}
+
+int hot_restart_receive(int channel_fd, int* listen_fds, int max_fds) {
+    if (channel_fd < 0 || !listen_fds || max_fds <= 0) {
+        return -1;
+    }
+
+    HandoffHeader header;
+    struct iovec iov = { .iov_base = &header, .iov_len = sizeof(header) };
+
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HOT_RESTART_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t n;
+    do {
+        n = recvmsg(channel_fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+
+    if (n != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, HANDOFF_MAGIC, sizeof(header.magic)) != 0 ||
+        (header.version != HANDOFF_VERSION && header.version != HANDOFF_VERSION_UNCONFIRMED)) {
+        log_error("Hot restart: invalid handoff message");
+        return -1;
+    }
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        log_error("Hot restart: handoff carried no descriptors");
+        return -1;
+    }
+
+    int received = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+    int fds[HOT_RESTART_MAX_FDS];
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * received);
+
+    if (received != (int)header.count || received > max_fds ||
+        (msg.msg_flags & MSG_CTRUNC)) {
+        log_error("Hot restart: expected %u listener(s), got %d", header.count, received);
+        for (int i = 0; i < received; i++) {
+            close(fds[i]);
+        }
+        return -1;
+    }
+
+    memcpy(listen_fds, fds, sizeof(int) * received);
+    received_version = header.version;
+    log_info("Hot restart: took over %d listener(s)", received);
+    return received;
+}
+
+int hot_restart_ready(int channel_fd) {
+    char ready = HANDOFF_READY;
+    ssize_t n;
+    do {
+        n = write(channel_fd, &ready, 1);
+    } while (n < 0 && errno == EINTR);
+
+    // The old process either confirms or closes the channel (it gave up);
+    // it decides, so no timeout here
+    char confirm = 0;
+    if (n == 1 && received_version != HANDOFF_VERSION_UNCONFIRMED) {
+        do {
+            n = read(channel_fd, &confirm, 1);
+        } while (n < 0 && errno == EINTR);
+        if (n == 1 && confirm != HANDOFF_CONFIRM) {
+            n = -1;
+        }
+    }
+
+    close(channel_fd);
+    return n == 1 ? 0 : -1;
+}
@@ -0,0 +1,52 @@
+#ifndef HOT_RESTART_H
+#define HOT_RESTART_H
+
+// Hot restart: on SIGUSR2 the running server re-executes its own command
+// line with --takeover-fd, passes its listening sockets to the new process
+// over a Unix socketpair (SCM_RIGHTS), stops accepting once the new
+// process reports ready, and drains its remaining sessions. The listen
+// queues never close, so clients see no refused connections.
+//
+// The old process confirms the READY it got. A new process that gets no
+// confirmation (the old one gave up waiting) exits again and must only
+// close() the listeners: shutting them down would empty the queues the
+// old process keeps serving.
+
+// Signal that triggers a hot restart
+#define HOT_RESTART_SIGNAL SIGUSR2
+
+// Descriptor number the channel is given in the new process
+#define HOT_RESTART_CHANNEL_FD 3
+
+// Most listeners one handoff may carry (kernel SCM_RIGHTS limit is 253)
+#define HOT_RESTART_MAX_FDS 128
+
+// How long the old process waits for the new one to report ready
+#define HOT_RESTART_READY_TIMEOUT_MS 10000
+
+// How long a new process that failed to take over gets to exit after
+// SIGTERM before it is killed
+#define HOT_RESTART_REAP_TIMEOUT_MS 5000
+
+// Old process: exec argv (plus --takeover-fd) and hand it listen_fds.
+// Returns 0 once the new process is serving, -1 if it failed to start
+// (the caller keeps serving as before).
+int hot_restart_spawn(char* const argv[], const int* listen_fds, int count);
+
+// Old process, the two halves of hot_restart_spawn's handoff over an
+// already connected channel: send count listeners (SCM_RIGHTS), then wait
+// up to HOT_RESTART_READY_TIMEOUT_MS for READY and confirm it. Each
+// returns 0 on success, -1 on failure.
+int hot_restart_send(int channel_fd, const int* listen_fds, int count);
+int hot_restart_await_ready(int channel_fd);
+
+// New process: receive the listening sockets from channel_fd.
+// Returns the number of descriptors stored in listen_fds, or -1.
+int hot_restart_receive(int channel_fd, int* listen_fds, int max_fds);
+
+// New process: report that the inherited listeners are being served,
+// wait for the old process to confirm and close the channel. Returns 0
+// once the listeners are ours, -1 if the old process kept them.
+int hot_restart_ready(int channel_fd);
+
+#endif // HOT_RESTART_H
@@ -0,0 +1,197 @@
+#include "listing_cache.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Every entry of a directory shares a bucket, so invalidation walks one
+static unsigned bucket_of(int dir_id) {
+    return (unsigned)dir_id % LISTING_CACHE_BUCKETS;
+}
+
+static int key_equal(const ListingCacheKey* a, const ListingCacheKey* b) {
+    return a->dir_id == b->dir_id && a->version == b->version &&
+           a->encoding == b->encoding && a->limit == b->limit && a->sort == b->sort &&
+           a->descending == b->descending && a->compression == b->compression;
+}
+
+static void entry_free(ListingCacheEntry* entry) {
+    free(entry->data);
+    free(entry);
+}
+
+// Caller holds the lock
+static void lru_unlink(ListingCache* cache, ListingCacheEntry* entry) {
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        cache->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        cache->lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+// Caller holds the lock
+static void lru_push_front(ListingCache* cache, ListingCacheEntry* entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head) {
+        cache->lru_head->lru_prev = entry;
+    } else {
+        cache->lru_tail = entry;
+    }
+    cache->lru_head = entry;
+}
+
+// Take entry out of the cache and drop the cache's reference; an entry
+// still being sent is freed by its last listing_cache_release(). Caller
+// holds the lock
+static void remove_entry(ListingCache* cache, ListingCacheEntry* entry) {
+    for (ListingCacheEntry** link = &cache->buckets[bucket_of(entry->key.dir_id)]; *link;
+         link = &(*link)->hash_next) {
+        if (*link == entry) {
+            *link = entry->hash_next;
+            break;
+        }
+    }
+    lru_unlink(cache, entry);
+    cache->size -= entry->length;
+    cache->count--;
+
+    if (--entry->refs == 0) {
+        entry_free(entry);
+    }
+}
+
+void listing_cache_init(ListingCache* cache, size_t capacity) {
+    memset(cache, 0, sizeof(*cache));
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->capacity = capacity;
+}
+
+void listing_cache_destroy(ListingCache* cache) {
+    ListingCacheEntry* entry = cache->lru_head;
+    while (entry) {
+        ListingCacheEntry* next = entry->lru_next;
+        entry_free(entry);
+        entry = next;
+    }
+    memset(cache->buckets, 0, sizeof(cache->buckets));
+    cache->lru_head = cache->lru_tail = NULL;
+    cache->size = 0;
+    cache->count = 0;
+    pthread_mutex_destroy(&cache->lock);
+}
+
+ListingCacheEntry* listing_cache_get(ListingCache* cache, const ListingCacheKey* key) {
+    if (cache->capacity == 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    ListingCacheEntry* entry = cache->buckets[bucket_of(key->dir_id)];
+    while (entry && !key_equal(&entry->key, key)) {
+        entry = entry->hash_next;
+    }
+    if (entry) {
+        lru_unlink(cache, entry);
+        lru_push_front(cache, entry);
+        entry->refs++;
+        cache->hits++;
+    } else {
+        cache->misses++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    return entry;
+}
+
+ListingCacheEntry* listing_cache_put(ListingCache* cache, const ListingCacheKey* key,
+                                     uint8_t* data, uint32_t length, int compressed) {
+    // One listing may not push out most of the others
+    if (cache->capacity == 0 || length > cache->capacity / 4) {
+        return NULL;
+    }
+
+    ListingCacheEntry* entry = calloc(1, sizeof(ListingCacheEntry));
+    if (!entry) {
+        return NULL;
+    }
+    entry->key = *key;
+    entry->data = data;
+    entry->length = length;
+    entry->compressed = compressed;
+    entry->refs = 2;            // The cache's and the caller's
+
+    pthread_mutex_lock(&cache->lock);
+
+    // A request that read the version before a write finished its listing
+    // after a newer one was cached: that listing is stale already
+    unsigned bucket = bucket_of(key->dir_id);
+    for (ListingCacheEntry* other = cache->buckets[bucket]; other; other = other->hash_next) {
+        if (other->key.dir_id == key->dir_id && other->key.version > key->version) {
+            pthread_mutex_unlock(&cache->lock);
+            free(entry);
+            return NULL;
+        }
+    }
+
+    // Older versions are stale, and an equal key may have been filled by
+    // a request that missed at the same time
+    ListingCacheEntry* other = cache->buckets[bucket];
+    while (other) {
+        ListingCacheEntry* next = other->hash_next;
+        if (other->key.dir_id == key->dir_id &&
+            (other->key.version < key->version || key_equal(&other->key, key))) {
+            remove_entry(cache, other);
+        }
+        other = next;
+    }
+
+    while (cache->lru_tail && cache->size + length > cache->capacity) {
+        remove_entry(cache, cache->lru_tail);
+    }
+
+    entry->hash_next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    lru_push_front(cache, entry);
+    cache->size += length;
+    cache->count++;
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return entry;
+}
+
+void listing_cache_release(ListingCache* cache, ListingCacheEntry* entry) {
+    if (!entry) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    int last = --entry->refs == 0;
+    pthread_mutex_unlock(&cache->lock);
+
+    if (last) {
+        entry_free(entry);
+    }
+}
+
+void listing_cache_invalidate(ListingCache* cache, int dir_id) {
+    if (cache->capacity == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    ListingCacheEntry* entry = cache->buckets[bucket_of(dir_id)];
+    while (entry) {
+        ListingCacheEntry* next = entry->hash_next;
+        if (entry->key.dir_id == dir_id) {
+            remove_entry(cache, entry);
+        }
+        entry = next;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
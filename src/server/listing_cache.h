@@ -0,0 +1,81 @@
+#ifndef LISTING_CACHE_H
+#define LISTING_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// Encoded LIST_DIR payloads of recently listed directories, as they go on
+// the wire (compressed for sessions that compress). An entry is keyed by
+// the directory's version (see db_get_directory_version()), so a change
+// to the directory makes it unreachable; writers also drop a directory's
+// entries right away to free their memory. When the payloads outgrow the
+// capacity, the least recently used ones are evicted.
+//
+// Entries are immutable and reference counted: a hit is sent straight
+// from the cache, without a copy, while eviction goes on.
+
+// Default bound on the bytes held (ServerConfig.listing_cache_size)
+#define LISTING_CACHE_DEFAULT_SIZE (16 * 1024 * 1024)
+
+#define LISTING_CACHE_BUCKETS 256
+
+// ListingCacheKey.encoding of a JSON listing; binary ones use their fields
+// word (columns and flags), which never has every bit set
+#define LISTING_CACHE_JSON UINT32_MAX
+
+typedef struct {
+    int dir_id;
+    int64_t version;
+    uint32_t encoding;
+    int limit;                  // First page of this many entries, 0 for all
+    int sort;                   // DbSort of a page
+    int descending;
+    int compression;            // Of the session it was encoded for (compress.h)
+} ListingCacheKey;
+
+typedef struct ListingCacheEntry {
+    ListingCacheKey key;
+    uint8_t* data;
+    uint32_t length;
+    int compressed;             // data is compress_payload() output
+    int refs;                   // The cache's own while linked, plus one per user
+    struct ListingCacheEntry* hash_next;
+    struct ListingCacheEntry* lru_prev;   // Towards the most recently used
+    struct ListingCacheEntry* lru_next;
+} ListingCacheEntry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    size_t capacity;            // 0 disables the cache
+    size_t size;                // Bytes of data held
+    int count;
+    ListingCacheEntry* buckets[LISTING_CACHE_BUCKETS];
+    ListingCacheEntry* lru_head;    // Most recently used
+    ListingCacheEntry* lru_tail;
+    uint64_t hits;
+    uint64_t misses;
+} ListingCache;
+
+void listing_cache_init(ListingCache* cache, size_t capacity);
+
+// Free every entry; none may still be in use
+void listing_cache_destroy(ListingCache* cache);
+
+// Entry for key, or NULL. Pair a hit with listing_cache_release()
+ListingCacheEntry* listing_cache_get(ListingCache* cache, const ListingCacheKey* key);
+
+// Cache length bytes of data (malloc()ed; the cache takes them over) for
+// key, evicting as needed, and drop the entries of older versions of the
+// directory. Returns the entry, to be released like a hit, or NULL when it
+// is not cached (disabled, or too large): data is then still the caller's
+ListingCacheEntry* listing_cache_put(ListingCache* cache, const ListingCacheKey* key,
+                                     uint8_t* data, uint32_t length, int compressed);
+
+// Give back an entry from listing_cache_get() or listing_cache_put()
+void listing_cache_release(ListingCache* cache, ListingCacheEntry* entry);
+
+// Drop every entry of dir_id (its listing changed)
+void listing_cache_invalidate(ListingCache* cache, int dir_id);
+
+#endif // LISTING_CACHE_H
@@ -1,124 +1,271 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include "server.h"
 #include "socket_mgr.h"
 #include "thread_pool.h"
+#include "event_loop.h"
+#include "hot_restart.h"
+#include "session_timers.h"
 #include "commands.h"
-#include "storage.h"
 #include "../common/protocol.h"
 #include "../common/utils.h"
-#include "../database/db_manager.h"
+#include "../common/io_backend.h"
 
-static volatile int running = 1;
-static int server_fd = -1;
+// Default time a replaced server keeps serving its sessions after a hot restart
+#define DEFAULT_DRAIN_TIMEOUT_SEC 30
 
-// Global database handle
-Database* global_db = NULL;
-
-void shutdown_handler(int sig) {
-    (void)sig;
-    printf("\nShutting down server...\n");
-    running = 0;
-    if (server_fd >= 0) {
-        socket_close(server_fd);
-    }
-    if (global_db) {
-        db_close(global_db);
-        global_db = NULL;
-    }
+static void print_usage(const char* prog) {
+    printf("Usage: %s [options] [port]\n", prog);
+    printf("  -m, --mode <threads|epoll>  Connection model (default: epoll on Linux)\n");
+    printf("  -w, --workers <n>           Worker threads running commands (default: CPU count)\n");
+    printf("      --max-transfers <n>     Downloads served at once, each on a worker; more wait\n");
+    printf("                              (default: half the workers)\n");
+    printf("  -r, --reactors <n>          epoll reactor threads doing socket I/O (default: 1,\n");
+    printf("                              or one per CPU with --reuseport)\n");
+    printf("      --reuseport             One SO_REUSEPORT listener per reactor (epoll mode)\n");
+    printf("  -b, --backlog <n>           Listen backlog (default: %d)\n", SOCKET_DEFAULT_BACKLOG);
+    printf("  -i, --io-backend <posix|uring>  Blocking send/recv and file I/O backend (default: posix)\n");
+    printf("      --drain-timeout <sec>   After a hot restart (kill -USR2), keep serving old\n");
+    printf("                              sessions this long (default: %d)\n", DEFAULT_DRAIN_TIMEOUT_SEC);
+    printf("      --takeover-fd <fd>      Internal: receive listeners from a restarting server\n");
+    printf("      --idle-timeout <sec>    Close sessions silent this long; 0 = never (default: %d)\n",
+           DEFAULT_IDLE_TIMEOUT_SEC);
+    printf("      --login-timeout <sec>   Close sessions not logged in this long after connecting\n");
+    printf("                              (default: %d)\n", DEFAULT_LOGIN_TIMEOUT_SEC);
+    printf("      --transfer-timeout <sec>  Abort uploads that stall this long (default: %d)\n",
+           DEFAULT_TRANSFER_TIMEOUT_SEC);
+    printf("      --max-streams <n>       Tagged requests a connection may run at once;\n");
+    printf("                              0 disables multiplexing (default: %d)\n",
+           SERVER_DEFAULT_MAX_STREAMS);
+    printf("      --listing-cache <MB>    Memory for encoded directory listings; 0 disables\n");
+    printf("                              (default: %d)\n", LISTING_CACHE_DEFAULT_SIZE / (1024 * 1024));
+    printf("  -h, --help                  Show this help\n");
 }
 
 int main(int argc, char** argv) {
-    int port = DEFAULT_PORT;
+    ServerConfig config;
+    server_config_defaults(&config);
+    IoBackend io_backend = IO_BACKEND_POSIX;
+    int drain_timeout = DEFAULT_DRAIN_TIMEOUT_SEC;
+    int takeover_fd = -1;
 
-    if (argc > 1) {
-        port = atoi(argv[1]);
+    // getopt_long() permutes argv; hot restart re-executes the original order
+    char** saved_argv = calloc(argc + 1, sizeof(char*));
+    if (!saved_argv) {
+        return 1;
     }
+    memcpy(saved_argv, argv, sizeof(char*) * argc);
 
-    // Setup signal handlers
-    signal(SIGINT, shutdown_handler);
-    signal(SIGTERM, shutdown_handler);
+    static struct option long_options[] = {
+        {"mode",    required_argument, NULL, 'm'},
+        {"workers", required_argument, NULL, 'w'},
+        {"max-transfers", required_argument, NULL, 'M'},
+        {"reactors", required_argument, NULL, 'r'},
+        {"io-backend", required_argument, NULL, 'i'},
+        {"reuseport", no_argument,     NULL, 'R'},
+        {"backlog", required_argument, NULL, 'b'},
+        {"drain-timeout", required_argument, NULL, 'D'},
+        {"takeover-fd", required_argument, NULL, 'T'},
+        {"idle-timeout", required_argument, NULL, 'I'},
+        {"login-timeout", required_argument, NULL, 'L'},
+        {"transfer-timeout", required_argument, NULL, 'X'},
+        {"max-streams", required_argument, NULL, 'S'},
+        {"listing-cache", required_argument, NULL, 'C'},
+        {"help",    no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
 
-    // Initialize logging
-    log_init("server.log");
+    int opt;
+    while ((opt = getopt_long(argc, argv, "m:w:r:i:b:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'm':
+                if (strcmp(optarg, "threads") == 0) {
+                    config.mode = SERVER_MODE_THREADS;
+                } else if (strcmp(optarg, "epoll") == 0) {
+                    config.mode = SERVER_MODE_EPOLL;
+                } else {
+                    fprintf(stderr, "Unknown mode: %s\n", optarg);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'w':
+                config.workers = atoi(optarg);
+                break;
+            case 'M':
+                config.max_transfers = atoi(optarg);
+                break;
+            case 'r':
+                config.reactors = atoi(optarg);
+                break;
+            case 'i':
+                if (strcmp(optarg, "posix") == 0) {
+                    io_backend = IO_BACKEND_POSIX;
+                } else if (strcmp(optarg, "uring") == 0 || strcmp(optarg, "io_uring") == 0) {
+                    io_backend = IO_BACKEND_URING;
+                } else {
+                    fprintf(stderr, "Unknown I/O backend: %s\n", optarg);
+                    print_usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'R':
+                config.reuse_port = 1;
+                break;
+            case 'b':
+                config.backlog = atoi(optarg);
+                break;
+            case 'D':
+                drain_timeout = atoi(optarg);
+                break;
+            case 'T':
+                takeover_fd = atoi(optarg);
+                break;
+            case 'I':
+                config.idle_timeout = atoi(optarg);
+                break;
+            case 'L':
+                config.login_timeout = atoi(optarg);
+                break;
+            case 'X':
+                config.transfer_timeout = atoi(optarg);
+                break;
+            case 'S':
+                config.max_streams = atoi(optarg);
+                break;
+            case 'C':
+                config.listing_cache_size = atoi(optarg) > 0 ? (size_t)atoi(optarg) * 1024 * 1024 : 0;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
 
-    // Initialize database
-    global_db = db_init("fileshare.db");
-    if (!global_db) {
-        log_error("Failed to initialize database");
-        return 1;
+    if (optind < argc) {
+        config.port = (uint16_t)atoi(argv[optind]);
     }
 
-    // Initialize database schema
-    if (db_init_schema(global_db, "src/database/db_init.sql") < 0) {
-        log_error("Failed to initialize database schema");
-        db_close(global_db);
+    if (config.mode == SERVER_MODE_EPOLL && !event_loop_supported()) {
+        fprintf(stderr, "epoll mode is not supported on this platform\n");
         return 1;
     }
 
-    // Initialize storage
-    if (storage_init("storage") < 0) {
-        log_error("Failed to initialize storage");
-        db_close(global_db);
+    if (config.reuse_port && config.mode != SERVER_MODE_EPOLL) {
+        fprintf(stderr, "--reuseport requires epoll mode\n");
         return 1;
     }
 
-    // Initialize command handlers
-    commands_init();
+    // Signals are taken synchronously by sigwait() below; every thread
+    // created from here on inherits the blocked mask
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, HOT_RESTART_SIGNAL);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signal(SIGPIPE, SIG_IGN);
 
-    // Initialize thread pool
-    thread_pool_init();
+    // Initialize logging
+    log_init("server.log");
 
-    // Create server socket
-    server_fd = socket_create_server(port);
-    if (server_fd < 0) {
-        log_error("Failed to create server socket");
+    // Select socket/file I/O backend (falls back to posix if io_uring is refused)
+    io_backend = io_backend_select(io_backend);
+
+    // Take over the listeners of the server being replaced
+    int inherited[EVENT_LOOP_MAX_REACTORS];
+    if (takeover_fd >= 0) {
+        config.num_inherited = hot_restart_receive(takeover_fd, inherited,
+                                                   EVENT_LOOP_MAX_REACTORS);
+        if (config.num_inherited <= 0) {
+            log_error("Failed to take over listening sockets");
+            return 1;
+        }
+        config.inherited_fds = inherited;
+    }
+
+    // Database, storage, session table and listener(s)
+    Server* srv = server_create(&config);
+    if (!srv) {
+        log_error("Failed to create server");
         return 1;
     }
 
-    log_info("Server listening on port %d", port);
-    printf("File Sharing Server started on port %d\n", port);
-    printf("Press Ctrl+C to shutdown\n");
+    int serving = server_start(srv);
 
-    // Main accept loop
-    while (running) {
-        struct sockaddr_in client_addr;
-        int client_fd = socket_accept_client(server_fd, &client_addr);
+    printf("File Sharing Server started on port %u\n", (unsigned)server_port(srv));
+    printf("Press Ctrl+C to shutdown, send SIGUSR2 (pid %d) to hot restart\n", (int)getpid());
+    if (serving == 0 && srv->config.mode == SERVER_MODE_EPOLL) {
+        printf("Using epoll reactor mode (%d reactors, %d workers, %d transfers, %s I/O%s)\n",
+               srv->config.reactors, thread_pool_worker_count(), thread_pool_transfer_limit(),
+               io_backend_name(io_backend),
+               srv->config.reuse_port ? ", SO_REUSEPORT listener per reactor" : "");
+    }
 
-        if (client_fd < 0) {
-            if (running) {
-                log_error("Failed to accept client");
+    if (takeover_fd >= 0) {
+        if (serving == 0) {
+            // The old process stops accepting only after this
+            if (hot_restart_ready(takeover_fd) == 0) {
+                srv->listeners_borrowed = 0;
+            } else {
+                log_error("Hot restart: old server kept its listeners; exiting");
+                serving = -1;
             }
-            continue;
+        } else {
+            close(takeover_fd);
         }
+    }
 
-        char* client_ip = socket_get_client_ip(&client_addr);
-        log_info("Client connected from %s", client_ip);
-        printf("Client connected from %s\n", client_ip);
-
-        // Spawn handler thread
-        if (thread_spawn_client(client_fd, &client_addr) < 0) {
-            log_error("Failed to spawn client handler");
-            socket_close(client_fd);
+    // Wait for shutdown or hot restart
+    int handed_over = 0;
+    while (serving == 0) {
+        int sig = 0;
+        if (sigwait(&signals, &sig) != 0) {
+            continue;
         }
+        if (sig == HOT_RESTART_SIGNAL) {
+            printf("Hot restart: starting new server...\n");
+            if (hot_restart_spawn(saved_argv, srv->listen_fds, srv->num_listeners) == 0) {
+                handed_over = 1;
+                break;
+            }
+            printf("Hot restart failed; still serving\n");
+            continue;
+        }
+        break;
+    }
 
-        free(client_ip);
+    // Stop accepting; with a handoff the listen queues live on in the new process
+    server_stop_accepting(srv);
+    server_close_listeners(srv, handed_over);
+
+    if (handed_over) {
+        printf("Handed over to new server, draining sessions (up to %ds)...\n", drain_timeout);
+        int left = server_wait_sessions(srv, drain_timeout * 1000);
+        log_info("Drain finished (%d sessions still open)", left);
+    } else {
+        printf("\nShutting down server...\n");
     }
 
     // Cleanup
     printf("Shutting down client handlers...\n");
-    thread_pool_shutdown();
-
-    // Close database if not already closed
-    if (global_db) {
-        db_close(global_db);
-        global_db = NULL;
-    }
+    server_destroy(srv);
 
+    free(saved_argv);
     log_info("Server shutdown complete");
     log_close();
 
     printf("Server stopped.\n");
-    return 0;
+    return serving == 0 ? 0 : 1;
 }
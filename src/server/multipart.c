@@ -0,0 +1,212 @@
+#include "multipart.h"
+#include "../common/utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void upload_free(MultipartUpload* upload) {
+    if (upload->fd >= 0) {
+        close(upload->fd);
+    }
+    free(upload->received);
+    free(upload->uuid);
+    free(upload);
+}
+
+// Caller holds the lock
+static MultipartUpload* find_upload(MultipartTable* table, int file_id) {
+    for (MultipartUpload* upload = table->uploads; upload; upload = upload->next) {
+        if (upload->file_id == file_id) {
+            return upload;
+        }
+    }
+    return NULL;
+}
+
+// Caller holds the lock
+static void unlink_upload(MultipartTable* table, MultipartUpload* upload) {
+    for (MultipartUpload** link = &table->uploads; *link; link = &(*link)->next) {
+        if (*link == upload) {
+            *link = upload->next;
+            upload->next = NULL;
+            return;
+        }
+    }
+}
+
+void multipart_table_init(MultipartTable* table) {
+    pthread_mutex_init(&table->lock, NULL);
+    table->uploads = NULL;
+}
+
+void multipart_table_destroy(MultipartTable* table) {
+    MultipartUpload* upload = table->uploads;
+    while (upload) {
+        MultipartUpload* next = upload->next;
+        upload_free(upload);
+        upload = next;
+    }
+    table->uploads = NULL;
+    pthread_mutex_destroy(&table->lock);
+}
+
+int multipart_begin(MultipartTable* table, int file_id, int user_id, SessionId owner,
+                    const char* uuid, int64_t size, uint32_t part_size, int fd) {
+    if (!uuid || size < 0 || part_size == 0) {
+        return -1;
+    }
+
+    MultipartUpload* upload = calloc(1, sizeof(MultipartUpload));
+    if (!upload) {
+        return -1;
+    }
+
+    uint64_t part_count = ((uint64_t)size + part_size - 1) / part_size;
+    if (part_count > UINT32_MAX) {
+        free(upload);
+        return -1;
+    }
+
+    upload->file_id = file_id;
+    upload->user_id = user_id;
+    upload->owner = owner;
+    upload->uuid = str_duplicate(uuid);
+    upload->size = size;
+    upload->part_size = part_size;
+    upload->part_count = (uint32_t)part_count;
+    upload->received = calloc(part_count / 8 + 1, 1);
+    upload->fd = -1;
+    if (!upload->uuid || !upload->received) {
+        upload_free(upload);
+        return -1;
+    }
+    upload->fd = fd;
+
+    pthread_mutex_lock(&table->lock);
+    upload->next = table->uploads;
+    table->uploads = upload;
+    pthread_mutex_unlock(&table->lock);
+    return 0;
+}
+
+MultipartUpload* multipart_claim_part(MultipartTable* table, int file_id, int user_id,
+                                      uint32_t part, size_t length, uint64_t* offset,
+                                      const char** error) {
+    pthread_mutex_lock(&table->lock);
+
+    MultipartUpload* upload = find_upload(table, file_id);
+    if (!upload || upload->user_id != user_id) {
+        pthread_mutex_unlock(&table->lock);
+        *error = "No such multipart upload";
+        return NULL;
+    }
+    if (part >= upload->part_count) {
+        pthread_mutex_unlock(&table->lock);
+        *error = "Invalid part number";
+        return NULL;
+    }
+
+    // Every part is part_size bytes but the last, which holds the rest
+    uint64_t start = (uint64_t)part * upload->part_size;
+    uint64_t expected = (uint64_t)upload->size - start;
+    if (expected > upload->part_size) {
+        expected = upload->part_size;
+    }
+    if (length != expected) {
+        pthread_mutex_unlock(&table->lock);
+        *error = "Invalid part size";
+        return NULL;
+    }
+
+    upload->writers++;
+    pthread_mutex_unlock(&table->lock);
+
+    *offset = start;
+    return upload;
+}
+
+void multipart_finish_part(MultipartTable* table, MultipartUpload* upload, uint32_t part, int ok) {
+    pthread_mutex_lock(&table->lock);
+    if (ok && !(upload->received[part / 8] & (1u << (part % 8)))) {
+        upload->received[part / 8] |= (uint8_t)(1u << (part % 8));
+        upload->parts_received++;
+    }
+    upload->writers--;
+    int orphaned = upload->detached && upload->writers == 0;
+    pthread_mutex_unlock(&table->lock);
+
+    if (orphaned) {
+        upload_free(upload);
+    }
+}
+
+MultipartUpload* multipart_take(MultipartTable* table, int file_id, SessionId owner,
+                                const char** error) {
+    pthread_mutex_lock(&table->lock);
+
+    MultipartUpload* upload = find_upload(table, file_id);
+    if (!upload || upload->owner != owner) {
+        pthread_mutex_unlock(&table->lock);
+        *error = "No such multipart upload";
+        return NULL;
+    }
+    if (upload->writers > 0) {
+        pthread_mutex_unlock(&table->lock);
+        *error = "Parts are still being written";
+        return NULL;
+    }
+
+    unlink_upload(table, upload);
+    pthread_mutex_unlock(&table->lock);
+    return upload;
+}
+
+MultipartUpload* multipart_take_owned(MultipartTable* table, SessionId owner) {
+    MultipartUpload* taken = NULL;
+
+    pthread_mutex_lock(&table->lock);
+    MultipartUpload** link = &table->uploads;
+    while (*link) {
+        MultipartUpload* upload = *link;
+        if (upload->owner == owner) {
+            *link = upload->next;
+            upload->next = taken;
+            taken = upload;
+        } else {
+            link = &upload->next;
+        }
+    }
+    pthread_mutex_unlock(&table->lock);
+
+    return taken;
+}
+
+void multipart_release(MultipartTable* table, MultipartUpload* upload) {
+    pthread_mutex_lock(&table->lock);
+    int busy = upload->writers > 0;
+    if (busy) {
+        upload->detached = 1;
+    }
+    pthread_mutex_unlock(&table->lock);
+
+    if (!busy) {
+        upload_free(upload);
+    }
+}
+
+int multipart_is_open(MultipartTable* table, int file_id) {
+    pthread_mutex_lock(&table->lock);
+    int open = find_upload(table, file_id) != NULL;
+    pthread_mutex_unlock(&table->lock);
+    return open;
+}
+
+int multipart_has_user(MultipartTable* table, int user_id) {
+    pthread_mutex_lock(&table->lock);
+    MultipartUpload* upload = table->uploads;
+    while (upload && upload->user_id != user_id) {
+        upload = upload->next;
+    }
+    pthread_mutex_unlock(&table->lock);
+    return upload != NULL;
+}
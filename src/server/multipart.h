@@ -0,0 +1,78 @@
+#ifndef MULTIPART_H
+#define MULTIPART_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "session_registry.h"
+
+// Multipart uploads (UPLOAD_REQ with "multipart"): the blob is allocated at
+// its final size when the upload opens, and numbered UPLOAD_PART frames,
+// which may arrive on any of the owner's connections at once, are written
+// in place at part * part_size. The session that opened the upload commits
+// or abandons it. The upload ID is the file's ID.
+
+// Largest part a client may ask for (the frame still has to fit)
+#define MULTIPART_MAX_PART_SIZE (8 * 1024 * 1024)
+
+typedef struct MultipartUpload {
+    int file_id;
+    int user_id;
+    SessionId owner;            // Session that opened it
+    char* uuid;
+    int64_t size;
+    uint32_t part_size;
+    uint32_t part_count;
+    uint32_t parts_received;
+    uint8_t* received;          // Bitmap of the parts written
+    int fd;                     // Blob, open until commit or abort
+    int writers;                // Parts being written right now
+    int detached;               // Taken out of the table while writers > 0
+    struct MultipartUpload* next;
+} MultipartUpload;
+
+// Open multipart uploads of one server
+typedef struct {
+    pthread_mutex_t lock;
+    MultipartUpload* uploads;
+} MultipartTable;
+
+void multipart_table_init(MultipartTable* table);
+
+// Close and free the uploads still open (their files are left as they are)
+void multipart_table_destroy(MultipartTable* table);
+
+// Register an upload; takes over fd. Returns 0, or -1 on error (fd is
+// then still the caller's)
+int multipart_begin(MultipartTable* table, int file_id, int user_id, SessionId owner,
+                    const char* uuid, int64_t size, uint32_t part_size, int fd);
+
+// Reserve part of user_id's upload file_id for a write of length bytes at
+// *offset into upload->fd. Returns the upload, or NULL with the reason in
+// *error. Pair with multipart_finish_part()
+MultipartUpload* multipart_claim_part(MultipartTable* table, int file_id, int user_id,
+                                      uint32_t part, size_t length, uint64_t* offset,
+                                      const char** error);
+
+// End a write reserved by multipart_claim_part(); ok marks the part written
+void multipart_finish_part(MultipartTable* table, MultipartUpload* upload, uint32_t part, int ok);
+
+// Unregister owner's upload file_id for commit. NULL (reason in *error) if
+// there is no such upload or parts are still being written
+MultipartUpload* multipart_take(MultipartTable* table, int file_id, SessionId owner,
+                                const char** error);
+
+// Unregister every upload owner opened (a list linked through next)
+MultipartUpload* multipart_take_owned(MultipartTable* table, SessionId owner);
+
+// Close and free a taken upload, or leave that to the last part still
+// being written into it
+void multipart_release(MultipartTable* table, MultipartUpload* upload);
+
+// Nonzero while file_id is an open multipart upload
+int multipart_is_open(MultipartTable* table, int file_id);
+
+// Nonzero while user_id has a multipart upload open
+int multipart_has_user(MultipartTable* table, int user_id);
+
+#endif // MULTIPART_H
@@ -1,43 +1,371 @@
 #include "server.h"
 #include "socket_mgr.h"
 #include "thread_pool.h"
+#include "session_timers.h"
+#include "storage.h"
 #include "../common/utils.h"
+#include "../common/protocol.h"
 #include "../database/db_manager.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+void server_config_defaults(ServerConfig* config) {
+    memset(config, 0, sizeof(*config));
+    config->port = DEFAULT_PORT;
+    config->mode = event_loop_supported() ? SERVER_MODE_EPOLL : SERVER_MODE_THREADS;
+    config->backlog = SOCKET_DEFAULT_BACKLOG;
+    config->max_streams = SERVER_DEFAULT_MAX_STREAMS;
+    config->db_path = SERVER_DEFAULT_DB_PATH;
+    config->schema_path = SERVER_DEFAULT_SCHEMA_PATH;
+    config->storage_root = SERVER_DEFAULT_STORAGE_ROOT;
+    config->idle_timeout = DEFAULT_IDLE_TIMEOUT_SEC;
+    config->login_timeout = DEFAULT_LOGIN_TIMEOUT_SEC;
+    config->transfer_timeout = DEFAULT_TRANSFER_TIMEOUT_SEC;
+    config->listing_cache_size = LISTING_CACHE_DEFAULT_SIZE;
+}
+
+// Legacy accept loop: one handler thread per client
+static void* acceptor_main(void* arg) {
+    Server* srv = (Server*)arg;
+
+    struct pollfd pfds[2] = {
+        { .fd = srv->socket_fd, .events = POLLIN, .revents = 0 },
+        { .fd = srv->acceptor_wake[0], .events = POLLIN, .revents = 0 }
+    };
+
+    for (;;) {
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_error("Accept loop poll() failed: %s", strerror(errno));
+            break;
+        }
+        if (pfds[1].revents) {
+            break;  // Told to stop accepting
+        }
+        if (!(pfds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        struct sockaddr_in client_addr;
+        int client_fd = socket_accept_client(srv->socket_fd, &client_addr);
+
+        if (client_fd < 0) {
+            continue;   // Raced with another acceptor, or a transient error
+        }
+
+        char* client_ip = socket_get_client_ip(&client_addr);
+        log_info("Client connected from %s (port %u)", client_ip, (unsigned)srv->port);
+
+        // Spawn handler thread
+        if (thread_spawn_client(srv, client_fd, &client_addr) < 0) {
+            log_error("Failed to spawn client handler");
+            socket_close(client_fd);
+        }
+
+        free(client_ip);
+    }
 
-Server* server_create(uint16_t port) {
-    // TODO: Implement server creation
-    // - Allocate Server structure
-    // - Initialize fields
-    // - Create socket and bind to port
-    // - Initialize thread pool
-    // - Initialize database manager
-    // - Return server or NULL on error
     return NULL;
 }
 
+static int acceptor_start(Server* srv) {
+    // Non-blocking so a connection taken by another process cannot park accept()
+    int flags = fcntl(srv->socket_fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(srv->socket_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        log_error("Failed to make listener non-blocking: %s", strerror(errno));
+        return -1;
+    }
+
+    if (pipe(srv->acceptor_wake) < 0) {
+        log_error("pipe() failed: %s", strerror(errno));
+        srv->acceptor_wake[0] = srv->acceptor_wake[1] = -1;
+        return -1;
+    }
+    fcntl(srv->acceptor_wake[0], F_SETFD, FD_CLOEXEC);
+    fcntl(srv->acceptor_wake[1], F_SETFD, FD_CLOEXEC);
+
+    if (pthread_create(&srv->acceptor_thread, NULL, acceptor_main, srv) != 0) {
+        log_error("Failed to create accept thread");
+        close(srv->acceptor_wake[0]);
+        close(srv->acceptor_wake[1]);
+        srv->acceptor_wake[0] = srv->acceptor_wake[1] = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static void acceptor_stop(Server* srv) {
+    if (srv->acceptor_wake[1] < 0) {
+        return;
+    }
+
+    char stop = 1;
+    ssize_t written = write(srv->acceptor_wake[1], &stop, 1);
+    (void)written;
+    pthread_join(srv->acceptor_thread, NULL);
+
+    close(srv->acceptor_wake[0]);
+    close(srv->acceptor_wake[1]);
+    srv->acceptor_wake[0] = srv->acceptor_wake[1] = -1;
+}
+
+// Bind the configured listener(s), or adopt the inherited ones
+static int server_open_listeners(Server* srv, const ServerConfig* config) {
+    if (config->num_inherited > 0) {
+        if (!config->inherited_fds || config->num_inherited > EVENT_LOOP_MAX_REACTORS) {
+            log_error("Invalid inherited listeners");
+            return -1;
+        }
+        if (config->num_inherited > 1) {
+            if (srv->config.mode != SERVER_MODE_EPOLL) {
+                log_error("Inherited %d SO_REUSEPORT listeners; threads mode needs one",
+                          config->num_inherited);
+                return -1;
+            }
+            srv->config.reuse_port = 1;
+            srv->config.reactors = config->num_inherited;
+        } else {
+            srv->config.reuse_port = 0;
+        }
+        memcpy(srv->listen_fds, config->inherited_fds, sizeof(int) * config->num_inherited);
+        srv->num_listeners = config->num_inherited;
+        srv->listeners_borrowed = 1;
+    } else {
+        int count = srv->config.reuse_port ? srv->config.reactors : 1;
+        int port = srv->config.port;
+        for (int i = 0; i < count; i++) {
+            int fd = socket_create_listener(port, srv->config.backlog, srv->config.reuse_port);
+            if (fd < 0) {
+                log_error("Failed to create listener %d on port %d", i, port);
+                return -1;
+            }
+            srv->listen_fds[srv->num_listeners++] = fd;
+
+            // An ephemeral port is picked by the first bind; the shards share it
+            if (port == 0) {
+                port = socket_get_port(fd);
+                if (port < 0) {
+                    return -1;
+                }
+            }
+        }
+    }
+
+    srv->socket_fd = srv->listen_fds[0];
+    int port = socket_get_port(srv->socket_fd);
+    if (port < 0) {
+        return -1;
+    }
+    srv->port = (uint16_t)port;
+    return 0;
+}
+
+Server* server_create(const ServerConfig* config) {
+    ServerConfig defaults;
+    if (!config) {
+        server_config_defaults(&defaults);
+        config = &defaults;
+    }
+
+    if (config->mode == SERVER_MODE_EPOLL && !event_loop_supported()) {
+        log_error("epoll mode is not supported on this platform");
+        return NULL;
+    }
+    if (config->reuse_port && config->mode != SERVER_MODE_EPOLL) {
+        log_error("SO_REUSEPORT listeners require epoll mode");
+        return NULL;
+    }
+
+    Server* srv = calloc(1, sizeof(Server));
+    if (!srv) {
+        log_error("Failed to allocate server");
+        return NULL;
+    }
+
+    srv->config = *config;
+    srv->config.inherited_fds = NULL;
+    srv->config.num_inherited = 0;
+    snprintf(srv->db_path, sizeof(srv->db_path), "%s",
+             config->db_path ? config->db_path : SERVER_DEFAULT_DB_PATH);
+    snprintf(srv->storage_root, sizeof(srv->storage_root), "%s",
+             config->storage_root ? config->storage_root : SERVER_DEFAULT_STORAGE_ROOT);
+    srv->config.db_path = srv->db_path;
+    srv->config.storage_root = srv->storage_root;
+    srv->config.schema_path = NULL;
+
+    if (srv->config.reactors <= 0) {
+        // Sharded listeners default to one reactor per core
+        long cpus = srv->config.reuse_port ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+        srv->config.reactors = cpus > 0 ? (int)cpus : 1;
+    }
+    if (srv->config.reactors > EVENT_LOOP_MAX_REACTORS) {
+        srv->config.reactors = EVENT_LOOP_MAX_REACTORS;
+    }
+    if (srv->config.max_sessions <= 0) {
+        srv->config.max_sessions = (srv->config.mode == SERVER_MODE_EPOLL)
+                                   ? EVENT_LOOP_MAX_CLIENTS : MAX_CLIENTS;
+    }
+
+    srv->socket_fd = -1;
+    srv->acceptor_wake[0] = srv->acceptor_wake[1] = -1;
+    pthread_mutex_init(&srv->idle_mutex, NULL);
+    pthread_cond_init(&srv->idle_cond, NULL);
+    multipart_table_init(&srv->uploads);
+    listing_cache_init(&srv->listings, srv->config.listing_cache_size);
+
+    if (session_registry_init(&srv->sessions, srv->config.max_sessions) < 0) {
+        log_error("Failed to initialize session registry");
+        server_destroy(srv);
+        return NULL;
+    }
+
+    srv->db = db_init(srv->db_path);
+    if (!srv->db) {
+        log_error("Failed to initialize database");
+        server_destroy(srv);
+        return NULL;
+    }
+
+    const char* schema = config->schema_path ? config->schema_path : SERVER_DEFAULT_SCHEMA_PATH;
+    if (db_init_schema(srv->db, schema) < 0) {
+        log_error("Failed to initialize database schema");
+        server_destroy(srv);
+        return NULL;
+    }
+
+    if (storage_init(srv->storage_root) < 0) {
+        log_error("Failed to initialize storage");
+        server_destroy(srv);
+        return NULL;
+    }
+
+    if (server_open_listeners(srv, config) < 0) {
+        server_destroy(srv);
+        return NULL;
+    }
+
+    log_info("Server created on port %u (max_sessions=%d, db=%s, storage=%s)",
+             (unsigned)srv->port, session_registry_capacity(&srv->sessions),
+             srv->db_path, srv->storage_root);
+    return srv;
+}
+
 int server_start(Server* srv) {
-    // TODO: Implement server start
-    // - Listen on socket
-    // - Main accept loop
-    // - Accept client connections
-    // - Dispatch client handler to thread pool
-    // - Return 0 on normal shutdown, -1 on error
-    return -1;
+    if (!srv || srv->is_running || srv->num_listeners == 0) {
+        return -1;
+    }
+
+    if (session_timers_start() < 0) {
+        return -1;
+    }
+
+    if (srv->config.mode == SERVER_MODE_EPOLL) {
+        if (thread_pool_start(srv->config.workers, srv->config.max_transfers,
+                              WORK_QUEUE_CAPACITY) < 0) {
+            log_error("Failed to start worker pool");
+            session_timers_stop();
+            return -1;
+        }
+        srv->loop = event_loop_start(srv, srv->listen_fds, srv->num_listeners,
+                                     srv->config.reactors);
+        if (!srv->loop) {
+            thread_pool_stop();
+            session_timers_stop();
+            return -1;
+        }
+    } else if (acceptor_start(srv) < 0) {
+        session_timers_stop();
+        return -1;
+    }
+
+    srv->is_running = 1;
+    log_info("Server listening on port %u", (unsigned)srv->port);
+    return 0;
+}
+
+uint16_t server_port(const Server* srv) {
+    return srv ? srv->port : 0;
+}
+
+void server_stop_accepting(Server* srv) {
+    if (!srv || !srv->is_running) {
+        return;
+    }
+    if (srv->loop) {
+        event_loop_stop_accepting(srv->loop);
+    } else {
+        acceptor_stop(srv);
+    }
+}
+
+void server_close_listeners(Server* srv, int handed_over) {
+    if (!srv) {
+        return;
+    }
+    for (int i = 0; i < srv->num_listeners; i++) {
+        if (handed_over || srv->listeners_borrowed) {
+            // The new process owns the socket now: drop our reference only,
+            // socket_close() would shut the shared listen queue down
+            close(srv->listen_fds[i]);
+        } else {
+            socket_close(srv->listen_fds[i]);
+        }
+    }
+    srv->num_listeners = 0;
+    srv->socket_fd = -1;
+}
+
+int server_wait_sessions(Server* srv, int timeout_ms) {
+    return srv ? thread_pool_wait_sessions(srv, timeout_ms) : 0;
 }
 
 void server_stop(Server* srv) {
-    // TODO: Implement server stop
-    // - Set is_running to 0
-    // - Close server socket
-    // - Wait for active connections to finish
+    if (!srv || !srv->is_running) {
+        return;
+    }
+
+    server_stop_accepting(srv);
+    server_close_listeners(srv, 0);
+
+    if (srv->loop) {
+        event_loop_stop(srv->loop);
+        event_loop_wait(srv->loop);
+        srv->loop = NULL;
+        thread_pool_stop();
+    }
+
+    // Threads mode sessions (the event loop already closed its own)
+    thread_pool_shutdown(srv);
+    session_timers_stop();
+
+    srv->is_running = 0;
+    log_info("Server on port %u stopped", (unsigned)srv->port);
 }
 
 void server_destroy(Server* srv) {
-    // TODO: Implement server cleanup
-    // - Stop server if running
-    // - Destroy thread pool
-    // - Close database manager
-    // - Free server structure
+    if (!srv) {
+        return;
+    }
+
+    server_stop(srv);
+    server_close_listeners(srv, 0);
+
+    if (srv->db) {
+        db_close(srv->db);
+        srv->db = NULL;
+    }
+
+    session_registry_destroy(&srv->sessions);
+    multipart_table_destroy(&srv->uploads);
+    listing_cache_destroy(&srv->listings);
+    pthread_mutex_destroy(&srv->idle_mutex);
+    pthread_cond_destroy(&srv->idle_cond);
+    free(srv);
 }
@@ -2,20 +2,111 @@
 #define SERVER_H
 
 #include <stdint.h>
+#include <pthread.h>
+#include "session_registry.h"
+#include "event_loop.h"
+#include "multipart.h"
+#include "listing_cache.h"
+#include "../database/db_manager.h"
 
-#define MAX_CLIENTS 100
-#define SERVER_BACKLOG 20
+// A Server owns its listening socket(s), database, storage root and
+// session table, so several servers can run side by side in one process
+// (tests and benchmarks bind port 0 and read the port back with
+// server_port()). The worker pool and the session timer thread are shared
+// by every server in the process and started by the first one.
+
+#define SERVER_DEFAULT_DB_PATH "fileshare.db"
+#define SERVER_DEFAULT_SCHEMA_PATH "src/database/db_init.sql"
+#define SERVER_DEFAULT_STORAGE_ROOT "storage"
+
+// Tagged requests a connection may have running at once (CMD_ENABLE_STREAMS)
+#define SERVER_DEFAULT_MAX_STREAMS 16
+
+typedef enum {
+    SERVER_MODE_THREADS,    // One detached thread per client (legacy)
+    SERVER_MODE_EPOLL       // epoll reactors feeding the worker pool (default on Linux)
+} ServerMode;
 
 typedef struct {
-    int socket_fd;
-    uint16_t port;
+    uint16_t port;              // 0 picks an ephemeral port
+    ServerMode mode;
+    int workers;                // Worker threads (<= 0: one per CPU; epoll mode)
+    int max_transfers;          // Downloads running at once (<= 0: half the workers)
+    int reactors;               // Reactor threads (<= 0: 1, or one per CPU with reuse_port)
+    int reuse_port;             // One SO_REUSEPORT listener per reactor
+    int backlog;
+    int max_sessions;           // <= 0: default for the mode
+    int max_streams;            // Concurrent tagged requests per connection, 0 disables
+    const char* db_path;
+    const char* schema_path;
+    const char* storage_root;
+    int idle_timeout;           // Session deadlines in seconds, 0 disables
+    int login_timeout;
+    int transfer_timeout;
+    size_t listing_cache_size;  // Bytes of cached LIST_DIR payloads, 0 disables
+    const int* inherited_fds;   // Listeners taken over from another process
+    int num_inherited;
+} ServerConfig;
+
+typedef struct Server {
+    ServerConfig config;
+    char db_path[256];
+    char storage_root[256];
+    uint16_t port;              // Bound port (resolved when config.port is 0)
+
+    int socket_fd;              // listen_fds[0]
+    int listen_fds[EVENT_LOOP_MAX_REACTORS];
+    int num_listeners;
+    int listeners_borrowed;     // Inherited, until the old process confirms the handoff
+
+    Database* db;
+    SessionRegistry sessions;
+    MultipartTable uploads;     // Open multipart uploads (see multipart.h)
+    ListingCache listings;      // Encoded listings by directory version (see listing_cache.h)
+
+    // Signalled when the last session goes away (see server_wait_sessions)
+    pthread_mutex_t idle_mutex;
+    pthread_cond_t idle_cond;
+
+    // Threads mode: accept loop thread and the pipe that stops it
+    pthread_t acceptor_thread;
+    int acceptor_wake[2];
+
+    EventLoop* loop;            // epoll mode
     int is_running;
 } Server;
 
-// Server lifecycle
-Server* server_create(uint16_t port);
+// Fill config with the defaults used by the server binary
+void server_config_defaults(ServerConfig* config);
+
+// Open the database and storage and bind the listener(s)
+// Returns NULL on error
+Server* server_create(const ServerConfig* config);
+
+// Start accepting in background threads and return
+// Returns 0 once the server is serving, -1 on error
 int server_start(Server* srv);
+
+// Port the server is listening on
+uint16_t server_port(const Server* srv);
+
+// Stop accepting new connections; open sessions keep being served
+void server_stop_accepting(Server* srv);
+
+// Close the listening sockets (after server_stop_accepting()). With
+// handed_over, or while listeners_borrowed, the sockets belong to another
+// process, so only our descriptors are dropped and the listen queues stay
+// open.
+void server_close_listeners(Server* srv, int handed_over);
+
+// Block until no session is left or timeout_ms elapses (< 0: no limit)
+// Returns the number of sessions still open
+int server_wait_sessions(Server* srv, int timeout_ms);
+
+// Stop accepting, disconnect every session and stop the serving threads
 void server_stop(Server* srv);
+
+// Stop the server if running, close the database and free it
 void server_destroy(Server* srv);
 
 #endif // SERVER_H
@@ -0,0 +1,212 @@
+#include "session_registry.h"
+#include "../common/utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+// A slot's generation is odd while a session is live and even while free,
+// and it is bumped on every acquire and release. Readers use it to tell a
+// live session from a recycled slot without taking any lock.
+typedef struct {
+    uint32_t generation;
+    uint32_t next_free;     // Free-list link: index + 1, 0 terminates
+    ClientSession session;
+} SessionSlot;
+
+typedef struct SessionSegment {
+    SessionSlot slots[SESSION_SEGMENT_SIZE];
+} SessionSegment;
+
+#define FREE_HEAD(tag, link) (((uint64_t)(tag) << 32) | (uint32_t)(link))
+#define FREE_TAG(head) ((uint32_t)((head) >> 32))
+#define FREE_LINK(head) ((uint32_t)(head))
+
+static SessionSlot* slot_at(SessionRegistry* reg, uint32_t index) {
+    uint32_t seg = index >> SESSION_SEGMENT_SHIFT;
+    if (seg >= SESSION_MAX_SEGMENTS) {
+        return NULL;
+    }
+    SessionSegment* segment = __atomic_load_n(&reg->segments[seg], __ATOMIC_ACQUIRE);
+    return segment ? &segment->slots[index & (SESSION_SEGMENT_SIZE - 1)] : NULL;
+}
+
+// Install the segment holding index if nobody has yet
+static SessionSlot* slot_materialize(SessionRegistry* reg, uint32_t index) {
+    uint32_t seg = index >> SESSION_SEGMENT_SHIFT;
+    if (seg >= SESSION_MAX_SEGMENTS) {
+        return NULL;
+    }
+
+    SessionSegment* segment = __atomic_load_n(&reg->segments[seg], __ATOMIC_ACQUIRE);
+    if (!segment) {
+        SessionSegment* fresh = calloc(1, sizeof(SessionSegment));
+        if (!fresh) {
+            return NULL;
+        }
+        SessionSegment* expected = NULL;
+        if (__atomic_compare_exchange_n(&reg->segments[seg], &expected, fresh, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            segment = fresh;
+            log_info("Session registry grew to %u slots",
+                     (seg + 1) << SESSION_SEGMENT_SHIFT);
+        } else {
+            free(fresh);    // Another thread won the race
+            segment = expected;
+        }
+    }
+
+    return &segment->slots[index & (SESSION_SEGMENT_SIZE - 1)];
+}
+
+static int free_list_pop(SessionRegistry* reg, uint32_t* index) {
+    uint64_t head = __atomic_load_n(&reg->free_head, __ATOMIC_ACQUIRE);
+    while (FREE_LINK(head) != 0) {
+        uint32_t idx = FREE_LINK(head) - 1;
+        SessionSlot* slot = slot_at(reg, idx);
+        uint32_t next = __atomic_load_n(&slot->next_free, __ATOMIC_RELAXED);
+        uint64_t desired = FREE_HEAD(FREE_TAG(head) + 1, next);
+        if (__atomic_compare_exchange_n(&reg->free_head, &head, desired, 1,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *index = idx;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void free_list_push(SessionRegistry* reg, uint32_t index, SessionSlot* slot) {
+    uint64_t head = __atomic_load_n(&reg->free_head, __ATOMIC_RELAXED);
+    uint64_t desired;
+    do {
+        __atomic_store_n(&slot->next_free, FREE_LINK(head), __ATOMIC_RELAXED);
+        desired = FREE_HEAD(FREE_TAG(head) + 1, index + 1);
+    } while (!__atomic_compare_exchange_n(&reg->free_head, &head, desired, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+int session_registry_init(SessionRegistry* reg, int capacity) {
+    if (capacity <= 0) {
+        return -1;
+    }
+    if ((long)capacity > (long)SESSION_MAX_SEGMENTS * SESSION_SEGMENT_SIZE) {
+        capacity = SESSION_MAX_SEGMENTS * SESSION_SEGMENT_SIZE;
+    }
+
+    session_registry_destroy(reg);
+    __atomic_store_n(&reg->max_live, capacity, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void session_registry_destroy(SessionRegistry* reg) {
+    for (int i = 0; i < SESSION_MAX_SEGMENTS; i++) {
+        free(reg->segments[i]);
+        reg->segments[i] = NULL;
+    }
+    reg->free_head = 0;
+    reg->next_index = 0;
+    reg->live_count = 0;
+}
+
+ClientSession* session_registry_acquire(SessionRegistry* reg) {
+    int limit = __atomic_load_n(&reg->max_live, __ATOMIC_ACQUIRE);
+    if (__atomic_fetch_add(&reg->live_count, 1, __ATOMIC_ACQ_REL) >= limit) {
+        __atomic_fetch_sub(&reg->live_count, 1, __ATOMIC_ACQ_REL);
+        return NULL;
+    }
+
+    // Reuse a released slot first; only grow when the free list is empty
+    uint32_t index;
+    SessionSlot* slot;
+    if (free_list_pop(reg, &index) == 0) {
+        slot = slot_at(reg, index);
+    } else {
+        index = __atomic_fetch_add(&reg->next_index, 1, __ATOMIC_ACQ_REL);
+        slot = slot_materialize(reg, index);
+    }
+
+    if (!slot) {
+        __atomic_fetch_sub(&reg->live_count, 1, __ATOMIC_ACQ_REL);
+        return NULL;
+    }
+
+    memset(&slot->session, 0, sizeof(ClientSession));
+    uint32_t generation = __atomic_load_n(&slot->generation, __ATOMIC_RELAXED) + 1;
+    slot->session.session_id = ((uint64_t)generation << 32) | index;
+
+    // Publish: the zeroed session is visible before the slot reads as live
+    __atomic_store_n(&slot->generation, generation, __ATOMIC_RELEASE);
+    return &slot->session;
+}
+
+int session_registry_release(SessionRegistry* reg, ClientSession* session) {
+    if (!session) {
+        return -1;
+    }
+
+    uint32_t index = (uint32_t)session->session_id;
+    uint32_t generation = (uint32_t)(session->session_id >> 32);
+    SessionSlot* slot = slot_at(reg, index);
+    if (!slot || &slot->session != session ||
+        __atomic_load_n(&slot->generation, __ATOMIC_ACQUIRE) != generation) {
+        log_error("Releasing unknown or stale session (slot=%u)", index);
+        return -1;
+    }
+
+    __atomic_store_n(&slot->generation, generation + 1, __ATOMIC_RELEASE);
+    free_list_push(reg, index, slot);
+    return __atomic_sub_fetch(&reg->live_count, 1, __ATOMIC_ACQ_REL);
+}
+
+ClientSession* session_registry_lookup(SessionRegistry* reg, SessionId id) {
+    uint32_t generation = (uint32_t)(id >> 32);
+    if ((generation & 1) == 0) {
+        return NULL;
+    }
+
+    SessionSlot* slot = slot_at(reg, (uint32_t)id);
+    if (!slot || __atomic_load_n(&slot->generation, __ATOMIC_ACQUIRE) != generation) {
+        return NULL;
+    }
+    return &slot->session;
+}
+
+int session_registry_foreach(SessionRegistry* reg, session_visit_fn fn, void* arg) {
+    if (!fn) {
+        return 0;
+    }
+
+    uint32_t limit = __atomic_load_n(&reg->next_index, __ATOMIC_ACQUIRE);
+    int visited = 0;
+
+    for (uint32_t i = 0; i < limit; i++) {
+        SessionSlot* slot = slot_at(reg, i);
+        if (!slot) {
+            // Segment still being installed by the acquirer; nothing live yet
+            i |= SESSION_SEGMENT_SIZE - 1;
+            continue;
+        }
+        if ((__atomic_load_n(&slot->generation, __ATOMIC_ACQUIRE) & 1) == 0) {
+            continue;
+        }
+
+        visited++;
+        if (fn(&slot->session, arg)) {
+            break;
+        }
+    }
+
+    return visited;
+}
+
+int session_registry_count(SessionRegistry* reg) {
+    return __atomic_load_n(&reg->live_count, __ATOMIC_ACQUIRE);
+}
+
+int session_registry_capacity(SessionRegistry* reg) {
+    return __atomic_load_n(&reg->max_live, __ATOMIC_ACQUIRE);
+}
+
+int session_registry_slots(SessionRegistry* reg) {
+    uint32_t slots = __atomic_load_n(&reg->next_index, __ATOMIC_ACQUIRE);
+    uint32_t max = (uint32_t)SESSION_MAX_SEGMENTS * SESSION_SEGMENT_SIZE;
+    return (int)(slots < max ? slots : max);
+}
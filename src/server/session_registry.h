@@ -0,0 +1,69 @@
+#ifndef SESSION_REGISTRY_H
+#define SESSION_REGISTRY_H
+
+#include <stdint.h>
+#include "thread_pool.h"
+
+// Sessions live in fixed-size segments that are allocated on demand and
+// never moved or freed while the registry exists, so a ClientSession pointer
+// (and the slot behind it) stays valid memory even after the session ends.
+#define SESSION_SEGMENT_SHIFT 10
+#define SESSION_SEGMENT_SIZE (1 << SESSION_SEGMENT_SHIFT)
+#define SESSION_MAX_SEGMENTS 1024
+
+// Stable handle: slot generation in the high 32 bits, slot index in the low.
+// A handle goes stale as soon as its session is released.
+typedef uint64_t SessionId;
+
+#define SESSION_ID_NONE 0
+
+struct SessionSegment;
+
+// One session table; every server owns its own
+typedef struct {
+    struct SessionSegment* segments[SESSION_MAX_SEGMENTS];
+
+    // Treiber stack of free slot indices. The high 32 bits are a tag
+    // bumped on every update so a pop cannot succeed on a stale head (ABA).
+    uint64_t free_head;
+
+    uint32_t next_index;    // First never-used slot
+    int live_count;
+    int max_live;
+} SessionRegistry;
+
+// Return nonzero to stop the iteration
+typedef int (*session_visit_fn)(ClientSession* session, void* arg);
+
+// Set the live-session limit and reset the registry (no sessions may be live)
+int session_registry_init(SessionRegistry* reg, int capacity);
+
+// Free every segment; only call once all session users have stopped
+void session_registry_destroy(SessionRegistry* reg);
+
+// Take a free slot (lock-free) and return its zeroed session with
+// session_id set, or NULL when capacity is reached
+ClientSession* session_registry_acquire(SessionRegistry* reg);
+
+// Return the session's slot to the free list (lock-free)
+// Returns the number of sessions still live, or -1 for an unknown session
+int session_registry_release(SessionRegistry* reg, ClientSession* session);
+
+// Resolve a handle; NULL if the session has since been released
+ClientSession* session_registry_lookup(SessionRegistry* reg, SessionId id);
+
+// Visit every live session. The callback runs concurrently with the
+// sessions' own threads, so it may only read fields or use thread-safe
+// calls such as shutdown(). Returns the number of sessions visited.
+int session_registry_foreach(SessionRegistry* reg, session_visit_fn fn, void* arg);
+
+// Live sessions
+int session_registry_count(SessionRegistry* reg);
+
+// Configured live-session limit
+int session_registry_capacity(SessionRegistry* reg);
+
+// Slots allocated so far (live + free list)
+int session_registry_slots(SessionRegistry* reg);
+
+#endif // SESSION_REGISTRY_H
@@ -0,0 +1,206 @@
+#include "session_timers.h"
+#include "socket_mgr.h"
+#include "server.h"
+#include "../common/utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+
+static TimerWheel wheel;
+static pthread_mutex_t wheel_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ticker_cond;
+static pthread_t ticker_thread;
+static int running = 0;
+static int users = 0;
+
+// Tick the ticker last processed; read without the lock by touch()
+static uint64_t current_tick = 0;
+
+static uint64_t clock_tick(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t ms = (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+    return ms / SESSION_TIMER_TICK_MS;
+}
+
+static uint64_t seconds_to_ticks(int seconds) {
+    if (seconds <= 0) {
+        return 0;
+    }
+    return ((uint64_t)seconds * 1000 + SESSION_TIMER_TICK_MS - 1) / SESSION_TIMER_TICK_MS;
+}
+
+// Runs under wheel_mutex, so the session cannot be released underneath us
+static void session_expire(ClientSession* session, const char* reason) {
+    char* client_ip = socket_get_client_ip(&session->client_addr);
+    log_info("Closing session for %s (fd=%d): %s", client_ip, session->client_socket, reason);
+    free(client_ip);
+
+    // The owner sees EOF and cleans up through the usual disconnect path
+    session->state = STATE_DISCONNECTED;
+    shutdown(session->client_socket, SHUT_RDWR);
+}
+
+// Fire only if nothing arrived for period ticks; otherwise push the
+// deadline out to period ticks after the last activity
+static int still_active(ClientSession* session, TimerEntry* timer, uint64_t period) {
+    uint64_t last = __atomic_load_n(&session->last_activity, __ATOMIC_RELAXED);
+    if (last + period >= wheel.now) {
+        timer_wheel_add(&wheel, timer, last + period);
+        return 1;
+    }
+    return 0;
+}
+
+static void idle_expired(TimerEntry* timer, void* arg) {
+    ClientSession* session = arg;
+    if (!still_active(session, timer, seconds_to_ticks(session->server->config.idle_timeout))) {
+        session_expire(session, "idle timeout");
+    }
+}
+
+static void login_expired(TimerEntry* timer, void* arg) {
+    (void)timer;
+    session_expire(arg, "login timeout");
+}
+
+static void transfer_expired(TimerEntry* timer, void* arg) {
+    ClientSession* session = arg;
+    if (!still_active(session, timer,
+                      seconds_to_ticks(session->server->config.transfer_timeout))) {
+        session_expire(session, "transfer stalled");
+    }
+}
+
+static void* ticker_main(void* arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&wheel_mutex);
+    while (running) {
+        uint64_t now = clock_tick();
+        timer_wheel_advance(&wheel, now);
+        __atomic_store_n(&current_tick, now, __ATOMIC_RELAXED);
+
+        // Sleep until the next tick boundary (or until stopped)
+        struct timespec deadline;
+        uint64_t next_ms = (now + 1) * SESSION_TIMER_TICK_MS;
+        deadline.tv_sec = (time_t)(next_ms / 1000);
+        deadline.tv_nsec = (long)(next_ms % 1000) * 1000000L;
+        pthread_cond_timedwait(&ticker_cond, &wheel_mutex, &deadline);
+    }
+    pthread_mutex_unlock(&wheel_mutex);
+    return NULL;
+}
+
+int session_timers_start(void) {
+    pthread_mutex_lock(&wheel_mutex);
+    if (running) {
+        users++;
+        pthread_mutex_unlock(&wheel_mutex);
+        return 0;
+    }
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ticker_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    uint64_t now = clock_tick();
+    timer_wheel_init(&wheel, now);
+    __atomic_store_n(&current_tick, now, __ATOMIC_RELAXED);
+    running = 1;
+    users = 1;
+
+    int rc = pthread_create(&ticker_thread, NULL, ticker_main, NULL);
+    if (rc != 0) {
+        log_error("Failed to start session timer thread: %s", strerror(rc));
+        running = 0;
+        users = 0;
+        pthread_cond_destroy(&ticker_cond);
+        pthread_mutex_unlock(&wheel_mutex);
+        return -1;
+    }
+    pthread_mutex_unlock(&wheel_mutex);
+
+    log_info("Session timer thread started (tick=%dms)", SESSION_TIMER_TICK_MS);
+    return 0;
+}
+
+void session_timers_stop(void) {
+    pthread_mutex_lock(&wheel_mutex);
+    if (!running || --users > 0) {
+        pthread_mutex_unlock(&wheel_mutex);
+        return;
+    }
+    running = 0;
+    pthread_cond_signal(&ticker_cond);
+    pthread_mutex_unlock(&wheel_mutex);
+
+    pthread_join(ticker_thread, NULL);
+    pthread_cond_destroy(&ticker_cond);
+
+    if (wheel.count > 0) {
+        log_error("Session timers stopped with %d deadline(s) still armed", wheel.count);
+    }
+}
+
+void session_timers_attach(ClientSession* session) {
+    timer_init(&session->idle_timer, idle_expired, session);
+    timer_init(&session->login_timer, login_expired, session);
+    timer_init(&session->transfer_timer, transfer_expired, session);
+
+    uint64_t idle_ticks = seconds_to_ticks(session->server->config.idle_timeout);
+    uint64_t login_ticks = seconds_to_ticks(session->server->config.login_timeout);
+
+    pthread_mutex_lock(&wheel_mutex);
+    if (running) {
+        uint64_t now = wheel.now;
+        __atomic_store_n(&session->last_activity, now, __ATOMIC_RELAXED);
+        if (idle_ticks) {
+            timer_wheel_add(&wheel, &session->idle_timer, now + idle_ticks);
+        }
+        if (login_ticks) {
+            timer_wheel_add(&wheel, &session->login_timer, now + login_ticks);
+        }
+    }
+    pthread_mutex_unlock(&wheel_mutex);
+}
+
+void session_timers_detach(ClientSession* session) {
+    pthread_mutex_lock(&wheel_mutex);
+    timer_wheel_cancel(&wheel, &session->idle_timer);
+    timer_wheel_cancel(&wheel, &session->login_timer);
+    timer_wheel_cancel(&wheel, &session->transfer_timer);
+    pthread_mutex_unlock(&wheel_mutex);
+}
+
+void session_timers_touch(ClientSession* session) {
+    __atomic_store_n(&session->last_activity,
+                     __atomic_load_n(&current_tick, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+void session_timers_authenticated(ClientSession* session) {
+    pthread_mutex_lock(&wheel_mutex);
+    timer_wheel_cancel(&wheel, &session->login_timer);
+    pthread_mutex_unlock(&wheel_mutex);
+}
+
+void session_timers_transfer_start(ClientSession* session) {
+    uint64_t transfer_ticks = seconds_to_ticks(session->server->config.transfer_timeout);
+    session_timers_touch(session);
+
+    pthread_mutex_lock(&wheel_mutex);
+    if (running && transfer_ticks) {
+        timer_wheel_add(&wheel, &session->transfer_timer, wheel.now + transfer_ticks);
+    }
+    pthread_mutex_unlock(&wheel_mutex);
+}
+
+void session_timers_transfer_done(ClientSession* session) {
+    pthread_mutex_lock(&wheel_mutex);
+    timer_wheel_cancel(&wheel, &session->transfer_timer);
+    pthread_mutex_unlock(&wheel_mutex);
+}
@@ -0,0 +1,49 @@
+#ifndef SESSION_TIMERS_H
+#define SESSION_TIMERS_H
+
+#include "thread_pool.h"
+
+// Per-session deadlines on one timer wheel shared by every server in the
+// process, driven by a single ticker thread. The timeouts come from the
+// session's server configuration (0 disables a deadline):
+//   idle     - no bytes received for idle_timeout seconds
+//   login    - not authenticated within login_timeout seconds of connecting
+//   transfer - an upload made no progress for transfer_timeout seconds
+// An expired session is marked disconnected and its socket shut down; the
+// thread or reactor that owns it then cleans up as for any disconnect.
+// Moving bytes in either direction only stamps last_activity; the idle and
+// transfer timers re-check the stamp when they fire, so busy sessions never
+// touch the wheel.
+
+#define SESSION_TIMER_TICK_MS 250
+
+#define DEFAULT_IDLE_TIMEOUT_SEC 300
+#define DEFAULT_LOGIN_TIMEOUT_SEC 30
+#define DEFAULT_TRANSFER_TIMEOUT_SEC 60
+
+// Start the ticker, or add a reference if it is already running
+int session_timers_start(void);
+
+// Drop a reference; the last one stops and joins the ticker
+void session_timers_stop(void);
+
+// Arm the idle and login deadlines of a new session
+void session_timers_attach(ClientSession* session);
+
+// Cancel every deadline; must run before the socket is closed
+void session_timers_detach(ClientSession* session);
+
+// Bytes arrived from or left for the client (lock-free; call on every
+// receive and every step of a download)
+void session_timers_touch(ClientSession* session);
+
+// Login succeeded: drop the login deadline
+void session_timers_authenticated(ClientSession* session);
+
+// Upload accepted: arm the transfer deadline
+void session_timers_transfer_start(ClientSession* session);
+
+// Upload finished or was abandoned
+void session_timers_transfer_done(ClientSession* session);
+
+#endif // SESSION_TIMERS_H
@@ -10,9 +10,13 @@
 #include <errno.h>
 
 int socket_create_server(int port) {
-    // Validate port range
-    if (port < 1024 || port > 65535) {
-        log_error("Invalid port number: %d (must be 1024-65535)", port);
+    return socket_create_listener(port, SOCKET_DEFAULT_BACKLOG, 0);
+}
+
+int socket_create_listener(int port, int backlog, int reuse_port) {
+    // Validate port range (0 lets the kernel pick an ephemeral port)
+    if (port != 0 && (port < 1024 || port > 65535)) {
+        log_error("Invalid port number: %d (must be 0 or 1024-65535)", port);
         return -1;
     }
 
@@ -33,6 +37,21 @@ int socket_create_server(int port) {
         return -1;
     }
 
+    if (reuse_port) {
+#ifdef SO_REUSEPORT
+        if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+            perror("setsockopt(SO_REUSEPORT) failed");
+            log_error("Failed to set SO_REUSEPORT");
+            close(server_fd);
+            return -1;
+        }
+#else
+        log_error("SO_REUSEPORT is not supported on this platform");
+        close(server_fd);
+        return -1;
+#endif
+    }
+
     // Set socket options (keepalive, etc.)
     if (socket_set_options(server_fd) < 0) {
         log_error("Failed to set socket options");
@@ -54,18 +73,32 @@ int socket_create_server(int port) {
         return -1;
     }
 
-    // Start listening with backlog of 10
-    if (listen(server_fd, 10) < 0) {
+    // Start listening (the kernel caps backlog at net.core.somaxconn)
+    if (backlog <= 0) {
+        backlog = SOCKET_DEFAULT_BACKLOG;
+    }
+    if (listen(server_fd, backlog) < 0) {
         perror("listen() failed");
         log_error("Failed to listen on socket");
         close(server_fd);
         return -1;
     }
 
-    log_info("Server socket created and listening on port %d", port);
+    log_info("Server socket created and listening on port %d (fd=%d, backlog=%d%s)",
+             port, server_fd, backlog, reuse_port ? ", SO_REUSEPORT" : "");
     return server_fd;
 }
 
+int socket_get_port(int socket_fd) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(socket_fd, (struct sockaddr*)&addr, &len) < 0) {
+        log_error("getsockname() failed: %s", strerror(errno));
+        return -1;
+    }
+    return ntohs(addr.sin_port);
+}
+
 int socket_accept_client(int server_fd, struct sockaddr_in* client_addr) {
     if (!client_addr) {
         log_error("client_addr is NULL");
@@ -77,7 +110,7 @@ int socket_accept_client(int server_fd, struct sockaddr_in* client_addr) {
 
     int client_fd = accept(server_fd, (struct sockaddr*)client_addr, &addr_len);
     if (client_fd < 0) {
-        if (errno != EINTR) {
+        if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
             perror("accept() failed");
             log_error("Failed to accept client connection");
         }
@@ -3,9 +3,21 @@
 
 #include <netinet/in.h>
 
-// Create and configure server socket
+// Listen backlog used when none is configured
+#define SOCKET_DEFAULT_BACKLOG 1024
+
+// Create and configure server socket (default backlog, no SO_REUSEPORT)
 int socket_create_server(int port);
 
+// Create a listener with an explicit backlog (<= 0 selects the default).
+// Port 0 binds an ephemeral port (see socket_get_port()).
+// With reuse_port set, SO_REUSEPORT lets several listeners bind the same
+// port; the kernel then spreads incoming connections across them.
+int socket_create_listener(int port, int backlog, int reuse_port);
+
+// Local port a socket is bound to, or -1
+int socket_get_port(int socket_fd);
+
 // Accept incoming client connection
 int socket_accept_client(int server_fd, struct sockaddr_in* client_addr);
 
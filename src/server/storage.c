@@ -1,5 +1,6 @@
 #include "storage.h"
 #include "../common/utils.h"
+#include "../common/io_backend.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,34 +8,30 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 
-static char storage_base[256] = {0};
-
-int storage_init(const char* base_path) {
-    if (!base_path || strlen(base_path) == 0) {
+int storage_init(const char* root) {
+    if (!root || strlen(root) == 0) {
         log_error("Invalid storage base path");
         return -1;
     }
 
-    strncpy(storage_base, base_path, sizeof(storage_base) - 1);
-    storage_base[sizeof(storage_base) - 1] = '\0';
-
     // Create base storage directory
     struct stat st = {0};
-    if (stat(storage_base, &st) == -1) {
-        if (mkdir(storage_base, 0755) == -1) {
+    if (stat(root, &st) == -1) {
+        if (mkdir(root, 0755) == -1) {
             log_error("Failed to create storage directory '%s': %s",
-                     storage_base, strerror(errno));
+                     root, strerror(errno));
             return -1;
         }
     }
 
-    log_info("Storage initialized at: %s", storage_base);
+    log_info("Storage initialized at: %s", root);
     return 0;
 }
 
-char* storage_get_path(const char* uuid) {
-    if (!uuid || strlen(uuid) < 2) {
+char* storage_get_path(const char* root, const char* uuid) {
+    if (!root || !uuid || strlen(uuid) < 2) {
         log_error("Invalid UUID");
         return NULL;
     }
@@ -47,35 +44,67 @@ char* storage_get_path(const char* uuid) {
     }
 
     char subdir[3] = {uuid[0], uuid[1], '\0'};
-    snprintf(full_path, 512, "%s/%s/%s", storage_base, subdir, uuid);
+    snprintf(full_path, 512, "%s/%s/%s", root, subdir, uuid);
 
     return full_path;
 }
 
-int storage_write_file(const char* uuid, const uint8_t* data, size_t size) {
+// Create the <root>/<first 2 chars> subdirectory for uuid if needed
+static int storage_make_subdir(const char* root, const char* uuid) {
+    char subdir_path[512];
+    char subdir[3] = {uuid[0], uuid[1], '\0'};
+    snprintf(subdir_path, sizeof(subdir_path), "%s/%s", root, subdir);
+
+    struct stat st = {0};
+    if (stat(subdir_path, &st) == -1) {
+        if (mkdir(subdir_path, 0755) == -1 && errno != EEXIST) {
+            log_error("Failed to create subdirectory '%s': %s",
+                     subdir_path, strerror(errno));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int storage_write_file(const char* root, const char* uuid, const uint8_t* data, size_t size) {
     if (!uuid || !data || size == 0) {
         log_error("Invalid parameters for storage_write_file");
         return -1;
     }
 
-    char* full_path = storage_get_path(uuid);
+    char* full_path = storage_get_path(root, uuid);
     if (!full_path) {
         return -1;
     }
 
     // Create subdirectory if needed
-    char subdir_path[512];
-    char subdir[3] = {uuid[0], uuid[1], '\0'};
-    snprintf(subdir_path, sizeof(subdir_path), "%s/%s", storage_base, subdir);
+    if (storage_make_subdir(root, uuid) < 0) {
+        free(full_path);
+        return -1;
+    }
 
-    struct stat st = {0};
-    if (stat(subdir_path, &st) == -1) {
-        if (mkdir(subdir_path, 0755) == -1) {
-            log_error("Failed to create subdirectory '%s': %s",
-                     subdir_path, strerror(errno));
+    if (io_backend_current() == IO_BACKEND_URING) {
+        int fd = open(full_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            log_error("Failed to open file '%s' for writing: %s",
+                     full_path, strerror(errno));
+            free(full_path);
+            return -1;
+        }
+
+        int rc = io_pwrite_all(fd, data, size, 0);
+        close(fd);
+
+        if (rc < 0) {
+            log_error("Failed to write complete file '%s' (%zu bytes)", full_path, size);
+            unlink(full_path);  // Clean up partial file
             free(full_path);
             return -1;
         }
+
+        log_info("Wrote file to storage: %s (%zu bytes)", full_path, size);
+        free(full_path);
+        return 0;
     }
 
     // Write file
@@ -103,17 +132,138 @@ int storage_write_file(const char* uuid, const uint8_t* data, size_t size) {
     return 0;
 }
 
-int storage_read_file(const char* uuid, uint8_t** data, size_t* size) {
+int storage_open_write(const char* root, const char* uuid) {
+    char* full_path = storage_get_path(root, uuid);
+    if (!full_path) {
+        return -1;
+    }
+
+    if (storage_make_subdir(root, uuid) < 0) {
+        free(full_path);
+        return -1;
+    }
+
+    int fd = open(full_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_error("Failed to open file '%s' for writing: %s", full_path, strerror(errno));
+    }
+
+    free(full_path);
+    return fd;
+}
+
+int storage_preallocate(int fd, int64_t size) {
+    if (fd < 0 || size < 0) {
+        log_error("Invalid parameters for storage_preallocate");
+        return -1;
+    }
+    if (size == 0) {
+        return 0;
+    }
+
+    // Not every filesystem allocates; a sparse file of the right size will do
+    int rc = posix_fallocate(fd, 0, (off_t)size);
+    if (rc != 0 && ftruncate(fd, (off_t)size) < 0) {
+        log_error("Failed to allocate %lld bytes: %s", (long long)size, strerror(rc));
+        return -1;
+    }
+    return 0;
+}
+
+int storage_open_resume(const char* root, const char* uuid, int64_t* length) {
+    char* full_path = storage_get_path(root, uuid);
+    if (!full_path) {
+        return -1;
+    }
+
+    int fd = open(full_path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        log_error("Failed to open file '%s' for resuming: %s", full_path, strerror(errno));
+        free(full_path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        log_error("Failed to get file size for '%s'", full_path);
+        close(fd);
+        free(full_path);
+        return -1;
+    }
+
+    *length = (int64_t)st.st_size;
+    free(full_path);
+    return fd;
+}
+
+int storage_write_at(int fd, const uint8_t* data, size_t size, uint64_t offset) {
+    if (fd < 0 || !data) {
+        log_error("Invalid parameters for storage_write_at");
+        return -1;
+    }
+
+    if (io_pwrite_all(fd, data, size, (off_t)offset) < 0) {
+        log_error("Failed to write %zu bytes at offset %llu: %s",
+                  size, (unsigned long long)offset, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int storage_read_file(const char* root, const char* uuid, uint8_t** data, size_t* size) {
     if (!uuid || !data || !size) {
         log_error("Invalid parameters for storage_read_file");
         return -1;
     }
 
-    char* full_path = storage_get_path(uuid);
+    char* full_path = storage_get_path(root, uuid);
     if (!full_path) {
         return -1;
     }
 
+    if (io_backend_current() == IO_BACKEND_URING) {
+        int fd = open(full_path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            log_error("Failed to open file '%s' for reading: %s",
+                     full_path, strerror(errno));
+            free(full_path);
+            return -1;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            log_error("Failed to get file size for '%s'", full_path);
+            close(fd);
+            free(full_path);
+            return -1;
+        }
+
+        *data = malloc(st.st_size > 0 ? (size_t)st.st_size : 1);
+        if (!*data) {
+            log_error("Memory allocation failed for file read");
+            close(fd);
+            free(full_path);
+            return -1;
+        }
+
+        int rc = io_pread_all(fd, *data, (size_t)st.st_size, 0);
+        close(fd);
+
+        if (rc < 0) {
+            log_error("Failed to read complete file '%s' (%lld bytes)",
+                     full_path, (long long)st.st_size);
+            free(*data);
+            *data = NULL;
+            free(full_path);
+            return -1;
+        }
+
+        *size = (size_t)st.st_size;
+        log_info("Read file from storage: %s (%zu bytes)", full_path, *size);
+        free(full_path);
+        return 0;
+    }
+
     FILE* fp = fopen(full_path, "rb");
     if (!fp) {
         log_error("Failed to open file '%s' for reading: %s",
@@ -162,13 +312,13 @@ int storage_read_file(const char* uuid, uint8_t** data, size_t* size) {
     return 0;
 }
 
-int storage_delete_file(const char* uuid) {
+int storage_delete_file(const char* root, const char* uuid) {
     if (!uuid) {
         log_error("Invalid UUID for deletion");
         return -1;
     }
 
-    char* full_path = storage_get_path(uuid);
+    char* full_path = storage_get_path(root, uuid);
     if (!full_path) {
         return -1;
     }
@@ -184,12 +334,12 @@ int storage_delete_file(const char* uuid) {
     return 0;
 }
 
-int storage_file_exists(const char* uuid) {
+int storage_file_exists(const char* root, const char* uuid) {
     if (!uuid) {
         return 0;
     }
 
-    char* full_path = storage_get_path(uuid);
+    char* full_path = storage_get_path(root, uuid);
     if (!full_path) {
         return 0;
     }
@@ -200,3 +350,60 @@ int storage_file_exists(const char* uuid) {
     free(full_path);
     return exists;
 }
+
+int storage_open_read(const char* root, const char* uuid, int64_t* size) {
+    if (!uuid || !size) {
+        log_error("Invalid parameters for storage_open_read");
+        return -1;
+    }
+
+    char* full_path = storage_get_path(root, uuid);
+    if (!full_path) {
+        return -1;
+    }
+
+    int fd = open(full_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        log_error("Failed to open file '%s' for reading: %s", full_path, strerror(errno));
+        free(full_path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        log_error("Failed to get file size for '%s'", full_path);
+        close(fd);
+        free(full_path);
+        return -1;
+    }
+
+    *size = (int64_t)st.st_size;
+    free(full_path);
+    return fd;
+}
+
+int storage_read_at(int fd, uint8_t* data, size_t size, uint64_t offset) {
+    if (fd < 0 || !data) {
+        log_error("Invalid parameters for storage_read_at");
+        return -1;
+    }
+
+    if (io_pread_all(fd, data, size, (off_t)offset) < 0) {
+        log_error("Failed to read %zu bytes at offset %llu: %s",
+                  size, (unsigned long long)offset, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+void storage_prefetch(int fd, uint64_t offset, uint64_t length) {
+#ifdef POSIX_FADV_WILLNEED
+    if (fd >= 0 && length > 0) {
+        posix_fadvise(fd, (off_t)offset, (off_t)length, POSIX_FADV_WILLNEED);
+    }
+#else
+    (void)fd;
+    (void)offset;
+    (void)length;
+#endif
+}
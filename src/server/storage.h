@@ -4,22 +4,52 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// Files live under a storage root as <root>/<first 2 chars>/<uuid>;
+// each server passes its own root
+
 // Initialize storage directory
-int storage_init(const char* base_path);
+int storage_init(const char* root);
 
 // Get full path for a UUID
-char* storage_get_path(const char* uuid);
+char* storage_get_path(const char* root, const char* uuid);
 
 // Write file to storage
-int storage_write_file(const char* uuid, const uint8_t* data, size_t size);
+int storage_write_file(const char* root, const char* uuid, const uint8_t* data, size_t size);
+
+// Streaming writes: create (or truncate) the file for uuid
+// Returns an open descriptor for storage_write_at(), or -1 on error
+int storage_open_write(const char* root, const char* uuid);
+
+// Reopen a partially written file without truncating it; *length is the
+// number of bytes it holds. Returns the descriptor or -1 on error
+int storage_open_resume(const char* root, const char* uuid, int64_t* length);
+
+// Give a file from storage_open_write() its final size up front, so parts
+// written out of order land in allocated blocks
+int storage_preallocate(int fd, int64_t size);
+
+// Write size bytes at offset into a descriptor from storage_open_write()
+int storage_write_at(int fd, const uint8_t* data, size_t size, uint64_t offset);
 
 // Read file from storage
-int storage_read_file(const char* uuid, uint8_t** data, size_t* size);
+int storage_read_file(const char* root, const char* uuid, uint8_t** data, size_t* size);
+
+// Streaming reads: open the file for uuid and report its size
+// Returns an open descriptor for storage_read_at(), or -1 on error
+int storage_open_read(const char* root, const char* uuid, int64_t* size);
+
+// Read exactly size bytes at offset from a descriptor from storage_open_read()
+int storage_read_at(int fd, uint8_t* data, size_t size, uint64_t offset);
+
+// Start reading [offset, offset + length) into the page cache ahead of a
+// range read. Concurrent readers of one file start far apart, where the
+// kernel's sequential readahead does not see them coming. Best effort
+void storage_prefetch(int fd, uint64_t offset, uint64_t length);
 
 // Delete file from storage
-int storage_delete_file(const char* uuid);
+int storage_delete_file(const char* root, const char* uuid);
 
 // Check if file exists
-int storage_file_exists(const char* uuid);
+int storage_file_exists(const char* root, const char* uuid);
 
 #endif
@@ -1,61 +1,33 @@
 #include "thread_pool.h"
 #include "socket_mgr.h"
 #include "commands.h"
+#include "session_registry.h"
+#include "session_timers.h"
+#include "server.h"
 #include "../common/utils.h"
 #include "../common/protocol.h"
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <errno.h>
+#include <time.h>
 
-// Global session array and mutex
-static ClientSession* sessions[MAX_CLIENTS];
-static pthread_mutex_t sessions_mutex = PTHREAD_MUTEX_INITIALIZER;
-static int active_count = 0;
-
-void thread_pool_init(void) {
-    pthread_mutex_lock(&sessions_mutex);
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        sessions[i] = NULL;
-    }
-    active_count = 0;
-    pthread_mutex_unlock(&sessions_mutex);
-    log_info("Thread pool initialized");
-}
-
-int thread_spawn_client(int client_socket, struct sockaddr_in* addr) {
-    if (!addr) {
+ClientSession* session_create(Server* server, int client_socket, struct sockaddr_in* addr) {
+    if (!server || !addr) {
         log_error("Invalid client address");
-        return -1;
-    }
-
-    pthread_mutex_lock(&sessions_mutex);
-
-    // Find free slot
-    int slot = -1;
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (sessions[i] == NULL) {
-            slot = i;
-            break;
-        }
-    }
-
-    if (slot == -1) {
-        pthread_mutex_unlock(&sessions_mutex);
-        log_error("Max clients reached (%d)", MAX_CLIENTS);
-        return -1;
+        return NULL;
     }
 
-    // Allocate session
-    ClientSession* session = malloc(sizeof(ClientSession));
+    // Take a zeroed session from the registry (no global lock)
+    ClientSession* session = session_registry_acquire(&server->sessions);
     if (!session) {
-        pthread_mutex_unlock(&sessions_mutex);
-        log_error("Failed to allocate session");
-        return -1;
+        log_error("Max clients reached (%d)", session_registry_capacity(&server->sessions));
+        return NULL;
     }
 
     // Initialize session
-    memset(session, 0, sizeof(ClientSession));
+    session->server = server;
     session->client_socket = client_socket;
     memcpy(&session->client_addr, addr, sizeof(struct sockaddr_in));
     session->state = STATE_CONNECTED;
@@ -64,6 +36,33 @@ int thread_spawn_client(int client_socket, struct sockaddr_in* addr) {
     session->current_directory = -1;
     session->pending_upload_uuid = NULL;
     session->pending_upload_size = 0;
+    session->pending_upload_file_id = 0;
+    session->pending_upload_fd = -1;
+    session->pending_upload_received = 0;
+    session->pending_upload_error = NULL;
+    session->max_streams = 0;
+    pthread_mutex_init(&session->send_mutex, NULL);
+
+    session_timers_attach(session);
+
+    log_info("Session registered (slot=%u, active=%d)",
+             (unsigned)session->session_id, session_registry_count(&server->sessions));
+    return session;
+}
+
+// Wake server_wait_sessions() callers once the last session is gone
+static void sessions_idle_signal(Server* server) {
+    // Taking the mutex orders this after a waiter's check of the count
+    pthread_mutex_lock(&server->idle_mutex);
+    pthread_cond_broadcast(&server->idle_cond);
+    pthread_mutex_unlock(&server->idle_mutex);
+}
+
+int thread_spawn_client(Server* server, int client_socket, struct sockaddr_in* addr) {
+    ClientSession* session = session_create(server, client_socket, addr);
+    if (!session) {
+        return -1;
+    }
 
     // Create detached thread
     pthread_attr_t attr;
@@ -72,22 +71,25 @@ int thread_spawn_client(int client_socket, struct sockaddr_in* addr) {
 
     if (pthread_create(&session->thread_id, &attr, client_handler, session) != 0) {
         pthread_attr_destroy(&attr);
-        pthread_mutex_unlock(&sessions_mutex);
-        free(session);
+        session_timers_detach(session);
+        pthread_mutex_destroy(&session->send_mutex);
+        if (session_registry_release(&server->sessions, session) == 0) {
+            sessions_idle_signal(server);
+        }
         log_error("Failed to create client handler thread");
         return -1;
     }
 
     pthread_attr_destroy(&attr);
-    sessions[slot] = session;
-    active_count++;
 
-    pthread_mutex_unlock(&sessions_mutex);
-
-    log_info("Spawned client handler thread (slot=%d, active=%d)", slot, active_count);
+    log_info("Spawned client handler thread (active=%d)", thread_pool_active_count(server));
     return 0;
 }
 
+static void recv_progress(void* arg) {
+    session_timers_touch((ClientSession*)arg);
+}
+
 void* client_handler(void* arg) {
     ClientSession* session = (ClientSession*)arg;
     if (!session) {
@@ -103,7 +105,18 @@ void* client_handler(void* arg) {
     while (session->state != STATE_DISCONNECTED) {
         Packet pkt = {0};
 
-        int result = packet_recv(session->client_socket, &pkt);
+        // Stamp activity per chunk so a slow upload is not taken for a stall
+        int result = packet_recv_header(session->client_socket, &pkt);
+        if (result == 0) {
+            recv_progress(session);
+            if (command_defers_payload(session, &pkt)) {
+                // Moved from the socket to disk by its handler
+                pkt.payload_unread = 1;
+            } else {
+                result = packet_recv_payload(session->client_socket, &pkt,
+                                             recv_progress, session);
+            }
+        }
         if (result < 0) {
             if (result == -1) {
                 log_info("Client %s disconnected", client_ip);
@@ -136,77 +149,375 @@ void cleanup_session(ClientSession* session) {
     log_info("Cleaning up session for %s (fd=%d)", client_ip, session->client_socket);
     free(client_ip);
 
+    // No deadline may fire on the socket once it is closed
+    session_timers_detach(session);
+
     // Close socket
     socket_close(session->client_socket);
 
-    // Free pending upload UUID if exists
-    if (session->pending_upload_uuid) {
-        free(session->pending_upload_uuid);
-        session->pending_upload_uuid = NULL;
+    // An upload cut off mid-stream is kept for resuming; others are dropped
+    suspend_pending_upload(session);
+    abandon_multipart_uploads(session);
+
+    pthread_mutex_destroy(&session->send_mutex);
+
+    // Hand the slot back; the registry keeps the memory for reuse
+    Server* server = session->server;
+    unsigned slot = (unsigned)session->session_id;
+    int remaining = session_registry_release(&server->sessions, session);
+    log_info("Session removed (slot=%u, active=%d)", slot, remaining);
+
+    if (remaining == 0) {
+        sessions_idle_signal(server);
     }
+}
+
+static int session_signal_disconnect(ClientSession* session, void* arg) {
+    (void)arg;
+    session->state = STATE_DISCONNECTED;
+    shutdown(session->client_socket, SHUT_RDWR);
+    return 0;
+}
+
+static int session_force_cleanup(ClientSession* session, void* arg) {
+    (void)arg;
+    log_info("Force cleaning up session in slot %u", (unsigned)session->session_id);
+    cleanup_session(session);
+    return 0;
+}
+
+void thread_pool_shutdown(Server* server) {
+    log_info("Shutting down thread pool...");
 
-    // Remove from sessions array
-    pthread_mutex_lock(&sessions_mutex);
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (sessions[i] == session) {
-            sessions[i] = NULL;
-            active_count--;
-            log_info("Session removed (slot=%d, active=%d)", i, active_count);
+    // Signal all sessions to disconnect
+    session_registry_foreach(&server->sessions, session_signal_disconnect, NULL);
+
+    // Give threads time to cleanup; the last one to leave wakes us
+    thread_pool_wait_sessions(server, SESSION_SHUTDOWN_TIMEOUT_MS);
+
+    // Force cleanup any remaining sessions
+    session_registry_foreach(&server->sessions, session_force_cleanup, NULL);
+
+    log_info("Thread pool shutdown complete");
+}
+
+int thread_pool_active_count(Server* server) {
+    return session_registry_count(&server->sessions);
+}
+
+int thread_pool_wait_sessions(Server* server, int timeout_ms) {
+    struct timespec deadline;
+    if (timeout_ms >= 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock(&server->idle_mutex);
+    int remaining;
+    while ((remaining = session_registry_count(&server->sessions)) > 0) {
+        if (timeout_ms < 0) {
+            pthread_cond_wait(&server->idle_cond, &server->idle_mutex);
+        } else if (pthread_cond_timedwait(&server->idle_cond, &server->idle_mutex,
+                                          &deadline) == ETIMEDOUT) {
+            remaining = session_registry_count(&server->sessions);
             break;
         }
     }
-    pthread_mutex_unlock(&sessions_mutex);
+    pthread_mutex_unlock(&server->idle_mutex);
 
-    // Free session
-    free(session);
+    return remaining;
 }
 
-void thread_pool_shutdown(void) {
-    log_info("Shutting down thread pool...");
+// Bounded MPMC queue of decoded packets feeding the worker threads
+typedef struct {
+    ClientSession* session;
+    Packet pkt;
+    task_done_fn done;
+    void* arg;
+} Task;
+
+// Transfer waiting for a transfer slot (see thread_pool_start())
+typedef struct WaitingTransfer {
+    Task task;
+    struct WaitingTransfer* next;
+} WaitingTransfer;
+
+static struct {
+    Task* tasks;
+    int capacity;
+    int head;
+    int count;
+    int busy;       // Tasks popped but not finished
+    int stopping;
+    int transfers;          // Transfers running
+    int transfer_limit;
+    WaitingTransfer* waiting_head;
+    WaitingTransfer* waiting_tail;
+    int waiting;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    pthread_cond_t idle;
+} work_queue = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .not_empty = PTHREAD_COND_INITIALIZER,
+    .not_full = PTHREAD_COND_INITIALIZER,
+    .idle = PTHREAD_COND_INITIALIZER
+};
+
+static pthread_t* workers = NULL;
+static int worker_count = 0;
+
+// Servers sharing the pool (see thread_pool_start)
+static int pool_users = 0;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void pool_shutdown(void);
+
+static void run_task(Task* task) {
+    log_debug("Worker dispatching command 0x%02X (fd=%d)",
+              task->pkt.command, task->session->client_socket);
+    dispatch_command(task->session, &task->pkt);
+    free(task->pkt.payload);
+
+    if (task->done) {
+        task->done(task->session, task->arg);
+    }
+}
 
-    pthread_mutex_lock(&sessions_mutex);
+// Set a transfer aside while every transfer slot is taken. Its session
+// waits for it like for a running one. Returns -1 if it must run now
+// (out of memory). Caller holds the queue mutex
+static int wait_for_transfer_slot(const Task* task) {
+    WaitingTransfer* waiting = malloc(sizeof(WaitingTransfer));
+    if (!waiting) {
+        return -1;
+    }
+    waiting->task = *task;
+    waiting->next = NULL;
+    if (work_queue.waiting_tail) {
+        work_queue.waiting_tail->next = waiting;
+    } else {
+        work_queue.waiting_head = waiting;
+    }
+    work_queue.waiting_tail = waiting;
+    work_queue.waiting++;
+    return 0;
+}
 
-    // Signal all sessions to disconnect
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (sessions[i]) {
-            sessions[i]->state = STATE_DISCONNECTED;
-            shutdown(sessions[i]->client_socket, SHUT_RDWR);
+// Next transfer waiting for the slot that just freed up, 0 if none. Caller
+// holds the queue mutex
+static int next_waiting_transfer(Task* task) {
+    WaitingTransfer* waiting = work_queue.waiting_head;
+    if (!waiting) {
+        return 0;
+    }
+    work_queue.waiting_head = waiting->next;
+    if (!work_queue.waiting_head) {
+        work_queue.waiting_tail = NULL;
+    }
+    work_queue.waiting--;
+    *task = waiting->task;
+    free(waiting);
+    return 1;
+}
+
+static void* worker_main(void* arg) {
+    (void)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&work_queue.mutex);
+        while (work_queue.count == 0 && !work_queue.stopping) {
+            pthread_cond_wait(&work_queue.not_empty, &work_queue.mutex);
+        }
+        if (work_queue.count == 0) {
+            pthread_mutex_unlock(&work_queue.mutex);
+            break;
+        }
+
+        Task task = work_queue.tasks[work_queue.head];
+        work_queue.head = (work_queue.head + 1) % work_queue.capacity;
+        work_queue.count--;
+        pthread_cond_signal(&work_queue.not_full);
+
+        int transfer = command_is_transfer(task.pkt.command);
+        if (transfer) {
+            if (work_queue.transfers >= work_queue.transfer_limit &&
+                wait_for_transfer_slot(&task) == 0) {
+                pthread_mutex_unlock(&work_queue.mutex);
+                continue;
+            }
+            work_queue.transfers++;
+        }
+        work_queue.busy++;
+        pthread_mutex_unlock(&work_queue.mutex);
+
+        run_task(&task);
+
+        pthread_mutex_lock(&work_queue.mutex);
+        // A finished transfer hands its slot to the oldest waiting one
+        while (transfer && next_waiting_transfer(&task)) {
+            pthread_mutex_unlock(&work_queue.mutex);
+            run_task(&task);
+            pthread_mutex_lock(&work_queue.mutex);
         }
+        if (transfer) {
+            work_queue.transfers--;
+        }
+        work_queue.busy--;
+        if (work_queue.count == 0 && work_queue.busy == 0) {
+            pthread_cond_broadcast(&work_queue.idle);
+        }
+        pthread_mutex_unlock(&work_queue.mutex);
     }
 
-    pthread_mutex_unlock(&sessions_mutex);
+    return NULL;
+}
 
-    // Give threads time to cleanup
-    int wait_count = 0;
-    while (active_count > 0 && wait_count < 50) {
-        usleep(100000); // 100ms
-        wait_count++;
+int thread_pool_start(int num_workers, int max_transfers, int queue_capacity) {
+    pthread_mutex_lock(&pool_mutex);
+    if (workers) {
+        pool_users++;
+        pthread_mutex_unlock(&pool_mutex);
+        return 0;
+    }
+    if (num_workers <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_workers = cpus > 0 ? (int)cpus : 1;
+    }
+    if (queue_capacity <= 0) {
+        queue_capacity = WORK_QUEUE_CAPACITY;
+    }
+    if (max_transfers <= 0) {
+        max_transfers = num_workers > 1 ? num_workers / 2 : 1;
+    }
+    if (num_workers <= max_transfers) {
+        num_workers = max_transfers + 1;
     }
 
-    pthread_mutex_lock(&sessions_mutex);
+    work_queue.tasks = calloc(queue_capacity, sizeof(Task));
+    workers = calloc(num_workers, sizeof(pthread_t));
+    if (!work_queue.tasks || !workers) {
+        log_error("Failed to allocate worker pool");
+        free(work_queue.tasks);
+        free(workers);
+        work_queue.tasks = NULL;
+        workers = NULL;
+        pthread_mutex_unlock(&pool_mutex);
+        return -1;
+    }
 
-    // Force cleanup any remaining sessions
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (sessions[i]) {
-            log_info("Force cleaning up session in slot %d", i);
-            socket_close(sessions[i]->client_socket);
-            if (sessions[i]->pending_upload_uuid) {
-                free(sessions[i]->pending_upload_uuid);
-            }
-            free(sessions[i]);
-            sessions[i] = NULL;
+    work_queue.capacity = queue_capacity;
+    work_queue.head = 0;
+    work_queue.count = 0;
+    work_queue.busy = 0;
+    work_queue.stopping = 0;
+    work_queue.transfers = 0;
+    work_queue.transfer_limit = max_transfers;
+
+    for (int i = 0; i < num_workers; i++) {
+        if (pthread_create(&workers[i], NULL, worker_main, NULL) != 0) {
+            log_error("Failed to create worker thread %d", i);
+            break;
         }
+        worker_count++;
+    }
+
+    if (worker_count == 0) {
+        pool_shutdown();
+        pthread_mutex_unlock(&pool_mutex);
+        return -1;
+    }
+    if (worker_count <= work_queue.transfer_limit) {
+        work_queue.transfer_limit = worker_count > 1 ? worker_count - 1 : 1;
     }
 
-    active_count = 0;
-    pthread_mutex_unlock(&sessions_mutex);
+    pool_users = 1;
+    pthread_mutex_unlock(&pool_mutex);
 
-    log_info("Thread pool shutdown complete");
+    log_info("Worker pool started (workers=%d, transfers=%d, queue=%d)",
+             worker_count, work_queue.transfer_limit, queue_capacity);
+    return 0;
+}
+
+int thread_pool_submit(ClientSession* session, Packet* pkt, task_done_fn done, void* arg) {
+    if (!session || !pkt) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&work_queue.mutex);
+    while (work_queue.count == work_queue.capacity && !work_queue.stopping) {
+        pthread_cond_wait(&work_queue.not_full, &work_queue.mutex);
+    }
+    if (work_queue.stopping || worker_count == 0) {
+        pthread_mutex_unlock(&work_queue.mutex);
+        return -1;
+    }
+
+    int tail = (work_queue.head + work_queue.count) % work_queue.capacity;
+    Task* task = &work_queue.tasks[tail];
+    task->session = session;
+    task->pkt = *pkt;
+    task->done = done;
+    task->arg = arg;
+    work_queue.count++;
+
+    pthread_cond_signal(&work_queue.not_empty);
+    pthread_mutex_unlock(&work_queue.mutex);
+
+    // The queue owns the payload now
+    pkt->payload = NULL;
+    return 0;
+}
+
+void thread_pool_drain(void) {
+    pthread_mutex_lock(&work_queue.mutex);
+    while (work_queue.count > 0 || work_queue.busy > 0) {
+        pthread_cond_wait(&work_queue.idle, &work_queue.mutex);
+    }
+    pthread_mutex_unlock(&work_queue.mutex);
+}
+
+void thread_pool_stop(void) {
+    pthread_mutex_lock(&pool_mutex);
+    if (workers && --pool_users == 0) {
+        pool_shutdown();
+    }
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+static void pool_shutdown(void) {
+    thread_pool_drain();
+
+    pthread_mutex_lock(&work_queue.mutex);
+    work_queue.stopping = 1;
+    pthread_cond_broadcast(&work_queue.not_empty);
+    pthread_cond_broadcast(&work_queue.not_full);
+    pthread_mutex_unlock(&work_queue.mutex);
+
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    free(workers);
+    workers = NULL;
+    worker_count = 0;
+    free(work_queue.tasks);
+    work_queue.tasks = NULL;
+    work_queue.capacity = 0;
+
+    log_info("Worker pool stopped");
+}
+
+int thread_pool_worker_count(void) {
+    return worker_count;
 }
 
-int thread_pool_active_count(void) {
-    pthread_mutex_lock(&sessions_mutex);
-    int count = active_count;
-    pthread_mutex_unlock(&sessions_mutex);
-    return count;
+int thread_pool_transfer_limit(void) {
+    return work_queue.transfer_limit;
 }
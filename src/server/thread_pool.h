@@ -3,8 +3,14 @@
 
 #include <pthread.h>
 #include <netinet/in.h>
+#include "../common/protocol.h"
+#include "timer_wheel.h"
 
 #define MAX_CLIENTS 100
+#define WORK_QUEUE_CAPACITY 1024
+
+// How long thread_pool_shutdown() waits for client threads to exit
+#define SESSION_SHUTDOWN_TIMEOUT_MS 5000
 
 typedef enum {
     STATE_CONNECTED,
@@ -13,7 +19,11 @@ typedef enum {
     STATE_DISCONNECTED
 } ClientState;
 
+struct Server;
+
 typedef struct {
+    uint64_t session_id;    // Registry handle (see session_registry.h)
+    struct Server* server;  // Owning server (database, storage, session table)
     int client_socket;
     struct sockaddr_in client_addr;
     pthread_t thread_id;
@@ -22,25 +32,84 @@ typedef struct {
     ClientState state;
     int authenticated;
     char* pending_upload_uuid;
-    long pending_upload_size;
+    int64_t pending_upload_size;
+    int pending_upload_file_id;     // Row created by UPLOAD_REQ, 0 if none
+    int pending_upload_fd;          // Open while UPLOAD_CHUNK frames arrive, else -1
+    int64_t pending_upload_received;    // Bytes written by UPLOAD_CHUNK so far
+    const char* pending_upload_error;   // First chunk failure, reported at commit
+
+    // Multiplexing (see CMD_ENABLE_STREAMS): tagged requests that may run
+    // at once, 0 until negotiated. Responses of concurrent requests share
+    // the socket, so every send holds send_mutex.
+    int max_streams;
+    pthread_mutex_t send_mutex;
+
+    // On-the-wire compression agreed by HELLO or at login (compress.h)
+    int compression;
+
+    // Capabilities agreed by CMD_HELLO, all 0 until the client sends it:
+    // protocol version, FEATURE_* flags both sides support and the largest
+    // frame the client accepts
+    int protocol_version;
+    uint32_t features;
+    uint32_t max_frame;
+
+    // Deadlines (see session_timers.h)
+    TimerEntry idle_timer;
+    TimerEntry login_timer;
+    TimerEntry transfer_timer;
+    uint64_t last_activity;         // Tick of the last byte received or sent
 } ClientSession;
 
-// Initialize thread management
-void thread_pool_init(void);
+// Called on the worker thread after a task's command has been handled
+typedef void (*task_done_fn)(ClientSession* session, void* arg);
+
+// Take a session from the server's registry for an accepted socket (no thread)
+ClientSession* session_create(struct Server* server, int client_socket, struct sockaddr_in* addr);
 
 // Create new client handler thread
-int thread_spawn_client(int client_socket, struct sockaddr_in* addr);
+int thread_spawn_client(struct Server* server, int client_socket, struct sockaddr_in* addr);
 
 // Client handler function (thread entry point)
 void* client_handler(void* arg);
 
-// Cleanup single session
+// Close the session's socket and return it to its server's registry
 void cleanup_session(ClientSession* session);
 
-// Shutdown all client threads
-void thread_pool_shutdown(void);
+// Disconnect all of the server's sessions and wait for them to go away
+void thread_pool_shutdown(struct Server* server);
+
+// Get the server's active client count
+int thread_pool_active_count(struct Server* server);
+
+// Block until the server has no session left or timeout_ms elapses
+// (< 0: no limit). Returns the number of sessions still open
+int thread_pool_wait_sessions(struct Server* server, int timeout_ms);
+
+// Start num_workers worker threads (<= 0: one per CPU) pulling decoded
+// packets from a bounded queue of queue_capacity tasks. The pool is shared
+// by every server in the process: later calls only add a reference.
+//
+// A download keeps its worker until a possibly slow client has read the
+// file, so at most max_transfers (<= 0: half the workers) run at once;
+// further ones wait aside without taking a worker. The pool grows to
+// max_transfers + 1 workers if needed, so short commands always find one.
+int thread_pool_start(int num_workers, int max_transfers, int queue_capacity);
+
+// Queue pkt for dispatch_command() on a worker; takes ownership of
+// pkt->payload. Blocks while the queue is full. done may be NULL.
+int thread_pool_submit(ClientSession* session, Packet* pkt, task_done_fn done, void* arg);
+
+// Wait until the queue is empty and no worker is running a task
+void thread_pool_drain(void);
+
+// Drop a reference; the last one drains, then stops and joins the workers
+void thread_pool_stop(void);
+
+// Number of running worker threads
+int thread_pool_worker_count(void);
 
-// Get active client count
-int thread_pool_active_count(void);
+// Most downloads the pool runs at once
+int thread_pool_transfer_limit(void);
 
 #endif // THREAD_POOL_H
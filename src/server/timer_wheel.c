@@ -0,0 +1,130 @@
+#include "timer_wheel.h"
+#include <string.h>
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+
+// Ticks covered by levels 0..level-1
+#define LEVEL_SPAN(level) (1ULL << (TIMER_WHEEL_BITS * (level)))
+
+// Furthest tick the wheel can hold relative to now
+#define WHEEL_RANGE (LEVEL_SPAN(TIMER_WHEEL_LEVELS) - 1)
+
+static void slot_link(TimerWheel* wheel, TimerEntry* timer, int level, int slot) {
+    TimerEntry** head = &wheel->slots[level][slot];
+    timer->level = (uint8_t)level;
+    timer->slot = (uint8_t)slot;
+    timer->prev = NULL;
+    timer->next = *head;
+    if (*head) {
+        (*head)->prev = timer;
+    }
+    *head = timer;
+}
+
+static void slot_unlink(TimerWheel* wheel, TimerEntry* timer) {
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        wheel->slots[timer->level][timer->slot] = timer->next;
+    }
+    if (timer->next) {
+        timer->next->prev = timer->prev;
+    }
+    timer->prev = NULL;
+    timer->next = NULL;
+}
+
+// File a timer under the lowest level whose span still covers it
+static void wheel_place(TimerWheel* wheel, TimerEntry* timer) {
+    if (timer->expires < wheel->now) {
+        timer->expires = wheel->now;
+    }
+    if (timer->expires - wheel->now > WHEEL_RANGE) {
+        timer->expires = wheel->now + WHEEL_RANGE;
+    }
+
+    uint64_t delta = timer->expires - wheel->now;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= LEVEL_SPAN(level + 1)) {
+        level++;
+    }
+
+    int slot = (int)((timer->expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+    slot_link(wheel, timer, level, slot);
+}
+
+// Move every timer in a higher-level bucket down to where it now belongs
+static void wheel_cascade(TimerWheel* wheel, int level, int slot) {
+    TimerEntry* timer = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+
+    while (timer) {
+        TimerEntry* next = timer->next;
+        wheel_place(wheel, timer);
+        timer = next;
+    }
+}
+
+void timer_wheel_init(TimerWheel* wheel, uint64_t now) {
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now = now;
+}
+
+void timer_init(TimerEntry* timer, timer_fn fn, void* arg) {
+    memset(timer, 0, sizeof(*timer));
+    timer->fn = fn;
+    timer->arg = arg;
+}
+
+void timer_wheel_add(TimerWheel* wheel, TimerEntry* timer, uint64_t expires) {
+    if (timer->armed) {
+        slot_unlink(wheel, timer);
+    } else {
+        timer->armed = 1;
+        wheel->count++;
+    }
+
+    timer->expires = expires;
+    wheel_place(wheel, timer);
+}
+
+void timer_wheel_cancel(TimerWheel* wheel, TimerEntry* timer) {
+    if (!timer->armed) {
+        return;
+    }
+    slot_unlink(wheel, timer);
+    timer->armed = 0;
+    wheel->count--;
+}
+
+int timer_wheel_advance(TimerWheel* wheel, uint64_t now) {
+    int fired = 0;
+
+    while (wheel->now <= now) {
+        uint64_t tick = wheel->now;
+
+        // A level's bucket comes due when every lower level has wrapped
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+            if (tick & (LEVEL_SPAN(level) - 1)) {
+                break;
+            }
+            wheel_cascade(wheel, level,
+                          (int)((tick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK));
+        }
+
+        // Timers re-added from a callback land in a later tick's bucket
+        wheel->now = tick + 1;
+
+        TimerEntry** bucket = &wheel->slots[0][tick & TIMER_WHEEL_MASK];
+        while (*bucket) {
+            TimerEntry* timer = *bucket;
+            slot_unlink(wheel, timer);
+            timer->armed = 0;
+            wheel->count--;
+            fired++;
+            timer->fn(timer, timer->arg);
+        }
+    }
+
+    return fired;
+}
@@ -0,0 +1,57 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+// Hierarchical timing wheel: TIMER_WHEEL_LEVELS wheels of
+// TIMER_WHEEL_SLOTS buckets each. Adding and cancelling a timer is O(1);
+// timers are cascaded down one level at a time as their bucket comes due,
+// so each tick only touches the timers that actually expire.
+// Times are in ticks; the wheel covers SLOTS^LEVELS ticks ahead and
+// clamps anything further out.
+// Not thread-safe: the owner serializes every call.
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+typedef struct TimerEntry TimerEntry;
+
+// Runs from timer_wheel_advance(); may add or cancel timers on the same
+// wheel, including re-adding the timer that fired
+typedef void (*timer_fn)(TimerEntry* timer, void* arg);
+
+struct TimerEntry {
+    TimerEntry* prev;
+    TimerEntry* next;
+    uint64_t expires;
+    timer_fn fn;
+    void* arg;
+    uint8_t level;
+    uint8_t slot;
+    uint8_t armed;
+};
+
+typedef struct {
+    TimerEntry* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t now;       // Next tick to process
+    int count;          // Armed timers
+} TimerWheel;
+
+// Start an empty wheel at tick now
+void timer_wheel_init(TimerWheel* wheel, uint64_t now);
+
+// Bind a callback to a timer (leaves it disarmed)
+void timer_init(TimerEntry* timer, timer_fn fn, void* arg);
+
+// Arm (or re-arm) timer to fire at tick expires; past ticks fire on the
+// next advance
+void timer_wheel_add(TimerWheel* wheel, TimerEntry* timer, uint64_t expires);
+
+// Disarm timer; no-op if it is not armed
+void timer_wheel_cancel(TimerWheel* wheel, TimerEntry* timer);
+
+// Process every tick up to and including now, firing due timers
+// Returns the number of timers fired
+int timer_wheel_advance(TimerWheel* wheel, uint64_t now);
+
+#endif // TIMER_WHEEL_H
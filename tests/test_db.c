@@ -198,6 +198,187 @@ void test_file_operations(void) {
     printf(" PASSED\n");
 }
 
+// Walk dir_id in pages of limit entries; returns the number seen and
+// checks that they come in the page's order
+// Room for any name a FileEntry can hold
+typedef char EntryName[sizeof(((FileEntry*)0)->name)];
+
+static int walk_pages(Database* db, int dir_id, DbSort sort, int descending, int limit,
+                      EntryName* names, int* ids) {
+    DbPage page = { .sort = sort, .descending = descending, .limit = limit };
+    char last_name[256] = "";
+    int seen = 0;
+    int more = 1;
+    while (more) {
+        FileEntry* entries = NULL;
+        int count = 0;
+        assert(db_list_directory_page(db, dir_id, &page, &entries, &count, &more) == 0);
+        assert(count <= limit && (count == limit || !more));
+        for (int i = 0; i < count; i++) {
+            snprintf(names[seen], sizeof(names[seen]), "%s", entries[i].name);
+            ids[seen++] = entries[i].id;
+        }
+        if (count > 0) {
+            snprintf(last_name, sizeof(last_name), "%s", entries[count - 1].name);
+            page.after_name = last_name;
+            page.after_id = entries[count - 1].id;
+            page.after_directory = entries[count - 1].is_directory;
+        }
+        free(entries);
+    }
+    return seen;
+}
+
+void test_directory_pages(void) {
+    printf("[TEST] test_directory_pages...");
+
+    cleanup_test_db();
+
+    Database* db = db_init(TEST_DB);
+    assert(db != NULL);
+    db_init_schema(db, TEST_SCHEMA);
+
+    int dir_id = db_create_file(db, 0, "big", NULL, 1, 0, 1, 755);
+    assert(dir_id > 0);
+
+    // Inserted out of name order, with one name twice
+    char name[16];
+    for (int i = 0; i < 25; i++) {
+        snprintf(name, sizeof(name), "f%02d", (i * 7) % 25);
+        assert(db_create_file(db, dir_id, name, NULL, 1, i, 0, 644) > 0);
+    }
+    assert(db_create_file(db, dir_id, "f10", NULL, 1, 0, 0, 644) > 0);
+
+    EntryName names[32];
+    int ids[32];
+    assert(walk_pages(db, dir_id, DB_SORT_NAME, 0, 4, names, ids) == 26);
+    for (int i = 1; i < 26; i++) {
+        int cmp = strcmp(names[i - 1], names[i]);
+        assert(cmp < 0 || (cmp == 0 && ids[i - 1] < ids[i]));
+    }
+    assert(walk_pages(db, dir_id, DB_SORT_NAME, 1, 7, names, ids) == 26);
+    for (int i = 1; i < 26; i++) {
+        int cmp = strcmp(names[i - 1], names[i]);
+        assert(cmp > 0 || (cmp == 0 && ids[i - 1] > ids[i]));
+    }
+    assert(walk_pages(db, dir_id, DB_SORT_ID, 0, 5, names, ids) == 26);
+    for (int i = 1; i < 26; i++) {
+        assert(ids[i - 1] < ids[i]);
+    }
+    assert(walk_pages(db, dir_id, DB_SORT_ID, 1, 26, names, ids) == 26);
+    assert(ids[0] > ids[25]);
+
+    // Directories ahead of files, with the page break inside each kind
+    // and across the boundary between them
+    assert(db_create_file(db, dir_id, "g1", NULL, 1, 0, 1, 755) > 0);
+    assert(db_create_file(db, dir_id, "a1", NULL, 1, 0, 1, 755) > 0);
+    assert(db_create_file(db, dir_id, "f10", NULL, 1, 0, 1, 755) > 0);
+    assert(walk_pages(db, dir_id, DB_SORT_DIRECTORIES, 0, 2, names, ids) == 29);
+    assert(strcmp(names[0], "a1") == 0 && strcmp(names[1], "f10") == 0 &&
+           strcmp(names[2], "g1") == 0 && strcmp(names[3], "f00") == 0);
+    for (int i = 4; i < 29; i++) {
+        int cmp = strcmp(names[i - 1], names[i]);
+        assert(cmp < 0 || (cmp == 0 && ids[i - 1] < ids[i]));
+    }
+    assert(walk_pages(db, dir_id, DB_SORT_DIRECTORIES, 1, 4, names, ids) == 29);
+    assert(strcmp(names[26], "g1") == 0 && strcmp(names[27], "f10") == 0 &&
+           strcmp(names[28], "a1") == 0);
+    for (int i = 1; i < 26; i++) {
+        int cmp = strcmp(names[i - 1], names[i]);
+        assert(cmp > 0 || (cmp == 0 && ids[i - 1] > ids[i]));
+    }
+
+    // Past the end, and an empty directory
+    DbPage page = { .sort = DB_SORT_NAME, .after_name = "zzz", .limit = 10 };
+    FileEntry* entries = NULL;
+    int count = -1, more = -1;
+    assert(db_list_directory_page(db, dir_id, &page, &entries, &count, &more) == 0);
+    assert(count == 0 && more == 0);
+    free(entries);
+    page.after_name = NULL;
+    assert(db_list_directory_page(db, 12345, &page, &entries, &count, &more) == 0);
+    assert(count == 0 && more == 0);
+    free(entries);
+    page.limit = 0;
+    assert(db_list_directory_page(db, dir_id, &page, &entries, &count, &more) == -1);
+
+    db_close(db);
+
+    printf(" PASSED\n");
+}
+
+void test_transactions(void) {
+    printf("[TEST] test_transactions...");
+
+    cleanup_test_db();
+
+    Database* db = db_init(TEST_DB);
+    assert(db != NULL);
+    db_init_schema(db, TEST_SCHEMA);
+
+    // Rolled back, the row is gone
+    FileEntry entry;
+    assert(db_begin(db) == 0);
+    int dropped = db_create_file(db, 0, "dropped", NULL, 1, 0, 1, 755);
+    assert(dropped > 0);
+    assert(db_get_file_by_id(db, dropped, &entry) == 0);
+    db_rollback(db);
+    assert(db_get_file_by_id(db, dropped, &entry) < 0);
+
+    // Committed, every change of the transaction stays
+    assert(db_begin(db) == 0);
+    int kept = db_create_file(db, 0, "kept", NULL, 1, 0, 1, 755);
+    assert(kept > 0);
+    assert(db_update_permissions(db, kept, 0700) == 0);
+    assert(db_commit(db) == 0);
+    assert(db_get_file_by_id(db, kept, &entry) == 0);
+    assert(entry.permissions == 0700);
+
+    db_close(db);
+
+    printf(" PASSED\n");
+}
+
+void test_directory_versions(void) {
+    printf("[TEST] test_directory_versions...");
+
+    cleanup_test_db();
+
+    Database* db = db_init(TEST_DB);
+    assert(db != NULL);
+    db_init_schema(db, TEST_SCHEMA);
+
+    int64_t root = -1, dir = -1, before = -1;
+    assert(db_get_directory_version(db, 0, &root) == 0);
+    int dir_id = db_create_file(db, 0, "dir", NULL, 1, 0, 1, 0755);
+    assert(dir_id > 0);
+    assert(db_get_directory_version(db, 0, &before) == 0 && before > root);
+    assert(db_get_directory_version(db, dir_id, &dir) == 0 && dir == 0);
+
+    // Create, chmod and delete of a child each raise its directory's
+    // version, and only that one
+    int64_t version;
+    int file_id = db_create_file(db, dir_id, "a.txt", "uuid-a", 1, 10, 0, 0644);
+    assert(file_id > 0);
+    assert(db_get_directory_version(db, dir_id, &version) == 0 && version > dir);
+    dir = version;
+    assert(db_update_permissions(db, file_id, 0600) == 0);
+    assert(db_get_directory_version(db, dir_id, &version) == 0 && version > dir);
+    dir = version;
+    assert(db_delete_file(db, file_id) == 0);
+    assert(db_get_directory_version(db, dir_id, &version) == 0 && version > dir);
+    assert(db_get_directory_version(db, 0, &root) == 0 && root == before);
+
+    // Not a directory
+    file_id = db_create_file(db, dir_id, "b.txt", "uuid-b", 1, 10, 0, 0644);
+    assert(db_get_directory_version(db, file_id, &version) == -1);
+    assert(db_get_directory_version(db, 12345, &version) == -1);
+
+    db_close(db);
+
+    printf(" PASSED\n");
+}
+
 int main(void) {
     printf("========================================\n");
     printf("Running Phase 3 Database Tests\n");
@@ -208,6 +389,9 @@ int main(void) {
     test_user_operations();
     test_activity_logging();
     test_file_operations();
+    test_directory_pages();
+    test_transactions();
+    test_directory_versions();
 
     cleanup_test_db();
 
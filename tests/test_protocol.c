@@ -2,7 +2,12 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
 #include "../src/common/protocol.h"
+#include "../src/common/io_backend.h"
+#include "../src/common/compress.h"
+#include "../src/common/listing.h"
 
 void test_packet_create_and_free(void) {
     printf("Testing packet_create and packet_free...\n");
@@ -88,6 +93,209 @@ void test_buffer_too_small(void) {
     printf("PASSED\n");
 }
 
+static void count_step(void* arg) {
+    (*(int*)arg)++;
+}
+
+void test_splice_to_file(void) {
+    printf("Testing socket to file ingest...\n");
+
+    int sv[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+
+    char path[] = "/tmp/fs_test_splice_XXXXXX";
+    int file_fd = mkstemp(path);
+    assert(file_fd >= 0);
+    unlink(path);
+
+    // Written at an offset, leaving the trailing bytes on the socket
+    const char* data = "0123456789abcdef";
+    assert(write(sv[0], data, 16) == 16);
+
+    size_t consumed = 0;
+    int steps = 0;
+    assert(io_splice_to_file(sv[1], file_fd, 4, 10, &consumed, count_step, &steps) == 0);
+    assert(consumed == 10 && steps >= 1);
+
+    char read_back[16] = {0};
+    assert(pread(file_fd, read_back, 10, 4) == 10);
+    assert(memcmp(read_back, data, 10) == 0);
+
+    assert(io_recv_discard(sv[1], 6) == 0);
+
+    // The peer closing mid-transfer is a socket error
+    assert(write(sv[0], "xyz", 3) == 3);
+    close(sv[0]);
+    assert(io_splice_to_file(sv[1], file_fd, 0, 10, &consumed, NULL, NULL) == -1);
+    assert(consumed == 3);
+
+    close(sv[1]);
+    close(file_fd);
+    printf("PASSED\n");
+}
+
+void test_compressed_frames(void) {
+    printf("Testing compressed frames...\n");
+
+    // Text compresses, random bytes are skipped by the entropy sample
+    char text[8192];
+    for (size_t i = 0; i < sizeof(text); i++) {
+        text[i] = "the quick brown fox jumps over the lazy dog\n"[i % 44];
+    }
+    uint8_t noise[8192];
+    unsigned seed = 12345;
+    for (size_t i = 0; i < sizeof(noise); i++) {
+        noise[i] = (uint8_t)(rand_r(&seed) >> 7);
+    }
+    assert(compress_worthwhile((const uint8_t*)text, sizeof(text)));
+    assert(!compress_worthwhile(noise, sizeof(noise)));
+    assert(!compress_worthwhile((const uint8_t*)text, COMPRESS_MIN_SIZE - 1));
+
+    // Each method built in round-trips; decompress_payload() tells them apart
+    uint8_t* packed = NULL;
+    size_t packed_len = 0;
+    Compression methods[] = { COMPRESSION_ZLIB, COMPRESSION_ZSTD };
+    for (int m = 0; m < 2; m++) {
+        if (!compression_available(methods[m])) {
+            assert(compress_payload(methods[m], (const uint8_t*)text, sizeof(text),
+                                    COMPRESS_LEVEL_DATA, &packed, &packed_len) == -1);
+            continue;
+        }
+        assert(compress_payload(methods[m], (const uint8_t*)text, sizeof(text),
+                                COMPRESS_LEVEL_DATA, &packed, &packed_len) == 0);
+        assert(packed_len < sizeof(text) / 4);
+        uint8_t* original = NULL;
+        size_t original_len = 0;
+        assert(decompress_payload(packed, packed_len, sizeof(text) - 1,
+                                  &original, &original_len) == -1);
+        assert(decompress_payload(packed, packed_len, sizeof(text), &original, &original_len) == 0);
+        assert(original_len == sizeof(text) && memcmp(original, text, sizeof(text)) == 0);
+        free(original);
+        free(packed);
+        assert(compress_payload(methods[m], noise, sizeof(noise), COMPRESS_LEVEL_DATA,
+                                &packed, &packed_len) == -1);
+    }
+    assert(compress_payload(COMPRESSION_NONE, (const uint8_t*)text, sizeof(text),
+                            COMPRESS_LEVEL_DATA, &packed, &packed_len) == -1);
+    assert(compression_from_name("zstd") ==
+           (compression_available(COMPRESSION_ZSTD) ? COMPRESSION_ZSTD : COMPRESSION_NONE));
+
+    // On the wire: the compressed magic, and the receiver gets the original
+    int sv[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    Packet* pkt = packet_create(CMD_SUCCESS, text, sizeof(text));
+    assert(packet_send_compressed(sv[0], pkt, COMPRESSION_ZLIB, COMPRESS_LEVEL_JSON) == 0);
+    packet_free(pkt);
+
+    uint8_t header[HEADER_SIZE];
+    assert(recv(sv[1], header, HEADER_SIZE, MSG_PEEK) == HEADER_SIZE);
+    assert(header[1] == MAGIC_BYTE_2_COMPRESSED);
+
+    Packet received = {0};
+    assert(packet_recv(sv[1], &received) == 0);
+    assert(!received.compressed);
+    assert(received.data_length == sizeof(text));
+    assert(memcmp(received.payload, text, sizeof(text)) == 0);
+    free(received.payload);
+
+    // Small payloads go out as they are
+    pkt = packet_create(CMD_SUCCESS, "{}", 2);
+    assert(packet_send_compressed(sv[0], pkt, COMPRESSION_ZLIB, COMPRESS_LEVEL_JSON) == 0);
+    packet_free(pkt);
+    assert(recv(sv[1], header, HEADER_SIZE, MSG_PEEK) == HEADER_SIZE);
+    assert(header[1] == MAGIC_BYTE_2);
+    assert(packet_recv(sv[1], &received) == 0);
+    free(received.payload);
+
+    close(sv[0]);
+    close(sv[1]);
+    printf("PASSED\n");
+}
+
+void test_listing_encoding(void) {
+    printf("Testing binary listing encoding...\n");
+
+    ListingEntry rows[3] = {
+        { .id = 7, .parent_id = 1, .owner_id = 2, .permissions = 0755, .is_directory = 1,
+          .size = 0, .name = "docs", .created_at = "2024-01-01 10:00:00" },
+        { .id = 8, .parent_id = 1, .owner_id = 3, .permissions = 0644,
+          .size = 5000000000LL, .name = "video.mkv", .created_at = "2024-01-02 11:00:00" },
+        { .id = 9, .parent_id = 1, .owner_id = 3, .permissions = 0600, .size = 12, .name = "" },
+    };
+
+    // Every column survives the round trip
+    size_t length = 0;
+    uint8_t* data = listing_encode(rows, 3, LISTING_FIELDS_ALL, 0, &length);
+    assert(data != NULL);
+    assert(length == LISTING_HEADER_SIZE + 3 * listing_record_size(LISTING_FIELDS_ALL) +
+           strlen("docs") + strlen("video.mkv") + 2 * strlen("2024-01-01 10:00:00") + 6);
+    ListingEntry* entries = NULL;
+    int count = 0;
+    uint32_t fields = 0;
+    assert(listing_decode(data, length, &entries, &count, &fields, NULL) == 0);
+    assert(count == 3 && fields == LISTING_FIELDS_ALL);
+    for (int i = 0; i < 3; i++) {
+        assert(entries[i].id == rows[i].id && entries[i].parent_id == rows[i].parent_id);
+        assert(entries[i].owner_id == rows[i].owner_id);
+        assert(entries[i].permissions == rows[i].permissions);
+        assert(entries[i].is_directory == rows[i].is_directory);
+        assert(entries[i].size == rows[i].size);
+        assert(strcmp(entries[i].name, rows[i].name) == 0);
+        assert(strcmp(entries[i].created_at, rows[i].created_at ? rows[i].created_at : "") == 0);
+    }
+    free(entries);
+
+    // Truncated, padded or pointing past the strings: rejected
+    assert(listing_decode(data, length - 1, &entries, &count, NULL, NULL) == -1);
+    uint8_t* padded = malloc(length + 1);
+    assert(padded != NULL);
+    memcpy(padded, data, length);
+    padded[length] = 0;
+    assert(listing_decode(padded, length + 1, &entries, &count, NULL, NULL) == -1);
+    packet_put_u32(padded + LISTING_HEADER_SIZE + 4, 0xFFFF);
+    assert(listing_decode(padded, length, &entries, &count, NULL, NULL) == -1);
+    free(padded);
+    free(data);
+
+    // A projection carries only its columns
+    data = listing_encode(rows, 3, LISTING_FIELD_ID | LISTING_FIELD_SIZE, 0, &length);
+    assert(data != NULL);
+    assert(length == LISTING_HEADER_SIZE + 3 * 12);
+    assert(listing_decode(data, length, &entries, &count, &fields, NULL) == 0);
+    assert(fields == (LISTING_FIELD_ID | LISTING_FIELD_SIZE));
+    assert(entries[1].id == 8 && entries[1].size == 5000000000LL);
+    assert(entries[1].name == NULL && entries[1].permissions == 0);
+    free(entries);
+    free(data);
+
+    // An empty directory is just the header; the page flag rides along
+    data = listing_encode(NULL, 0, LISTING_FIELDS_DEFAULT | LISTING_FLAG_MORE, 0, &length);
+    assert(data != NULL && length == LISTING_HEADER_SIZE);
+    assert(listing_decode(data, length, &entries, &count, &fields, NULL) == 0 && count == 0);
+    assert(fields == (LISTING_FIELDS_DEFAULT | LISTING_FLAG_MORE));
+    free(entries);
+    free(data);
+
+    // The directory version follows the header when flagged
+    uint64_t version = 0;
+    data = listing_encode(rows, 3, LISTING_FIELD_ID | LISTING_FLAG_VERSION,
+                          (1ULL << 40) + 3, &length);
+    assert(data != NULL && length == LISTING_HEADER_SIZE + LISTING_VERSION_SIZE + 3 * 4);
+    assert(listing_decode(data, length, &entries, &count, &fields, &version) == 0);
+    assert(count == 3 && entries[2].id == 9 && version == (1ULL << 40) + 3);
+    assert(fields == (LISTING_FIELD_ID | LISTING_FLAG_VERSION));
+    free(entries);
+    assert(listing_decode(data, length - 4, &entries, &count, NULL, NULL) == -1);
+    free(data);
+    data = listing_encode(rows, 1, LISTING_FIELD_ID, 77, &length);
+    assert(listing_decode(data, length, &entries, &count, NULL, &version) == 0);
+    assert(version == 0);
+    free(entries);
+    free(data);
+
+    printf("PASSED\n");
+}
+
 int main(void) {
     printf("=== Protocol Unit Tests ===\n\n");
 
@@ -96,6 +304,9 @@ int main(void) {
     test_invalid_magic();
     test_empty_payload();
     test_buffer_too_small();
+    test_splice_to_file();
+    test_compressed_frames();
+    test_listing_encoding();
 
     printf("\n=== All tests passed! ===\n");
     return 0;
@@ -0,0 +1,2414 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "../src/server/server.h"
+#include "../src/server/storage.h"
+#include "../src/server/hot_restart.h"
+#include "../src/server/socket_mgr.h"
+#include "../src/common/protocol.h"
+#include "../src/common/compress.h"
+#include "../src/common/io_backend.h"
+#include "../src/client/client.h"
+
+#define TEST_SCHEMA "src/database/db_init.sql"
+
+// A server on a scratch directory of its own, which also holds any local
+// files the test writes
+typedef struct {
+    char dir[64];
+    char db_path[128];
+    char storage_root[128];
+    Server* srv;
+} TestServer;
+
+// The reactor where the platform has one; what most tests run against
+static ServerMode default_mode(void) {
+    return event_loop_supported() ? SERVER_MODE_EPOLL : SERVER_MODE_THREADS;
+}
+
+// Create ts's directory and fill config for a server on it. Tests adjust
+// the config before passing it to start_test_server()
+static void test_server_config(TestServer* ts, ServerMode mode, ServerConfig* config) {
+    snprintf(ts->dir, sizeof(ts->dir), "/tmp/fs_test_server_XXXXXX");
+    assert(mkdtemp(ts->dir) != NULL);
+    snprintf(ts->db_path, sizeof(ts->db_path), "%s/fileshare.db", ts->dir);
+    snprintf(ts->storage_root, sizeof(ts->storage_root), "%s/storage", ts->dir);
+    ts->srv = NULL;
+
+    server_config_defaults(config);
+    config->port = 0;
+    config->mode = mode;
+    config->workers = 2;
+    config->db_path = ts->db_path;
+    config->schema_path = TEST_SCHEMA;
+    config->storage_root = ts->storage_root;
+}
+
+// Start ts's server from config; NULL starts one in default_mode()
+static Server* start_test_server(TestServer* ts, ServerConfig* config) {
+    ServerConfig defaults;
+    if (!config) {
+        test_server_config(ts, default_mode(), &defaults);
+        config = &defaults;
+    }
+    ts->srv = server_create(config);
+    assert(ts->srv != NULL);
+    assert(server_port(ts->srv) != 0);
+    assert(server_start(ts->srv) == 0);
+    return ts->srv;
+}
+
+static void stop_test_server(TestServer* ts) {
+    if (ts->srv) {
+        server_destroy(ts->srv);
+        ts->srv = NULL;
+    }
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", ts->dir);
+    assert(system(cmd) == 0);
+}
+
+// Write data to name in ts's directory; path receives the full path
+static void write_test_file(const TestServer* ts, const char* name, const void* data,
+                            size_t size, char* path, size_t path_size) {
+    snprintf(path, path_size, "%s/%s", ts->dir, name);
+    FILE* fp = fopen(path, "wb");
+    assert(fp != NULL);
+    assert(fwrite(data, 1, size, fp) == size);
+    fclose(fp);
+}
+
+// size bytes of i * mul + (i >> shift): shifted or reordered data shows
+static uint8_t* pattern_data(size_t size, unsigned mul, unsigned shift) {
+    uint8_t* data = malloc(size);
+    assert(data != NULL);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)(i * mul + (i >> shift));
+    }
+    return data;
+}
+
+static int connect_to(Server* srv) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd >= 0);
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(server_port(srv));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    return fd;
+}
+
+// Send one request and return the reply's command byte (payload in *reply)
+static uint8_t request(int fd, uint8_t command, const char* payload, Packet* reply) {
+    Packet* pkt = packet_create(command, payload, payload ? strlen(payload) : 0);
+    assert(pkt != NULL);
+    assert(packet_send(fd, pkt) == 0);
+    packet_free(pkt);
+
+    memset(reply, 0, sizeof(*reply));
+    assert(packet_recv(fd, reply) == 0);
+    return reply->command;
+}
+
+// Send one tagged request without waiting for its response
+static void send_tagged(int fd, uint8_t command, const char* payload, uint32_t stream_id) {
+    Packet* pkt = packet_create(command, payload, payload ? strlen(payload) : 0);
+    assert(pkt != NULL);
+    pkt->stream_id = stream_id;
+    assert(packet_send(fd, pkt) == 0);
+    packet_free(pkt);
+}
+
+static int login_admin(Server* srv) {
+    int fd = connect_to(srv);
+    Packet reply;
+    assert(request(fd, CMD_LOGIN_REQ, "{\"username\":\"admin\",\"password\":\"admin\"}",
+                   &reply) == CMD_LOGIN_RES);
+    free(reply.payload);
+    return fd;
+}
+
+void test_ephemeral_ports(void) {
+    printf("[TEST] test_ephemeral_ports...");
+
+    TestServer a, b;
+    ServerConfig config;
+    test_server_config(&a, SERVER_MODE_THREADS, &config);
+    Server* first = start_test_server(&a, &config);
+    test_server_config(&b, SERVER_MODE_THREADS, &config);
+    Server* second = start_test_server(&b, &config);
+    assert(server_port(first) != server_port(second));
+
+    // PING is answered before login, on each server independently
+    Server* servers[2] = { first, second };
+    for (int i = 0; i < 2; i++) {
+        int fd = connect_to(servers[i]);
+        Packet reply;
+        assert(request(fd, CMD_PING, "probe", &reply) == CMD_PONG);
+        assert(reply.data_length == 5 && memcmp(reply.payload, "probe", 5) == 0);
+        free(reply.payload);
+        close(fd);
+    }
+
+    stop_test_server(&a);
+    stop_test_server(&b);
+
+    printf(" PASSED\n");
+}
+
+// One SO_REUSEPORT listener per reactor, more reactors than CPUs: the
+// kernel spreads connections over the shards and every one is served
+void test_reuse_port(void) {
+    printf("[TEST] test_reuse_port...");
+
+    if (!event_loop_supported()) {
+        printf(" SKIPPED\n");
+        return;
+    }
+
+    TestServer ts;
+    ServerConfig config;
+    test_server_config(&ts, SERVER_MODE_EPOLL, &config);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    config.reuse_port = 1;
+    config.reactors = cpus + 3 < EVENT_LOOP_MAX_REACTORS ? (int)cpus + 3 : EVENT_LOOP_MAX_REACTORS;
+    Server* srv = start_test_server(&ts, &config);
+    assert(srv->num_listeners == config.reactors);
+
+    // All connected at once, so each shard holds several live sessions
+    enum { CLIENTS = 32 };
+    int fds[CLIENTS];
+    struct timeval tv = { .tv_sec = 5 };
+    for (int i = 0; i < CLIENTS; i++) {
+        fds[i] = login_admin(srv);
+        setsockopt(fds[i], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+    for (int i = 0; i < CLIENTS; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "client-%d", i);
+        Packet reply;
+        assert(request(fds[i], CMD_PING, name, &reply) == CMD_PONG);
+        assert(reply.data_length == strlen(name) && memcmp(reply.payload, name, reply.data_length) == 0);
+        free(reply.payload);
+        assert(request(fds[i], CMD_LIST_DIR, "{\"directory_id\":0}", &reply) == CMD_LIST_DIR);
+        free(reply.payload);
+    }
+    for (int i = 0; i < CLIENTS; i++) {
+        close(fds[i]);
+    }
+
+    stop_test_server(&ts);
+
+    printf(" PASSED\n");
+}
+
+static void* await_ready_thread(void* arg) {
+    int* channel = arg;
+    channel[1] = hot_restart_await_ready(channel[0]);
+    return NULL;
+}
+
+// A listener handed over still has its queue: a client that connected
+// while the old process held it is accepted by the new one
+static void check_handed_over(int port, int listener) {
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    assert(client >= 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(connect(client, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+
+    int accepted = accept(listener, NULL, NULL);
+    assert(accepted >= 0);
+    assert(write(client, "x", 1) == 1);
+    char c = 0;
+    assert(read(accepted, &c, 1) == 1 && c == 'x');
+    close(accepted);
+    close(client);
+}
+
+void test_hot_restart_handoff(void) {
+    printf("[TEST] test_hot_restart_handoff...");
+
+    int listeners[2];
+    for (int i = 0; i < 2; i++) {
+        listeners[i] = socket_create_listener(0, 16, 0);
+        assert(listeners[i] >= 0);
+    }
+
+    // READY answered with CONFIRM: the listeners belong to the new side
+    int sv[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    assert(hot_restart_send(sv[0], listeners, 2) == 0);
+    int taken[4];
+    assert(hot_restart_receive(sv[1], taken, 4) == 2);
+    int channel[2] = { sv[0], -2 };
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, await_ready_thread, channel) == 0);
+    assert(hot_restart_ready(sv[1]) == 0);
+    pthread_join(thread, NULL);
+    assert(channel[1] == 0);
+    close(sv[0]);
+
+    for (int i = 0; i < 2; i++) {
+        assert(taken[i] != listeners[i]);
+        int port = socket_get_port(listeners[i]);
+        assert(port > 0 && socket_get_port(taken[i]) == port);
+        check_handed_over(port, taken[i]);
+        close(taken[i]);
+    }
+
+    // The old side gave up and closed the channel: no confirmation, so the
+    // new side must leave the listeners to it
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    assert(hot_restart_send(sv[0], listeners, 1) == 0);
+    assert(hot_restart_receive(sv[1], taken, 4) == 1);
+    close(sv[0]);
+    assert(hot_restart_ready(sv[1]) == -1);
+    close(taken[0]);
+    check_handed_over(socket_get_port(listeners[0]), listeners[0]);
+
+    // A new process that exits without taking over is reaped right away,
+    // well within HOT_RESTART_REAP_TIMEOUT_MS, and leaves no zombie
+    char* argv[] = { "/bin/false", NULL };
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    assert(hot_restart_spawn(argv, listeners, 2) == -1);
+    gettimeofday(&end, NULL);
+    long ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000;
+    assert(ms < HOT_RESTART_REAP_TIMEOUT_MS / 2);
+    assert(waitpid(-1, NULL, WNOHANG) == -1);
+
+    close(listeners[0]);
+    close(listeners[1]);
+
+    printf(" PASSED\n");
+}
+
+void test_isolated_state(void) {
+    printf("[TEST] test_isolated_state...");
+
+    TestServer a, b;
+    Server* first = start_test_server(&a, NULL);
+    ServerConfig config;
+    test_server_config(&b, SERVER_MODE_THREADS, &config);
+    Server* second = start_test_server(&b, &config);
+
+    int fd_a = login_admin(first);
+    int fd_b = login_admin(second);
+    assert(session_registry_count(&first->sessions) == 1);
+    assert(session_registry_count(&second->sessions) == 1);
+
+    // A directory made on one server does not exist on the other
+    Packet reply;
+    assert(request(fd_a, CMD_MAKE_DIR, "{\"name\":\"only_on_first\",\"parent_id\":0}",
+                   &reply) == CMD_SUCCESS);
+    free(reply.payload);
+
+    assert(request(fd_a, CMD_LIST_DIR, "{\"directory_id\":0}", &reply) == CMD_LIST_DIR);
+    assert(strstr(reply.payload, "only_on_first") != NULL);
+    free(reply.payload);
+
+    assert(request(fd_b, CMD_LIST_DIR, "{\"directory_id\":0}", &reply) == CMD_LIST_DIR);
+    assert(strstr(reply.payload, "only_on_first") == NULL);
+    free(reply.payload);
+
+    // Stopping one server leaves the other (and the shared pools) running
+    stop_test_server(&a);
+    close(fd_a);
+
+    assert(request(fd_b, CMD_PING, NULL, &reply) == CMD_PONG);
+    free(reply.payload);
+    close(fd_b);
+
+    assert(server_wait_sessions(second, 5000) == 0);
+    stop_test_server(&b);
+
+    printf(" PASSED\n");
+}
+
+void test_multiplexed_requests(void) {
+    printf("[TEST] test_multiplexed_requests...");
+
+    TestServer ts;
+    Server* srv = start_test_server(&ts, NULL);
+    int fd = login_admin(srv);
+
+    Packet reply;
+    assert(request(fd, CMD_ENABLE_STREAMS, "{\"max_streams\":4}", &reply) == CMD_SUCCESS);
+    assert(strstr(reply.payload, "\"max_streams\":4") != NULL);
+    free(reply.payload);
+
+    // Several requests outstanding at once; a barrier (CHANGE_DIR) among them
+    send_tagged(fd, CMD_MAKE_DIR, "{\"name\":\"streamed\",\"parent_id\":0}", 7);
+    send_tagged(fd, CMD_PING, "seven-ish", 8);
+    send_tagged(fd, CMD_CHANGE_DIR, "{\"directory_id\":0}", 9);
+    send_tagged(fd, CMD_FILE_INFO, "{\"file_id\":999999}", 10);
+    send_tagged(fd, CMD_LIST_DIR, "{\"directory_id\":0}", 11);
+
+    // Every response carries its request's stream ID, in whatever order
+    int seen[5] = {0};
+    for (int i = 0; i < 5; i++) {
+        memset(&reply, 0, sizeof(reply));
+        assert(packet_recv(fd, &reply) == 0);
+        assert(reply.stream_id >= 7 && reply.stream_id <= 11);
+        assert(!seen[reply.stream_id - 7]);
+        seen[reply.stream_id - 7] = 1;
+
+        if (reply.stream_id == 8) {
+            assert(reply.command == CMD_PONG);
+            assert(strcmp(reply.payload, "seven-ish") == 0);
+        } else if (reply.stream_id == 10) {
+            assert(reply.command == CMD_ERROR);
+        }
+        free(reply.payload);
+    }
+
+    // Untagged requests still get untagged responses
+    assert(request(fd, CMD_PING, "plain", &reply) == CMD_PONG);
+    assert(reply.stream_id == 0);
+    free(reply.payload);
+
+    close(fd);
+    stop_test_server(&ts);
+
+    printf(" PASSED\n");
+}
+
+// A reactor connection with a download holding one stream: concurrent
+// requests still run up to max_streams, and a CHANGE_DIR waits parked
+// until the download finishes. Nothing follows the barrier on the socket,
+// so only the worker's re-arm can wake the reactor to dispatch it
+void test_parked_requests(void) {
+    printf("[TEST] test_parked_requests...");
+
+    if (!event_loop_supported()) {
+        printf(" SKIPPED\n");
+        return;
+    }
+
+    TestServer ts;
+    ServerConfig config;
+    test_server_config(&ts, SERVER_MODE_EPOLL, &config);
+    Server* srv = start_test_server(&ts, &config);
+
+    size_t size = 16 * 1024 * 1024;
+    uint8_t* data = pattern_data(size, 7, 10);
+    char local_path[192];
+    write_test_file(&ts, "parked.bin", data, size, local_path, sizeof(local_path));
+
+    ClientConnection* conn = client_connect("127.0.0.1", server_port(srv));
+    assert(conn != NULL);
+    assert(client_login(conn, "admin", "admin") == 0);
+    assert(client_upload(conn, local_path) == 0);
+    ClientListing* listing = client_list_page(conn, 0, NULL, CLIENT_LIST_PAGE);
+    assert(listing != NULL && listing->count == 1);
+    char download[80];
+    snprintf(download, sizeof(download), "{\"file_id\":%d,\"chunked\":true}",
+             listing->entries[0].id);
+    client_listing_free(listing);
+    client_disconnect(conn);
+
+    int fd = login_admin(srv);
+    Packet reply;
+    assert(request(fd, CMD_ENABLE_STREAMS, "{\"max_streams\":2}", &reply) == CMD_SUCCESS);
+    free(reply.payload);
+
+    // The download fills the socket while nothing reads it
+    send_tagged(fd, CMD_DOWNLOAD_REQ, download, 1);
+    send_tagged(fd, CMD_PING, "second", 2);
+    send_tagged(fd, CMD_PING, "third", 3);
+    send_tagged(fd, CMD_CHANGE_DIR, "{\"directory_id\":0}", 4);
+    usleep(300 * 1000);
+
+    struct timeval tv = { .tv_sec = 5 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    // Record when each reply arrives relative to the download's frames
+    int frame = 0, download_done = 0;
+    int answered[5] = {0};
+    size_t received = 0;
+    while (received < size || !answered[2] || !answered[3] || !answered[4]) {
+        memset(&reply, 0, sizeof(reply));
+        assert(packet_recv(fd, &reply) == 0);
+        frame++;
+        assert(reply.stream_id >= 1 && reply.stream_id <= 4);
+        if (reply.stream_id == 1) {
+            if (reply.command == CMD_DOWNLOAD_CHUNK) {
+                uint64_t offset = packet_get_u64((uint8_t*)reply.payload);
+                size_t length = reply.data_length - CHUNK_OFFSET_SIZE;
+                assert(offset == received);
+                assert(memcmp(reply.payload + CHUNK_OFFSET_SIZE, data + offset, length) == 0);
+                received += length;
+                if (received == size) {
+                    download_done = frame;
+                }
+            } else {
+                assert(reply.command == CMD_DOWNLOAD_RES);
+            }
+        } else {
+            assert(!answered[reply.stream_id]);
+            answered[reply.stream_id] = frame;
+            assert(reply.command == (reply.stream_id == 4 ? CMD_SUCCESS : CMD_PONG));
+        }
+        free(reply.payload);
+    }
+
+    // A PING shared the stream limit with the download; the barrier waited
+    // for the download to finish
+    assert(answered[2] < download_done);
+    assert(answered[4] > download_done);
+
+    assert(request(fd, CMD_PING, "after", &reply) == CMD_PONG);
+    free(reply.payload);
+
+    close(fd);
+    free(data);
+    stop_test_server(&ts);
+
+    printf(" PASSED\n");
+}
+
+// Untagged requests sent back-to-back are answered one by one, in order
+static void check_pipeline(ServerMode mode) {
+    TestServer ts;
+    ServerConfig config;
+    test_server_config(&ts, mode, &config);
+    Server* srv = start_test_server(&ts, &config);
+
+    ClientConnection* conn = client_connect("127.0.0.1", server_port(srv));
+    assert(conn != NULL);
+
+    // More requests than CLIENT_PIPELINE_DEPTH, so the window slides
+    enum { DIRS = 150, COUNT = DIRS + 3 };
+    ClientRequest requests[COUNT];
+    char payloads[COUNT][96];
+    memset(requests, 0, sizeof(requests));
+
+    snprintf(payloads[0], sizeof(payloads[0]),
+             "{\"username\":\"admin\",\"password\":\"admin\"}");
+    requests[0].command = CMD_LOGIN_REQ;
+    for (int i = 1; i <= DIRS; i++) {
+        snprintf(payloads[i], sizeof(payloads[i]),
+                 "{\"name\":\"piped_%03d\",\"parent_id\":0}", i);
+        requests[i].command = CMD_MAKE_DIR;
+    }
+    snprintf(payloads[DIRS + 1], sizeof(payloads[0]), "{\"directory_id\":0}");
+    requests[DIRS + 1].command = CMD_CHANGE_DIR;
+    snprintf(payloads[DIRS + 2], sizeof(payloads[0]), "{\"directory_id\":0}");
+    requests[DIRS + 2].command = CMD_LIST_DIR;
+    for (int i = 0; i < COUNT; i++) {
+        requests[i].payload = payloads[i];
+    }
+
+    assert(client_pipeline(conn, requests, COUNT) == COUNT);
+
+    // Each directory was created after the previous one
+    assert(requests[0].response_command == CMD_LOGIN_RES);
+    int last_id = 0;
+    for (int i = 1; i <= DIRS; i++) {
+        assert(requests[i].response_command == CMD_SUCCESS);
+        const char* id = strstr(requests[i].response, "\"directory_id\":");
+        assert(id != NULL);
+        int dir_id = atoi(id + strlen("\"directory_id\":"));
+        assert(dir_id > last_id);
+        last_id = dir_id;
+    }
+    assert(requests[DIRS + 1].response_command == CMD_SUCCESS);
+    assert(requests[DIRS + 2].response_command == CMD_LIST_DIR);
+    assert(strstr(requests[DIRS + 2].response, "piped_150") != NULL);
+
+    client_pipeline_free(requests, COUNT);
+    client_disconnect(conn);
+    stop_test_server(&ts);
+}
+
+void test_pipelined_requests(void) {
+    printf("[TEST] test_pipelined_requests...");
+
+    check_pipeline(SERVER_MODE_THREADS);
+    if (event_loop_supported()) {
+        check_pipeline(SERVER_MODE_EPOLL);
+    }
+
+    printf(" PASSED\n");
+}
+
+// Send one UPLOAD_CHUNK frame (no reply is expected)
+static void send_chunk(int fd, uint64_t offset, const uint8_t* data, size_t length) {
+    uint8_t* frame = malloc(CHUNK_OFFSET_SIZE + length);
+    assert(frame != NULL);
+    packet_put_u64(frame, offset);
+    memcpy(frame + CHUNK_OFFSET_SIZE, data, length);
+
+    Packet pkt = {0};
+    pkt.command = CMD_UPLOAD_CHUNK;
+    pkt.data_length = (uint32_t)(CHUNK_OFFSET_SIZE + length);
+    pkt.payload = (char*)frame;
+    assert(packet_send(fd, &pkt) == 0);
+    free(frame);
+}
+
+void test_chunked_upload(void) {
+    printf("[TEST] test_chunked_upload...");
+
+    TestServer ts;
+    Server* srv = start_test_server(&ts, NULL);
+
+    // Several chunks plus a partial one, through the client
+    size_t size = 3 * CHUNK_MAX_SIZE + 12345;
+    uint8_t* data = pattern_data(size, 31, 12);
+
+    char local_path[192];
+    write_test_file(&ts, "chunked.bin", data, size, local_path, sizeof(local_path));
+
+    ClientConnection* conn = client_connect("127.0.0.1", server_port(srv));
+    assert(conn != NULL);
+    assert(client_login(conn, "admin", "admin") == 0);
+    assert(client_upload(conn, local_path) == 0);
+    client_disconnect(conn);
+
+    int fd = login_admin(srv);
+    Packet reply;
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0}", &reply) == CMD_LIST_DIR);
+    const char* id = strstr(reply.payload, "\"id\":");
+    assert(id != NULL && strstr(reply.payload, "chunked.bin") != NULL);
+    char download[64];
+    snprintf(download, sizeof(download), "{\"file_id\":%d}", atoi(id + strlen("\"id\":")));
+    free(reply.payload);
+
+    assert(request(fd, CMD_DOWNLOAD_REQ, download, &reply) == CMD_DOWNLOAD_RES);
+    assert(reply.data_length == size && memcmp(reply.payload, data, size) == 0);
+    free(reply.payload);
+
+    // A skipped chunk is reported by UPLOAD_COMMIT and the upload is dropped
+    assert(request(fd, CMD_UPLOAD_REQ, "{\"name\":\"gap.bin\",\"size\":200,\"parent_id\":0}",
+                   &reply) == CMD_SUCCESS);
+    assert(strstr(reply.payload, "\"chunk_size\"") != NULL);
+    free(reply.payload);
+    send_chunk(fd, 0, data, 100);
+    send_chunk(fd, 150, data, 50);
+    assert(request(fd, CMD_UPLOAD_COMMIT, NULL, &reply) == CMD_ERROR);
+    assert(strstr(reply.payload, "offset") != NULL);
+    free(reply.payload);
+
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0}", &reply) == CMD_LIST_DIR);
+    assert(strstr(reply.payload, "gap.bin") == NULL);
+    free(reply.payload);
+
+    // Sizes past 32 bits are accepted (and checked at commit)
+    assert(request(fd, CMD_UPLOAD_REQ,
+                   "{\"name\":\"big.bin\",\"size\":5000000000,\"parent_id\":0}",
+                   &reply) == CMD_SUCCESS);
+    free(reply.payload);
+    send_chunk(fd, 0, data, 10);
+    assert(request(fd, CMD_UPLOAD_COMMIT, NULL, &reply) == CMD_ERROR);
+    assert(strstr(reply.payload, "5000000000") != NULL);
+    free(reply.payload);
+
+    close(fd);
+    free(data);
+    stop_test_server(&ts);
+
+    printf(" PASSED\n");
+}
+
+#define REGISTRY_THREADS 4
+#define REGISTRY_HELD 8
+
+typedef struct {
+    SessionRegistry* reg;
+    int tag;
+} RegistryWorker;
+
+// Churn through sessions, holding a few at a time, and check nobody else
+// was handed a slot this thread still owns
+static void* registry_churn(void* arg) {
+    RegistryWorker* worker = arg;
+    ClientSession* held[REGISTRY_HELD] = { 0 };
+    for (int i = 0; i < 20000; i++) {
+        int k = i % REGISTRY_HELD;
+        if (held[k]) {
+            assert(held[k]->client_socket == worker->tag + k);
+            assert(session_registry_lookup(worker->reg, held[k]->session_id) == held[k]);
+            assert(session_registry_release(worker->reg, held[k]) >= 0);
+        }
+        held[k] = session_registry_acquire(worker->reg);
+        assert(held[k] != NULL);
+        held[k]->client_socket = worker->tag + k;
+    }
+    for (int k = 0; k < REGISTRY_HELD; k++) {
+        assert(session_registry_release(worker->reg, held[k]) >= 0);
+    }
+    return NULL;
+}
+
+static int registry_count_visit(ClientSession* session, void* arg) {
+    (void)session;
+    (*(int*)arg)++;
+    return 0;
+}
+
+void test_session_registry(void) {
+    printf("[TEST] test_session_registry...");
+
+    SessionRegistry* reg = calloc(1, sizeof(SessionRegistry));
+    assert(reg != NULL);
+
+    // Exactly enough room for every thread's sessions at once
+    assert(session_registry_init(reg, REGISTRY_THREADS * REGISTRY_HELD) == 0);
+    pthread_t threads[REGISTRY_THREADS];
+    RegistryWorker workers[REGISTRY_THREADS];
+    for (int t = 0; t < REGISTRY_THREADS; t++) {
+        workers[t] = (RegistryWorker){ .reg = reg, .tag = (t + 1) * 100 };
+        assert(pthread_create(&threads[t], NULL, registry_churn, &workers[t]) == 0);
+    }
+    for (int t = 0; t < REGISTRY_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    assert(session_registry_count(reg) == 0);
+    assert(session_registry_slots(reg) <= REGISTRY_THREADS * REGISTRY_HELD);
+
+    // A released handle stays dead once its slot is handed out again
+    ClientSession* first = session_registry_acquire(reg);
+    assert(first != NULL);
+    SessionId old_id = first->session_id;
+    assert(session_registry_release(reg, first) == 0);
+    assert(session_registry_lookup(reg, old_id) == NULL);
+    ClientSession* reused = session_registry_acquire(reg);
+    assert(reused == first && reused->session_id != old_id);
+    assert(session_registry_lookup(reg, old_id) == NULL);
+    assert(session_registry_lookup(reg, reused->session_id) == reused);
+    ClientSession stale = *reused;
+    stale.session_id = old_id;
+    assert(session_registry_release(reg, &stale) == -1);
+    assert(session_registry_release(reg, reused) == 0);
+    assert(session_registry_release(reg, reused) == -1);
+
+    // Past the first segment, up to the limit and no further
+    int total = SESSION_SEGMENT_SIZE + SESSION_SEGMENT_SIZE / 2;
+    assert(session_registry_init(reg, total) == 0);
+    ClientSession** sessions = calloc((size_t)total, sizeof(ClientSession*));
+    assert(sessions != NULL);
+    for (int i = 0; i < total; i++) {
+        sessions[i] = session_registry_acquire(reg);
+        assert(sessions[i] != NULL);
+        sessions[i]->client_socket = i;
+    }
+    assert(session_registry_acquire(reg) == NULL);
+    assert(session_registry_slots(reg) == total && session_registry_count(reg) == total);
+    int visited = 0;
+    assert(session_registry_foreach(reg, registry_count_visit, &visited) == total);
+    assert(visited == total);
+    for (int i = 0; i < total; i++) {
+        ClientSession* found = session_registry_lookup(reg, sessions[i]->session_id);
+        assert(found == sessions[i] && found->client_socket == i);
+    }
+    for (int i = 0; i < total; i++) {
+        assert(session_registry_release(reg, sessions[i]) == total - i - 1);
+    }
+    free(sessions);
+
+    session_registry_destroy(reg);
+    free(reg);
+
+    printf(" PASSED\n");
+}
+
+// A session of its own on a socketpair, run straight through the pool.
+// With full set, the socket's buffer is filled first so any reply blocks
+// its worker until the peer end (fds[1]) is closed
+typedef struct {
+    ClientSession session;
+    int fds[2];
+    int done;
+    int order;
+    pthread_t thread;
+} PoolProbe;
+
+static int pool_finished = 0;
+
+static void pool_probe_init(PoolProbe* probe, int full) {
+    memset(probe, 0, sizeof(*probe));
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, probe->fds) == 0);
+    probe->session.client_socket = probe->fds[0];
+    pthread_mutex_init(&probe->session.send_mutex, NULL);
+    if (full) {
+        char filler[4096];
+        memset(filler, 'f', sizeof(filler));
+        while (send(probe->fds[0], filler, sizeof(filler), MSG_DONTWAIT) > 0) {
+        }
+    }
+}
+
+static void pool_probe_done(ClientSession* session, void* arg) {
+    (void)session;
+    PoolProbe* probe = arg;
+    probe->thread = pthread_self();
+    probe->order = __atomic_add_fetch(&pool_finished, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&probe->done, 1, __ATOMIC_RELEASE);
+}
+
+static void pool_probe_submit(PoolProbe* probe, uint8_t command) {
+    Packet pkt = { .command = command };
+    assert(thread_pool_submit(&probe->session, &pkt, pool_probe_done, probe) == 0);
+}
+
+// Wait up to ms for *flag to be set
+static int wait_flag(int* flag, int ms) {
+    for (int waited = 0; waited < ms; waited += 10) {
+        if (__atomic_load_n(flag, __ATOMIC_ACQUIRE)) {
+            return 1;
+        }
+        usleep(10 * 1000);
+    }
+    return __atomic_load_n(flag, __ATOMIC_ACQUIRE);
+}
+
+static void pool_probe_release(PoolProbe* probe) {
+    close(probe->fds[1]);
+    probe->fds[1] = -1;
+}
+
+static void pool_probe_close(PoolProbe* probe) {
+    if (probe->fds[1] >= 0) {
+        close(probe->fds[1]);
+    }
+    close(probe->fds[0]);
+    pthread_mutex_destroy(&probe->session.send_mutex);
+}
+
+typedef struct {
+    PoolProbe* probe;
+    int returned;
+} PoolSubmitter;
+
+static void* pool_submit_thread(void* arg) {
+    PoolSubmitter* submitter = arg;
+    pool_probe_submit(submitter->probe, CMD_PING);
+    __atomic_store_n(&submitter->returned, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+void test_worker_pool(void) {
+    printf("[TEST] test_worker_pool...");
+
+    // Three workers, one transfer at a time, two queued tasks at most
+    assert(thread_pool_start(3, 1, 2) == 0);
+    assert(thread_pool_worker_count() == 3 && thread_pool_transfer_limit() == 1);
+
+    // Transfers past the limit wait aside without a worker; a short
+    // command still runs, and each finished transfer hands its worker to
+    // the oldest waiting one
+    PoolProbe transfers[3], ping;
+    for (int i = 0; i < 3; i++) {
+        pool_probe_init(&transfers[i], 1);
+        pool_probe_submit(&transfers[i], CMD_DOWNLOAD_REQ);
+    }
+    pool_probe_init(&ping, 0);
+    pool_probe_submit(&ping, CMD_PING);
+    assert(wait_flag(&ping.done, 2000));
+    for (int i = 0; i < 3; i++) {
+        assert(!transfers[i].done);
+    }
+    for (int i = 0; i < 3; i++) {
+        pool_probe_release(&transfers[i]);
+        assert(wait_flag(&transfers[i].done, 2000));
+        if (i > 0) {
+            assert(transfers[i].order > transfers[i - 1].order);
+            assert(pthread_equal(transfers[i].thread, transfers[0].thread));
+        }
+        usleep(50 * 1000);
+    }
+    thread_pool_drain();
+
+    // Every worker busy and the queue full: the next submit blocks until a
+    // worker takes a queued task
+    PoolProbe busy[3], queued[3];
+    for (int i = 0; i < 3; i++) {
+        pool_probe_init(&busy[i], 1);
+        pool_probe_submit(&busy[i], CMD_PING);
+    }
+    usleep(100 * 1000);
+    for (int i = 0; i < 3; i++) {
+        pool_probe_init(&queued[i], 0);
+    }
+    pool_probe_submit(&queued[0], CMD_PING);
+    pool_probe_submit(&queued[1], CMD_PING);
+    PoolSubmitter submitter = { .probe = &queued[2] };
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, pool_submit_thread, &submitter) == 0);
+    usleep(200 * 1000);
+    assert(!__atomic_load_n(&submitter.returned, __ATOMIC_ACQUIRE));
+    pool_probe_release(&busy[0]);
+    assert(wait_flag(&submitter.returned, 2000));
+    pthread_join(thread, NULL);
+    for (int i = 1; i < 3; i++) {
+        pool_probe_release(&busy[i]);
+    }
+    thread_pool_drain();
+    for (int i = 0; i < 3; i++) {
+        assert(busy[i].done && queued[i].done);
+    }
+
+    thread_pool_stop();
+    assert(thread_pool_worker_count() == 0);
+    for (int i = 0; i < 3; i++) {
+        pool_probe_close(&transfers[i]);
+        pool_probe_close(&busy[i]);
+        pool_probe_close(&queued[i]);
+    }
+    pool_probe_close(&ping);
+
+    printf(" PASSED\n");
+}
+
+typedef struct {
+    TimerWheel* wheel;
+    uint64_t fired_at;      // Tick of the last firing
+    int fires;
+    TimerEntry* victim;     // Cancelled by the callback
+    uint64_t readd;         // Re-armed for this tick by the callback, 0: not
+} WheelProbe;
+
+static void wheel_probe_fire(TimerEntry* timer, void* arg) {
+    WheelProbe* probe = arg;
+    probe->fired_at = probe->wheel->now - 1;
+    probe->fires++;
+    if (probe->victim) {
+        timer_wheel_cancel(probe->wheel, probe->victim);
+    }
+    if (probe->readd) {
+        uint64_t at = probe->readd;
+        probe->readd = 0;
+        timer_wheel_add(probe->wheel, timer, at);
+    }
+}
+
+void test_timer_wheel(void) {
+    printf("[TEST] test_timer_wheel...");
+
+    // Each timer fires on its own tick, whichever level it started on and
+    // however many cascades brought it down; the start is off a level boundary
+    TimerWheel wheel;
+    timer_wheel_init(&wheel, 3);
+    uint64_t expires[] = { 10, 63, 64, 100, 4095, 4096, 5000, 70000, 300000 };
+    int n = (int)(sizeof(expires) / sizeof(expires[0]));
+    TimerEntry timers[9];
+    WheelProbe probes[9];
+    for (int i = 0; i < n; i++) {
+        probes[i] = (WheelProbe){ .wheel = &wheel };
+        timer_init(&timers[i], wheel_probe_fire, &probes[i]);
+        timer_wheel_add(&wheel, &timers[i], expires[i]);
+    }
+    assert(wheel.count == n);
+
+    int fired = 0;
+    for (uint64_t now = 0; now <= 300000; now += 997) {
+        fired += timer_wheel_advance(&wheel, now);
+        for (int i = 0; i < n; i++) {
+            assert(probes[i].fires == (expires[i] <= now));
+        }
+    }
+    fired += timer_wheel_advance(&wheel, 300000);
+    assert(fired == n && wheel.count == 0);
+    for (int i = 0; i < n; i++) {
+        assert(probes[i].fires == 1 && probes[i].fired_at == expires[i]);
+    }
+
+    // From inside a callback: cancel a timer waiting on level 2, re-arm
+    // the firing timer across into level 2, and re-arm one for a past tick
+    timer_wheel_init(&wheel, 0);
+    for (int i = 0; i < 4; i++) {
+        probes[i] = (WheelProbe){ .wheel = &wheel };
+        timer_init(&timers[i], wheel_probe_fire, &probes[i]);
+    }
+    probes[0].victim = &timers[1];
+    probes[0].readd = 200 + 4100;
+    probes[2].readd = 10;
+    timer_wheel_add(&wheel, &timers[0], 200);
+    timer_wheel_add(&wheel, &timers[1], 5000);
+    timer_wheel_add(&wheel, &timers[2], 50);
+    timer_wheel_add(&wheel, &timers[3], 4300);
+    timer_wheel_cancel(&wheel, &timers[3]);
+    timer_wheel_cancel(&wheel, &timers[3]);
+    assert(wheel.count == 3);
+
+    assert(timer_wheel_advance(&wheel, 51) == 2);
+    assert(probes[2].fires == 2 && probes[2].fired_at == 51);
+    assert(timer_wheel_advance(&wheel, 200) == 1 && wheel.count == 1);
+    assert(timer_wheel_advance(&wheel, 4299) == 0);
+    assert(timer_wheel_advance(&wheel, 10000) == 1);
+    assert(probes[0].fires == 2 && probes[0].fired_at == 4300);
+    assert(probes[1].fires == 0 && probes[3].fires == 0 && wheel.count == 0);
+
+    printf(" PASSED\n");
+}
+
+// An unauthenticated or silent session is closed by the server, while one
+// that keeps talking stays open
+void test_session_timeouts(void) {
+    printf("[TEST] test_session_timeouts...");
+
+    ServerMode modes[] = { SERVER_MODE_THREADS, SERVER_MODE_EPOLL };
+    for (int m = 0; m < 2; m++) {
+        if (modes[m] == SERVER_MODE_EPOLL && !event_loop_supported()) {
+            continue;
+        }
+
+        TestServer ts;
+        ServerConfig config;
+        test_server_config(&ts, modes[m], &config);
+        config.login_timeout = 1;
+        config.idle_timeout = 1;
+        Server* srv = start_test_server(&ts, &config);
+
+        // Never logs in; then logs in and goes quiet
+        int fds[2] = { connect_to(srv), login_admin(srv) };
+        for (int i = 0; i < 2; i++) {
+            struct timeval timeout = { 5, 0 };
+            assert(setsockopt(fds[i], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0);
+            char byte;
+            assert(recv(fds[i], &byte, 1, 0) == 0);
+            close(fds[i]);
+        }
+
+        // Requests every 400 ms keep pushing the idle deadline out
+        if (m == 0) {
+            int fd = login_admin(srv);
+            for (int i = 0; i < 6; i++) {
+                usleep(400 * 1000);
+                Packet reply;
+                assert(request(fd, CMD_LIST_DIR, "{}", &reply) == CMD_LIST_DIR);
+                free(reply.payload);
+            }
+            close(fd);
+        }
+
+        stop_test_server(&ts);
+    }
+
+    printf(" PASSED\n");
+}
+
+// A chunk trickling in keeps its upload alive past the transfer timeout:
+// every splice step counts as progress
+void test_slow_sender(void) {
+    printf("[TEST] test_slow_sender...");
+
+    TestServer ts;
+    ServerConfig config;
+    test_server_config(&ts, default_mode(), &config);
+    config.transfer_timeout = 1;
+    Server* srv = start_test_server(&ts, &config);
+
+    size_t size = 512 * 1024;
+    uint8_t* frame = malloc(HEADER_SIZE + CHUNK_OFFSET_SIZE + size);
+    assert(frame != NULL);
+    frame[0] = MAGIC_BYTE_1;
+    frame[1] = MAGIC_BYTE_2;
+    frame[2] = CMD_UPLOAD_CHUNK;
+    packet_put_u32(frame + 3, (uint32_t)(CHUNK_OFFSET_SIZE + size));
+    packet_put_u64(frame + HEADER_SIZE, 0);
+    uint8_t* data = frame + HEADER_SIZE + CHUNK_OFFSET_SIZE;
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)(i * 17 + (i >> 10));
+    }
+
+    int fd = login_admin(srv);
+    Packet reply;
+    assert(request(fd, CMD_UPLOAD_REQ, "{\"name\":\"slow.bin\",\"size\":524288,\"parent_id\":0}",
+                   &reply) == CMD_SUCCESS);
+    free(reply.payload);
+
+    // The frame in 16 pieces over three seconds
+    size_t total = HEADER_SIZE + CHUNK_OFFSET_SIZE + size;
+    size_t piece = (total + 15) / 16;
+    for (size_t sent = 0; sent < total; sent += piece) {
+        size_t length = total - sent < piece ? total - sent : piece;
+        assert(send(fd, frame + sent, length, 0) == (ssize_t)length);
+        usleep(200 * 1000);
+    }
+    assert(request(fd, CMD_UPLOAD_COMMIT, NULL, &reply) == CMD_SUCCESS);
+    free(reply.payload);
+
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0}", &reply) == CMD_LIST_DIR);
+    const char* id = strstr(reply.payload, "\"id\":");
+    assert(id != NULL && strstr(reply.payload, "slow.bin") != NULL);
+    char download[64];
+    snprintf(download, sizeof(download), "{\"file_id\":%d}", atoi(id + strlen("\"id\":")));
+    free(reply.payload);
+    assert(request(fd, CMD_DOWNLOAD_REQ, download, &reply) == CMD_DOWNLOAD_RES);
+    assert(reply.data_length == size && memcmp(reply.payload, data, size) == 0);
+    free(reply.payload);
+
+    close(fd);
+    free(frame);
+    stop_test_server(&ts);
+
+    printf(" PASSED\n");
+}
+
+// Chunk headers announcing data that never comes do not tie up the
+// workers: only an open upload reads its chunks on a worker
+void test_stalled_chunks(void) {
+    printf("[TEST] test_stalled_chunks...");
+
+    TestServer ts;
+    Server* srv = start_test_server(&ts, NULL);
+
+    uint8_t header[HEADER_SIZE] = { MAGIC_BYTE_1, MAGIC_BYTE_2, CMD_UPLOAD_CHUNK };
+    packet_put_u32(header + 3, 1024 * 1024);
+    int stalled[4];
+    for (int i = 0; i < 4; i++) {
+        stalled[i] = (i < 2) ? connect_to(srv) : login_admin(srv);
+        assert(send(stalled[i], header, sizeof(header), 0) == (ssize_t)sizeof(header));
+    }
+
+    int fd = connect_to(srv);
+    struct timeval timeout = { 5, 0 };
+    assert(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0);
+    Packet reply;
+    assert(request(fd, CMD_LOGIN_REQ, "{\"username\":\"admin\",\"password\":\"admin\"}",
+                   &reply) == CMD_LOGIN_RES);
+    free(reply.payload);
+    assert(request(fd, CMD_LIST_DIR, "{}", &reply) == CMD_LIST_DIR);
+    free(reply.payload);
+
+    close(fd);
+    for (int i = 0; i < 4; i++) {
+        close(stalled[i]);
+    }
+    stop_test_server(&ts);
+
+    printf(" PASSED\n");
+}
+
+void test_chunked_download(void) {
+    printf("[TEST] test_chunked_download...");
+
+    TestServer ts;
+    Server* srv = start_test_server(&ts, NULL);
+
+    size_t size = 2 * CHUNK_MAX_SIZE + 777;
+    uint8_t* data = pattern_data(size, 7, 16);
+
+    char local_path[192], saved_path[192];
+    snprintf(local_path, sizeof(local_path), "%s/source.bin", ts.dir);
+    snprintf(saved_path, sizeof(saved_path), "%s/saved.bin", ts.dir);
+    FILE* fp = fopen(local_path, "wb");
+    assert(fp != NULL);
+    assert(fwrite(data, 1, size, fp) == size);
+    fclose(fp);
+
+    ClientConnection* conn = client_connect("127.0.0.1", server_port(srv));
+    assert(conn != NULL);
+    assert(client_login(conn, "admin", "admin") == 0);
+    assert(client_upload(conn, local_path) == 0);
+
+    int fd = login_admin(srv);
+    Packet reply;
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0}", &reply) == CMD_LIST_DIR);
+    const char* id = strstr(reply.payload, "\"id\":");
+    assert(id != NULL);
+    int file_id = atoi(id + strlen("\"id\":"));
+    free(reply.payload);
+
+    // The client streams the chunks to disk
+    assert(client_download(conn, file_id, saved_path) == 0);
+    client_disconnect(conn);
+
+    uint8_t* saved = malloc(size + 1);
+    assert(saved != NULL);
+    fp = fopen(saved_path, "rb");
+    assert(fp != NULL);
+    assert(fread(saved, 1, size + 1, fp) == size);
+    fclose(fp);
+    assert(memcmp(saved, data, size) == 0);
+    free(saved);
+
+    // Metadata first, then offset-tagged chunks of at most chunk_size bytes
+    char download[80];
+    snprintf(download, sizeof(download), "{\"file_id\":%d,\"chunked\":true}", file_id);
+    assert(request(fd, CMD_DOWNLOAD_REQ, download, &reply) == CMD_DOWNLOAD_RES);
+    char expected[64];
+    snprintf(expected, sizeof(expected), "\"size\":%zu", size);
+    assert(strstr(reply.payload, expected) != NULL);
+    free(reply.payload);
+
+    uint64_t offset = 0;
+    int frames = 0;
+    while (offset < size) {
+        memset(&reply, 0, sizeof(reply));
+        assert(packet_recv(fd, &reply) == 0);
+        assert(reply.command == CMD_DOWNLOAD_CHUNK);
+        assert(reply.data_length <= CHUNK_OFFSET_SIZE + CHUNK_MAX_SIZE);
+        assert(packet_get_u64((const uint8_t*)reply.payload) == offset);
+        size_t length = reply.data_length - CHUNK_OFFSET_SIZE;
+        assert(memcmp(reply.payload + CHUNK_OFFSET_SIZE, data + offset, length) == 0);
+        offset += length;
+        frames++;
+        free(reply.payload);
+    }
+    assert(offset == size && frames == 3);
+
+    // The connection is back to request/response afterwards
+    assert(request(fd, CMD_PING, "after", &reply) == CMD_PONG);
+    free(reply.payload);
+
+    close(fd);
+    free(data);
+    stop_test_server(&ts);
+
+    printf(" PASSED\n");
+}
+
+// Wait until the server has cleaned up every session
+static void wait_sessions_closed(Server* srv) {
+    for (int i = 0; i < 500 && session_registry_count(&srv->sessions) > 0; i++) {
+        usleep(10 * 1000);
+    }
+    assert(session_registry_count(&srv->sessions) == 0);
+}
+
+// Clients that request downloads and never read them hold no more than
+// the transfer slots: logins and listings still find a worker
+void test_slow_downloads(void) {
+    printf("[TEST] test_slow_downloads...");
+
+    TestServer ts;
+    Server* srv = start_test_server(&ts, NULL);
+
+    size_t size = 16 * 1024 * 1024;
+    uint8_t* data = pattern_data(size, 7, 16);
+    char local_path[192];
+    write_test_file(&ts, "large.bin", data, size, local_path, sizeof(local_path));
+    free(data);
+
+    ClientConnection* conn = client_connect("127.0.0.1", server_port(srv));
+    assert(conn != NULL);
+    assert(client_login(conn, "admin", "admin") == 0);
+    assert(client_upload(conn, local_path) == 0);
+    ClientListing* listing = client_list_page(conn, 0, NULL, CLIENT_LIST_PAGE);
+    assert(listing != NULL && listing->count == 1);
+    char download[80];
+    snprintf(download, sizeof(download), "{\"file_id\":%d,\"chunked\":true}",
+             listing->entries[0].id);
+    client_listing_free(listing);
+    client_disconnect(conn);
+
+    int slow[3];
+    for (int i = 0; i < 3; i++) {
+        slow[i] = login_admin(srv);
+        Packet* pkt = packet_create(CMD_DOWNLOAD_REQ, download, strlen(download));
+        assert(packet_send(slow[i], pkt) == 0);
+        packet_free(pkt);
+    }
+
+    int fd = connect_to(srv);
+    struct timeval timeout = { 5, 0 };
+    assert(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0);
+    Packet reply;
+    assert(request(fd, CMD_LOGIN_REQ, "{\"username\":\"admin\",\"password\":\"admin\"}",
+                   &reply) == CMD_LOGIN_RES);
+    free(reply.payload);
+    assert(request(fd, CMD_LIST_DIR, "{}", &reply) == CMD_LIST_DIR);
+    free(reply.payload);
+
+    close(fd);
+    for (int i = 0; i < 3; i++) {
+        close(slow[i]);
+    }
+    stop_test_server(&ts);
+
+    printf(" PASSED\n");
+}
+
+// A download the client reads slowly keeps the session alive past the
+// idle timeout: bytes going out count as activity
+void test_slow_reader(void) {
+    printf("[TEST] test_slow_reader...");
+
+    TestServer ts;
+    ServerConfig config;
+    test_server_config(&ts, default_mode(), &config);
+    config.idle_timeout = 1;
+    Server* srv = start_test_server(&ts, &config);
+
+    size_t size = 16 * 1024 * 1024;
+    uint8_t* data = pattern_data(size, 13, 12);
+    char local_path[192];
+    write_test_file(&ts, "slow.bin", data, size, local_path, sizeof(local_path));
+
+    ClientConnection* conn = client_connect("127.0.0.1", server_port(srv));
+    assert(conn != NULL);
+    assert(client_login(conn, "admin", "admin") == 0);
+    assert(client_upload(conn, local_path) == 0);
+    ClientListing* listing = client_list_page(conn, 0, NULL, CLIENT_LIST_PAGE);
+    assert(listing != NULL && listing->count == 1);
+    char download[80];
+    snprintf(download, sizeof(download), "{\"file_id\":%d,\"chunked\":true}",
+             listing->entries[0].id);
+    client_listing_free(listing);
+    client_disconnect(conn);
+
+    // About four seconds for the whole file, four times the idle timeout
+    int fd = login_admin(srv);
+    Packet reply;
+    assert(request(fd, CMD_DOWNLOAD_REQ, download, &reply) == CMD_DOWNLOAD_RES);
+    free(reply.payload);
+    size_t received = 0;
+    while (received < size) {
+        usleep(250 * 1000);
+        assert(packet_recv(fd, &reply) == 0);
+        assert(reply.command == CMD_DOWNLOAD_CHUNK);
+        uint64_t offset = packet_get_u64((uint8_t*)reply.payload);
+        size_t length = reply.data_length - CHUNK_OFFSET_SIZE;
+        assert(offset == received);
+        assert(memcmp(reply.payload + CHUNK_OFFSET_SIZE, data + offset, length) == 0);
+        received += length;
+        free(reply.payload);
+    }
+
+    close(fd);
+    free(data);
+    stop_test_server(&ts);
+
+    printf(" PASSED\n");
+}
+
+static double cpu_seconds(void) {
+    struct rusage usage;
+    assert(getrusage(RUSAGE_SELF, &usage) == 0);
+    return (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+           (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// Uploads and compressed downloads through the io_uring backend, in both
+// modes. A client that stops reading leaves the sender waiting on the
+// ring, not spinning on EAGAIN. Skipped where io_uring is unavailable
+void test_io_uring(void) {
+    printf("[TEST] test_io_uring...");
+
+    if (io_backend_select(IO_BACKEND_URING) != IO_BACKEND_URING) {
+        printf(" SKIPPED\n");
+        return;
+    }
+
+    ServerMode modes[] = { SERVER_MODE_THREADS, SERVER_MODE_EPOLL };
+    for (int m = 0; m < 2; m++) {
+        if (modes[m] == SERVER_MODE_EPOLL && !event_loop_supported()) {
+            continue;
+        }
+
+        TestServer ts;
+        ServerConfig config;
+        test_server_config(&ts, modes[m], &config);
+        Server* srv = start_test_server(&ts, &config);
+
+        // Half the bits random: each chunk deflates, yet to several MB in all
+        size_t size = 24 * 1024 * 1024;
+        uint8_t* data = malloc(size);
+        assert(data != NULL);
+        srand(7);
+        for (size_t i = 0; i < size; i++) {
+            data[i] = (uint8_t)(rand() & 0x0f);
+        }
+        char local_path[192];
+        write_test_file(&ts, "ring.bin", data, size, local_path, sizeof(local_path));
+
+        ClientConnection* conn = client_connect("127.0.0.1", server_port(srv));
+        assert(conn != NULL);
+        assert(client_login(conn, "admin", "admin") == 0);
+        assert(conn->compression != COMPRESSION_NONE);
+        assert(client_upload(conn, local_path) == 0);
+        ClientListing* listing = client_list_page(conn, 0, NULL, CLIENT_LIST_PAGE);
+        assert(listing != NULL && listing->count == 1);
+        char download[80];
+        snprintf(download, sizeof(download), "{\"file_id\":%d,\"chunked\":true}",
+                 listing->entries[0].id);
+        client_listing_free(listing);
+
+        Packet reply;
+        assert(request(conn->socket_fd, CMD_DOWNLOAD_REQ, download, &reply) == CMD_DOWNLOAD_RES);
+        free(reply.payload);
+
+        // The socket buffers fill up well before the file is out
+        double before = cpu_seconds();
+        usleep(1000 * 1000);
+        assert(cpu_seconds() - before < 0.5);
+
+        size_t received = 0;
+        while (received < size) {
+            assert(packet_recv(conn->socket_fd, &reply) == 0);
+            assert(reply.command == CMD_DOWNLOAD_CHUNK);
+            uint64_t offset = packet_get_u64((uint8_t*)reply.payload);
+            size_t length = reply.data_length - CHUNK_OFFSET_SIZE;
+            assert(offset == received);
+            assert(memcmp(reply.payload + CHUNK_OFFSET_SIZE, data + offset, length) == 0);
+            received += length;
+            free(reply.payload);
+        }
+
+        client_disconnect(conn);
+        free(data);
+        stop_test_server(&ts);
+    }
+
+    io_backend_select(IO_BACKEND_POSIX);
+    printf(" PASSED\n");
+}
+
+void test_resumable_transfers(void) {
+    printf("[TEST] test_resumable_transfers...");
+
+    TestServer ts;
+    Server* srv = start_test_server(&ts, NULL);
+
+    size_t size = 3 * CHUNK_MAX_SIZE + 4321;
+    uint8_t* data = pattern_data(size, 13, 10);
+
+    // Two chunks go through, then the connection drops
+    char upload[128];
+    snprintf(upload, sizeof(upload),
+             "{\"name\":\"resume.bin\",\"size\":%zu,\"parent_id\":0,\"resume\":true}", size);
+    int fd = login_admin(srv);
+    Packet reply;
+    assert(request(fd, CMD_UPLOAD_REQ, upload, &reply) == CMD_SUCCESS);
+    assert(strstr(reply.payload, "\"offset\":0") != NULL);
+    const char* id = strstr(reply.payload, "\"file_id\":");
+    assert(id != NULL);
+    int file_id = atoi(id + strlen("\"file_id\":"));
+    free(reply.payload);
+    send_chunk(fd, 0, data, CHUNK_MAX_SIZE);
+    send_chunk(fd, CHUNK_MAX_SIZE, data + CHUNK_MAX_SIZE, CHUNK_MAX_SIZE);
+    close(fd);
+    wait_sessions_closed(srv);
+
+    // The unfinished file cannot be downloaded
+    fd = login_admin(srv);
+    char download[96];
+    snprintf(download, sizeof(download), "{\"file_id\":%d,\"chunked\":true}", file_id);
+    assert(request(fd, CMD_DOWNLOAD_REQ, download, &reply) == CMD_ERROR);
+    free(reply.payload);
+
+    // A new session continues from the stored bytes of the same file
+    assert(request(fd, CMD_UPLOAD_REQ, upload, &reply) == CMD_SUCCESS);
+    char expected[64];
+    snprintf(expected, sizeof(expected), "\"file_id\":%d,", file_id);
+    assert(strstr(reply.payload, expected) != NULL);
+    snprintf(expected, sizeof(expected), "\"offset\":%d", 2 * CHUNK_MAX_SIZE);
+    assert(strstr(reply.payload, expected) != NULL);
+    free(reply.payload);
+    send_chunk(fd, 2 * CHUNK_MAX_SIZE, data + 2 * CHUNK_MAX_SIZE, CHUNK_MAX_SIZE);
+    send_chunk(fd, 3 * CHUNK_MAX_SIZE, data + 3 * CHUNK_MAX_SIZE, size - 3 * CHUNK_MAX_SIZE);
+    assert(request(fd, CMD_UPLOAD_COMMIT, NULL, &reply) == CMD_SUCCESS);
+    free(reply.payload);
+
+    // A download can start at an offset
+    snprintf(download, sizeof(download), "{\"file_id\":%d,\"chunked\":true,\"offset\":%zu}",
+             file_id, size - 100);
+    assert(request(fd, CMD_DOWNLOAD_REQ, download, &reply) == CMD_DOWNLOAD_RES);
+    free(reply.payload);
+    memset(&reply, 0, sizeof(reply));
+    assert(packet_recv(fd, &reply) == 0);
+    assert(reply.command == CMD_DOWNLOAD_CHUNK);
+    assert(reply.data_length == CHUNK_OFFSET_SIZE + 100);
+    assert(packet_get_u64((const uint8_t*)reply.payload) == size - 100);
+    assert(memcmp(reply.payload + CHUNK_OFFSET_SIZE, data + size - 100, 100) == 0);
+    free(reply.payload);
+    close(fd);
+
+    // The client continues a local file from its current length
+    char local_path[192];
+    write_test_file(&ts, "partial.bin", data, size / 2, local_path, sizeof(local_path));
+
+    ClientConnection* conn = client_connect("127.0.0.1", server_port(srv));
+    assert(conn != NULL);
+    assert(client_login(conn, "admin", "admin") == 0);
+    assert(client_download_resume(conn, file_id, local_path) == 0);
+    client_disconnect(conn);
+
+    uint8_t* saved = malloc(size + 1);
+    assert(saved != NULL);
+    FILE* fp = fopen(local_path, "rb");
+    assert(fp != NULL);
+    assert(fread(saved, 1, size + 1, fp) == size);
+    fclose(fp);
+    assert(memcmp(saved, data, size) == 0);
+    free(saved);
+
+    free(data);
+    stop_test_server(&ts);
+
+    printf(" PASSED\n");
+}
+
+void test_range_reads(void) {
+    printf("[TEST] test_range_reads...");
+
+    TestServer ts;
+    Server* srv = start_test_server(&ts, NULL);
+
+    size_t size = 2 * CHUNK_MAX_SIZE + 99;
+    uint8_t* data = pattern_data(size, 17, 8);
+
+    char local_path[192];
+    write_test_file(&ts, "range.bin", data, size, local_path, sizeof(local_path));
+
+    ClientConnection* conn = client_connect("127.0.0.1", server_port(srv));
+    assert(conn != NULL);
+    assert(client_login(conn, "admin", "admin") == 0);
+    assert(client_upload(conn, local_path) == 0);
+
+    int fd = login_admin(srv);
+    Packet reply;
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0}", &reply) == CMD_LIST_DIR);
+    const char* id = strstr(reply.payload, "\"id\":");
+    assert(id != NULL);
+    int file_id = atoi(id + strlen("\"id\":"));
+    free(reply.payload);
+    close(fd);
+
+    uint8_t* buffer = malloc(CHUNK_MAX_SIZE + 64);
+    assert(buffer != NULL);
+
+    // A few bytes from the middle
+    assert(client_read_range(conn, file_id, 1000, 16, buffer) == 16);
+    assert(memcmp(buffer, data + 1000, 16) == 0);
+
+    // Across a chunk boundary: two frames
+    uint64_t offset = CHUNK_MAX_SIZE - 10;
+    assert(client_read_range(conn, file_id, offset, CHUNK_MAX_SIZE + 20, buffer) ==
+           CHUNK_MAX_SIZE + 20);
+    assert(memcmp(buffer, data + offset, CHUNK_MAX_SIZE + 20) == 0);
+
+    // Clipped at the end of the file; nothing at the very end
+    assert(client_read_range(conn, file_id, size - 50, 4096, buffer) == 50);
+    assert(memcmp(buffer, data + size - 50, 50) == 0);
+    assert(client_read_range(conn, file_id, size, 10, buffer) == 0);
+
+    // Past the end is an error; the connection stays usable
+    assert(client_read_range(conn, file_id, size + 1, 10, buffer) == -1);
+    assert(client_read_range(conn, file_id, 0, 8, buffer) == 8);
+    assert(memcmp(buffer, data, 8) == 0);
+
+    client_disconnect(conn);
+    free(buffer);
+    free(data);
+    stop_test_server(&ts);
+
+    printf(" PASSED\n");
+}
+
+void test_striped_download(void) {
+    printf("[TEST] test_striped_download...");
+
+    TestServer ts;
+    Server* srv = start_test_server(&ts, NULL);
+
+    size_t size = 3 * CHUNK_MAX_SIZE + 4321;
+    uint8_t* data = pattern_data(size, 31, 12);
+
+    char local_path[192];
+    write_test_file(&ts, "striped.bin", data, size, local_path, sizeof(local_path));
+
+    ClientConnection* conn = client_connect("127.0.0.1", server_port(srv));
+    assert(conn != NULL);
+    assert(client_login(conn, "admin", "admin") == 0);
+    assert(client_upload(conn, local_path) == 0);
+
+    int fd = login_admin(srv);
+    Packet reply;
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0}", &reply) == CMD_LIST_DIR);
+    const char* id = strstr(reply.payload, "\"id\":");
+    assert(id != NULL);
+    int file_id = atoi(id + strlen("\"id\":"));
+    free(reply.payload);
+    close(fd);
+
+    uint8_t* copy = malloc(size);
+    assert(copy != NULL);
+
+    // Stripes that do not line up with chunks, more of them than connections
+    char copy_path[192];
+    snprintf(copy_path, sizeof(copy_path), "%s/striped.copy", ts.dir);
+    assert(client_download_striped(conn, "admin", "admin", file_id, copy_path, 3,
+                                   CHUNK_MAX_SIZE / 2 + 123) == 0);
+    FILE* fp = fopen(copy_path, "rb");
+    assert(fp != NULL);
+    assert(fread(copy, 1, size, fp) == size);
+    assert(fgetc(fp) == EOF);
+    fclose(fp);
+    assert(memcmp(copy, data, size) == 0);
+
+    // More connections than stripes; the first connection stays usable
+    assert(client_download_striped(conn, "admin", "admin", file_id, copy_path, 8, 0) == 0);
+    fp = fopen(copy_path, "rb");
+    assert(fp != NULL);
+    assert(fread(copy, 1, size, fp) == size);
+    fclose(fp);
+    assert(memcmp(copy, data, size) == 0);
+    assert(client_read_range(conn, file_id, 0, 16, copy) == 16);
+
+    // Without credentials every stripe goes over conn
+    memset(copy, 0, size);
+    assert(client_download_striped(conn, NULL, NULL, file_id, copy_path, 4, 0) == 0);
+    fp = fopen(copy_path, "rb");
+    assert(fp != NULL);
+    assert(fread(copy, 1, size, fp) == size);
+    fclose(fp);
+    assert(memcmp(copy, data, size) == 0);
+
+    // Unknown file
+    assert(client_download_striped(conn, "admin", "admin", file_id + 100, copy_path, 2, 0) == -1);
+
+    client_disconnect(conn);
+    free(copy);
+    free(data);
+    stop_test_server(&ts);
+
+    printf(" PASSED\n");
+}
+
+// Send one UPLOAD_PART frame and return the reply's command byte
+static uint8_t send_part(int fd, uint32_t upload_id, uint32_t part,
+                         const uint8_t* data, size_t length) {
+    uint8_t* frame = malloc(PART_HEADER_SIZE + length);
+    assert(frame != NULL);
+    packet_put_u32(frame, upload_id);
+    packet_put_u32(frame + 4, part);
+    memcpy(frame + PART_HEADER_SIZE, data, length);
+
+    Packet pkt = {0};
+    pkt.command = CMD_UPLOAD_PART;
+    pkt.data_length = (uint32_t)(PART_HEADER_SIZE + length);
+    pkt.payload = (char*)frame;
+    assert(packet_send(fd, &pkt) == 0);
+    free(frame);
+
+    Packet reply = {0};
+    assert(packet_recv(fd, &reply) == 0);
+    free(reply.payload);
+    return reply.command;
+}
+
+// Open a multipart upload of size bytes in parts of part_size; returns its ID
+static uint32_t open_multipart(int fd, const char* name, int size, int part_size) {
+    char req[160];
+    snprintf(req, sizeof(req),
+             "{\"name\":\"%s\",\"size\":%d,\"multipart\":true,\"part_size\":%d}",
+             name, size, part_size);
+    Packet reply;
+    assert(request(fd, CMD_UPLOAD_REQ, req, &reply) == CMD_SUCCESS);
+    const char* id = strstr(reply.payload, "\"upload_id\":");
+    assert(id != NULL);
+    uint32_t upload_id = (uint32_t)atoi(id + strlen("\"upload_id\":"));
+    free(reply.payload);
+    return upload_id;
+}
+
+void test_multipart_upload(void) {
+    printf("[TEST] test_multipart_upload...");
+
+    TestServer ts;
+    Server* srv = start_test_server(&ts, NULL);
+
+    // Parts sent out of order over two connections, the last one short
+    int owner = login_admin(srv);
+    int helper = login_admin(srv);
+    const uint8_t data[] = "0123456789";
+    uint32_t upload_id = open_multipart(owner, "parts.txt", 10, 4);
+
+    char req[64];
+    snprintf(req, sizeof(req), "{\"file_id\":%u,\"chunked\":true}", upload_id);
+    Packet reply;
+    assert(request(helper, CMD_DOWNLOAD_REQ, req, &reply) == CMD_ERROR);
+    assert(strstr(reply.payload, "not complete") != NULL);
+    free(reply.payload);
+
+    assert(send_part(helper, upload_id, 2, data + 8, 2) == CMD_SUCCESS);
+    assert(send_part(owner, upload_id, 0, data, 4) == CMD_SUCCESS);
+    assert(send_part(helper, upload_id, 1, data + 4, 3) == CMD_ERROR);     // Wrong size
+    assert(send_part(helper, upload_id, 3, data, 1) == CMD_ERROR);         // No such part
+    assert(send_part(helper, upload_id, 1, data + 4, 4) == CMD_SUCCESS);
+
+    // Only the owner commits
+    snprintf(req, sizeof(req), "{\"upload_id\":%u}", upload_id);
+    assert(request(helper, CMD_UPLOAD_COMMIT, req, &reply) == CMD_ERROR);
+    free(reply.payload);
+    assert(request(owner, CMD_UPLOAD_COMMIT, req, &reply) == CMD_SUCCESS);
+    free(reply.payload);
+
+    snprintf(req, sizeof(req), "{\"file_id\":%u,\"offset\":0,\"length\":10}", upload_id);
+    assert(request(helper, CMD_READ_RANGE, req, &reply) == CMD_DOWNLOAD_RES);
+    free(reply.payload);
+    assert(packet_recv(helper, &reply) == 0);
+    assert(reply.command == CMD_DOWNLOAD_CHUNK);
+    assert(reply.data_length == CHUNK_OFFSET_SIZE + 10);
+    assert(memcmp(reply.payload + CHUNK_OFFSET_SIZE, data, 10) == 0);
+    free(reply.payload);
+
+    // A commit with a part missing drops the file
+    upload_id = open_multipart(owner, "gap.txt", 10, 4);
+    assert(send_part(owner, upload_id, 0, data, 4) == CMD_SUCCESS);
+    snprintf(req, sizeof(req), "{\"upload_id\":%u}", upload_id);
+    assert(request(owner, CMD_UPLOAD_COMMIT, req, &reply) == CMD_ERROR);
+    assert(strstr(reply.payload, "Missing parts") != NULL);
+    free(reply.payload);
+
+    // So does the owner's connection closing before the commit
+    upload_id = open_multipart(owner, "dropped.txt", 10, 4);
+    assert(send_part(helper, upload_id, 0, data, 4) == CMD_SUCCESS);
+    close(owner);
+    close(helper);
+    wait_sessions_closed(srv);
+
+    int fd = login_admin(srv);
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0}", &reply) == CMD_LIST_DIR);
+    assert(strstr(reply.payload, "parts.txt") != NULL);
+    assert(strstr(reply.payload, "gap.txt") == NULL);
+    assert(strstr(reply.payload, "dropped.txt") == NULL);
+    free(reply.payload);
+    close(fd);
+
+    // The client spreads a larger file over several connections
+    size_t size = 3 * CHUNK_MAX_SIZE + 777;
+    uint8_t* big = malloc(size);
+    uint8_t* copy = malloc(size);
+    assert(big != NULL && copy != NULL);
+    for (size_t i = 0; i < size; i++) {
+        big[i] = (uint8_t)(i * 13 + (i >> 10));
+    }
+    char local_path[192];
+    write_test_file(&ts, "multipart.bin", big, size, local_path, sizeof(local_path));
+
+    ClientConnection* conn = client_connect("127.0.0.1", server_port(srv));
+    assert(conn != NULL);
+    assert(client_login(conn, "admin", "admin") == 0);
+    assert(client_upload_multipart(conn, "admin", "admin", local_path, 3, 256 * 1024 + 3) == 0);
+
+    fd = login_admin(srv);
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0}", &reply) == CMD_LIST_DIR);
+    // The entry's "id" comes before its "name"
+    const char* entry = strstr(reply.payload, "multipart.bin");
+    assert(entry != NULL);
+    const char* id = NULL;
+    for (const char* p = strstr(reply.payload, "\"id\":"); p && p < entry;
+         p = strstr(p + 1, "\"id\":")) {
+        id = p;
+    }
+    assert(id != NULL);
+    int file_id = atoi(id + strlen("\"id\":"));
+    free(reply.payload);
+    close(fd);
+
+    assert(client_read_range(conn, file_id, 0, CHUNK_MAX_SIZE, copy) == CHUNK_MAX_SIZE);
+    assert(memcmp(copy, big, CHUNK_MAX_SIZE) == 0);
+    char copy_path[192];
+    snprintf(copy_path, sizeof(copy_path), "%s/multipart.copy", ts.dir);
+    assert(client_download(conn, file_id, copy_path) == 0);
+    FILE* fp = fopen(copy_path, "rb");
+    assert(fp != NULL);
+    assert(fread(copy, 1, size, fp) == size);
+    fclose(fp);
+    assert(memcmp(copy, big, size) == 0);
+
+    client_disconnect(conn);
+    free(copy);
+    free(big);
+    stop_test_server(&ts);
+
+    printf(" PASSED\n");
+}
+
+// Magic byte of the next frame on fd, left unread
+static uint8_t peek_magic(int fd) {
+    uint8_t header[HEADER_SIZE];
+    assert(recv(fd, header, HEADER_SIZE, MSG_PEEK | MSG_WAITALL) == HEADER_SIZE);
+    return header[1];
+}
+
+void test_compression(void) {
+    printf("[TEST] test_compression...");
+
+    TestServer ts;
+    Server* srv = start_test_server(&ts, NULL);
+
+    // A client that offers nothing gets raw frames
+    int plain = login_admin(srv);
+    int fd = connect_to(srv);
+    Packet reply;
+    assert(request(fd, CMD_LOGIN_REQ, "{\"username\":\"admin\",\"password\":\"admin\","
+                   "\"compression\":[\"lz4\",\"zlib\"]}", &reply) == CMD_LOGIN_RES);
+    assert(strstr(reply.payload, "\"compression\":\"zlib\"") != NULL);
+    free(reply.payload);
+
+    // zstd is taken over zlib in the offer's order, where it is built in
+    int preferred = connect_to(srv);
+    assert(request(preferred, CMD_LOGIN_REQ, "{\"username\":\"admin\",\"password\":\"admin\","
+                   "\"compression\":[\"zstd\",\"zlib\"]}", &reply) == CMD_LOGIN_RES);
+    assert(strstr(reply.payload, compression_available(COMPRESSION_ZSTD)
+                                 ? "\"compression\":\"zstd\"" : "\"compression\":\"zlib\"") != NULL);
+    free(reply.payload);
+    close(preferred);
+
+    char req[128];
+    for (int i = 0; i < 40; i++) {
+        snprintf(req, sizeof(req), "{\"name\":\"directory-with-a-long-name-%02d\"}", i);
+        assert(request(plain, CMD_MAKE_DIR, req, &reply) == CMD_SUCCESS);
+        free(reply.payload);
+    }
+
+    // Large JSON responses are compressed, and read back as they were
+    Packet* pkt = packet_create(CMD_LIST_DIR, "{\"directory_id\":0}", 18);
+    assert(packet_send(plain, pkt) == 0 && packet_send(fd, pkt) == 0);
+    packet_free(pkt);
+    assert(peek_magic(plain) == MAGIC_BYTE_2);
+    assert(peek_magic(fd) == MAGIC_BYTE_2_COMPRESSED);
+    Packet raw = {0};
+    assert(packet_recv(plain, &raw) == 0);
+    assert(packet_recv(fd, &reply) == 0);
+    assert(reply.command == CMD_LIST_DIR && reply.data_length == raw.data_length);
+    assert(memcmp(reply.payload, raw.payload, raw.data_length) == 0);
+    free(raw.payload);
+    free(reply.payload);
+
+    // Text chunks are deflated; random ones still go out with sendfile
+    size_t size = CHUNK_MAX_SIZE + 4096;
+    uint8_t* data = malloc(size);
+    assert(data != NULL);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)"lorem ipsum dolor sit amet\n"[i % 27];
+    }
+    unsigned seed = 7;
+    for (size_t i = CHUNK_MAX_SIZE; i < size; i++) {
+        data[i] = (uint8_t)(rand_r(&seed) >> 7);
+    }
+
+    char local_path[192];
+    write_test_file(&ts, "mixed.txt", data, size, local_path, sizeof(local_path));
+
+    ClientConnection* conn = client_connect("127.0.0.1", server_port(srv));
+    assert(conn != NULL);
+    assert(client_login(conn, "admin", "admin") == 0);
+    assert(conn->compression == protocol_compression(protocol_features()));
+    assert(client_upload(conn, local_path) == 0);
+
+    pkt = packet_create(CMD_LIST_DIR, "{\"directory_id\":0}", 18);
+    assert(packet_send(plain, pkt) == 0);
+    packet_free(pkt);
+    assert(packet_recv(plain, &reply) == 0);
+    const char* entry = strstr(reply.payload, "mixed.txt");
+    assert(entry != NULL);
+    const char* id = NULL;
+    for (const char* p = strstr(reply.payload, "\"id\":"); p && p < entry;
+         p = strstr(p + 1, "\"id\":")) {
+        id = p;
+    }
+    assert(id != NULL);
+    int file_id = atoi(id + strlen("\"id\":"));
+    free(reply.payload);
+
+    snprintf(req, sizeof(req), "{\"file_id\":%d,\"chunked\":true}", file_id);
+    assert(request(fd, CMD_DOWNLOAD_REQ, req, &reply) == CMD_DOWNLOAD_RES);
+    free(reply.payload);
+    assert(peek_magic(fd) == MAGIC_BYTE_2_COMPRESSED);
+    assert(packet_recv(fd, &reply) == 0);
+    assert(reply.data_length == CHUNK_OFFSET_SIZE + CHUNK_MAX_SIZE);
+    assert(memcmp(reply.payload + CHUNK_OFFSET_SIZE, data, CHUNK_MAX_SIZE) == 0);
+    free(reply.payload);
+    assert(peek_magic(fd) == MAGIC_BYTE_2);
+    assert(packet_recv(fd, &reply) == 0);
+    assert(packet_get_u64((const uint8_t*)reply.payload) == CHUNK_MAX_SIZE);
+    assert(memcmp(reply.payload + CHUNK_OFFSET_SIZE, data + CHUNK_MAX_SIZE, 4096) == 0);
+    free(reply.payload);
+
+    // The compressed upload landed intact
+    char copy_path[192];
+    snprintf(copy_path, sizeof(copy_path), "%s/mixed.copy", ts.dir);
+    assert(client_download(conn, file_id, copy_path) == 0);
+    uint8_t* copy = malloc(size);
+    assert(copy != NULL);
+    FILE* fp = fopen(copy_path, "rb");
+    assert(fp != NULL);
+    assert(fread(copy, 1, size, fp) == size);
+    fclose(fp);
+    assert(memcmp(copy, data, size) == 0);
+
+    client_disconnect(conn);
+    close(fd);
+    close(plain);
+    free(copy);
+    free(data);
+    stop_test_server(&ts);
+
+    printf(" PASSED\n");
+}
+
+void test_hello(void) {
+    printf("[TEST] test_hello...");
+
+    TestServer ts;
+    Server* srv = start_test_server(&ts, NULL);
+
+    // The client library says HELLO on connect and gets everything
+    ClientConnection* conn = client_connect("127.0.0.1", server_port(srv));
+    assert(conn != NULL);
+    assert(conn->protocol_version == PROTOCOL_VERSION);
+    assert(conn->features == protocol_features());
+    assert(conn->max_frame == MAX_PAYLOAD_SIZE);
+    assert(conn->max_streams > 0);
+    assert(conn->compression == protocol_compression(protocol_features()));
+    assert(client_login(conn, "admin", "admin") == 0);
+    assert(conn->compression == protocol_compression(protocol_features()));
+
+    size_t size = 3 * PROTOCOL_MIN_FRAME;
+    uint8_t* data = malloc(size);
+    assert(data != NULL);
+    unsigned seed = 11;
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)(rand_r(&seed) >> 7);
+    }
+    char local_path[192];
+    write_test_file(&ts, "hello.bin", data, size, local_path, sizeof(local_path));
+    assert(client_upload(conn, local_path) == 0);
+
+    // A newer peer gets our version, the features we share and its frame size
+    int fd = connect_to(srv);
+    Packet reply;
+    char req[160];
+    assert(request(fd, CMD_HELLO, "{\"version\":1}", &reply) == CMD_SUCCESS);
+    assert(strstr(reply.payload, "\"version\":1") != NULL);
+    assert(strstr(reply.payload, "\"features\":0") != NULL);
+    free(reply.payload);
+    assert(request(fd, CMD_HELLO, "{\"max_frame\":100,\"version\":2}", &reply) == CMD_ERROR);
+    free(reply.payload);
+    snprintf(req, sizeof(req), "{\"version\":9,\"max_frame\":%d,\"features\":%d}",
+             PROTOCOL_MIN_FRAME, FEATURE_CHUNKED | FEATURE_RANGE | 0x4000);
+    assert(request(fd, CMD_HELLO, req, &reply) == CMD_SUCCESS);
+    snprintf(req, sizeof(req), "{\"status\":\"OK\",\"version\":%d,\"max_frame\":%d,"
+             "\"features\":%d}", PROTOCOL_VERSION, PROTOCOL_MIN_FRAME,
+             FEATURE_CHUNKED | FEATURE_RANGE);
+    assert(strcmp(reply.payload, req) == 0);
+    free(reply.payload);
+    assert(request(fd, CMD_LOGIN_REQ, "{\"username\":\"admin\",\"password\":\"admin\"}",
+                   &reply) == CMD_LOGIN_RES);
+    free(reply.payload);
+
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0}", &reply) == CMD_LIST_DIR);
+    const char* entry = strstr(reply.payload, "hello.bin");
+    assert(entry != NULL);
+    const char* id = NULL;
+    for (const char* p = strstr(reply.payload, "\"id\":"); p && p < entry;
+         p = strstr(p + 1, "\"id\":")) {
+        id = p;
+    }
+    assert(id != NULL);
+    int file_id = atoi(id + strlen("\"id\":"));
+    free(reply.payload);
+
+    // Download chunks fit its frames; no compression was agreed
+    snprintf(req, sizeof(req), "{\"file_id\":%d,\"chunked\":true}", file_id);
+    assert(request(fd, CMD_DOWNLOAD_REQ, req, &reply) == CMD_DOWNLOAD_RES);
+    snprintf(req, sizeof(req), "\"chunk_size\":%d", PROTOCOL_MIN_FRAME - CHUNK_OFFSET_SIZE);
+    assert(strstr(reply.payload, req) != NULL);
+    free(reply.payload);
+    size_t received = 0;
+    while (received < size) {
+        assert(peek_magic(fd) == MAGIC_BYTE_2);
+        assert(packet_recv(fd, &reply) == 0);
+        assert(reply.command == CMD_DOWNLOAD_CHUNK);
+        assert(reply.data_length <= PROTOCOL_MIN_FRAME);
+        assert(packet_get_u64((const uint8_t*)reply.payload) == received);
+        size_t length = reply.data_length - CHUNK_OFFSET_SIZE;
+        assert(memcmp(reply.payload + CHUNK_OFFSET_SIZE, data + received, length) == 0);
+        received += length;
+        free(reply.payload);
+    }
+    assert(received == size);
+
+    // A client that never says HELLO works as before
+    int old = login_admin(srv);
+    assert(request(old, CMD_PING, "old", &reply) == CMD_PONG);
+    free(reply.payload);
+
+    close(old);
+    close(fd);
+    client_disconnect(conn);
+    free(data);
+    stop_test_server(&ts);
+
+    printf(" PASSED\n");
+}
+
+void test_binary_listing(void) {
+    printf("[TEST] test_binary_listing...");
+
+    TestServer ts;
+    Server* srv = start_test_server(&ts, NULL);
+
+    ClientConnection* conn = client_connect("127.0.0.1", server_port(srv));
+    assert(conn != NULL);
+    assert(conn->features & FEATURE_BINARY_LIST);
+    assert(client_login(conn, "admin", "admin") == 0);
+    const char* names[3] = { "alpha", "beta", "gamma" };
+    assert(client_mkdir_many(conn, names, 3) == 3);
+
+    // Same entries as the JSON listing
+    ClientListing* listing = client_list_entries(conn, 0);
+    assert(listing != NULL && listing->json == NULL);
+    assert(listing->count >= 3);
+    int beta_id = 0;
+    for (int i = 0; i < listing->count; i++) {
+        if (strcmp(listing->entries[i].name, "beta") == 0) {
+            beta_id = listing->entries[i].id;
+            assert(listing->entries[i].is_directory);
+            assert(listing->entries[i].owner_id == conn->user_id);
+        }
+    }
+    assert(beta_id > 0);
+    int count = listing->count;
+    client_listing_free(listing);
+
+    // Raw: a projection, and FILE_INFO as one record
+    int fd = connect_to(srv);
+    Packet reply;
+    char req[128];
+    snprintf(req, sizeof(req), "{\"version\":%d,\"features\":%d}",
+             PROTOCOL_VERSION, FEATURE_BINARY_LIST);
+    assert(request(fd, CMD_HELLO, req, &reply) == CMD_SUCCESS);
+    free(reply.payload);
+    assert(request(fd, CMD_LOGIN_REQ, "{\"username\":\"admin\",\"password\":\"admin\"}",
+                   &reply) == CMD_LOGIN_RES);
+    free(reply.payload);
+
+    snprintf(req, sizeof(req), "{\"directory_id\":0,\"encoding\":\"binary\",\"fields\":%d}",
+             LISTING_FIELD_ID | LISTING_FIELD_NAME);
+    assert(request(fd, CMD_LIST_DIR, req, &reply) == CMD_LIST_DIR);
+    ListingEntry* entries = NULL;
+    int n = 0;
+    uint32_t fields = 0;
+    assert(listing_decode((const uint8_t*)reply.payload, reply.data_length,
+                          &entries, &n, &fields, NULL) == 0);
+    assert(n == count && fields == (LISTING_FIELD_ID | LISTING_FIELD_NAME));
+    free(entries);
+    free(reply.payload);
+
+    snprintf(req, sizeof(req), "{\"file_id\":%d,\"encoding\":\"binary\"}", beta_id);
+    assert(request(fd, CMD_FILE_INFO, req, &reply) == CMD_SUCCESS);
+    assert(listing_decode((const uint8_t*)reply.payload, reply.data_length,
+                          &entries, &n, &fields, NULL) == 0);
+    assert(n == 1 && fields == LISTING_FIELDS_ALL);
+    assert(entries[0].id == beta_id && strcmp(entries[0].name, "beta") == 0);
+    assert(entries[0].parent_id == 0 && entries[0].created_at[0] != '\0');
+    free(entries);
+    free(reply.payload);
+
+    // Without HELLO the request stays JSON
+    int old = login_admin(srv);
+    assert(request(old, CMD_LIST_DIR, "{\"directory_id\":0,\"encoding\":\"binary\"}",
+                   &reply) == CMD_LIST_DIR);
+    assert(reply.payload[0] == '{' && strstr(reply.payload, "\"beta\"") != NULL);
+    free(reply.payload);
+
+    close(old);
+    close(fd);
+    client_disconnect(conn);
+    stop_test_server(&ts);
+
+    printf(" PASSED\n");
+}
+
+void test_paged_listing(void) {
+    printf("[TEST] test_paged_listing...");
+
+    TestServer ts;
+    Server* srv = start_test_server(&ts, NULL);
+
+    ClientConnection* conn = client_connect("127.0.0.1", server_port(srv));
+    assert(conn != NULL);
+    assert(client_login(conn, "admin", "admin") == 0);
+    char names[30][16];
+    const char* name_ptrs[30];
+    for (int i = 0; i < 30; i++) {
+        snprintf(names[i], sizeof(names[i]), "d%02d", (i * 11) % 30);
+        name_ptrs[i] = names[i];
+    }
+    assert(client_mkdir_many(conn, name_ptrs, 30) == 30);
+
+    // Binary pages of 7 cover the directory once, in name order
+    ClientListing* page = client_list_page(conn, 0, NULL, 7);
+    char last[16] = "";
+    int seen = 0, pages = 0;
+    while (page) {
+        pages++;
+        assert(page->count <= 7 && (page->count == 7 || !page->more));
+        for (int i = 0; i < page->count; i++) {
+            assert(strcmp(last, page->entries[i].name) < 0);
+            snprintf(last, sizeof(last), "%s", page->entries[i].name);
+            seen++;
+        }
+        ClientListing* next = page->more ? client_list_page(conn, 0, page, 7) : NULL;
+        assert(next || !page->more);
+        client_listing_free(page);
+        page = next;
+    }
+    assert(seen == 30 && pages == 5);
+
+    // JSON pages carry the cursor of the next one
+    int fd = login_admin(srv);
+    Packet reply;
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0,\"limit\":2,\"order\":\"desc\"}",
+                   &reply) == CMD_LIST_DIR);
+    assert(strstr(reply.payload, "\"name\":\"d29\"") != NULL);
+    assert(strstr(reply.payload, "\"more\":true,\"next\":{\"after_name\":\"d28\"") != NULL);
+    free(reply.payload);
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0,\"limit\":2,\"order\":\"desc\","
+                   "\"after_name\":\"d01\",\"after_id\":99}", &reply) == CMD_LIST_DIR);
+    assert(strstr(reply.payload, "\"name\":\"d00\"") != NULL);
+    assert(strstr(reply.payload, "\"more\":false") != NULL);
+    assert(strstr(reply.payload, "\"next\"") == NULL);
+    free(reply.payload);
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0,\"limit\":40,\"sort\":\"id\"}",
+                   &reply) == CMD_LIST_DIR);
+    assert(strstr(reply.payload, "\"more\":false") != NULL);
+    free(reply.payload);
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0,\"limit\":5,\"sort\":\"size\"}",
+                   &reply) == CMD_ERROR);
+    free(reply.payload);
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0,\"limit\":0}", &reply) == CMD_ERROR);
+    free(reply.payload);
+
+    // Without "limit" the whole directory, as before
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0}", &reply) == CMD_LIST_DIR);
+    assert(strstr(reply.payload, "\"more\"") == NULL);
+    assert(strstr(reply.payload, "\"d00\"") && strstr(reply.payload, "\"d29\""));
+    free(reply.payload);
+
+    close(fd);
+    client_disconnect(conn);
+    stop_test_server(&ts);
+
+    printf(" PASSED\n");
+}
+
+void test_batch(void) {
+    printf("[TEST] test_batch...");
+
+    TestServer ts;
+    Server* srv = start_test_server(&ts, NULL);
+
+    char local_path[192];
+    snprintf(local_path, sizeof(local_path), "%s/batched.txt", ts.dir);
+    FILE* fp = fopen(local_path, "w");
+    assert(fp != NULL);
+    fputs("batched\n", fp);
+    fclose(fp);
+
+    // The *_many() helpers go out as BATCH once HELLO agreed on it
+    ClientConnection* conn = client_connect("127.0.0.1", server_port(srv));
+    assert(conn != NULL);
+    assert(conn->features & FEATURE_BATCH);
+    assert(client_login(conn, "admin", "admin") == 0);
+    const char* names[] = { "b1", "b2", "b3" };
+    assert(client_mkdir_many(conn, names, 3) == 3);
+    assert(client_upload(conn, local_path) == 0);
+
+    int fd = login_admin(srv);
+    Packet reply;
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0}", &reply) == CMD_LIST_DIR);
+    const char* id = strstr(reply.payload, "\"name\":\"batched.txt\"");
+    assert(id != NULL);
+    while (strncmp(id, "\"id\":", 5) != 0) {
+        id--;
+    }
+    int file_id = atoi(id + strlen("\"id\":"));
+    free(reply.payload);
+
+    char payload[512];
+    snprintf(payload, sizeof(payload), "{\"file_id\":%d}", file_id);
+    assert(request(fd, CMD_FILE_INFO, payload, &reply) == CMD_SUCCESS);
+    const char* path = strstr(reply.payload, "\"physical_path\":\"");
+    assert(path != NULL);
+    char uuid[64];
+    snprintf(uuid, sizeof(uuid), "%s", path + strlen("\"physical_path\":\""));
+    *strchr(uuid, '"') = '\0';
+    free(reply.payload);
+    char* blob = storage_get_path(ts.storage_root, uuid);
+    assert(blob != NULL && access(blob, F_OK) == 0);
+
+    // Mixed sub-requests are answered in order, each as if sent alone; a
+    // failing one (or one not allowed in a batch) leaves the others be
+    snprintf(payload, sizeof(payload),
+             "{\"requests\":["
+             "{\"command\":%d,\"payload\":{\"name\":\"b4\",\"parent_id\":0}},"
+             "{\"command\":%d,\"payload\":{\"file_id\":%d,\"permissions\":\"600\"}},"
+             "{\"command\":%d,\"payload\":{\"file_id\":%d,\"encoding\":\"binary\"}},"
+             "{\"command\":%d,\"payload\":{\"directory_id\":0}},"
+             "{\"command\":%d,\"payload\":{\"file_id\":99999}},"
+             "{\"command\":%d,\"payload\":{\"file_id\":%d}}]}",
+             CMD_MAKE_DIR, CMD_CHMOD, file_id, CMD_FILE_INFO, file_id, CMD_LIST_DIR,
+             CMD_DELETE, CMD_DELETE, file_id);
+    assert(request(fd, CMD_BATCH, payload, &reply) == CMD_SUCCESS);
+    const char* results = strstr(reply.payload, "\"results\":[");
+    assert(results != NULL);
+    const char* r1 = strstr(results, "\"directory_id\":");
+    const char* r2 = strstr(results, "\"permissions\":384");
+    const char* r3 = strstr(results, "\"name\":\"batched.txt\"");
+    const char* r4 = strstr(results, "Command not allowed in a batch");
+    const char* r5 = strstr(results, "File not found");
+    const char* r6 = strstr(results, "File deleted successfully");
+    assert(r1 && r1 < r2 && r2 < r3 && r3 < r4 && r4 < r5 && r5 < r6);
+    free(reply.payload);
+
+    // The deleted file's blob goes once the batch has committed
+    assert(access(blob, F_OK) != 0);
+    free(blob);
+    snprintf(payload, sizeof(payload), "{\"file_id\":%d}", file_id);
+    assert(request(fd, CMD_FILE_INFO, payload, &reply) == CMD_ERROR);
+    free(reply.payload);
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0}", &reply) == CMD_LIST_DIR);
+    assert(strstr(reply.payload, "\"b4\"") && !strstr(reply.payload, "batched.txt"));
+    free(reply.payload);
+
+    // Empty and oversized batches are refused whole
+    assert(request(fd, CMD_BATCH, "{\"requests\":[]}", &reply) == CMD_ERROR);
+    free(reply.payload);
+    assert(request(fd, CMD_BATCH, "{}", &reply) == CMD_ERROR);
+    free(reply.payload);
+
+    // More requests than one BATCH holds are split over several
+    enum { COUNT = BATCH_MAX_REQUESTS + 10 };
+    static char dir_names[COUNT][16];
+    const char* dir_ptrs[COUNT];
+    for (int i = 0; i < COUNT; i++) {
+        snprintf(dir_names[i], sizeof(dir_names[i]), "many_%03d", i);
+        dir_ptrs[i] = dir_names[i];
+    }
+    assert(client_mkdir_many(conn, dir_ptrs, COUNT) == COUNT);
+
+    close(fd);
+    client_disconnect(conn);
+    stop_test_server(&ts);
+
+    printf(" PASSED\n");
+}
+
+void test_listing_versions(void) {
+    printf("[TEST] test_listing_versions...");
+
+    TestServer ts;
+    Server* srv = start_test_server(&ts, NULL);
+
+    ClientConnection* conn = client_connect("127.0.0.1", server_port(srv));
+    assert(conn != NULL);
+    assert(conn->features & FEATURE_DIR_VERSION);
+    assert(client_login(conn, "admin", "admin") == 0);
+    const char* names[] = { "v1", "v2" };
+    assert(client_mkdir_many(conn, names, 2) == 2);
+
+    // The binary listing carries the version; while nothing changes the
+    // directory is answered NOT_MODIFIED
+    ClientListing* listing = client_list_page(conn, 0, NULL, CLIENT_LIST_PAGE);
+    assert(listing != NULL && listing->count == 2 && !listing->not_modified);
+    int v1 = listing->entries[0].id, v2 = listing->entries[1].id;
+    int64_t version = listing->version;
+    assert(version > 0);
+    client_listing_free(listing);
+    listing = client_list_changed(conn, 0, version, CLIENT_LIST_PAGE);
+    assert(listing != NULL && listing->not_modified && listing->count == 0);
+    client_listing_free(listing);
+
+    // A chmod of a child is a change
+    assert(client_chmod(conn, v1, 0700) == 0);
+    listing = client_list_changed(conn, 0, version, CLIENT_LIST_PAGE);
+    assert(listing != NULL && !listing->not_modified && listing->count == 2);
+    assert(listing->version > version);
+    version = listing->version;
+    client_listing_free(listing);
+
+    // JSON: "version" in the listing, a bare NOT_MODIFIED frame
+    int fd = login_admin(srv);
+    Packet reply;
+    char req[96];
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0}", &reply) == CMD_LIST_DIR);
+    const char* found = strstr(reply.payload, "\"version\":");
+    assert(found && atoll(found + strlen("\"version\":")) == version);
+    free(reply.payload);
+    snprintf(req, sizeof(req), "{\"directory_id\":0,\"if_version\":%lld}", (long long)version);
+    assert(request(fd, CMD_LIST_DIR, req, &reply) == CMD_NOT_MODIFIED);
+    assert(reply.data_length == 0 && reply.payload == NULL);
+    snprintf(req, sizeof(req), "{\"directory_id\":0,\"if_version\":%lld}",
+             (long long)version - 1);
+    assert(request(fd, CMD_LIST_DIR, req, &reply) == CMD_LIST_DIR);
+    free(reply.payload);
+
+    // Deleting a child moves the version on again
+    assert(client_delete(conn, v2) == 0);
+    snprintf(req, sizeof(req), "{\"directory_id\":0,\"if_version\":%lld}", (long long)version);
+    assert(request(fd, CMD_LIST_DIR, req, &reply) == CMD_LIST_DIR);
+    assert(strstr(reply.payload, "\"v1\"") && !strstr(reply.payload, "\"v2\""));
+    free(reply.payload);
+
+    close(fd);
+    client_disconnect(conn);
+    stop_test_server(&ts);
+
+    printf(" PASSED\n");
+}
+
+static uint8_t* cache_bytes(size_t length) {
+    uint8_t* data = malloc(length);
+    assert(data != NULL);
+    memset(data, 'x', length);
+    return data;
+}
+
+void test_listing_cache(void) {
+    printf("[TEST] test_listing_cache...");
+
+    // LRU by size, versions and references, on the cache alone
+    ListingCache cache;
+    listing_cache_init(&cache, 1000);
+    ListingCacheKey keys[5];
+    for (int i = 0; i < 5; i++) {
+        keys[i] = (ListingCacheKey){ .dir_id = i + 1, .version = 1, .encoding = LISTING_CACHE_JSON };
+        if (i < 4) {
+            listing_cache_release(&cache, listing_cache_put(&cache, &keys[i], cache_bytes(250), 250, 0));
+        }
+    }
+    assert(cache.count == 4 && cache.size == 1000);
+    listing_cache_release(&cache, listing_cache_get(&cache, &keys[0]));
+    listing_cache_release(&cache, listing_cache_put(&cache, &keys[4], cache_bytes(250), 250, 0));
+    assert(!listing_cache_get(&cache, &keys[1]));
+    ListingCacheEntry* held = listing_cache_get(&cache, &keys[0]);
+    assert(held != NULL && held->length == 250);
+
+    // Dropped while in use: still readable until released
+    listing_cache_invalidate(&cache, keys[0].dir_id);
+    assert(!listing_cache_get(&cache, &keys[0]) && held->data[249] == 'x');
+    listing_cache_release(&cache, held);
+
+    // A newer version replaces an older one, never the other way round
+    ListingCacheKey newer = keys[2];
+    newer.version = 2;
+    listing_cache_release(&cache, listing_cache_put(&cache, &newer, cache_bytes(10), 10, 0));
+    assert(!listing_cache_get(&cache, &keys[2]));
+    uint8_t* stale = cache_bytes(10);
+    assert(!listing_cache_put(&cache, &keys[2], stale, 10, 0));
+    free(stale);
+
+    // Nothing above a quarter of the capacity
+    uint8_t* large = cache_bytes(251);
+    assert(!listing_cache_put(&cache, &keys[1], large, 251, 0));
+    free(large);
+    listing_cache_destroy(&cache);
+
+    TestServer ts;
+    Server* srv = start_test_server(&ts, NULL);
+
+    ClientConnection* conn = client_connect("127.0.0.1", server_port(srv));
+    assert(conn != NULL);
+    assert(client_login(conn, "admin", "admin") == 0);
+    const char* names[] = { "c1", "c2", "c3" };
+    assert(client_mkdir_many(conn, names, 3) == 3);
+
+    // The second JSON listing is the first one's bytes, from the cache
+    int fd = login_admin(srv);
+    Packet first, reply;
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0}", &first) == CMD_LIST_DIR);
+    uint64_t hits = srv->listings.hits;
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0}", &reply) == CMD_LIST_DIR);
+    assert(srv->listings.hits == hits + 1);
+    assert(reply.data_length == first.data_length &&
+           memcmp(reply.payload, first.payload, first.data_length) == 0);
+    free(first.payload);
+    free(reply.payload);
+
+    // Binary listings are cached apart from JSON ones
+    ClientListing* listing = client_list_page(conn, 0, NULL, CLIENT_LIST_PAGE);
+    assert(listing != NULL && listing->count == 3);
+    client_listing_free(listing);
+    listing = client_list_page(conn, 0, NULL, CLIENT_LIST_PAGE);
+    assert(listing != NULL && listing->count == 3);
+    assert(strcmp(listing->entries[2].name, "c3") == 0);
+    client_listing_free(listing);
+    assert(srv->listings.hits == hits + 2 && srv->listings.count == 2);
+
+    // A write drops the directory's listings and the next one shows it
+    assert(request(fd, CMD_MAKE_DIR, "{\"name\":\"c4\",\"parent_id\":0}", &reply) == CMD_SUCCESS);
+    free(reply.payload);
+    assert(srv->listings.count == 0);
+    assert(request(fd, CMD_LIST_DIR, "{\"directory_id\":0}", &reply) == CMD_LIST_DIR);
+    assert(strstr(reply.payload, "\"c4\""));
+    free(reply.payload);
+    listing = client_list_page(conn, 0, NULL, CLIENT_LIST_PAGE);
+    assert(listing != NULL && listing->count == 4);
+    client_listing_free(listing);
+
+    close(fd);
+    client_disconnect(conn);
+    stop_test_server(&ts);
+
+    printf(" PASSED\n");
+}
+
+int main(void) {
+    printf("========================================\n");
+    printf("Running In-Process Server Tests\n");
+    printf("========================================\n\n");
+
+    // As in the server binary: a client gone mid-send is an error, not a signal
+    signal(SIGPIPE, SIG_IGN);
+
+    test_ephemeral_ports();
+    test_isolated_state();
+    test_reuse_port();
+    test_hot_restart_handoff();
+    test_multiplexed_requests();
+    test_parked_requests();
+    test_pipelined_requests();
+    test_session_registry();
+    test_worker_pool();
+    test_timer_wheel();
+    test_session_timeouts();
+    test_chunked_upload();
+    test_stalled_chunks();
+    test_slow_sender();
+    test_chunked_download();
+    test_slow_downloads();
+    test_slow_reader();
+    test_io_uring();
+    test_resumable_transfers();
+    test_range_reads();
+    test_striped_download();
+    test_multipart_upload();
+    test_compression();
+    test_hello();
+    test_binary_listing();
+    test_paged_listing();
+    test_batch();
+    test_listing_versions();
+    test_listing_cache();
+
+    printf("\n========================================\n");
+    printf("All server tests PASSED!\n");
+    printf("========================================\n");
+
+    return 0;
+}